@@ -3,10 +3,12 @@
 
 #include <asm/bda.h>
 #include <asm/acpi.h>
+#include <asm/pci.h>
 
 #include <uapi/elfboot/common.h>
+#include <uapi/elfboot/const.h>
 
-static uint8_t acpi_rsdp_checksum(void *buffer, int length)
+static uint8_t acpi_checksum(void *buffer, uint32_t length)
 {
 	uint8_t *end, sum;
 	uint8_t *addr = buffer;
@@ -33,11 +35,11 @@ struct rsdp_descriptor *acpi_scan_rsdp_memory(uint32_t base, uint32_t length)
 		if (strncmp(rsdp->signature, ACPI_RSDP_SIGNATURE, 8))
 			continue;
 
-		if (acpi_rsdp_checksum(rsdp, ACPI_RSDP_CHECKSUM_LENGTH))
+		if (acpi_checksum(rsdp, ACPI_RSDP_CHECKSUM_LENGTH))
 			continue;
 
 		if(rsdp->revision >= 2 
-			&& acpi_rsdp_checksum(rsdp, ACPI_RSDP_XCHECKSUM_LENGTH))
+			&& acpi_checksum(rsdp, ACPI_RSDP_XCHECKSUM_LENGTH))
 			continue;
 
 		return addr;
@@ -62,4 +64,77 @@ struct rsdp_descriptor *acpi_get_rsdp(void)
 		return rsdp;
 
 	return NULL;
-}
\ No newline at end of file
+}
+
+static struct acpi_sdt_hdr *acpi_get_table(uint32_t addr, const char *signature)
+{
+	struct acpi_sdt_hdr *hdr = tvptr(addr);
+
+	if (!addr || strncmp(hdr->signature, signature, 4))
+		return NULL;
+
+	if (acpi_checksum(hdr, hdr->length))
+		return NULL;
+
+	return hdr;
+}
+
+struct acpi_sdt_hdr *acpi_find_table(const char *signature)
+{
+	struct rsdp_descriptor *rsdp = acpi_get_rsdp();
+	struct acpi_sdt_hdr *hdr;
+	struct acpi_rsdt *rsdt;
+	uint32_t i, entries;
+
+	if (!rsdp)
+		return NULL;
+
+	/*
+	 * The XSDT may point above 4 GiB, which we can't reach without paging.
+	 * BIOS firmware always provides the RSDT with the same tables.
+	 */
+	rsdt = (struct acpi_rsdt *)acpi_get_table(rsdp->rsdt_addr,
+		ACPI_RSDT_SIGNATURE);
+	if (!rsdt)
+		return NULL;
+
+	entries = (rsdt->acpi_hdr.length - sizeof(rsdt->acpi_hdr)) /
+		sizeof(*rsdt->sdt_ptr);
+
+	for (i = 0; i < entries; i++) {
+		hdr = acpi_get_table(rsdt->sdt_ptr[i], signature);
+		if (hdr)
+			return hdr;
+	}
+
+	return NULL;
+}
+
+void *arch_pci_ecam(uint8_t *bus_start, uint8_t *bus_end)
+{
+	struct acpi_mcfg *mcfg;
+	struct acpi_mcfg_entry *entry;
+	uint32_t i, entries;
+
+	mcfg = (struct acpi_mcfg *)acpi_find_table(ACPI_MCFG_SIGNATURE);
+	if (!mcfg)
+		return NULL;
+
+	entries = (mcfg->acpi_hdr.length - sizeof(*mcfg)) / sizeof(*entry);
+
+	for (i = 0; i < entries; i++) {
+		entry = &mcfg->entries[i];
+
+		/* Every bus has 1 MiB, all of them have to be below 4 GiB */
+		if (entry->segment || entry->bus_start > entry->bus_end ||
+		    entry->base_addr + ((entry->bus_end + 1ULL) << 20) > _BITULL(32))
+			continue;
+
+		*bus_start = entry->bus_start;
+		*bus_end = entry->bus_end;
+
+		return tvptr((uint32_t)entry->base_addr);
+	}
+
+	return NULL;
+}
@@ -1,6 +1,9 @@
 #include <elfboot/core.h>
 #include <elfboot/mm.h>
-#include <elfboot/sections.h>
+#include <elfboot/bdev.h>
+#include <elfboot/math.h>
+#include <elfboot/time.h>
+#include <elfboot/string.h>
 #include <elfboot/printf.h>
 
 #include <asm/bios.h>
@@ -25,6 +28,14 @@ static int edd_extensions_present(uint8_t devno, struct edd_device_info *edi)
 	if (oreg.bx != EDD_MAGIC2)
 		return -1;
 
+	/* We only use the extended read function */
+	if (!(oreg.cx & EDD_EXT_FIXED_DISK))
+		return -1;
+
+	edi->device = devno;
+	edi->version = oreg.ah;
+	edi->interface_support = oreg.cx;
+
 	return 0;
 }
 
@@ -69,146 +80,278 @@ int edd_read_device_info(uint8_t devno, struct edd_device_info *edi)
 	return 0;
 }
 
-int edd_extended_read(struct edd_extfer_info *ext)
+int edd_device_location(struct edd_device_info *edi, struct pci_address *addr,
+	uint16_t *port)
 {
-	struct biosregs ireg, oreg;
+	struct edd_device_params *edp = &edi->params;
 
-	struct disk_address_packet dap = {
-		.len = sizeof(dap),
-		.num = min(ext->num, (BUFFER_SIZE / ext->bps)),
-		.buf = BUFFER_START,
-		.lba = ext->lba,
-	};
+	/* Only EDD 3.0 reports where the device is attached */
+	if (edp->key != EDD_DEVICE_PATH_KEY)
+		return -ENODEV;
 
-	initregs(&ireg);
-	ireg.ah = 0x42;
-	ireg.dl = ext->dev;
-	ireg.si = tuint(&dap);
+	if (edd_device_is_type(edp->host_bus_type, EDD_HOST_BUS_PCI))
+		return -ENODEV;
+
+	addr->bus  = EDD_BUS(*edi);
+	addr->slot = EDD_SLOT(*edi);
+	addr->func = EDD_FUNC(*edi);
+
+	/* This covers ATAPI devices as well, they share the same layout */
+	if (!edd_device_is_type(edp->interface_type, EDD_INTERFACE_ATA))
+		*port = (edp->interface_path.pci.channel << 1) |
+			edp->device_path.ata.device;
+	else if (!edd_device_is_type(edp->interface_type, EDD_INTERFACE_SATA))
+		*port = edp->device_path.sata.device;
+	else
+		*port = BDEV_PORT_NONE;
+
+	return 0;
+}
+
+#ifdef CONFIG_X86_EDD
+
+/*
+ * Block device
+ *
+ * The BIOS is our fallback for controllers we don't have a native driver for.
+ * Every request needs a switch to real mode and back, which is by far the most
+ * expensive part of a transfer, especially when running virtualized.
+ */
+
+static uint32_t edd_window = 0;
+static uint32_t edd_window_size = 0;
+
+static int edd_alloc_window(void)
+{
+	struct page *page;
+	uint32_t order = EDD_WINDOW_ORDER + 1;
 
-	while (ext->num) {
-		bioscall(0x13, &ireg, &oreg);
+	if (edd_window)
+		return 0;
 
-		if (oreg.eflags & X86_EFLAGS_CF)
-			return oreg.ah;
+	/* The page allocator only manages memory below 1 MB */
+	while (order--) {
+		page = alloc_pages(order);
+		if (!page)
+			continue;
 
-		memcpy(tvptr(ext->buf), tvptr(dap.buf), dap.num * ext->bps);
+		edd_window = page_to_phys(page);
+		edd_window_size = PAGE_SIZE << order;
+
+		return 0;
+	}
+
+	return -ENOMEM;
+}
+
+static uint32_t edd_fill_packets(struct edd_dev *edd,
+	struct disk_address_packet *dap, uint64_t lba, uint32_t num,
+	uint32_t addr, uint32_t logs)
+{
+	uint32_t n;
+
+	for (n = 0; num; n++) {
+		dap[n].len = sizeof(*dap);
+		dap[n].__reserved = 0;
+		dap[n].num = min(num, (uint32_t)edd->packet_blocks);
+		dap[n].buf = fptr_make(addr);
+		dap[n].lba = lba;
+
+		lba  += dap[n].num;
+		num  -= dap[n].num;
+		addr += dap[n].num << logs;
+	}
+
+	return n;
+}
+
+static int edd_read(struct bdev *bdev, uint64_t lba, uint64_t num,
+	void *buffer)
+{
+	struct disk_address_packet dap[EDD_MAX_BATCH];
+	struct edd_dev *edd = bdev->private;
+	uint32_t count, addr, packets, ret;
+	bool direct;
+
+	while (num) {
+		count = min(num, (uint64_t)EDD_MAX_BATCH * edd->packet_blocks);
+
+		/*
+		 * Buffers in low memory are directly accessible in real mode, all
+		 * others are bounced through our window.
+		 */
+		direct = tuint(buffer) + (count << bdev->block_logs) <= MEMORY_LIMIT;
+		if (direct) {
+			addr = tuint(buffer);
+		} else {
+			addr = edd_window;
+			count = min(count, edd_window_size >> bdev->block_logs);
+		}
+
+		packets = edd_fill_packets(edd, dap, lba, count, addr,
+			bdev->block_logs);
+
+		ret = edd_batch_read(edd->devno, dap, packets);
+
+		edd->switches++;
+		edd->packets += packets;
+
+		if ((ret & 0xffff) != packets) {
+			bprintln("EDD: %s: Read of lba %llu failed with status %02lx",
+				bdev->name, dap[ret & 0xffff].lba, (ret >> 16) & 0xff);
+			return -EIO;
+		}
+
+		if (!direct)
+			memcpy(buffer, tvptr(edd_window), count << bdev->block_logs);
+
+		buffer = vptradd(buffer, count << bdev->block_logs);
+		lba += count;
+		num -= count;
+	}
+
+	return 0;
+}
+
+static int edd_write(struct bdev *bdev, uint64_t lba, uint64_t num,
+	const void *buffer)
+{
+	/*
+	 * Not supported.
+	 */
+	return -ENOTSUP;
+}
+
+static int edd_ioctl(struct bdev *bdev, int request, void *args)
+{
+	return 0;
+}
+
+static struct bdev_ops edd_bdev_ops = {
+	.read  = edd_read,
+	.write = edd_write,
+	.ioctl = edd_ioctl
+};
+
+static void edd_report(struct bdev *bdev)
+{
+	struct edd_dev *edd = bdev->private;
+	uint32_t packets, nsecs, rem;
+	uint64_t start;
+
+	/*
+	 * An empty batch measures the round trip to real mode and back. Spread
+	 * over a full window, this is the overhead of every single packet.
+	 */
+	start = timestamp();
+	edd_batch_read(edd->devno, NULL, 0);
+	nsecs = div((timestamp() - start) * 1000000, arch_timestamp_khz(), &rem);
+
+	packets = edd_window_size >> bdev->block_logs;
+	packets = min((packets + edd->packet_blocks - 1) / edd->packet_blocks,
+		(uint32_t)EDD_MAX_BATCH);
+
+	bprintln("EDD: %s: %llu blocks of %u bytes, %lu KiB window, "
+		"%lu packets per switch, %lu ns per switch (%lu ns per packet)",
+		bdev->name, bdev->last_block + 1, bdev->block_size,
+		edd_window_size >> 10, packets, nsecs, nsecs / packets);
+}
+
+static int edd_probe(uint8_t devno)
+{
+	struct edd_device_info edi;
+	struct pci_address addr;
+	struct edd_dev *edd;
+	struct bdev *bdev;
+	char name[] = "eddXX";
+	uint16_t block_size, port;
+	int ret = -ENOMEM;
+
+	if (edd_read_device_info(devno, &edi))
+		return -ENODEV;
+
+	block_size = edi.params.bytes_per_sector;
+	if (block_size < 512 || (block_size & (block_size - 1)))
+		return -EINVAL;
+
+	/* Reads of buffers above 1 MB go through the window block by block */
+	if (block_size > edd_window_size)
+		return -EINVAL;
+
+	edd = bzalloc(sizeof(*edd));
+	if (!edd)
+		return -ENOMEM;
+
+	bdev = bzalloc(sizeof(*bdev));
+	if (!bdev)
+		goto edd_free_dev;
+
+	sprintf(name, "edd%02x", devno);
+
+	bdev->name = bstrdup(name);
+	if (!bdev->name)
+		goto edd_free_bdev;
+
+	edd->devno = devno;
+	edd->packet_blocks = min(EDD_MAX_SECTORS,
+		EDD_MAX_PACKET_SIZE / block_size);
+
+	/* Optical drives usually don't report their size */
+	bdev->last_block = edi.params.total_sectors ?
+		edi.params.total_sectors - 1 : UINT32_MAX;
+	bdev->block_size = block_size;
+	bdev->max_blocks = edd->packet_blocks;
+	bdev->flags |= BDEV_FLAGS_LBA;
+	bdev->private = edd;
+
+	/* Lets the boot device search try the boot drive first */
+	if (!edd_device_location(&edi, &addr, &port))
+		bdev_set_location(bdev, &addr, port);
+
+	ret = bdev_init(bdev, &edd_bdev_ops);
+	if (ret)
+		goto edd_free_name;
+
+	edd_report(bdev);
+
+	return 0;
+
+edd_free_name:
+	bfree_const(bdev->name);
+
+edd_free_bdev:
+	bfree(bdev);
+
+edd_free_dev:
+	bfree(edd);
+
+	return ret;
+}
+
+int edd_init(uint8_t bootdev)
+{
+	uint8_t devno;
+	int ret;
+
+	ret = edd_alloc_window();
+	if (ret)
+		return ret;
+
+	/*
+	 * The boot device comes first since it might be a drive which is not a
+	 * hard disk, e.g. an optical drive booted in no emulation mode.
+	 */
+	edd_probe(bootdev);
 
-		/* Update ext header */
-		ext->num -= dap.num;
-		ext->buf += dap.num * ext->bps;
+	for (devno = 0x80; devno < 0x80 + EDD_MAX_DEVICES; devno++) {
+		if (devno == bootdev)
+			continue;
 
-		/* Update DAP structure */
-		dap.lba += dap.num;
-		dap.buf += dap.num * ext->bps;
-		dap.num  = min(ext->num, (BUFFER_SIZE / ext->bps));
-	};
+		if (edd_probe(devno) == -ENODEV)
+			break;
+	}
 
 	return 0;
 }
 
-// static int edd_device_setup(struct device *device, struct edd_device_info *edi)
-// {
-// 	struct edd_disk_drive_params *ddp;
-// 	const char *interface_type = edi->params.interface_type;
-// 
-// 	/*
-// 	 * Physical devices require I/O ports and controls
-// 	 * in order to communicate with the bootloader.
-// 	 */
-// 
-// 	device->io = bmalloc(sizeof(*device->io));
-// 	if (!device->io)
-// 		return -EFAULT;
-// 	
-// 	/* Devices created here are always block devices */
-// 	device->type = DEVICE_BLOCK;
-// 
-// 	/* Basic parameters for IO */
-// 	ddp = segment_offset_ptr(edi->params.dpte_ptr);
-// 	device->io->io_base = ddp->io_base;
-// 	device->io->control = ddp->control;
-// 
-// 	/*
-// 	 * All devices created by edd_device_create() are actual
-// 	 * physical devices such as ATA or SCSI. Virtual devices
-// 	 * such as TTY and streams do not rely on actual devices
-// 	 * and are handled separately.
-// 	 *
-// 	 * For all devices created here, the DEVICE_FLAGS_VIRTUAL
-// 	 * flag is cleared. Also, since we are using the BIOS EDD
-// 	 * extensions, we know tha the device is a block device.
-// 	 */
-// 
-// 	/* Determine device type via interface */
-// 	if (!edd_device_is_type(interface_type, EDD_DEVICE_INTERFACE_ATAPI)) {
-// 		device_set(device, DEVICE_FLAG_LUN);
-// 		device->info.lun = edi->params.device_path.atapi.lun;
-// 	}
-// 
-// 	/* Device is slave */
-// 	if (ddp->flags & EDD_DISK_DRIVE_PARAM_SLAVE)
-// 		device_set(device, DEVICE_FLAG_SLAVE);
-// 
-// 	/* Device uses LBA addressing */
-// 	if (ddp->flags & EDD_DISK_DRIVE_PARAM_LBA)
-// 		device_set(device, DEVICE_FLAG_LBA);
-// 
-// 	/* Device has valid CHS information */
-// 	if (edi->params.info_flags & EDD_DEVICE_PARAM_CHS_VALID) {
-// 		device_set(device, DEVICE_FLAG_CHS);
-// 		device->info.cylinders = edi->params.num_cylinders;
-// 		device->info.heads = edi->params.num_heads;
-// 		device->info.sectors = edi->params.num_sectors;
-// 		device->info.total_sectors = edi->params.total_sectors;
-// 	}
-// 
-// 	/* Sector size is always valid */
-// 	device->info.block_size = edi->params.bytes_per_sector;
-// 
-// 	return 0;
-// }
-// 
-// struct device *edd_device_create(uint8_t devno)
-// {
-// 	struct edd_device_info edi;
-// 	struct device *device;
-// 
-// 	if (edd_read_device_info(devno, &edi))
-// 		return NULL;
-// 
-// 	device = bmalloc(sizeof(*device));
-// 	if (!device)
-// 		return NULL;
-// 
-// 	if (edd_device_setup(device, &edi)) {
-// 		bfree(device);
-// 		return NULL;
-// 	}
-// 
-// 	return device;
-// }
-// 
-// int edd_query_devices(void)
-// {
-// 	uint8_t devno;
-// 	struct device *device;
-// 	char name[] = "sda";
-// 
-// 	for (devno = 0x80; devno < 0x80 + EDD_MAX_DEVICES; devno++) {
-// 		device = edd_device_create(devno);
-// 
-// 		if (!device)
-// 			continue;
-// 
-// 		if (!device_create(device, name))
-// 			continue;
-// 
-// 		/*
-// 		 * Use sda, sdb, ... etc as names for our devices.
-// 		 */
-// 		
-// 		name[2]++;
-// 	}
-// 
-// 	return 0;
-// }
\ No newline at end of file
+#endif /* CONFIG_X86_EDD */
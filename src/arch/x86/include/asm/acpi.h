@@ -12,6 +12,9 @@
 #define ACPI_RSDP_CHECKSUM_LENGTH                 20
 #define ACPI_RSDP_XCHECKSUM_LENGTH                36
 
+#define ACPI_RSDT_SIGNATURE                       "RSDT"
+#define ACPI_MCFG_SIGNATURE                       "MCFG"
+
 struct rsdp_descriptor {
 	char signature[8];
 	uint8_t  checksum;
@@ -51,4 +54,22 @@ struct acpi_xsdt {
 	uint64_t sdt_ptr[];
 } __packed;
 
+struct acpi_mcfg_entry {
+	uint64_t base_addr;
+	uint16_t segment;
+	uint8_t  bus_start;
+	uint8_t  bus_end;
+	uint32_t _reserved;
+} __packed;
+
+struct acpi_mcfg {
+	struct acpi_sdt_hdr acpi_hdr;
+	uint64_t _reserved;
+	struct acpi_mcfg_entry entries[];
+} __packed;
+
+struct rsdp_descriptor *acpi_get_rsdp(void);
+
+struct acpi_sdt_hdr *acpi_find_table(const char *signature);
+
 #endif /* __X86_ACPI_H__ */
\ No newline at end of file
@@ -25,7 +25,7 @@ struct bios_data_area {
 	uint8_t  kbd_alt_keypad;
 	uint16_t kbd_head;
 	uint16_t kbd_tail;
-	uint16_t kbd_buffer;
+	uint16_t kbd_buffer[16];
 
 	uint8_t  floppy_recalibrate;
 	uint8_t  floppy_motor;
@@ -27,6 +27,13 @@
 #define BOOT_STACK_END			0x5000
 #define BOOT_STACK_SIZE			(BOOT_STACK_START - BOOT_STACK_END)
 
+/*
+ * E820 memory map entries, E820_MAX_ENTRIES of 20 bytes each
+ */
+
+#define E820_TABLE_ADDRESS		0x1000
+#define E820_TABLE_SIZE			0x0A00
+
 /*
  * Real-mode interrupt vector table
  */
@@ -47,6 +47,10 @@
 #define EDD_INTERFACE_USB			"USB"
 #define EDD_INTERFACE_1394			"1394"
 #define EDD_INTERFACE_FIBRE			"FIBRE"
+#define EDD_INTERFACE_SATA			"SATA"
+
+/* Device path information is only valid with this key */
+#define EDD_DEVICE_PATH_KEY			0xBEDD
 
 /*
  * Disk address packet
@@ -61,20 +65,31 @@ struct disk_address_packet {
 };
 
 /*
- * Structure for reading from drive
+ * Extended reads
+ *
+ * A single packet transfers at most 127 sectors to a buffer which must not
+ * wrap around its segment. All packets of a batch are issued with a single
+ * round trip to real mode, with the data bounced through a window in low
+ * memory. The window is the largest power-of-two block of pages we get.
  */
 
-struct edd_extfer_info {
-	uint8_t dev;
-	uint16_t bps;
-	uint32_t lba;
-	uint32_t len;
+#define EDD_MAX_DEVICES			16
+#define EDD_MAX_SECTORS			127
+#define EDD_MAX_PACKET_SIZE		0xFE00
+#define EDD_MAX_BATCH			16
+#define EDD_WINDOW_ORDER		7
 
-	/*
-	 * final step
-	 */
-	uint16_t num;
-	uint32_t buf;
+/* Interface support bitmap, returned by the installation check */
+#define EDD_EXT_FIXED_DISK_BIT		0
+#define EDD_EXT_FIXED_DISK		_BITUL(EDD_EXT_FIXED_DISK_BIT)
+
+struct edd_dev {
+	uint8_t devno;
+	uint16_t packet_blocks;
+
+	/* Number of real mode round trips and packets issued */
+	uint32_t switches;
+	uint32_t packets;
 };
 
 /*
@@ -224,9 +239,17 @@ struct edd_device_info {
 #define EDD_SLOT(edi)	(edi).params.interface_path.pci.slot
 #define EDD_FUNC(edi)	(edi).params.interface_path.pci.function
 
+struct pci_address;
+
 int edd_read_device_info(uint8_t devno, struct edd_device_info *edi);
 
-int edd_extended_read(struct edd_extfer_info *ext);
+int edd_device_location(struct edd_device_info *edi, struct pci_address *addr,
+	uint16_t *port);
+
+uint32_t edd_batch_read(uint8_t devno, struct disk_address_packet *dap,
+	uint32_t num);
+
+int edd_init(uint8_t bootdev);
 
 static inline int edd_device_is_type(const char *name, const char *type)
 {
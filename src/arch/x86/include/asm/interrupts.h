@@ -5,6 +5,7 @@
 #include <asm/traps.h>
 
 #define ARCH_NUM_INTERRUPTS		X86_IDT_NUM_ENTRIES
+#define ARCH_NUM_IRQS			16
 
 static inline void arch_enable_clock(void)
 {
@@ -26,9 +27,44 @@ static inline void arch_disable_keyboard(void)
 	pic_mask_irq(X86_INTR_KBD);
 }
 
+static inline void arch_enable_irq(uint32_t irq)
+{
+	pic_unmask_irq(irq);
+}
+
+static inline void arch_disable_irq(uint32_t irq)
+{
+	pic_mask_irq(irq);
+}
+
+static inline uint32_t arch_irq_vector(uint32_t irq)
+{
+	return X86_INTR_OFFSET + irq;
+}
+
+static inline void arch_enable_interrupts(void)
+{
+	asm volatile("sti" ::: "memory");
+}
+
+static inline void arch_disable_interrupts(void)
+{
+	asm volatile("cli" ::: "memory");
+}
+
 static inline void arch_suspend_machine(void)
 {
 	asm volatile("hlt");
 }
 
+/*
+ * Enables interrupts and halts until the next one arrives. The instruction
+ * following sti is executed before any interrupt is delivered, so a caller
+ * that checked its wakeup condition with interrupts disabled can't miss it.
+ */
+static inline void arch_wait_for_interrupt(void)
+{
+	asm volatile("sti; hlt" ::: "memory");
+}
+
 #endif /* __X86_INTERRUPTS_H__ */
\ No newline at end of file
@@ -49,6 +49,34 @@ static inline uint32_t inl(uint16_t port)
 	return v;
 }
 
+/*
+ * String port I/O, transfers count words or longs from or to a buffer
+ */
+
+static inline void insw(uint16_t port, void *buf, uint32_t count)
+{
+	__asm__ volatile("rep insw"
+		: "+D" (buf), "+c" (count) : "d" (port) : "memory");
+}
+
+static inline void outsw(uint16_t port, const void *buf, uint32_t count)
+{
+	__asm__ volatile("rep outsw"
+		: "+S" (buf), "+c" (count) : "d" (port) : "memory");
+}
+
+static inline void insl(uint16_t port, void *buf, uint32_t count)
+{
+	__asm__ volatile("rep insl"
+		: "+D" (buf), "+c" (count) : "d" (port) : "memory");
+}
+
+static inline void outsl(uint16_t port, const void *buf, uint32_t count)
+{
+	__asm__ volatile("rep outsl"
+		: "+S" (buf), "+c" (count) : "d" (port) : "memory");
+}
+
 static inline void io_delay(void)
 {
 	const uint16_t delay_port = 0x80;
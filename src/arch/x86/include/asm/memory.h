@@ -8,4 +8,8 @@ uint32_t arch_memory_lower_size(void);
 
 uint32_t arch_memory_upper_size(void);
 
+struct e820_table;
+
+struct e820_table *arch_memory_e820(void);
+
 #endif /* __X86_MEMORY_H__ */
\ No newline at end of file
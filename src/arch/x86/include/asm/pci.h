@@ -0,0 +1,14 @@
+#ifndef __X86_PCI_H__
+#define __X86_PCI_H__
+
+#include <elfboot/core.h>
+#include <elfboot/linkage.h>
+
+/*
+ * Memory-mapped configuration space (ECAM) of PCI segment 0, taken from the
+ * ACPI MCFG table. Returns the address of bus 0 and the range of buses which
+ * are decoded, or NULL if there is none we can reach.
+ */
+void *arch_pci_ecam(uint8_t *bus_start, uint8_t *bus_end);
+
+#endif /* __X86_PCI_H__ */
@@ -0,0 +1,17 @@
+#ifndef __X86_TIME_H__
+#define __X86_TIME_H__
+
+#include <elfboot/core.h>
+
+static inline uint64_t arch_timestamp(void)
+{
+	uint64_t tsc;
+
+	asm volatile("rdtsc" : "=A" (tsc));
+
+	return tsc;
+}
+
+uint32_t arch_timestamp_khz(void);
+
+#endif /* __X86_TIME_H__ */
@@ -10,7 +10,7 @@
  * E820 memory map structure
  */
 
-#define E820_MAX_ENTRIES                          8
+#define E820_MAX_ENTRIES                          128
 #define SMAP                                      0x534d4150
 
 #define E820_MEMORY_TYPE_INVALID                   0
@@ -38,9 +38,13 @@ struct e820_entry {
 	uint32_t type;
 } __packed;
 
+/*
+ * The entries are not part of the table itself, since a full map would not
+ * fit into the bootloader image. They live at E820_TABLE_ADDRESS instead.
+ */
 struct e820_table {
 	uint16_t nr_entries;
-	struct e820_entry entries[E820_MAX_ENTRIES];
+	struct e820_entry *entries;
 } __packed;
 
 /*
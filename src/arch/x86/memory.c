@@ -14,6 +14,7 @@ static uint16_t detect_memory_e820(struct e820_table *table)
 	struct e820_entry *desc, buf;
 	uint32_t count = 0;
 
+	table->entries = (struct e820_entry *) E820_TABLE_ADDRESS;
 	desc = table->entries;
 
 	initregs(&ireg);
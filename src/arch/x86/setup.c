@@ -9,6 +9,7 @@
 #include <elfboot/module.h>
 #include <elfboot/bdev.h>
 #include <elfboot/pci.h>
+#include <elfboot/partition.h>
 #include <elfboot/tree.h>
 #include <elfboot/printf.h>
 
@@ -16,6 +17,7 @@
 
 #include <asm/boot.h>
 #include <asm/bda.h>
+#include <asm/edd.h>
 #include <asm/pic.h>
 #include <asm/segment.h>
 #include <asm/memory.h>
@@ -39,6 +41,11 @@ uint32_t arch_memory_upper_size(void)
 	return boot_params.memory_upper;
 }
 
+struct e820_table *arch_memory_e820(void)
+{
+	return &boot_params.e820_table;
+}
+
 uint32_t arch_bootdev_partitions(void) {
 	return boot_params.disk_drive;
 }
@@ -49,30 +56,88 @@ uint32_t arch_bootdev_partitions(void) {
  * Architecture-specific initialization functions.
  */
 
+/*
+ * Boot device
+ *
+ * Verifying a block device means reading its boot uid, which is slow for
+ * devices that spin up or need a real mode switch per request. The firmware
+ * tells us where the boot drive is attached, so we rank all block devices by
+ * how well they match that location and verify the best candidates first.
+ */
+
+struct boot_hint {
+	struct pci_address addr;
+	uint16_t port;
+	uint16_t block_size;
+	bool located;
+};
+
+static struct boot_hint boot_hint = { 0 };
+static struct bdev *boot_bdev = NULL;
+
+static void arch_init_boot_hint(void)
+{
+	struct edd_device_info edi;
+
+	if (edd_read_device_info(boot_params.disk_drive >> 24, &edi))
+		return;
+
+	boot_hint.block_size = edi.params.bytes_per_sector;
+	boot_hint.located = !edd_device_location(&edi, &boot_hint.addr,
+		&boot_hint.port);
+}
+
+static int arch_boot_rank(struct bdev *bdev)
+{
+	struct pci_address *addr = &bdev->location;
+	int rank = 0;
+
+	/* Tells optical drives and hard disks apart */
+	if (bdev->block_size == boot_hint.block_size)
+		rank += 1;
+
+	if (!boot_hint.located || !(bdev->flags & BDEV_FLAGS_LOCATED))
+		return rank;
+
+	if (addr->bus != boot_hint.addr.bus || addr->slot != boot_hint.addr.slot ||
+	    addr->func != boot_hint.addr.func)
+		return rank;
+
+	rank += 4;
+
+	if (bdev->port == boot_hint.port && bdev->port != BDEV_PORT_NONE)
+		rank += 2;
+
+	return rank;
+}
+
 static int arch_init_boot_verify(struct bdev *bdev)
 {
 	char *uidsym, *buffer;
 	uint32_t uidlba, uidlen;
 	struct boot_info_table *bit;
 
-	buffer = bmalloc(bdev->block_size);
-	if (!buffer)
-		return -ENOMEM;
-
 	bit = boot_params.boot_table;
 	bit->bootuid_lba = bit->elfboot_lba + bdev_blknum(bdev, bit->elfboot_len);
 	uidlba = bit->bootuid_lba;
 	uidlen = bdev_blknum(bdev, bit->bootuid_len);
 
+	buffer = bmalloc(uidlen << bdev->block_logs);
+	if (!buffer)
+		return -ENOMEM;
+
 	if (bdev_read(bdev, uidlba, uidlen, buffer))
 		goto verify_free_buffer;
 
+	/* The uid is much shorter than a block, never read past the buffer */
+	buffer[(uidlen << bdev->block_logs) - 1] = '\0';
+
 	uidsym = strtok(buffer, " ");
-	if (strcmp(uidsym, ELFBOOT))
+	if (!uidsym || strcmp(uidsym, ELFBOOT))
 		goto verify_free_buffer;
 
 	uidsym = strtok(NULL, " ");
-	if (strtoul(uidsym, NULL, 16) != crc32(ELFBOOT, 7))
+	if (!uidsym || strtoul(uidsym, NULL, 16) != crc32(ELFBOOT, 7))
 		goto verify_free_buffer;
 
 	bdev->flags |= BDEV_FLAGS_BOOT;
@@ -87,31 +152,97 @@ verify_free_buffer:
 	return -EFAULT;
 }
 
+static struct bdev *arch_find_bootdevice(struct fs_node *node)
+{
+	struct fs_node *npos;
+	struct bdev *best;
+	int rank, best_rank;
+
+	if (boot_bdev)
+		return boot_bdev;
+
+	/*
+	 * Devices are verified lazily in the order of their rank. Every device is
+	 * verified at most once, even if we are called again after more devices
+	 * have shown up.
+	 */
+	do {
+		best = NULL;
+		best_rank = -1;
+
+		tree_for_each_child_entry(npos, node, tree) {
+
+			/*
+			 * We are only interested in block devices, which is why we simply
+			 * skip those nodes that don't have that specific flag set.
+			 */
+			if (!(npos->flags & FS_BLOCKDEVICE) || !npos->bdev)
+				continue;
+
+			/* The boot info table refers to blocks of the whole device */
+			if (npos->bdev->flags & (BDEV_FLAGS_PARTITION | BDEV_FLAGS_PROBED))
+				continue;
+
+			rank = arch_boot_rank(npos->bdev);
+			if (rank > best_rank) {
+				best = npos->bdev;
+				best_rank = rank;
+			}
+		}
+
+		if (!best)
+			return NULL;
+
+		best->flags |= BDEV_FLAGS_PROBED;
+
+	} while (arch_init_boot_verify(best));
+
+	bprintln("BOOT: Boot device %s (rank %d)", best->name, best_rank);
+
+	boot_bdev = best;
+
+	return best;
+}
+
 static int arch_init_bootdevice(void)
 {
-	struct fs_node *node, *npos;
+	struct fs_node *node;
+	struct bdev *bdev;
+#ifdef CONFIG_PARTITIONS
+	struct bdev *root;
+#endif
 
 	node = vfs_open("/dev");
 	if (!node)
 		return -ENOENT;
 
-	tree_for_each_child_entry(npos, node, tree) {
+	arch_init_boot_hint();
 
-		/*
-		 * We are only interested in block devices, which is why we simply skip
-		 * those nodes that don't have that specific flag set.
-		 */
-		if (!(npos->flags & FS_BLOCKDEVICE))
-			continue;
+	bdev = arch_find_bootdevice(node);
 
-		if (!arch_init_boot_verify(npos->bdev))
-			break;
-	}
+#ifdef CONFIG_X86_EDD
+	/*
+	 * None of our native drivers found the boot device, so we fall back to
+	 * the BIOS for accessing it.
+	 */
+	if (!bdev && !edd_init(boot_params.disk_drive >> 24))
+		bdev = arch_find_bootdevice(node);
+#endif
 
-	if (!npos || !(npos->flags & FS_BLOCKDEVICE) || !npos->bdev)
+	if (!bdev)
 		return -ENODEV;
 
-	if (vfs_mount(npos->bdev, "/", "root"))
+#ifdef CONFIG_PARTITIONS
+	/*
+	 * Go straight to the root partition of a partitioned boot device, the
+	 * whole device is only used if there is none or mounting it failed.
+	 */
+	root = partition_find_root(bdev);
+	if (root && !vfs_mount(root, "/", "root"))
+		return 0;
+#endif
+
+	if (vfs_mount(bdev, "/", "root"))
 		return -EFAULT;
 
 	return 0;
@@ -141,6 +272,8 @@ int arch_init_late(void)
 	if (arch_init_interrupts())
 		return -EFAULT;
 
+	set_interrupts_ready();
+
 	/*
 	 * Initialize boot device and load the appropiate disk driver
 	 * from it by using the information stored in boot info table
@@ -166,6 +299,9 @@ static void bootmem_reserve_regions(void)
 	/* Reserve memory for the Extended BIOS Data Area */
 	memblock_reserve(EBDA_ADDRESS, EBDA_MAX_SIZE);
 
+	/* Reserve memory for the e820 memory map entries */
+	memblock_reserve(E820_TABLE_ADDRESS, E820_TABLE_SIZE);
+
 	/* Reserve memory for boot stack */
 	memblock_reserve(BOOT_STACK_START, BOOT_STACK_SIZE);
 
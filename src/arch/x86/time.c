@@ -0,0 +1,64 @@
+#include <elfboot/core.h>
+#include <elfboot/io.h>
+#include <elfboot/math.h>
+#include <elfboot/time.h>
+
+#include <asm/time.h>
+
+/*
+ * Channel 2 of the PIT is only connected to the PC speaker, which is why we
+ * can use it for calibration without disturbing the clock on channel 0. Its
+ * gate and output are accessible through the system control port.
+ */
+
+#define PIT_CH2_DATA			0x42
+#define PIT_COMMAND			0x43
+#define PIT_SYSCTL			0x61
+
+#define PIT_SYSCTL_GATE2		0x01
+#define PIT_SYSCTL_SPEAKER		0x02
+#define PIT_SYSCTL_OUT2			0x20
+
+#define PIT_FREQUENCY			1193182
+#define PIT_CALIBRATE_MS		10
+#define PIT_CALIBRATE_LATCH		(PIT_FREQUENCY / (1000 / PIT_CALIBRATE_MS))
+
+static uint32_t tsc_khz = 0;
+
+static uint32_t arch_calibrate_tsc(void)
+{
+	uint64_t start, end;
+	uint32_t rem;
+	uint8_t sysctl;
+
+	/* Enable the gate of channel 2 but keep the speaker silent */
+	sysctl = inb(PIT_SYSCTL);
+	outb(PIT_SYSCTL, (sysctl & ~PIT_SYSCTL_SPEAKER) | PIT_SYSCTL_GATE2);
+
+	/* Channel 2, lobyte/hibyte, mode 0 (interrupt on terminal count) */
+	outb(PIT_COMMAND, 0xb0);
+	outb(PIT_CH2_DATA, (PIT_CALIBRATE_LATCH >> 0) & 0xff);
+	outb(PIT_CH2_DATA, (PIT_CALIBRATE_LATCH >> 8) & 0xff);
+
+	start = arch_timestamp();
+
+	while (!(inb(PIT_SYSCTL) & PIT_SYSCTL_OUT2));
+
+	end = arch_timestamp();
+
+	outb(PIT_SYSCTL, sysctl);
+
+	return div(end - start, PIT_CALIBRATE_MS, &rem);
+}
+
+uint32_t arch_timestamp_khz(void)
+{
+	/*
+	 * The calibration takes 10 ms, so it is only done once the first user
+	 * actually needs to convert timestamps into time.
+	 */
+	if (!tsc_khz)
+		tsc_khz = arch_calibrate_tsc();
+
+	return tsc_khz;
+}
@@ -37,6 +37,17 @@ int bdev_ioctl(struct bdev *bdev, int request, void *args)
 	return -ENOTSUP;	
 }
 
+void *bdev_map(struct bdev *bdev, uint64_t sector, uint64_t blknum)
+{
+	if (!(bdev->flags & BDEV_FLAGS_ZEROCOPY))
+		return NULL;
+
+	if (bdev->ops && bdev->ops->map)
+		return bdev->ops->map(bdev, sector, blknum);
+
+	return NULL;
+}
+
 void bdev_register_driver(struct bdev_ops *ops)
 {
 	list_add(&ops->list, &bdev_ops);
@@ -6,6 +6,8 @@
 
 struct list_head *interrupt_handlers = NULL;
 static uint32_t num_interrupts = 0;
+static bool clock_enabled = false;
+static bool interrupts_ready = false;
 
 /*
  * Keyboard - Enable & disable input
@@ -28,11 +30,51 @@ void disable_keyboard(void)
 void enable_clock(void)
 {
 	arch_enable_clock();
+
+	clock_enabled = true;
 }
 
 void disable_clock(void)
 {
 	arch_disable_clock();
+
+	clock_enabled = false;
+}
+
+/*
+ * Drivers may only halt the machine while waiting for a device if the
+ * periodic clock interrupt guarantees that they wake up for a timeout.
+ */
+bool clock_is_enabled(void)
+{
+	return clock_enabled;
+}
+
+/*
+ * Device interrupts - Enable & disable legacy IRQ lines
+ */
+
+int enable_irq(uint32_t irq)
+{
+	if (irq >= ARCH_NUM_IRQS)
+		return -EINVAL;
+
+	arch_enable_irq(irq);
+
+	return 0;
+}
+
+void disable_irq(uint32_t irq)
+{
+	if (irq >= ARCH_NUM_IRQS)
+		return;
+
+	arch_disable_irq(irq);
+}
+
+uint32_t irq_to_vector(uint32_t irq)
+{
+	return arch_irq_vector(irq);
 }
 
 /*
@@ -70,6 +112,20 @@ void interrupt_callback(uint32_t vector, void *info)
 	}
 }
 
+/*
+ * Interrupts must stay disabled until the architecture has installed its
+ * handlers. Built-in drivers are initialized before that and poll.
+ */
+void set_interrupts_ready(void)
+{
+	interrupts_ready = true;
+}
+
+bool interrupts_are_ready(void)
+{
+	return interrupts_ready;
+}
+
 int init_interrupts(void)
 {
 	int i;
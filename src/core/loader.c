@@ -1,10 +1,12 @@
 #include <elfboot/core.h>
 #include <elfboot/linkage.h>
 #include <elfboot/mm.h>
+#include <elfboot/mmtrace.h>
 #include <elfboot/bdev.h>
 #include <elfboot/file.h>
 #include <elfboot/module.h>
 #include <elfboot/loader.h>
+#include <elfboot/loop.h>
 #include <elfboot/console.h>
 #include <elfboot/input.h>
 #include <elfboot/interrupts.h>
@@ -183,6 +185,27 @@ static int loader_parse_cmdline(struct boot_entry *boot_entry, char *option)
 	return 0;
 }
 
+#ifdef CONFIG_LOOP
+static int loader_parse_loop(struct boot_entry *boot_entry, char *option)
+{
+	char *lopt, *topt = strtok_r(option, WORD_DELIMITER, &lopt);
+	struct bdev *bdev;
+
+	if (!topt)
+		return -EINVAL;
+
+	/*
+	 * The image is mounted to /loopN right away, so that the kernel and
+	 * initrd paths of the entry can point into it.
+	 */
+	bdev = loop_create(topt, LOOP_BLOCK_SIZE);
+	if (!bdev)
+		return -ENOENT;
+
+	return vfs_mount(bdev, "/", bdev->name);
+}
+#endif
+
 static int loader_parse_entry(struct boot_entry *boot_entry, char *line)
 {
 	char *option = loader_strip_entry_line(line);
@@ -193,6 +216,10 @@ static int loader_parse_entry(struct boot_entry *boot_entry, char *line)
 		return loader_parse_initrd(boot_entry, option + 7);
 	if (!strncmp(option, "cmdline", 7))
 		return loader_parse_cmdline(boot_entry, option + 8);
+#ifdef CONFIG_LOOP
+	if (!strncmp(option, "loop", 4))
+		return loader_parse_loop(boot_entry, option + 5);
+#endif
 
 	bprintln("EBL: Unsupported bootentry option \"%s\"", option);
 
@@ -487,6 +514,9 @@ static int loader_menu_init_selected(unsigned char c, int prev_choice)
 				goto loader_menu_next_key;
 
 			prev_choice = boot_choice++;
+		} else if (c == MM_TRACE_KEY) {
+			mm_trace_dump();
+			goto loader_menu_next_key;
 		} else
 			goto loader_menu_next_key;
 
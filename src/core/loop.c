@@ -0,0 +1,244 @@
+#include <elfboot/core.h>
+#include <elfboot/mm.h>
+#include <elfboot/fs.h>
+#include <elfboot/file.h>
+#include <elfboot/bdev.h>
+#include <elfboot/bitops.h>
+#include <elfboot/loop.h>
+#include <elfboot/string.h>
+#include <elfboot/printf.h>
+
+static uint32_t loop_num_devs = 0;
+
+static struct loop_extent *loop_find_extent(struct loop_dev *loop,
+	uint32_t start)
+{
+	struct loop_extent *ext;
+	uint32_t lo = 0, hi = loop->nr_extents;
+
+	/* The extents are sorted by their offset in the file */
+	while (lo < hi) {
+		ext = &loop->extents[(lo + hi) / 2];
+
+		if (start < ext->start)
+			hi = ext - loop->extents;
+		else if (start >= ext->start + ext->count)
+			lo = ext - loop->extents + 1;
+		else
+			return ext;
+	}
+
+	return NULL;
+}
+
+static int loop_read_extents(struct bdev *bdev, uint64_t lba, uint64_t num,
+	void *buffer)
+{
+	struct loop_dev *loop = bdev->private;
+	struct bdev *backing = loop->backing;
+	struct loop_extent *ext;
+	uint32_t shift, start, count, n;
+
+	shift = bdev->block_logs - backing->block_logs;
+	start = lba << shift;
+	count = num << shift;
+
+	while (count) {
+		ext = loop_find_extent(loop, start);
+		if (!ext)
+			return -EINVAL;
+
+		n = min(count, ext->start + ext->count - start);
+
+		if (bdev_read(backing, ext->sector + (start - ext->start), n, buffer))
+			return -EIO;
+
+		buffer = vptradd(buffer, n << backing->block_logs);
+		start += n;
+		count -= n;
+	}
+
+	return 0;
+}
+
+static int loop_read_file(struct bdev *bdev, uint64_t lba, uint64_t num,
+	void *buffer)
+{
+	struct loop_dev *loop = bdev->private;
+	uint32_t offset, length, avail;
+
+	offset = lba << bdev->block_logs;
+	length = num << bdev->block_logs;
+	avail  = min(length, loop->file->length - offset);
+
+	if (file_seek(loop->file, FILE_SET, offset))
+		return -EIO;
+
+	if (file_read(loop->file, avail, buffer) != (int)avail)
+		return -EIO;
+
+	/* The last block of the file might be incomplete */
+	memset(vptradd(buffer, avail), 0, length - avail);
+
+	return 0;
+}
+
+static int loop_read(struct bdev *bdev, uint64_t lba, uint64_t num,
+	void *buffer)
+{
+	struct loop_dev *loop = bdev->private;
+
+	if (lba + num <= lba || lba + num > bdev->last_block + 1)
+		return -EINVAL;
+
+	if (loop->extents)
+		return loop_read_extents(bdev, lba, num, buffer);
+
+	return loop_read_file(bdev, lba, num, buffer);
+}
+
+static int loop_write(struct bdev *bdev, uint64_t lba, uint64_t num,
+	const void *buffer)
+{
+	/*
+	 * Not supported.
+	 */
+	return -ENOTSUP;
+}
+
+static int loop_ioctl(struct bdev *bdev, int request, void *args)
+{
+	return 0;
+}
+
+static struct bdev_ops loop_bdev_ops = {
+	.read  = loop_read,
+	.write = loop_write,
+	.ioctl = loop_ioctl
+};
+
+static int loop_map_extents(struct loop_dev *loop, struct bdev *bdev)
+{
+	struct fs_node *node = loop->file->node;
+	struct superblock *sb = node->sb;
+	struct loop_extent *ext = NULL;
+	uint32_t blkidx, blknum, count, shift;
+	uint64_t sector;
+
+	if (!sb || !sb->bdev || !node->ops || !node->ops->bmap)
+		return -ENOTSUP;
+
+	/*
+	 * A loop block has to consist of whole device blocks and may not span
+	 * more than one file system block.
+	 */
+	if (bdev->block_logs < sb_bdlogs(sb) || bdev->block_logs > sb->block_logs)
+		return -ENOTSUP;
+
+	loop->extents = bmalloc(LOOP_MAX_EXTENTS * sizeof(*loop->extents));
+	if (!loop->extents)
+		return -ENOMEM;
+
+	shift  = sb->block_logs - sb_bdlogs(sb);
+	blknum = (loop->file->length + sb->block_size - 1) >> sb->block_logs;
+
+	for (blkidx = 0; blkidx < blknum; blkidx += count) {
+		if (node->ops->bmap(node, blkidx, &sector, &count))
+			goto loop_map_free_extents;
+
+		count = min(count, blknum - blkidx);
+
+		/* Runs reported separately might still be contiguous */
+		if (ext && ext->sector + ext->count == sector) {
+			ext->count += count << shift;
+			continue;
+		}
+
+		if (loop->nr_extents == LOOP_MAX_EXTENTS)
+			goto loop_map_free_extents;
+
+		ext = &loop->extents[loop->nr_extents++];
+		ext->start  = blkidx << shift;
+		ext->count  = count << shift;
+		ext->sector = sector;
+	}
+
+	loop->backing = sb->bdev;
+
+	return 0;
+
+loop_map_free_extents:
+	bfree(loop->extents);
+
+	loop->extents = NULL;
+	loop->nr_extents = 0;
+
+	return -ENOTSUP;
+}
+
+struct bdev *loop_create(const char *path, uint16_t block_size)
+{
+	struct loop_dev *loop;
+	struct bdev *bdev;
+	char name[] = "loopXXXX";
+
+	if (block_size < 512 || (block_size & (block_size - 1)))
+		return NULL;
+
+	loop = bzalloc(sizeof(*loop));
+	if (!loop)
+		return NULL;
+
+	bdev = bzalloc(sizeof(*bdev));
+	if (!bdev)
+		goto loop_free_dev;
+
+	loop->file = file_open(path, 0);
+	if (!loop->file)
+		goto loop_free_bdev;
+
+	if (!loop->file->length)
+		goto loop_close_file;
+
+	sprintf(name, "loop%lu", loop_num_devs);
+
+	bdev->name = bstrdup(name);
+	if (!bdev->name)
+		goto loop_close_file;
+
+	bdev->block_size = block_size;
+	bdev->block_logs = ffs(block_size);
+	bdev->last_block = (loop->file->length - 1) >> bdev->block_logs;
+	bdev->flags |= BDEV_FLAGS_LBA;
+	bdev->private = loop;
+
+	/* Reading through the file still works without extents */
+	loop_map_extents(loop, bdev);
+
+	if (bdev_init(bdev, &loop_bdev_ops))
+		goto loop_free_name;
+
+	loop_num_devs++;
+
+	bprintln("LOOP: %s: %s, %lu extents", bdev->name, path,
+		loop->nr_extents);
+
+	return bdev;
+
+loop_free_name:
+	bfree_const(bdev->name);
+
+	if (loop->extents)
+		bfree(loop->extents);
+
+loop_close_file:
+	file_close(loop->file);
+
+loop_free_bdev:
+	bfree(bdev);
+
+loop_free_dev:
+	bfree(loop);
+
+	return NULL;
+}
@@ -1,5 +1,6 @@
 #include <elfboot/core.h>
 #include <elfboot/mm.h>
+#include <elfboot/mmtrace.h>
 #include <elfboot/initcall.h>
 #include <elfboot/fs.h>
 #include <elfboot/pci.h>
@@ -9,6 +10,7 @@
 #include <elfboot/interrupts.h>
 #include <elfboot/loader.h>
 #include <elfboot/module.h>
+#include <elfboot/ramdisk.h>
 #include <elfboot/symbol.h>
 #include <elfboot/string.h>
 #include <elfboot/printf.h>
@@ -39,6 +41,37 @@ symbols_free_syms:
 	return -EFAULT;
 }
 
+#if CONFIG_NET == CONFIG_M
+
+static const char *net_modules[] = {
+	"net",
+#if CONFIG_DRIVER_VIRTIO_NET == CONFIG_M
+	"virtio_net",
+#endif /* CONFIG_DRIVER_VIRTIO_NET */
+#if CONFIG_FS_TFTPFS == CONFIG_M
+	"tftpfs",
+#endif /* CONFIG_FS_TFTPFS */
+#if CONFIG_FS_HTTPFS == CONFIG_M
+	"httpfs",
+#endif /* CONFIG_FS_HTTPFS */
+};
+
+static void net_modules_load(void)
+{
+	uint32_t i;
+
+	/*
+	 * Network modules depend on each other and are loaded in order. Booting
+	 * from disk still works without them, so failures are not fatal.
+	 */
+	for (i = 0; i < ARRAY_SIZE(net_modules); i++) {
+		if (module_open(net_modules[i]))
+			bprintln("NET: Unable to load module %s", net_modules[i]);
+	}
+}
+
+#endif /* CONFIG_NET */
+
 static int modules_load(void)
 {
 	/*
@@ -58,6 +91,10 @@ static int modules_load(void)
 	if (module_open("kbd"))
 		return -EFAULT;
 
+#if CONFIG_NET == CONFIG_M
+	net_modules_load();
+#endif /* CONFIG_NET */
+
 	return 0;
 }
 
@@ -81,6 +118,10 @@ int elfboot_init(modinit_t *start, modinit_t *end)
 
 int elfboot_main(void)
 {
+	/* Allocation tracer */
+	if (mm_trace_init())
+		return -EFAULT;
+
 	/* Buddy allocation */
 	if (page_alloc_init())
 		return -EFAULT;
@@ -101,6 +142,12 @@ int elfboot_main(void)
 	if (modules_init())
 		return -EFAULT;
 
+#ifdef CONFIG_RAMDISK
+	/* Ramdisks from a previous stage */
+	if (ramdisk_init())
+		return -EFAULT;
+#endif
+
 	/* Call arch-specific late init function */
 	if (arch_init_late())
 		return -EFAULT;
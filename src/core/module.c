@@ -27,6 +27,27 @@ static Elf32_Sym *module_find_symbol(struct module *mod, const char *name)
 	return NULL;
 }
 
+/*
+ * Modules can use the global symbols of modules loaded before them, e.g. a
+ * network driver the functions of the network stack module.
+ */
+static uint32_t module_lookup_symbol(const char *name)
+{
+	struct module *mod;
+	Elf32_Sym *sym;
+
+	list_for_each_entry(mod, &modules, list) {
+		sym = module_find_symbol(mod, name);
+		if (!sym || sym->st_shndx == SHN_UNDEF)
+			continue;
+
+		if (ELF_ST_BIND(sym->st_info) == STB_GLOBAL)
+			return sym->st_value;
+	}
+
+	return 0;
+}
+
 static int module_find_sections(struct module *mod)
 {
 	Elf32_Shdr *shdr;
@@ -100,6 +121,9 @@ static int module_resolve_symbols(struct module *mod)
 			break;
 		case SHN_UNDEF:
 			bsymval = symbol_lookup_name(name);
+			if (!bsymval)
+				bsymval = module_lookup_symbol(name);
+
 			if (bsymval) {
 				symtab[symndx].st_value = bsymval;
 				break;
@@ -0,0 +1,358 @@
+#include <elfboot/core.h>
+#include <elfboot/mm.h>
+#include <elfboot/bdev.h>
+#include <elfboot/partition.h>
+#include <elfboot/string.h>
+#include <elfboot/printf.h>
+
+static const uint8_t partition_linux_guid[16] = GPT_TYPE_LINUX;
+
+/*
+ * Child block devices
+ */
+
+static bool partition_valid(struct bdev *bdev, uint64_t lba, uint64_t num)
+{
+	return lba + num > lba && lba + num <= bdev->last_block + 1;
+}
+
+static int partition_read(struct bdev *bdev, uint64_t lba, uint64_t num,
+	void *buffer)
+{
+	struct partition *part = bdev->private;
+
+	if (!partition_valid(bdev, lba, num))
+		return -EINVAL;
+
+	return bdev_read(part->parent, bdev->init_block + lba, num, buffer);
+}
+
+static int partition_write(struct bdev *bdev, uint64_t lba, uint64_t num,
+	const void *buffer)
+{
+	struct partition *part = bdev->private;
+
+	if (!partition_valid(bdev, lba, num))
+		return -EINVAL;
+
+	return bdev_write(part->parent, bdev->init_block + lba, num, buffer);
+}
+
+static int partition_ioctl(struct bdev *bdev, int request, void *args)
+{
+	struct partition *part = bdev->private;
+
+	return bdev_ioctl(part->parent, request, args);
+}
+
+static void *partition_map(struct bdev *bdev, uint64_t lba, uint64_t num)
+{
+	struct partition *part = bdev->private;
+
+	if (!partition_valid(bdev, lba, num))
+		return NULL;
+
+	return bdev_map(part->parent, bdev->init_block + lba, num);
+}
+
+static struct bdev_ops partition_bdev_ops = {
+	.read  = partition_read,
+	.write = partition_write,
+	.ioctl = partition_ioctl,
+	.map   = partition_map
+};
+
+static int partition_add(struct bdev *parent, struct partition *info,
+	uint64_t start, uint64_t count)
+{
+	struct partition *part;
+	struct bdev *bdev;
+	const char *fmt;
+	char *name, last;
+	int ret = -ENOMEM;
+
+	/* The partition has to lie within its parent */
+	if (!start || !partition_valid(parent, start, count))
+		return -EINVAL;
+
+	part = bmalloc(sizeof(*part));
+	if (!part)
+		return -ENOMEM;
+
+	bdev = bzalloc(sizeof(*bdev));
+	if (!bdev)
+		goto partition_free_part;
+
+	name = bmalloc(strlen(parent->name) + 8);
+	if (!name)
+		goto partition_free_bdev;
+
+	/* Same naming scheme as Linux, e.g. hda1 and nvme0n1p1 */
+	last = parent->name[strlen(parent->name) - 1];
+	fmt = (last >= '0' && last <= '9') ? "%sp%lu" : "%s%lu";
+	sprintf(name, fmt, parent->name, info->index);
+
+	memcpy(part, info, sizeof(*part));
+	part->parent = parent;
+
+	bdev->name = name;
+	bdev->flags = BDEV_FLAGS_LBA | BDEV_FLAGS_PARTITION |
+		(parent->flags & BDEV_FLAGS_ZEROCOPY);
+	bdev->private = part;
+	bdev->init_block = start;
+	bdev->last_block = count - 1;
+	bdev->block_size = parent->block_size;
+	bdev->max_blocks = parent->max_blocks;
+
+	ret = bdev_init(bdev, &partition_bdev_ops);
+	if (ret)
+		goto partition_free_name;
+
+	bprintln("PART: %s: %llu - %llu, type %02x, %s", name, start,
+		start + count - 1, part->type, part->label);
+
+	return 0;
+
+partition_free_name:
+	bfree(name);
+
+partition_free_bdev:
+	bfree(bdev);
+
+partition_free_part:
+	bfree(part);
+
+	return ret;
+}
+
+/*
+ * MBR partition tables
+ */
+
+static bool partition_mbr_signature(void *buffer)
+{
+	return get_le16(vptradd(buffer, MBR_SIGNATURE_OFFSET)) == MBR_SIGNATURE;
+}
+
+static void partition_mbr_info(struct partition *info, struct mbr_partition *mbr,
+	uint32_t index)
+{
+	memset(info, 0, sizeof(*info));
+
+	info->index = index;
+	info->type = mbr->type;
+
+	if (mbr->status == MBR_STATUS_ACTIVE)
+		info->flags |= PARTITION_BOOTABLE;
+}
+
+static void partition_scan_ebr(struct bdev *bdev, void *buffer, uint32_t base)
+{
+	struct mbr_partition table[2];
+	struct partition info;
+	uint32_t ebr = 0, index;
+
+	/*
+	 * Logical partitions form a chain of extended boot records. The first
+	 * entry of each describes a partition relative to the record itself, the
+	 * second one points to the next record relative to the extended partition.
+	 */
+	for (index = 5; index < 5 + PARTITION_MAX_LOGICAL; index++) {
+		if (bdev_read(bdev, base + ebr, 1, buffer))
+			return;
+
+		if (!partition_mbr_signature(buffer))
+			return;
+
+		memcpy(table, vptradd(buffer, MBR_TABLE_OFFSET), sizeof(table));
+
+		if (table[0].type != MBR_TYPE_EMPTY && table[0].sectors) {
+			partition_mbr_info(&info, &table[0], index);
+			partition_add(bdev, &info, (uint64_t)base + ebr + table[0].lba,
+				table[0].sectors);
+		}
+
+		if (!mbr_type_extended(table[1].type) || !table[1].lba)
+			return;
+
+		ebr = table[1].lba;
+	}
+}
+
+static int partition_scan_mbr(struct bdev *bdev, void *buffer)
+{
+	struct mbr_partition table[MBR_TABLE_ENTRIES];
+	struct partition info;
+	uint32_t i;
+
+	memcpy(table, vptradd(buffer, MBR_TABLE_OFFSET), sizeof(table));
+
+	for (i = 0; i < MBR_TABLE_ENTRIES; i++) {
+		/* Boot sectors without a partition table have garbage here */
+		if (table[i].status & ~MBR_STATUS_ACTIVE)
+			return -EINVAL;
+	}
+
+	for (i = 0; i < MBR_TABLE_ENTRIES; i++) {
+		if (table[i].type == MBR_TYPE_EMPTY || !table[i].sectors)
+			continue;
+
+		if (mbr_type_extended(table[i].type)) {
+			partition_scan_ebr(bdev, buffer, table[i].lba);
+			continue;
+		}
+
+		partition_mbr_info(&info, &table[i], i + 1);
+		partition_add(bdev, &info, table[i].lba, table[i].sectors);
+	}
+
+	return 0;
+}
+
+/*
+ * GUID partition tables
+ */
+
+static void partition_gpt_info(struct partition *info, struct gpt_entry *entry,
+	uint32_t index)
+{
+	uint32_t i;
+
+	memset(info, 0, sizeof(*info));
+
+	info->index = index;
+	info->type = MBR_TYPE_GPT;
+	info->flags = PARTITION_GPT;
+
+	if (entry->attributes & GPT_ATTR_BOOTABLE)
+		info->flags |= PARTITION_BOOTABLE;
+
+	memcpy(info->type_guid, entry->type_guid, sizeof(info->type_guid));
+
+	/* Labels are UTF-16, we only keep the ASCII characters */
+	for (i = 0; i < GPT_NAME_LENGTH && entry->name[i]; i++)
+		info->label[i] = entry->name[i] < 0x80 ? entry->name[i] : '?';
+}
+
+static int partition_scan_gpt(struct bdev *bdev, void *buffer)
+{
+	struct gpt_header *hdr = buffer;
+	struct gpt_entry *entry;
+	struct partition info;
+	uint64_t entries_lba;
+	uint32_t i, num, size;
+
+	if (bdev_read(bdev, GPT_HEADER_LBA, 1, buffer))
+		return -EIO;
+
+	/*
+	 * The CRCs of the header and entries are not checked. Our crc32() uses
+	 * a different polynomial than the one of the specification.
+	 */
+	if (memcmp(hdr->signature, GPT_SIGNATURE, sizeof(hdr->signature)))
+		return -EINVAL;
+
+	size = hdr->entry_size;
+	num = min(hdr->num_entries, (uint32_t)PARTITION_MAX_GPT_ENTRIES);
+	entries_lba = hdr->entries_lba;
+
+	if (size < sizeof(*entry) || size > bdev->block_size ||
+	    (size & (size - 1)))
+		return -EINVAL;
+
+	for (i = 0; i < num; i++) {
+		if (!((i * size) & (bdev->block_size - 1)) &&
+		    bdev_read(bdev, entries_lba + ((i * size) >> bdev->block_logs),
+		    1, buffer))
+			return -EIO;
+
+		entry = vptradd(buffer, (i * size) & (bdev->block_size - 1));
+		if (!entry->first_lba || entry->last_lba < entry->first_lba)
+			continue;
+
+		partition_gpt_info(&info, entry, i + 1);
+		partition_add(bdev, &info, entry->first_lba,
+			entry->last_lba - entry->first_lba + 1);
+	}
+
+	return 0;
+}
+
+static int partition_scan(struct bdev *bdev)
+{
+	struct mbr_partition *mbr;
+	void *buffer;
+	int ret = -EINVAL;
+
+	buffer = bmalloc(bdev->block_size);
+	if (!buffer)
+		return -ENOMEM;
+
+	if (bdev_read(bdev, 0, 1, buffer))
+		goto partition_free_buffer;
+
+	if (!partition_mbr_signature(buffer))
+		goto partition_free_buffer;
+
+	/* A protective MBR covers the whole disk with a single partition */
+	mbr = vptradd(buffer, MBR_TABLE_OFFSET);
+	if (mbr->type == MBR_TYPE_GPT)
+		ret = partition_scan_gpt(bdev, buffer);
+	else
+		ret = partition_scan_mbr(bdev, buffer);
+
+partition_free_buffer:
+	bfree(buffer);
+
+	return ret;
+}
+
+/*
+ * Root partition discovery
+ */
+
+static int partition_rank(struct partition *part)
+{
+	if (part->flags & PARTITION_BOOTABLE)
+		return 2;
+
+	if (part->type == MBR_TYPE_LINUX ||
+	    !memcmp(part->type_guid, partition_linux_guid, 16))
+		return 1;
+
+	return 0;
+}
+
+struct bdev *partition_find_root(struct bdev *bdev)
+{
+	struct bdev *child = NULL, *root = NULL;
+	struct partition *part;
+	int rank, best = -1;
+
+	/*
+	 * Only the boot device is scanned. Reading the partition tables of
+	 * every device at registration time would also wait for empty optical
+	 * drives to become ready.
+	 */
+	if (partition_scan(bdev))
+		return NULL;
+
+	/*
+	 * Bootable partitions come first, then partitions with a Linux type.
+	 * Otherwise, we take the first partition of the device.
+	 */
+	while ((child = bdev_get(BDEV_FLAGS_PARTITION, child)) != NULL) {
+		part = child->private;
+		if (part->parent != bdev)
+			continue;
+
+		rank = partition_rank(part);
+		if (rank > best || (rank == best &&
+		    part->index < ((struct partition *)root->private)->index)) {
+			root = child;
+			best = rank;
+		}
+	}
+
+	return root;
+}
@@ -1,13 +1,17 @@
 #include <elfboot/core.h>
 #include <elfboot/mm.h>
 #include <elfboot/io.h>
+#include <elfboot/math.h>
 #include <elfboot/pci.h>
+#include <elfboot/time.h>
 #include <elfboot/string.h>
 #include <elfboot/printf.h>
 #include <elfboot/list.h>
 
 LIST_HEAD(pci_devs);
 
+static uint32_t pci_num_devs = 0;
+
 #ifdef CONFIG_DEBUG_PCI
 
 static const char *pci_dev_classes[] = {
@@ -55,61 +59,59 @@ static void pci_dump_device(struct pci_dev *pcidev)
 }
 
 /*
- * Raw PCI reading and writing
+ * Memory-mapped configuration space (ECAM), a single access instead of two
+ * port I/Os for every register
  */
 
-static uint8_t  read_pci_config_byte(uint8_t bus, uint8_t slot, uint8_t func,
-				    uint8_t offset)
-{
-	uint8_t v;
-	
-	outl(PCI_CONFIG_ADDR, PCI_CONFIG_REGISTER(bus, slot, func, offset));
-	v = inb(PCI_CONFIG_DATA + (offset & 3));
-	
-	return v;
-}
+#ifdef CONFIG_PCI_ECAM
 
-static uint16_t read_pci_config_word(uint8_t bus, uint8_t slot, uint8_t func,
-				     uint8_t offset)
+static uint8_t *pci_ecam_base = NULL;
+static uint8_t pci_ecam_start, pci_ecam_end;
+
+static void *pci_ecam(struct pci_address *addr, uint8_t offset)
 {
-	uint16_t v;
-	
-	outl(PCI_CONFIG_ADDR, PCI_CONFIG_REGISTER(bus, slot, func, offset));
-	v = inw(PCI_CONFIG_DATA + (offset & 2));
-	
-	return v;
+	if (!pci_ecam_base || addr->bus < pci_ecam_start ||
+	    addr->bus > pci_ecam_end)
+		return NULL;
+
+	return pci_ecam_base + (((uint32_t)addr->bus << 20) |
+		(addr->slot << 15) | (addr->func << 12) | offset);
 }
 
-static uint32_t read_pci_config_long(uint8_t bus, uint8_t slot, uint8_t func,
-				     uint8_t offset)
+static void pci_ecam_init(void)
 {
-	uint32_t v;
-
-	outl(PCI_CONFIG_ADDR, PCI_CONFIG_REGISTER(bus, slot, func, offset));
-	v = inl(PCI_CONFIG_DATA);
-	
-	return v;
+	pci_ecam_base = arch_pci_ecam(&pci_ecam_start, &pci_ecam_end);
+	if (pci_ecam_base)
+		bprintln("PCI: ECAM at %p", pci_ecam_base);
 }
 
-static void write_pci_config_byte(uint8_t bus, uint8_t slot, uint8_t func,
-				  uint8_t offset, uint8_t val)
+#else
+
+static inline void *pci_ecam(struct pci_address *addr, uint8_t offset)
 {
-	outl(PCI_CONFIG_ADDR, PCI_CONFIG_REGISTER(bus, slot, func, offset));
-	outb(val, PCI_CONFIG_DATA + (offset & 3));
+	return NULL;
 }
 
-static void write_pci_config_word(uint8_t bus, uint8_t slot, uint8_t func,
-				  uint8_t offset, uint16_t val)
+static inline void pci_ecam_init(void)
 {
-	outl(PCI_CONFIG_ADDR, PCI_CONFIG_REGISTER(bus, slot, func, offset));
-	outw(val, PCI_CONFIG_DATA + (offset & 2));
+
 }
 
-static void write_pci_config_long(uint8_t bus, uint8_t slot, uint8_t func,
-				  uint8_t offset, uint32_t val)
+#endif /* CONFIG_PCI_ECAM */
+
+/*
+ * Raw PCI reading and writing
+ */
+
+static void *pci_config_select(struct pci_address *addr, uint8_t offset)
 {
-	outl(PCI_CONFIG_ADDR, PCI_CONFIG_REGISTER(bus, slot, func, offset));
-	outl(val, PCI_CONFIG_DATA);
+	void *ecam = pci_ecam(addr, offset);
+
+	if (!ecam)
+		outl(PCI_CONFIG_ADDR, PCI_CONFIG_REGISTER(addr->bus, addr->slot,
+			addr->func, offset));
+
+	return ecam;
 }
 
 /*
@@ -118,43 +120,59 @@ static void write_pci_config_long(uint8_t bus, uint8_t slot, uint8_t func,
 
 uint8_t  pci_read_config_byte(struct pci_address *addr, uint8_t offset)
 {
-	return read_pci_config_byte(addr->bus, addr->slot, addr->func, offset);
+	volatile uint8_t *ecam = pci_config_select(addr, offset);
+
+	return ecam ? *ecam : inb(PCI_CONFIG_DATA + (offset & 3));
 }
 
 uint16_t pci_read_config_word(struct pci_address *addr, uint8_t offset)
 {
-	return read_pci_config_word(addr->bus, addr->slot, addr->func, offset);
+	volatile uint16_t *ecam = pci_config_select(addr, offset);
+
+	return ecam ? *ecam : inw(PCI_CONFIG_DATA + (offset & 2));
 }
 
 uint32_t pci_read_config_long(struct pci_address *addr, uint8_t offset)
 {
-	return read_pci_config_long(addr->bus, addr->slot, addr->func, offset);
+	volatile uint32_t *ecam = pci_config_select(addr, offset);
+
+	return ecam ? *ecam : inl(PCI_CONFIG_DATA);
 }
 
 void pci_write_config_byte(struct pci_address *addr, uint8_t offset, uint8_t val)
 {
-	write_pci_config_byte(addr->bus, addr->slot, addr->func, offset, val);
+	volatile uint8_t *ecam = pci_config_select(addr, offset);
+
+	if (ecam)
+		*ecam = val;
+	else
+		outb(PCI_CONFIG_DATA + (offset & 3), val);
 }
 
 void pci_write_config_word(struct pci_address *addr, uint8_t offset, uint16_t val)
 {
-	write_pci_config_word(addr->bus, addr->slot, addr->func, offset, val);
+	volatile uint16_t *ecam = pci_config_select(addr, offset);
+
+	if (ecam)
+		*ecam = val;
+	else
+		outw(PCI_CONFIG_DATA + (offset & 2), val);
 }
 
 void pci_write_config_long(struct pci_address *addr, uint8_t offset, uint32_t val)
 {
-	write_pci_config_long(addr->bus, addr->slot, addr->func, offset, val);
+	volatile uint32_t *ecam = pci_config_select(addr, offset);
+
+	if (ecam)
+		*ecam = val;
+	else
+		outl(PCI_CONFIG_DATA, val);
 }
 
 /*
  * PCI utility functions
  */
 
-static bool pci_probe_byte(struct pci_address *addr, uint8_t offset, uint8_t val)
-{
-	return pci_read_config_byte(addr, offset) == val;
-}
-
 static bool pci_probe_word(struct pci_address *addr, uint8_t offset, uint16_t val)
 {
 	return pci_read_config_word(addr, offset) == val;
@@ -174,16 +192,6 @@ static bool pci_probe_device(struct pci_address *addr)
 	return pci_probe_long(addr, PCI_VENDOR, PCI_INVALID_DEVICE);
 }
 
-static bool pci_probe_class(struct pci_address *addr, uint8_t class)
-{
-	return pci_probe_byte(addr, PCI_CLASS, class);
-}
-
-static bool pci_probe_subclass(struct pci_address *addr, uint8_t subclass)
-{
-	return pci_probe_byte(addr, PCI_SUBCLASS, subclass);
-}
-
 static bool pci_probe_multifunction(struct pci_address *addr)
 {
 	return !!(pci_read_config_byte(addr, PCI_HEADER_TYPE) & 0x80);
@@ -205,54 +213,101 @@ void pci_set_master(struct pci_dev *pcidev)
 	pci_write_config_word(&pcidev->addr, PCI_COMMAND, command);
 }
 
-/*
- * PCI devices
- */
+static void pci_set_memory(struct pci_dev *pcidev)
+{
+	uint16_t command = pci_read_config_word(&pcidev->addr, PCI_COMMAND);
 
-static struct pci_dev *pci_get_subsys(struct pci_dev_id *id, struct pci_dev *from)
+	if (command & PCI_COMMAND_MEMORY)
+		return;
+
+	command |= PCI_COMMAND_MEMORY;
+
+	pci_write_config_word(&pcidev->addr, PCI_COMMAND, command);
+}
+
+void pci_enable_intx(struct pci_dev *pcidev)
 {
-	struct pci_dev *pcidev;
+	uint16_t command = pci_read_config_word(&pcidev->addr, PCI_COMMAND);
 
-	list_for_each_entry(pcidev, (from) ? &from->list : &pci_devs, list) {
-		if ((id->vendor == PCI_ANY_ID || 
-		     id->vendor == pcidev->vendor) &&
-		    (id->device == PCI_ANY_ID || 
-		     id->device == pcidev->device) &&
-		    (id->subvendor == PCI_ANY_ID ||
-		     id->subvendor == pcidev->subvendor) &&
-		    (id->subdevice == PCI_ANY_ID ||
-		     id->subdevice == pcidev->subdevice) &&
-		    !((id->class ^ pcidev->classrv) & PCI_CLASS_MASK))
-			return pcidev;
-	}
+	if (!(command & PCI_COMMAND_INTX_DISABLE))
+		return;
 
-	return NULL;
+	command &= ~PCI_COMMAND_INTX_DISABLE;
+
+	pci_write_config_word(&pcidev->addr, PCI_COMMAND, command);
 }
 
-struct pci_dev *pci_get_device(uint16_t vendor, uint16_t device, struct pci_dev *from)
+uint8_t pci_find_capability(struct pci_dev *pcidev, uint8_t id, uint8_t from)
 {
-	struct pci_dev_id id = {
-		.vendor = vendor,
-		.device = device,
-		.subvendor = PCI_ANY_ID,
-		.subdevice = PCI_ANY_ID,
-		.class = PCI_ANY_ID
-	};
+	struct pci_address *addr = &pcidev->addr;
+	uint8_t pos;
+	uint32_t ttl;
 
-	return pci_get_subsys(&id, from);
+	if (!(pci_read_config_word(addr, PCI_STATUS) & PCI_STATUS_CAP_LIST))
+		return 0;
+
+	/*
+	 * Start behind a previously found capability to iterate over multiple
+	 * capabilities with the same ID. The TTL guards against broken lists
+	 * that loop back onto themselves.
+	 */
+	if (from)
+		pos = pci_read_config_byte(addr, from + PCI_CAP_NEXT);
+	else
+		pos = pci_read_config_byte(addr, PCI_CAPABILITIES);
+
+	for (ttl = 48; pos >= 0x40 && ttl; ttl--) {
+		pos &= ~0x03;
+
+		if (pci_read_config_byte(addr, pos + PCI_CAP_ID) == id)
+			return pos;
+
+		pos = pci_read_config_byte(addr, pos + PCI_CAP_NEXT);
+	}
+
+	return 0;
 }
 
-struct pci_dev *pci_get_class(uint32_t class, struct pci_dev *from)
+void *pci_map_bar(struct pci_dev *pcidev, uint8_t bar)
 {
-	struct pci_dev_id id = {
-		.vendor = PCI_ANY_ID,
-		.device = PCI_ANY_ID,
-		.subvendor = PCI_ANY_ID,
-		.subdevice = PCI_ANY_ID,
-		.class = class
-	};
+	uint32_t base;
+
+	if (bar >= ARRAY_SIZE(pcidev->bar))
+		return NULL;
+
+	base = pcidev->bar[bar];
+	if (!base || (base & PCI_BAR_IO))
+		return NULL;
+
+	/*
+	 * Without paging, we can only reach memory BARs below 4 GiB. Firmware
+	 * usually places 64-bit BARs there as well if they fit.
+	 */
+	if ((base & PCI_BAR_MEM_TYPE_MASK) == PCI_BAR_MEM_TYPE_64 &&
+	    (bar == ARRAY_SIZE(pcidev->bar) - 1 || pcidev->bar[bar + 1]))
+		return NULL;
+
+	pci_set_memory(pcidev);
+
+	return tvptr(base & PCI_BAR_MEM_MASK);
+}
+
+/*
+ * PCI devices
+ */
 
-	return pci_get_subsys(&id, from);
+static bool pci_match_id(const struct pci_dev_id *id, struct pci_dev *pcidev)
+{
+	return (id->vendor == PCI_ANY_ID ||
+		id->vendor == pcidev->vendor) &&
+	       (id->device == PCI_ANY_ID ||
+		id->device == pcidev->device) &&
+	       (id->subvendor == PCI_ANY_ID ||
+		id->subvendor == pcidev->subvendor) &&
+	       (id->subdevice == PCI_ANY_ID ||
+		id->subdevice == pcidev->subdevice) &&
+	       (id->class == PCI_ANY_ID ||
+		!((id->class ^ pcidev->classrv) & PCI_CLASS_MASK));
 }
 
 static struct pci_dev *pci_find_device_by_address(struct pci_address *addr)
@@ -285,32 +340,87 @@ struct pci_dev *pci_find_device(uint16_t bus, uint16_t slot, uint16_t func)
 	return pci_find_device_by_address(&addr);
 }
 
+/*
+ * PCI drivers
+ */
+
+int pci_register_driver(struct pci_driver *driver)
+{
+	const struct pci_dev_id *id;
+	struct pci_dev *pcidev;
+	int ret;
+
+	/*
+	 * A single pass over all functions, each one is checked against the
+	 * whole match table. The first matching entry is handed to the driver.
+	 */
+	list_for_each_entry(pcidev, &pci_devs, list) {
+		if (pcidev->driver)
+			continue;
+
+		for (id = driver->ids; id->vendor; id++) {
+			if (pci_match_id(id, pcidev))
+				break;
+		}
+
+		if (!id->vendor)
+			continue;
+
+		/* Drivers refuse functions they can't handle with -ENODEV */
+		ret = driver->probe(pcidev, id);
+		if (ret) {
+			if (ret != -ENODEV)
+				bprintln("%s: %02x:%02x.%x: Unable to initialize "
+					"device: %d", driver->name, pcidev->addr.bus,
+					pcidev->addr.slot, pcidev->addr.func, ret);
+			continue;
+		}
+
+		pcidev->driver = driver;
+	}
+
+	return 0;
+}
+
 /*
  * PCI initialization
  */
 
 static void pci_probe_bus(struct pci_address *addr, struct pci_dev *parent);
 
-static void pci_probe_bridge(struct pci_address *addr, struct pci_dev *parent)
+static void pci_probe_bridge(struct pci_dev *pcidev, uint32_t buses)
 {
 	struct pci_address bridge = { 0 };
+	uint8_t subordinate;
 
-	if ((pci_probe_class(addr, PCI_CLASS_BRIDGE)) &&
-	    (pci_probe_subclass(addr, PCI_SUBCLASS_BRIDGE_PCI))) {
-		bridge.bus = pci_read_config_byte(addr, PCI_SECONDARY_BUS);
+	if (pcidev->class != PCI_CLASS_BRIDGE ||
+	    pcidev->subclass != PCI_SUBCLASS_BRIDGE_PCI)
+		return;
 
-		/*
-		 * Start scanning from the secondary bus on the other
-		 * side of the PCI-to-PCI Bridge.
-		 */
+	bridge.bus = buses >> 8;
+	subordinate = buses >> 16;
 
-		pci_probe_bus(&bridge, parent);
-	}
+	/*
+	 * The bridge forwards the buses from its secondary to its subordinate
+	 * bus, bridges on the secondary bus lead to the others. Unconfigured
+	 * bridges and buses not behind our own would make us loop.
+	 */
+	if (bridge.bus <= pcidev->addr.bus || subordinate < bridge.bus)
+		return;
+
+	/*
+	 * Start scanning from the secondary bus on the other
+	 * side of the PCI-to-PCI Bridge.
+	 */
+
+	pci_probe_bus(&bridge, pcidev);
 }
 
 static void pci_alloc_device(struct pci_address *addr, struct pci_dev *parent)
 {
-	struct pci_dev *pcidev = bmalloc(sizeof(*pcidev));
+	struct pci_dev *pcidev = bzalloc(sizeof(*pcidev));
+	uint32_t header[PCI_HEADER_SIZE / sizeof(uint32_t)];
+	uint32_t i;
 
 	if (!pcidev)
 		return;
@@ -322,29 +432,32 @@ static void pci_alloc_device(struct pci_address *addr, struct pci_dev *parent)
 	pcidev->addr.slot = addr->slot;
 	pcidev->addr.func = addr->func;
 
-	/* Configuration Space of new device */
-	pcidev->vendor  = pci_read_config_word(addr, PCI_VENDOR);
-	pcidev->device  = pci_read_config_word(addr, PCI_DEVICE);
-	pcidev->command = pci_read_config_word(addr, PCI_COMMAND);
-	pcidev->status  = pci_read_config_word(addr, PCI_STATUS);
-	pcidev->classrv = pci_read_config_long(addr, PCI_REVISION);
-	pcidev->bar[0]  = pci_read_config_long(addr, PCI_BAR0);
-	pcidev->bar[1]  = pci_read_config_long(addr, PCI_BAR1);
-	pcidev->bar[2]  = pci_read_config_long(addr, PCI_BAR2);
-	pcidev->bar[3]  = pci_read_config_long(addr, PCI_BAR3);
-	pcidev->bar[4]  = pci_read_config_long(addr, PCI_BAR4);
-	pcidev->bar[5]  = pci_read_config_long(addr, PCI_BAR5);
-	pcidev->subvendor = pci_read_config_word(addr, PCI_SUBVENDOR);
-	pcidev->subdevice = pci_read_config_word(addr, PCI_SUBDEVICE);
+	/*
+	 * Configuration Space of new device. All fields we keep are within
+	 * the standard header, which is read with as few accesses as possible.
+	 */
+	for (i = 0; i < ARRAY_SIZE(header); i++)
+		header[i] = pci_read_config_long(addr, i << 2);
+
+	pcidev->vendor  = header[PCI_VENDOR >> 2];
+	pcidev->device  = header[PCI_DEVICE >> 2] >> 16;
+	pcidev->command = header[PCI_COMMAND >> 2];
+	pcidev->status  = header[PCI_STATUS >> 2] >> 16;
+	pcidev->classrv = header[PCI_REVISION >> 2];
+	memcpy(pcidev->bar, &header[PCI_BAR0 >> 2], sizeof(pcidev->bar));
+	pcidev->subvendor = header[PCI_SUBVENDOR >> 2] & 0xffff;
+	pcidev->subdevice = header[PCI_SUBDEVICE >> 2] >> 16;
+	pcidev->irq     = header[PCI_INTR_LINE >> 2];
 
 	pcidev->parent = parent;
 
 	pci_dump_device(pcidev);
 
 	list_add(&pcidev->list, &pci_devs);
+	pci_num_devs++;
 
 	/* Case: PCI-to-PCI Bridge */
-	pci_probe_bridge(addr, pcidev);
+	pci_probe_bridge(pcidev, header[PCI_PRIMARY_BUS >> 2]);
 }
 
 static void pci_probe_func(struct pci_address *addr, struct pci_dev *parent)
@@ -353,10 +466,6 @@ static void pci_probe_func(struct pci_address *addr, struct pci_dev *parent)
 	if (pci_probe_device(addr))
 		return;
 
-	/* We don't want duplicate entries for a device, skip */
-	if (pci_find_device(addr->bus, addr->slot, addr->func))
-		return;
-
 	/*
 	 * At this point, we made sure the device actually exists
 	 * so we can use the address to create a new PCI device.
@@ -393,7 +502,17 @@ static void pci_probe_bus(struct pci_address *addr, struct pci_dev *parent)
 
 int pci_init(void)
 {
-	struct pci_address addr = { 0 };
+	struct pci_address addr = { 0 }, host = { 0 };
+#ifdef CONFIG_DEBUG_PCI
+	uint32_t rem, usecs;
+	uint64_t start;
+#endif
+
+	pci_ecam_init();
+
+#ifdef CONFIG_DEBUG_PCI
+	start = timestamp();
+#endif
 
 	/*
 	 * Multiple PCI host controllers?
@@ -407,9 +526,27 @@ int pci_init(void)
 		 */
 
 		pci_probe_bus(&addr, NULL);
-	} else
-		for (; addr.bus < PCI_NUM_BUSES; addr.bus++)
+	} else {
+
+		/*
+		 * Function N of the host bridge is the host controller
+		 * of bus N. All other buses are behind bridges.
+		 */
+
+		for (; host.func < PCI_NUM_FUNCS; host.func++) {
+			if (pci_probe_device(&host))
+				continue;
+
+			addr.bus = host.func;
 			pci_probe_bus(&addr, NULL);
+		}
+	}
+
+#ifdef CONFIG_DEBUG_PCI
+	usecs = div((timestamp() - start) * 1000, arch_timestamp_khz(), &rem);
+
+	bprintln("PCI: Found %lu devices in %lu us", pci_num_devs, usecs);
+#endif /* CONFIG_DEBUG_PCI */
 
 	return 0;
 }
\ No newline at end of file
@@ -0,0 +1,128 @@
+#include <elfboot/core.h>
+#include <elfboot/mm.h>
+#include <elfboot/bdev.h>
+#include <elfboot/ramdisk.h>
+#include <elfboot/string.h>
+#include <elfboot/printf.h>
+
+static uint32_t ramdisk_num_devs = 0;
+
+static bool ramdisk_valid(struct bdev *bdev, uint64_t lba, uint64_t num)
+{
+	return lba + num > lba && lba + num <= bdev->last_block + 1;
+}
+
+static int ramdisk_read(struct bdev *bdev, uint64_t lba, uint64_t num,
+	void *buffer)
+{
+	if (!ramdisk_valid(bdev, lba, num))
+		return -EINVAL;
+
+	memcpy(buffer, vptradd(bdev->private, (uint32_t)lba << bdev->block_logs),
+		num << bdev->block_logs);
+
+	return 0;
+}
+
+static int ramdisk_write(struct bdev *bdev, uint64_t lba, uint64_t num,
+	const void *buffer)
+{
+	if (!ramdisk_valid(bdev, lba, num))
+		return -EINVAL;
+
+	memcpy(vptradd(bdev->private, (uint32_t)lba << bdev->block_logs), buffer,
+		num << bdev->block_logs);
+
+	return 0;
+}
+
+static int ramdisk_ioctl(struct bdev *bdev, int request, void *args)
+{
+	return 0;
+}
+
+static void *ramdisk_map(struct bdev *bdev, uint64_t lba, uint64_t num)
+{
+	if (!ramdisk_valid(bdev, lba, num))
+		return NULL;
+
+	return vptradd(bdev->private, (uint32_t)lba << bdev->block_logs);
+}
+
+static struct bdev_ops ramdisk_bdev_ops = {
+	.read  = ramdisk_read,
+	.write = ramdisk_write,
+	.ioctl = ramdisk_ioctl,
+	.map   = ramdisk_map
+};
+
+struct bdev *ramdisk_create(uint32_t addr, uint32_t size,
+	uint16_t block_size)
+{
+	struct bdev *bdev;
+	char name[] = "ramXXXX";
+	uint32_t start;
+
+	if (block_size < RAMDISK_BLOCK_SIZE || (block_size & (block_size - 1)))
+		return NULL;
+
+	if (size < block_size || addr + size < addr)
+		return NULL;
+
+	bdev = bzalloc(sizeof(*bdev));
+	if (!bdev)
+		return NULL;
+
+	sprintf(name, "ram%lu", ramdisk_num_devs);
+
+	bdev->name = bstrdup(name);
+	if (!bdev->name)
+		goto ramdisk_free_bdev;
+
+	bdev->block_size = block_size;
+	bdev->last_block = size / block_size - 1;
+	bdev->flags |= BDEV_FLAGS_LBA | BDEV_FLAGS_ZEROCOPY;
+	bdev->private = tvptr(addr);
+
+	if (bdev_init(bdev, &ramdisk_bdev_ops))
+		goto ramdisk_free_name;
+
+	/*
+	 * Keep the placement planner from loading images on top of the ramdisk.
+	 * Memory below 1 MB has to be reserved by whoever put the data there.
+	 */
+	start = max(addr, (uint32_t)MEMBLOCK_LIMIT);
+	if (addr + size > start)
+		memblock_reserve_kernel(start, addr + size - start);
+
+	ramdisk_num_devs++;
+
+	bprintln("RAM: %s: %08lx - %08lx, block size = %u", bdev->name, addr,
+		addr + size - 1, block_size);
+
+	return bdev;
+
+ramdisk_free_name:
+	bfree_const(bdev->name);
+
+ramdisk_free_bdev:
+	bfree(bdev);
+
+	return NULL;
+}
+
+int ramdisk_init(void)
+{
+	/*
+	 * An image at a fixed address, e.g. put there by the generic loader
+	 * device of QEMU, can be configured at build time.
+	 */
+	if (!CONFIG_RAMDISK_SIZE)
+		return 0;
+
+	if (!ramdisk_create(CONFIG_RAMDISK_ADDR, CONFIG_RAMDISK_SIZE,
+	    CONFIG_RAMDISK_BLOCK_SIZE))
+		return -EFAULT;
+
+	return 0;
+}
@@ -87,7 +87,7 @@ const char *symbol_lookup_caller(uint32_t addr)
 		caller = symbol;
 	}
 
-	return caller->name;
+	return caller ? caller->name : NULL;
 }
 
 int symbol_parse_map(char *syms)
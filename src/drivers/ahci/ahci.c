@@ -5,55 +5,94 @@
 #include <elfboot/module.h>
 #include <elfboot/bdev.h>
 #include <elfboot/pci.h>
+#include <elfboot/interrupts.h>
+#include <elfboot/time.h>
 #include <elfboot/libata.h>
+#include <elfboot/libatapi.h>
 #include <elfboot/string.h>
 #include <elfboot/printf.h>
 
 #include <drivers/ata.h>
-#include <drivers/scsi.h>
 #include <drivers/ahci.h>
 
-static int ahci_find_slot(volatile struct hba_port *port)
+static LIST_HEAD(ahci_ctrls);
+static int ahci_num_ctrls = 0;
+
+static int ahci_find_slot(struct ahci_dev *ahcidev)
 {
-	int i;
+	uint32_t i;
 
-	for (i = 0; i < AHCI_MAX_DEVICES; i++) {
-		if ((port->sact | port->ci) & (1UL << i))
+	/*
+	 * A slot is in use from the moment we prepare a command in it until
+	 * we destroyed it again, which is longer than the HBA considers it
+	 * busy in PxSACT and PxCI.
+	 */
+	for (i = 0; i < ahcidev->slots; i++) {
+		if (ahcidev->active & (1UL << i))
 			continue;
 
 		return i;
 	}
 
-	return -EFAULT;
+	return -EBUSY;
 }
 
-static void ahci_port_wait(volatile struct hba_port *port)
+/*
+ * Busy-waits until all bits of mask are cleared in a port register. This is
+ * a macro because the registers are members of a packed structure.
+ */
+#define ahci_wait_clear(reg, mask, msecs)			\
+({								\
+	uint64_t __deadline = timestamp_deadline(msecs);	\
+	int __ret = 0;						\
+								\
+	while ((reg) & (mask)) {				\
+		if (timestamp_expired(__deadline)) {		\
+			__ret = -ETIMEDOUT;			\
+			break;					\
+		}						\
+	}							\
+								\
+	__ret;							\
+})
+
+static int ahci_port_wait(volatile struct hba_port *port)
 {
-	while (true) {
-		if ((port->tfd & ATA_SR_BSY) || (port->tfd & ATA_SR_DRQ))
-			continue;
-
-		break;
-	}
+	return ahci_wait_clear(port->tfd, ATA_SR_BSY | ATA_SR_DRQ,
+		AHCI_CMD_TIMEOUT);
 }
 
-static void ahci_start_command(volatile struct hba_port *port)
+static int ahci_start_command(volatile struct hba_port *port)
 {
 	port->cmd &= ~HBA_PxCMD_ST;
 
-	while (port->cmd & HBA_PxCMD_CR);
+	if (ahci_wait_clear(port->cmd, HBA_PxCMD_CR, AHCI_ENGINE_TIMEOUT))
+		return -ETIMEDOUT;
 
+	/*
+	 * The device has to be idle before the command engine is started. After
+	 * a reset, its status is only updated once FIS reception is enabled.
+	 */
 	port->cmd |= HBA_PxCMD_FRE;
+
+	if (ahci_port_wait(port))
+		return -ETIMEDOUT;
+
 	port->cmd |= HBA_PxCMD_ST;
+
+	return 0;
 }
 
-static void ahci_stop_command(volatile struct hba_port *port)
+static int ahci_stop_command(volatile struct hba_port *port)
 {
 	port->cmd &= ~HBA_PxCMD_ST;
 
-	while (port->cmd & HBA_PxCMD_CR);
+	if (ahci_wait_clear(port->cmd, HBA_PxCMD_CR, AHCI_ENGINE_TIMEOUT))
+		return -ETIMEDOUT;
 
 	port->cmd &= ~HBA_PxCMD_FRE;
+
+	return ahci_wait_clear(port->cmd, HBA_PxCMD_FR, AHCI_ENGINE_TIMEOUT);
 }
 
 static uint8_t ahci_is_atapi(volatile struct hba_port *port)
@@ -66,63 +105,61 @@ static uint8_t ahci_is_atapi(volatile struct hba_port *port)
 	}
 }
 
-static int ahci_port_rebase_headers(struct hba_cmd_hdr *hdr)
+static struct hba_cmd_tbl *ahci_get_cmd_tbl(struct ahci_dev *ahcidev, int slot)
 {
-	int slot;
-
-	for (slot = 0; slot < AHCI_MAX_DEVICES; slot++) {
-		hdr[slot].prdtl = 8;
-		hdr[slot].ctba = tuint(bzalloc(256));
-		if (!hdr[slot].ctba)
-			return -EFAULT;
-	}
-
-	return 0;
+	return vptradd(ahcidev->cmdmem, AHCI_CMD_TBL_OFFSET + slot * AHCI_CMD_TBL_SIZE);
 }
 
-static int ahci_port_rebase(volatile struct hba_port *port)
+static int ahci_port_rebase(struct ahci_dev *ahcidev,
+	volatile struct hba_port *port)
 {
 	struct hba_cmd_hdr *hdr;
+	uint32_t slot;
+	void *cmdmem;
 
-	ahci_stop_command(port);
+	if (ahci_stop_command(port))
+		return -ETIMEDOUT;
 
-	port->clb = tuint(bzalloc(1024));
-	if (!port->clb)
+	/*
+	 * The command list, the received FIS area and the command tables of
+	 * all slots share a single allocation. Objects from bmalloc are aligned
+	 * to their size, which satisfies the 1 KiB alignment of the command
+	 * list. Everything behind it is placed on multiples of 128 bytes.
+	 */
+	cmdmem = bzalloc(AHCI_PORT_MEM_SIZE(ahcidev->slots));
+	if (!cmdmem)
 		return -ENOMEM;
+
+	port->clb  = tuint(cmdmem);
 	port->clbu = 0;
+	port->fb   = tuint(cmdmem) + AHCI_CMD_LIST_SIZE;
+	port->fbu  = 0;
 
-	port->fb = tuint(bzalloc(256));
-	if (!port->fb)
-		goto ahci_port_free_clb;
-	port->fbu = 0;
+	ahcidev->cmdmem = cmdmem;
 
-	hdr = tvptr(port->clb);
-	if (ahci_port_rebase_headers(hdr))
-		goto ahci_port_free_fb;
+	hdr = cmdmem;
+	for (slot = 0; slot < ahcidev->slots; slot++) {
+		hdr[slot].ctba  = tuint(ahci_get_cmd_tbl(ahcidev, slot));
+		hdr[slot].ctbau = 0;
+	}
 
-	ahci_start_command(port);
+	port->serr = port->serr;
+	port->is = port->is;
+	port->ie = HBA_PxIE_DEFAULT;
 
 	return 0;
-
-ahci_port_free_fb:
-	bfree(tvptr(port->fb));
-
-ahci_port_free_clb:
-	bfree(tvptr(port->clb));
-
-	return -EFAULT;
 }
 
-static struct hba_cmd_tbl *ahci_get_cmd_tbl(volatile struct hba_port *port, int slot)
+static struct hba_cmd_hdr *ahci_get_cmd_hdr(struct ahci_dev *ahcidev, int slot)
 {
-	struct hba_cmd_hdr *chdr = vptradd(port->clb, slot * sizeof(*chdr));
+	struct hba_cmd_hdr *chdr = ahcidev->cmdmem;
 
-	return tvptr(chdr->ctba);	
+	return chdr + slot;
 }
 
-static struct hba_fis_reg *ahci_get_fis_reg(volatile struct hba_port *port, int slot)
+static struct hba_fis_reg *ahci_get_fis_reg(struct ahci_dev *ahcidev, int slot)
 {
-	struct hba_cmd_tbl *ctbl = ahci_get_cmd_tbl(port, slot);
+	struct hba_cmd_tbl *ctbl = ahci_get_cmd_tbl(ahcidev, slot);
 
 	return (struct hba_fis_reg *)ctbl->cfis;
 }
@@ -130,118 +167,598 @@ static struct hba_fis_reg *ahci_get_fis_reg(volatile struct hba_port *port, int
 static int ahci_prepare_command(struct ahci_dev *ahcidev, size_t num_prdts, int write)
 {
 	struct hba_cmd_hdr *chdr;
-	struct hba_cmd_tbl *ctbl;
 	struct hba_fis_reg *freg;
 	int slot;
 
-	slot = ahci_find_slot(ahcidev->port);
-	if (slot < 0)
-		return -EFAULT;
+	if (num_prdts > AHCI_MAX_PRDTS)
+		return -EINVAL;
 
-	ctbl = bzalloc(sizeof(*ctbl) + sizeof(struct hba_prdt) * num_prdts);
-	if (!ctbl)
-		return -ENOMEM;
+	slot = ahci_find_slot(ahcidev);
+	if (slot < 0)
+		return slot;
 
-	chdr = vptradd(ahcidev->port->clb, slot * sizeof(*chdr));
+	chdr = ahci_get_cmd_hdr(ahcidev, slot);
 	chdr->pwacfl = HBA_PWACFL(5, ahcidev->atapi, write, 0);
-	chdr->ctba = tuint(ctbl);
-	chdr->ctbau = 0;
 	chdr->prdtl = num_prdts;
 
-	freg = ahci_get_fis_reg(ahcidev->port, slot);
+	/*
+	 * The command table is reused, so only the register FIS is cleared.
+	 * The PRDT entries are completely rewritten for each command.
+	 */
+	freg = ahci_get_fis_reg(ahcidev, slot);
+	memset(freg, 0, sizeof(*freg));
+
 	freg->type = FIS_TYPE_REG_H2D;
 	freg->pmic = HBA_PMIC(0, 0, 1);
 	freg->control = 0x08;
 
+	ahcidev->active |= (1UL << slot);
+
 	return slot;
 }
 
-static void ahci_destroy_command(volatile struct hba_port *port, int slot)
+static void ahci_destroy_command(struct ahci_dev *ahcidev, int slot)
+{
+	ahcidev->active &= ~(1UL << slot);
+}
+
+static void ahci_set_prdt(struct hba_cmd_tbl *ctbl, uint32_t index,
+	void *buffer, uint32_t length)
 {
-	struct hba_cmd_hdr *chdr = vptradd(port->clb, slot * sizeof(*chdr));
+	struct hba_prdt *prdt = &ctbl->prdt[index];
+
+	prdt->dba  = tuint(buffer);
+	prdt->dbau = 0;
+	prdt->__reserved = 0;
+	prdt->idbc = HBA_IDBC(length - 1, 0);
+}
 
-	bfree(tvptr(chdr->ctba));
+static inline uint32_t ahci_num_prdts(uint32_t length)
+{
+	return (length + HBA_PRDT_MAX_SIZE - 1) / HBA_PRDT_MAX_SIZE;
+}
+
+static void ahci_set_prdts(struct hba_cmd_tbl *ctbl, void *buffer,
+	uint32_t length)
+{
+	uint32_t index, size;
+
+	/*
+	 * Physical and virtual addresses are identical for us, so a buffer is
+	 * always contiguous and we only split it at the PRDT entry size.
+	 */
+	for (index = 0; length; index++) {
+		size = min(length, (uint32_t)HBA_PRDT_MAX_SIZE);
+		ahci_set_prdt(ctbl, index, buffer, size);
+
+		buffer  = vptradd(buffer, size);
+		length -= size;
+	}
 }
 
 /*
- * AHCI device operations
+ * Largest transfer of a single command for the given device and block size
  */
+static uint32_t ahci_max_blocks(struct bdev *bdev)
+{
+	return AHCI_MAX_PRDTS * (HBA_PRDT_MAX_SIZE / bdev->block_size);
+}
 
-static int ahci_idle(struct ahci_dev *ahcidev, int slot)
+static int ahci_issue_command(struct ahci_dev *ahcidev, int slot, bool queued)
 {
-	while (ahcidev->port->ci & (1UL << slot)) {
-		if (ahcidev->port->is & HBA_PxIS_TFES)
-			return -EFAULT;
+	volatile struct hba_port *port = ahcidev->port;
+
+	/*
+	 * The device only has to be idle for the first command. Queued commands
+	 * are accepted while others are still outstanding.
+	 */
+	if (!(port->sact | port->ci) && ahci_port_wait(port))
+		return -ETIMEDOUT;
+
+	ahci_get_cmd_hdr(ahcidev, slot)->prdbc = 0;
+
+	/*
+	 * Both registers ignore zero bits on writes. Never read-modify-write
+	 * them: a command completing in between would be issued again.
+	 */
+	if (queued)
+		port->sact = (1UL << slot);
+
+	port->ci = (1UL << slot);
+
+	/*
+	 * The slot must be busy in the HBA before the interrupt handler may
+	 * consider it, otherwise it would be completed right away.
+	 */
+	barrier();
+
+	ahcidev->issued |= (1UL << slot);
+
+	return 0;
+}
+
+static int ahci_reissue_commands(struct ahci_dev *ahcidev, uint32_t slots,
+	bool queued)
+{
+	uint32_t slot;
+	int ret;
+
+	for (slot = 0; slot < ahcidev->slots; slot++) {
+		if (!(slots & (1UL << slot)))
+			continue;
+
+		ret = ahci_issue_command(ahcidev, slot, queued);
+		if (ret)
+			return ret;
 	}
 
-	if (ahcidev->port->is & HBA_PxIS_TFES)
-		return -EFAULT;
+	return 0;
+}
+
+/*
+ * Command completion
+ */
+
+static void ahci_port_update(struct ahci_dev *ahcidev)
+{
+	volatile struct hba_port *port = ahcidev->port;
+	uint32_t is = port->is;
+
+	port->is = is;
+
+	/*
+	 * Queued commands stay set in PxSACT until the device reports their
+	 * completion, all others are done as soon as they left PxCI.
+	 */
+	ahcidev->error |= is & HBA_PxIS_ERROR;
+	ahcidev->completed |= ahcidev->issued & ~(port->sact | port->ci);
+}
+
+static void ahci_interrupt(void *info __unused)
+{
+	volatile struct hba_port *port;
+	struct ahci_ctrl *ctrl;
+	uint32_t is, i;
+
+	/*
+	 * The handler doesn't know which controller raised the interrupt, but
+	 * those that didn't have no bits set in their interrupt status.
+	 */
+	list_for_each_entry(ctrl, &ahci_ctrls, list) {
+		is = ctrl->hba->is;
+		if (!is)
+			continue;
+
+		for (i = 0; i < AHCI_MAX_PORTS; i++) {
+			if (!(is & (1UL << i)))
+				continue;
+
+			if (ctrl->ports[i]) {
+				ahci_port_update(ctrl->ports[i]);
+			} else {
+				port = &ctrl->hba->ports[i];
+				port->is = port->is;
+			}
+		}
+
+		ctrl->hba->is = is;
+		ctrl->irqs++;
+	}
+}
+
+static void ahci_init_irq(struct ahci_ctrl *ctrl);
+
+static int ahci_wait(struct ahci_dev *ahcidev, uint32_t *done)
+{
+	struct ahci_ctrl *ctrl = ahcidev->ctrl;
+	uint64_t deadline = timestamp_deadline(AHCI_CMD_TIMEOUT);
+	int ret = 0;
+
+	/*
+	 * Built-in, we already run before the IDT exists. Enabling interrupts
+	 * then would fault, so we purely poll until they are set up.
+	 */
+	if (!ctrl->irq_setup && interrupts_are_ready())
+		ahci_init_irq(ctrl);
+
+	/*
+	 * The IRQ line is only unmasked while we wait. BIOS calls in between
+	 * must not see interrupts of a device they know nothing about.
+	 */
+	if (ctrl->irq_enabled)
+		enable_irq(ctrl->irq);
+
+	while (true) {
+		if (ctrl->irq_enabled)
+			arch_disable_interrupts();
+
+		ahci_port_update(ahcidev);
+
+		if (ahcidev->error) {
+			ret = -EIO;
+			break;
+		}
+
+		if (ahcidev->completed)
+			break;
+
+		if (timestamp_expired(deadline)) {
+			ret = -ETIMEDOUT;
+			break;
+		}
+
+		if (!ctrl->irq_enabled)
+			continue;
+
+		/*
+		 * Halting is only safe once the controller has proven that its
+		 * interrupts arrive and the clock wakes us up for the timeout.
+		 * Until then we keep polling the port.
+		 */
+		if (ctrl->irqs && clock_is_enabled())
+			arch_wait_for_interrupt();
+		else
+			arch_enable_interrupts();
+	}
+
+	*done = ahcidev->completed;
+
+	ahcidev->issued &= ~ahcidev->completed;
+	ahcidev->completed = 0;
+
+	if (ctrl->irq_enabled) {
+		arch_enable_interrupts();
+		disable_irq(ctrl->irq);
+	}
+
+	return ret;
+}
+
+static uint32_t ahci_release_commands(struct ahci_dev *ahcidev, uint32_t slots)
+{
+	uint32_t slot, num = 0;
+
+	for (slot = 0; slot < ahcidev->slots; slot++) {
+		if (!(slots & (1UL << slot)))
+			continue;
+
+		ahci_destroy_command(ahcidev, slot);
+		num++;
+	}
+
+	return num;
+}
+
+/*
+ * Error recovery
+ */
+
+static void ahci_link_reset(struct ahci_dev *ahcidev)
+{
+	volatile struct hba_port *port = ahcidev->port;
+
+	/*
+	 * A hung device may keep the command engine running, the COMRESET
+	 * stops it anyway. Devices behind an HBA with staggered spin-up only
+	 * start once we allow them to.
+	 */
+	ahci_stop_command(port);
+
+	if (ahcidev->ctrl->hba->cap & HBA_CAP_SSS)
+		port->cmd |= HBA_PxCMD_SUD;
+
+	port->sctl = (port->sctl & ~HBA_PxSCTL_DET_MASK) | HBA_PxSCTL_DET_INIT;
+}
+
+static void ahci_link_release(struct ahci_dev *ahcidev)
+{
+	volatile struct hba_port *port = ahcidev->port;
+
+	/*
+	 * COMRESET has to be asserted for at least 1 ms. The device reports
+	 * its signature and status with a register FIS, which the HBA only
+	 * accepts with FIS reception enabled.
+	 */
+	port->sctl &= ~HBA_PxSCTL_DET_MASK;
+	port->cmd |= HBA_PxCMD_FRE;
+
+	ahcidev->reset = timestamp();
+}
+
+static int ahci_link_poll(struct ahci_dev *ahcidev)
+{
+	volatile struct hba_port *port = ahcidev->port;
+	uint8_t det = HBA_PxSSTS_DET(port->ssts);
+
+	if (!det) {
+		if (timestamp_elapsed(ahcidev->reset, AHCI_PRESENCE_TIMEOUT))
+			return -ENODEV;
+
+		return -EAGAIN;
+	}
+
+	if (det != HBA_PxSSTS_DET_PHY) {
+		if (timestamp_elapsed(ahcidev->reset, AHCI_LINK_TIMEOUT))
+			return -ETIMEDOUT;
+
+		return -EAGAIN;
+	}
+
+	/* The device may still be spinning up */
+	if (port->tfd & (ATA_SR_BSY | ATA_SR_DRQ)) {
+		if (timestamp_elapsed(ahcidev->reset, AHCI_CMD_TIMEOUT))
+			return -ETIMEDOUT;
+
+		return -EAGAIN;
+	}
 
 	return 0;
 }
 
+static int ahci_link_up(struct ahci_dev *ahcidev)
+{
+	volatile struct hba_port *port = ahcidev->port;
+
+	port->serr = port->serr;
+	port->is = port->is;
+
+	return ahci_start_command(port);
+}
+
+static int ahci_port_reset(struct ahci_dev *ahcidev)
+{
+	int ret;
+
+	bprintln(DRIVER_AHCI ": Resetting port %d...", ahcidev->portno);
+
+	ahci_link_reset(ahcidev);
+	mdelay(1);
+	ahci_link_release(ahcidev);
+
+	while ((ret = ahci_link_poll(ahcidev)) == -EAGAIN);
+
+	if (ret)
+		return ret;
+
+	return ahci_link_up(ahcidev);
+}
+
+static int ahci_port_recover(struct ahci_dev *ahcidev)
+{
+	volatile struct hba_port *port = ahcidev->port;
+	uint32_t error = ahcidev->error;
+
+	ahcidev->issued = 0;
+	ahcidev->completed = 0;
+	ahcidev->error = 0;
+
+	/*
+	 * Clearing PxCMD.ST aborts all outstanding commands and resets both
+	 * PxSACT and PxCI. A task file error leaves the link intact, restarting
+	 * the command engine is sufficient if the device is idle again. After
+	 * timeouts, HBA and interface errors we need a COMRESET.
+	 */
+	if (error != HBA_PxIS_TFES || ahci_stop_command(port) ||
+	   (port->tfd & (ATA_SR_BSY | ATA_SR_DRQ)))
+		return ahci_port_reset(ahcidev);
+
+	port->serr = port->serr;
+	port->is = port->is;
+
+	return ahci_start_command(port);
+}
+
+static int ahci_exec_command(struct ahci_dev *ahcidev, int slot)
+{
+	uint32_t done, retries = AHCI_RETRIES;
+	bool check;
+	int ret;
+
+	while (true) {
+		ret = ahci_issue_command(ahcidev, slot, false);
+		if (!ret)
+			ret = ahci_wait(ahcidev, &done);
+
+		if (!ret)
+			return 0;
+
+		/*
+		 * ATAPI devices report a check condition with a task file error.
+		 * That's not a transport problem, the caller has to request the
+		 * sense data instead of issuing the command again.
+		 */
+		check = ahcidev->atapi && ahcidev->error == HBA_PxIS_TFES;
+
+		if (ahci_port_recover(ahcidev) || check || !retries--)
+			return ret;
+
+		bprintln(DRIVER_AHCI ": Port %d: Retrying command: %d",
+			ahcidev->portno, ret);
+	}
+}
+
+/*
+ * AHCI device operations
+ */
+
 static int ahci_send_command(struct ahci_dev *ahcidev, struct ahci_cmd *cmd)
 {
 	struct hba_fis_reg *freg;
 	struct hba_cmd_tbl *ctbl;
-	int slot, ret = 0;
+	int slot, ret;
 
-	slot = ahci_prepare_command(ahcidev, 1, 0);
+	slot = ahci_prepare_command(ahcidev, ahci_num_prdts(cmd->buflen), 0);
 	if (slot < 0) {
 		bprintln(DRIVER_AHCI ": Error preparing command: %d", slot);
 		return slot;
 	}
 
-	freg = ahci_get_fis_reg(ahcidev->port, slot);
+	freg = ahci_get_fis_reg(ahcidev, slot);
 	freg->command = ATA_CMD_PACKET;
 	freg->device  = 0xA0 | (1 << 6);
 	freg->feature = 0x01;
 
-	ctbl = ahci_get_cmd_tbl(ahcidev->port, slot);
-	ctbl->prdt[0].idbc = HBA_IDBC(cmd->buflen - 1, 0);
-	ctbl->prdt[0].dba  = tuint(cmd->buffer);
+	ctbl = ahci_get_cmd_tbl(ahcidev, slot);
+	ahci_set_prdts(ctbl, cmd->buffer, cmd->buflen);
 
-	if (cmd->packet && cmd->pkglen)
+	if (cmd->packet && cmd->pkglen) {
+		memset(ctbl->acmd, 0, sizeof(ctbl->acmd));
 		memcpy(ctbl->acmd, cmd->packet, cmd->pkglen);
+	}
 
-	ahci_port_wait(ahcidev->port);
-	ahcidev->port->ci |= (1UL << slot);
-
-	if (ahci_idle(ahcidev, slot))
-		ret = -EFAULT;
+	ret = ahci_exec_command(ahcidev, slot);
 
-	ahci_destroy_command(ahcidev->port, slot);
+	ahci_destroy_command(ahcidev, slot);
 
 	return ret;
 }
 
-static int ahci_satapi_send(struct bdev *bdev, void *packet, size_t pkglen,
+static int ahci_satapi_send(struct libatapi_dev *atapi, void *packet,
 	void *buffer, size_t buflen)
 {
 	struct ahci_cmd cmd = { 0 };
 
 	cmd.packet = packet;
-	cmd.pkglen = pkglen;
+	cmd.pkglen = LIBATAPI_PACKET_SIZE;
 	cmd.buffer = buffer;
 	cmd.buflen = buflen;
 
-	return ahci_send_command(bdev->private, &cmd);
+	return ahci_send_command(atapi->bdev->private, &cmd);
 }
 
 /*
  * AHCI device operations: SATA
  */
 
+static uint32_t ahci_sata_max_blocks(struct bdev *bdev)
+{
+	struct ahci_dev *ahcidev = bdev->private;
+	uint32_t max_blocks = ahci_max_blocks(bdev);
+	uint32_t max_count = 256;
+
+	/*
+	 * A sector count of zero means 256 sectors for 28-bit commands and
+	 * 65536 sectors for 48-bit and queued commands.
+	 */
+	if (ahcidev->lba48 || ahcidev->ncq)
+		max_count = 65536;
+
+	return min(max_blocks, max_count);
+}
+
+static void ahci_sata_setup(struct ahci_dev *ahcidev, int slot, uint64_t lba,
+	uint32_t count, void *buffer, uint32_t length)
+{
+	struct hba_fis_reg *freg;
+	struct hba_cmd_tbl *ctbl;
+
+	freg = ahci_get_fis_reg(ahcidev, slot);
+	freg->lba_low  = (lba >>  0);
+	freg->lba_mid  = (lba >>  8);
+	freg->lba_high = (lba >> 16);
+	freg->device   = ATA_DEV_LBA;
+
+	if (ahcidev->ncq) {
+		/*
+		 * READ FPDMA QUEUED takes the sector count from the features
+		 * registers, the count register holds the tag of the command.
+		 */
+		freg->command  = ATA_READ_FPDMA_QUEUED;
+		freg->feature  = (count >> 0);
+		freg->featureh = (count >> 8);
+		freg->countl   = (slot << 3);
+	} else if (ahcidev->lba48) {
+		freg->command  = ATA_CMD_READ_DMA_EXT;
+		freg->countl   = (count >> 0);
+		freg->counth   = (count >> 8);
+	} else {
+		freg->command  = ATA_CMD_READ_DMA;
+		freg->device  |= (lba >> 24) & 0x0f;
+		freg->countl   = count;
+	}
+
+	if (ahcidev->ncq || ahcidev->lba48) {
+		freg->lba_ext_low  = (lba >> 24);
+		freg->lba_ext_mid  = (lba >> 32);
+		freg->lba_ext_high = (lba >> 40);
+	}
+
+	ctbl = ahci_get_cmd_tbl(ahcidev, slot);
+	ahci_set_prdts(ctbl, buffer, length);
+}
+
 static int ahci_sata_read(struct bdev *bdev, uint64_t offset, uint64_t num,
 	void *buffer)
 {
+	struct ahci_dev *ahcidev = bdev->private;
+	uint32_t count, length, issued = 0, inflight = 0, done;
+	uint32_t retries = AHCI_RETRIES;
+	int slot, ret = 0;
+
+	while (num || issued) {
+
+		/*
+		 * Fill up the queue of the device before we wait for the first
+		 * completion. Without NCQ, the queue depth is one.
+		 */
+		while (!ret && num && inflight < ahcidev->qdepth) {
+			count  = min(num, (uint64_t)bdev->max_blocks);
+			length = count << bdev->block_logs;
+
+			slot = ahci_prepare_command(ahcidev, ahci_num_prdts(length), 0);
+			if (slot < 0) {
+				ret = slot;
+				goto ahci_sata_read_abort;
+			}
+
+			ahci_sata_setup(ahcidev, slot, offset, count, buffer, length);
+
+			issued |= (1UL << slot);
+			inflight++;
+			offset += count;
+			num    -= count;
+			buffer  = vptradd(buffer, length);
+
+			ret = ahci_issue_command(ahcidev, slot, ahcidev->ncq);
+		}
+
+		done = 0;
+
+		if (!ret)
+			ret = ahci_wait(ahcidev, &done);
+
+		inflight -= ahci_release_commands(ahcidev, done);
+		issued &= ~done;
+
+		if (!ret)
+			continue;
+
+		/*
+		 * Commands that completed before the error are done. All others
+		 * were aborted by the recovery and still have their command
+		 * tables, so we can simply issue them again.
+		 */
+		if (ahci_port_recover(ahcidev) || !retries--)
+			goto ahci_sata_read_abort;
+
+		bprintln(DRIVER_AHCI ": Port %d: Retrying %lu commands: %d",
+			ahcidev->portno, inflight, ret);
+
+		ret = ahci_reissue_commands(ahcidev, issued, ahcidev->ncq);
+	}
+
 	return 0;
+
+ahci_sata_read_abort:
+	ahci_release_commands(ahcidev, issued);
+
+	return ret;
 }
 
-static int ahci_sata_write(struct bdev *bdev, uint64_t offset, uint64_t num,
-	const void *buffer)
+static int ahci_sata_write(struct bdev *bdev __unused, uint64_t offset __unused,
+	uint64_t num __unused, const void *buffer __unused)
 {
-	return 0;
+	return -ENOTSUP;
 }
 
 static int ahci_sata_ioctl(struct bdev *bdev, int request, void *args)
@@ -253,35 +770,12 @@ static int ahci_sata_ioctl(struct bdev *bdev, int request, void *args)
  * AHCI device operations: SATAPI
  */
 
-static int ahci_satapi_request_sense(struct bdev *bdev)
-{
-	struct scsi_request_sense_data rsd;
-	struct scsi_request_sense rs = {
-		.cmd = SCSI_CMD_REQUEST_SENSE,
-		.len = sizeof(rs)
-	};
-
-	return ahci_satapi_send(bdev, &rs, sizeof(rs), &rsd, sizeof(rsd));
-}
-
 static int ahci_satapi_read(struct bdev *bdev, uint64_t offset, uint64_t num,
 	void *buffer)
 {
-	int ret;
-	struct scsi_xfer12 xf = {
-		.cmd = SCSI_CMD_READ12,
-		.lba = cputobe32(offset),
-		.num = cputobe32(num)
-	};
-
-	ret = ahci_satapi_send(bdev, &xf, sizeof(xf), buffer, num * bdev->block_size);
-	if (ahci_satapi_request_sense(bdev))
-		return -EFAULT;
-
-	if (ret)
-		return ret;
+	struct ahci_dev *ahcidev = bdev->private;
 
-	return 0;
+	return libatapi_read(&ahcidev->satapi, offset, num, buffer);
 }
 
 static int ahci_satapi_write(struct bdev *bdev, uint64_t offset, uint64_t num,
@@ -317,15 +811,14 @@ static struct bdev_ops ahci_satapi_bdev_ops = {
 
 static int ahci_dev_name(struct ahci_dev *ahcidev, struct bdev *bdev)
 {
-	char ahci[] = "ahciXX";
+	char ahci[] = "ahciXXXX";
 
-	if (ahcidev->portno < 10) {
-		ahci[4] = '0' + (ahcidev->portno);
-		ahci[5] =  0;
-	} else {
-		ahci[4] = '0' + (ahcidev->portno / 10);
-		ahci[5] = '0' + (ahcidev->portno % 10);
-	}
+	/*
+	 * Ports of the first controller keep their port number, all further
+	 * controllers continue behind the ports of their predecessor.
+	 */
+	sprintf(ahci, "ahci%d",
+		ahcidev->ctrl->index * AHCI_MAX_PORTS + ahcidev->portno);
 
 	bdev->name = bstrdup(ahci);
 	if (!bdev->name)
@@ -334,19 +827,40 @@ static int ahci_dev_name(struct ahci_dev *ahcidev, struct bdev *bdev)
 	return 0;
 }
 
+static void ahci_fill_queue(struct ahci_dev *ahcidev)
+{
+	ahcidev->lba48 = libata_has_lba48_support(ahcidev->private);
+
+	if (!libata_has_ncq_support(ahcidev->private))
+		ahcidev->ncq = 0;
+
+	/*
+	 * Without NCQ, we can only have one command outstanding at a time.
+	 * Otherwise, the smaller queue of both the HBA and the device wins.
+	 */
+	if (ahcidev->ncq)
+		ahcidev->qdepth = min(libata_queue_depth(ahcidev->private),
+			ahcidev->slots);
+	else
+		ahcidev->qdepth = 1;
+}
+
 static int ahci_fill_sata(struct ahci_dev *ahcidev)
 {
 	struct bdev *bdev;
 
-	bdev = bmalloc(sizeof(*bdev));
+	bdev = bzalloc(sizeof(*bdev));
 	if (!bdev)
 		return -ENOMEM;
 
+	ahci_fill_queue(ahcidev);
+
 	if (ahci_dev_name(ahcidev, bdev))
 		goto ahci_sata_free_bdev;
 
 	bdev->init_block = 0;
 	bdev->private = ahcidev;
+	bdev_set_location(bdev, &ahcidev->ctrl->pcidev->addr, ahcidev->portno);
 
 	if (!libata_has_lba_support(ahcidev->private))
 		goto fill_ata_chs;
@@ -365,10 +879,11 @@ fill_ata_chs:
 fill_ata_block_size:
 
 	bdev->block_size = libata_block_size(ahcidev->private);
+	bdev->max_blocks = ahci_sata_max_blocks(bdev);
 
 #ifdef CONFIG_DRIVER_AHCI_DEBUG
-	bprintln(DRIVER_AHCI ": %s: sectors = %llu, block size = %u",
-		bdev->name, bdev->last_block, bdev->block_size);
+	bprintln(DRIVER_AHCI ": %s: sectors = %llu, block size = %u, queue depth = %u",
+		bdev->name, bdev->last_block, bdev->block_size, ahcidev->qdepth);
 #endif
 
 	return bdev_init(bdev, &ahci_sata_bdev_ops);
@@ -379,34 +894,13 @@ ahci_sata_free_bdev:
 	return -EFAULT;
 }
 
-static int ahci_satapi_read_capacity(struct bdev *bdev)
-{
-	int ret;
-	struct scsi_read_capacity10_data rcd;
-	struct scsi_read_capacity10 rc = {
-		.cmd = SCSI_CMD_READ_CAPACITY10
-	};
-
-	ret = ahci_satapi_send(bdev, &rc, sizeof(rc), &rcd, sizeof(rcd));
-	if (ahci_satapi_request_sense(bdev))
-		return -EFAULT;
-
-	if (ret)
-		return ret;
-
-	bdev->last_block = betocpu32(rcd.last_block);
-	bdev->block_size = betocpu32(rcd.block_size);
-
-	return 0;
-}
-
 static int ahci_fill_satapi(struct ahci_dev *ahcidev)
 {
 	struct bdev *bdev;
 
 	ahcidev->atapi = 1;
 
-	bdev = bmalloc(sizeof(*bdev));
+	bdev = bzalloc(sizeof(*bdev));
 	if (!bdev)
 		return -ENOMEM;
 
@@ -415,12 +909,18 @@ static int ahci_fill_satapi(struct ahci_dev *ahcidev)
 
 	bdev->flags |= BDEV_FLAGS_LBA;
 	bdev->private = ahcidev;
+	bdev_set_location(bdev, &ahcidev->ctrl->pcidev->addr, ahcidev->portno);
 
 	bdev->init_block = 0;
 
-	if (ahci_satapi_read_capacity(bdev))
+	ahcidev->satapi.bdev = bdev;
+	ahcidev->satapi.send = ahci_satapi_send;
+
+	if (libatapi_read_capacity(&ahcidev->satapi))
 		goto ahci_satapi_free_bdev;
 
+	bdev->max_blocks = ahci_max_blocks(bdev);
+
 #ifdef CONFIG_DRIVER_AHCI_DEBUG
 	bprintln(DRIVER_AHCI ": %s: sectors = %llu, block size = %u",
 		bdev->name, bdev->last_block, bdev->block_size);
@@ -450,21 +950,16 @@ static int ahci_identify_ahcidev(struct ahci_dev *ahcidev)
 	else
 		command = ATA_CMD_IDENTIFY;
 
-	freg = ahci_get_fis_reg(ahcidev->port, slot);
+	freg = ahci_get_fis_reg(ahcidev, slot);
 	freg->command = command;
 	freg->device = 0xA0;
 
-	ctbl = ahci_get_cmd_tbl(ahcidev->port, slot);
-	ctbl->prdt[0].idbc = HBA_IDBC(ATA_IDENTIFY_SIZE, 0);
-	ctbl->prdt[0].dba = tuint(ahcidev->private);
+	ctbl = ahci_get_cmd_tbl(ahcidev, slot);
+	ahci_set_prdt(ctbl, 0, ahcidev->private, ATA_IDENTIFY_SIZE);
 
-	ahci_port_wait(ahcidev->port);
-	ahcidev->port->ci |= (1UL << slot);
-
-	if (ahci_idle(ahcidev, slot)) {
-		ret = -EFAULT;
+	ret = ahci_exec_command(ahcidev, slot);
+	if (ret)
 		goto ahci_identify_destroy_command;
-	}
 
 	switch (ahcidev->port->sig) {
 		case SATA_SIG_ATA:
@@ -478,125 +973,240 @@ static int ahci_identify_ahcidev(struct ahci_dev *ahcidev)
 	}
 
 ahci_identify_destroy_command:
-	ahci_destroy_command(ahcidev->port, slot);
+	ahci_destroy_command(ahcidev, slot);
 
 	return ret;
 }
 
-static int ahci_init_ahcidev(struct ahci_dev *ahcidev,
-	volatile struct hba_port *port)
+static void ahci_free_port(struct ahci_dev *ahcidev)
 {
-	int ret;
-
-	if (ahci_port_rebase(port))
-		return -EFAULT;
+	struct ahci_ctrl *ctrl = ahcidev->ctrl;
 
-	ahcidev->private = bmalloc(ATA_IDENTIFY_SIZE);
-	if (!ahcidev->private)
-		return -ENOMEM;
+	ahci_stop_command(ahcidev->port);
 
-	ahcidev->port = port;
+	ahcidev->port->ie = 0;
+	ctrl->ports[ahcidev->portno] = NULL;
 
-	ret = ahci_identify_ahcidev(ahcidev);
+	if (ahcidev->cmdmem)
+		bfree(ahcidev->cmdmem);
 
-	bfree(ahcidev->private);
-
-	return ret;
+	bfree(ahcidev);
 }
 
-static int ahci_init_port(struct pci_dev *pcidev, int port)
+static int ahci_reset_port(struct ahci_ctrl *ctrl, int port)
 {
 	struct ahci_dev *ahcidev;
-	struct hba_memory *hba_mem;
 
-	ahcidev = bmalloc(sizeof(*ahcidev));
+	ahcidev = bzalloc(sizeof(*ahcidev));
 	if (!ahcidev)
 		return -ENOMEM;
 
 	ahcidev->portno = port;
+	ahcidev->ctrl = ctrl;
+	ahcidev->port = &ctrl->hba->ports[port];
+	ahcidev->slots = HBA_CAP_NCS(ctrl->hba->cap) + 1;
+	ahcidev->ncq = !!(ctrl->hba->cap & HBA_CAP_SNCQ);
+	ahcidev->state = AHCI_PORT_LINK;
+
+	/*
+	 * The interrupt handler has to know the port before the first command
+	 * is issued.
+	 */
+	ctrl->ports[port] = ahcidev;
 
-	hba_mem = tvptr(pcidev->bar[5]);
-	if (ahci_init_ahcidev(ahcidev, &hba_mem->ports[port]))
-		goto ahci_init_free_ahcidev;
+	if (ahci_port_rebase(ahcidev, ahcidev->port)) {
+		ahci_free_port(ahcidev);
+		return -EFAULT;
+	}
+
+	ahci_link_reset(ahcidev);
 
 	return 0;
+}
 
-ahci_init_free_ahcidev:
-	bfree(ahcidev);
+static int ahci_init_port(struct ahci_dev *ahcidev)
+{
+	int ret;
 
-	return -EFAULT;
+	ret = ahci_link_up(ahcidev);
+	if (ret)
+		return ret;
+
+	ahcidev->private = bmalloc(ATA_IDENTIFY_SIZE);
+	if (!ahcidev->private)
+		return -ENOMEM;
+
+	ret = ahci_identify_ahcidev(ahcidev);
+
+	bfree(ahcidev->private);
+
+	return ret;
 }
 
-static int ahci_check_type(struct hba_memory *hba, int port)
+static void ahci_init_irq(struct ahci_ctrl *ctrl)
 {
-	uint8_t det, ipm;
+	ctrl->irq_setup = true;
+
+	if (ctrl->irq >= NUM_IRQS) {
+		bprintln(DRIVER_AHCI ": No IRQ routed, polling for completions");
+		return;
+	}
 
-	det = (hba->ports[port].ssts >> 0) & 0x0f;
-	ipm = (hba->ports[port].ssts >> 8) & 0x0f;
+	ctrl->handler.name = DRIVER_AHCI;
+	ctrl->handler.callback = ahci_interrupt;
+
+	register_interrupt_handler(irq_to_vector(ctrl->irq), &ctrl->handler);
+
+	pci_enable_intx(ctrl->pcidev);
 
 	/*
-	 * We only accept devices with the following state:
-	 *
-	 * det: Phy communication established
-	 * ipm: AHCI device is in active state
+	 * Port interrupts are enabled as soon as a port has been rebased. The
+	 * line itself stays masked until somebody waits for a command.
 	 */
-	if ((det != 0x03) || (ipm != 0x01))
-		return -ENODEV;
+	ctrl->hba->is = ctrl->hba->is;
+	ctrl->hba->ghc |= HBA_GHC_IE;
 
-	return 0;
+	ctrl->irq_enabled = true;
 }
 
-static int ahci_probe_port(struct pci_dev *pcidev, int port)
+static int ahci_init_controller(struct pci_dev *pcidev,
+	const struct pci_dev_id *id __unused)
 {
-	struct hba_memory *mem = tvptr(pcidev->bar[5]);
+	struct ahci_ctrl *ctrl;
+	int port, num_ports;
 
-	if (!(mem->pi & (1UL << port)))
+	/*
+	 * RAID controllers only work for us if they implement AHCI, which
+	 * always maps the HBA registers with a memory BAR5.
+	 */
+	if (!pcidev->bar[5] || (pcidev->bar[5] & 0x01))
 		return -ENODEV;
 
-	return ahci_check_type(mem, port);
-}
+	ctrl = bzalloc(sizeof(*ctrl));
+	if (!ctrl)
+		return -ENOMEM;
 
-static int ahci_init_controller(struct pci_dev *pcidev, struct hba_memory *hba_memory)
-{
-	int port, num_dports;
+	ctrl->pcidev = pcidev;
+	pcidev->private = ctrl;
+	ctrl->hba = tvptr(pcidev->bar[5] & ~0x0f);
+	ctrl->irq = pcidev->irq;
+	ctrl->index = ahci_num_ctrls++;
+
+	list_add_tail(&ctrl->list, &ahci_ctrls);
 
 	pci_set_master(pcidev);
 
-	num_dports = HBA_CAP_NP(hba_memory->cap) + 1;
-	for (port = 0; port < num_dports; port++) {
+	ctrl->hba->ghc |= HBA_GHC_AE;
 
-		/*
-		 * Check the device signature. We ignore non-existent devices and only
-		 * initialize devices that are active and have a phy comm established.
-		 */
-		if (ahci_probe_port(pcidev, port))
+	if (interrupts_are_ready())
+		ahci_init_irq(ctrl);
+
+	/*
+	 * Only start the COMRESET of every implemented port here. Waiting for
+	 * the links is done for all ports of all controllers at once.
+	 */
+	num_ports = HBA_CAP_NP(ctrl->hba->cap) + 1;
+	for (port = 0; port < num_ports; port++) {
+		if (!(ctrl->hba->pi & (1UL << port)))
 			continue;
 
-		ahci_init_port(pcidev, port);
+		ahci_reset_port(ctrl, port);
 	}
 
 	return 0;
 }
 
-static int ahci_init(void)
+static void ahci_release_ports(void)
 {
-	struct pci_dev *pcidev;
+	struct ahci_ctrl *ctrl;
+	uint32_t port;
 
-	bprintln(DRIVER_AHCI ": Initialize module...");
+	/* A single delay covers the minimum COMRESET time of all ports */
+	mdelay(1);
+
+	list_for_each_entry(ctrl, &ahci_ctrls, list) {
+		for (port = 0; port < AHCI_MAX_PORTS; port++) {
+			if (ctrl->ports[port])
+				ahci_link_release(ctrl->ports[port]);
+		}
+	}
+}
+
+static bool ahci_poll_port(struct ahci_dev *ahcidev)
+{
+	int ret;
+
+	ret = ahci_link_poll(ahcidev);
+	if (ret == -EAGAIN)
+		return true;
 
 	/*
-	 * TODO CRO: Use table of allowed PCI devices
+	 * Identify the device as soon as its link is up, while the others are
+	 * still spinning up.
 	 */
+	if (!ret)
+		ret = ahci_init_port(ahcidev);
 
-	pcidev = pci_get_class(PCI_CLASS_SATA, NULL);
-	if (!pcidev) {
-		pcidev = pci_get_class(PCI_CLASS_RAID, NULL);
+	if (ret) {
+#ifdef CONFIG_DRIVER_AHCI_DEBUG
+		bprintln(DRIVER_AHCI ": Port %d: No device: %d", ahcidev->portno, ret);
+#endif
+		ahci_free_port(ahcidev);
 
-		if (!pcidev)
-			return 0;
+		return false;
 	}
 
-	return ahci_init_controller(pcidev, tvptr(pcidev->bar[5]));
+	ahcidev->state = AHCI_PORT_ACTIVE;
+
+	return false;
+}
+
+static void ahci_probe_ports(void)
+{
+	struct ahci_dev *ahcidev;
+	struct ahci_ctrl *ctrl;
+	uint32_t port;
+	bool pending;
+
+	ahci_release_ports();
+
+	do {
+		pending = false;
+
+		list_for_each_entry(ctrl, &ahci_ctrls, list) {
+			for (port = 0; port < AHCI_MAX_PORTS; port++) {
+				ahcidev = ctrl->ports[port];
+				if (!ahcidev || ahcidev->state != AHCI_PORT_LINK)
+					continue;
+
+				if (ahci_poll_port(ahcidev))
+					pending = true;
+			}
+		}
+	} while (pending);
+}
+
+static const struct pci_dev_id ahci_ids[] = {
+	{ PCI_ID_CLASS(PCI_CLASS_SATA) },
+	{ PCI_ID_CLASS(PCI_CLASS_RAID) },
+	{ 0 }
+};
+
+static struct pci_driver ahci_driver = {
+	.name  = DRIVER_AHCI,
+	.ids   = ahci_ids,
+	.probe = ahci_init_controller
+};
+
+static int ahci_init(void)
+{
+	bprintln(DRIVER_AHCI ": Initialize module...");
+
+	pci_register_driver(&ahci_driver);
+
+	ahci_probe_ports();
+
+	return 0;
 }
 
 static void ahci_exit(void)
@@ -5,13 +5,14 @@
 #include <elfboot/module.h>
 #include <elfboot/bdev.h>
 #include <elfboot/pci.h>
+#include <elfboot/math.h>
+#include <elfboot/time.h>
 #include <elfboot/libata.h>
 #include <elfboot/string.h>
 #include <elfboot/printf.h>
 
 #include <drivers/ide.h>
 #include <drivers/ata.h>
-#include <drivers/scsi.h>
 
 static uint16_t ide_ports[] = {
 	IDE_PORT_PRIMARY,
@@ -34,31 +35,39 @@ static uint8_t ide_inb(struct ide_dev *idedev, int reg)
 
 static void ide_read_io(struct ide_dev *idedev, uint16_t *buf, uint64_t size)
 {
-	uint64_t read;
+	uint16_t port = idedev->io_base + ATA_REG_DATA;
 
-	for (read = 0; read < (size >> 1); read++) {
+	/*
+	 * Read from ATA_REG_DATA with string I/O until we reached the specified
+	 * number of bytes. The controller splits 32-bit accesses into two word
+	 * transfers, a remaining word is read on its own.
+	 */
+#ifdef CONFIG_DRIVER_IDE_PIO32
+	insl(port, buf, size >> 2);
 
-		/*
-		 * Read from ATA_REG_DATA, until we reached the specified number of
-		 * bytes into the given buffer. To simplify it we read from the IDE
-		 * device in word granularity.
-		 */
-		buf[read] = inw(idedev->io_base + ATA_REG_DATA);
-	}
+	buf  += (size >> 2) << 1;
+	size &= 3;
+#endif
+
+	insw(port, buf, size >> 1);
 }
 
 static void ide_write_io(struct ide_dev *idedev, uint16_t *buf, uint64_t size)
 {
-	uint64_t write;
+	uint16_t port = idedev->io_base + ATA_REG_DATA;
 
-	for (write = 0; write < (size >> 1); write++) {
+	/*
+	 * Send the parameters to ATA_REG_DATA in the same way. ATAPI packets are
+	 * 12 or 16 bytes long, so they never leave a word behind.
+	 */
+#ifdef CONFIG_DRIVER_IDE_PIO32
+	outsl(port, buf, size >> 2);
 
-		/*
-		 * Send the parameters to ATA_REG_DATA in word chunks until we sent
-		 * all values to the target port.
-		 */
-		outw(idedev->io_base + ATA_REG_DATA, buf[write]);
-	}
+	buf  += (size >> 2) << 1;
+	size &= 3;
+#endif
+
+	outsw(port, buf, size >> 1);
 }
 
 static void ide_poll_piodel(struct ide_dev *idedev)
@@ -104,20 +113,13 @@ static uint8_t ide_poll_io(struct ide_dev *idedev)
  * IDE device operations
  */
 
-static int ide_send_command(struct ide_dev *idedev, struct ata_cmd *cmd)
+static void ide_write_taskfile(struct ide_dev *idedev, ata_regs_t *reg)
 {
-	uint8_t status, dev;
-	ata_regs_t *reg;
-	uint32_t i, cnt, rem, nbread;
+	uint8_t dev;
+	uint32_t i;
 
-	reg = &cmd->reg;
 	dev = (reg->disk & 0xef) | (idedev->slave << 4);
 
-	/*
-	 * Core function for handling read/write operation on a device connexted
-	 * to the PCI IDE controller. This function works for both ATA and ATAPI.
-	 */
-
 	ide_outb(idedev, ATA_REG_HDDEVSEL, dev);
 
 	/*
@@ -130,22 +132,62 @@ static int ide_send_command(struct ide_dev *idedev, struct ata_cmd *cmd)
 		ide_outb(idedev, i, reg->raw[i - ATA_REG_FEATURES]);
 
 	ide_outb(idedev, ATA_REG_COMMAND, reg->cmd);
-	status = ide_poll_io(idedev);
+}
 
+static int ide_send_packet(struct ide_dev *idedev, struct ata_cmd *cmd,
+	uint8_t *status)
+{
 	/*
 	 * Send an ATAPI packet to the IDE device only if a a size and the packet
 	 * itself are available. For now, only ATAPI is supported.
 	 */
-	if (cmd->cmdsize && cmd->cmd) {
-		if ((status & ATA_SR_POLL) != ATA_SR_DRQ)
-			return -EFAULT;
+	if ((*status & ATA_SR_POLL) != ATA_SR_DRQ)
+		return -EFAULT;
 
-		status = ide_inb(idedev, ATAPI_REG_IREASON);
-		if (!((status & ATAPI_IREASON_MASK) == ATAPI_IREASON_CMD_OUT))
-			return -EFAULT;
+	*status = ide_inb(idedev, ATAPI_REG_IREASON);
+	if (!((*status & ATAPI_IREASON_MASK) == ATAPI_IREASON_CMD_OUT))
+		return -EFAULT;
 
-		ide_write_io(idedev, cmd->cmd, cmd->cmdsize);
-		status = ide_poll_io(idedev);
+	ide_write_io(idedev, cmd->cmd, cmd->cmdsize);
+	*status = ide_poll_io(idedev);
+
+	return 0;
+}
+
+static uint32_t ide_drq_size(struct ide_dev *idedev, uint8_t command)
+{
+	/*
+	 * Without the multiple commands, the device asks for every sector on
+	 * its own. With them, a DRQ block holds multiple sectors.
+	 */
+	switch (command) {
+		case ATA_CMD_READ_MULTIPLE:
+		case ATA_CMD_READ_MULTIPLE_EXT:
+			return idedev->multiple * ATA_BLOCK_SIZE;
+		default:
+			return ATA_BLOCK_SIZE;
+	}
+}
+
+static int ide_send_command(struct ide_dev *idedev, struct ata_cmd *cmd)
+{
+	uint8_t status;
+	ata_regs_t *reg;
+	uint32_t i, cnt, rem, nbread;
+
+	reg = &cmd->reg;
+
+	/*
+	 * Core function for handling read/write operation on a device connexted
+	 * to the PCI IDE controller. This function works for both ATA and ATAPI.
+	 */
+
+	ide_write_taskfile(idedev, reg);
+	status = ide_poll_io(idedev);
+
+	if (cmd->cmdsize && cmd->cmd) {
+		if (ide_send_packet(idedev, cmd, &status))
+			return -EFAULT;
 	}
 
 	nbread = 0;
@@ -166,7 +208,7 @@ static int ide_send_command(struct ide_dev *idedev, struct ata_cmd *cmd)
 			if (!(cnt > 0 && cnt <= rem && (!(cnt & 1) || cnt == rem)))
 				return -EFAULT;
 		} else
-			cnt = 512;
+			cnt = ide_drq_size(idedev, reg->cmd);
 		
 		if (cnt > rem)
 			cnt = rem;
@@ -189,62 +231,182 @@ static int ide_send_command(struct ide_dev *idedev, struct ata_cmd *cmd)
 	cmd->bufsize = nbread;
 	ide_poll_io(idedev);
 
-	for (i = ATA_REG_ERROR; i < ATA_REG_STATUS; i++)
+	/*
+	 * Read back the task file including the status register. The command
+	 * byte shares its place in the registers with the status.
+	 */
+	for (i = ATA_REG_ERROR; i <= ATA_REG_STATUS; i++)
 		reg->raw[i - ATA_REG_FEATURES] = ide_inb(idedev, i);
 
-	if (reg->status & (ATA_SR_DRQ | ATA_SR_ERR))
+	/*
+	 * An error bit is the device rejecting the command, which is how ATAPI
+	 * devices report a check condition. A pending DRQ is a protocol error.
+	 */
+	if (reg->status & ATA_SR_ERR)
+		return -EIO;
+
+	if (reg->status & ATA_SR_DRQ)
 		return -EFAULT;
 
 	return 0;
 }
 
-static int ide_atapi_send(struct bdev *bdev, void *pkg, size_t pkglen,
-	void *buf, size_t buflen)
+/*
+ * IDE device operations: Bus Master DMA
+ */
+
+static bool ide_dma_usable(struct ide_dev *idedev, void *buffer,
+	uint32_t length)
 {
-	struct ata_cmd cmd = { 0 };
+	/* Regions have to start on a word and cover whole words */
+	return idedev->dma && length && !((tuint(buffer) | length) & 1);
+}
 
-	cmd.reg.atapi_cnthigh = (buflen >> 8) & 0xff;
-	cmd.reg.atapi_cntlow  = (buflen >> 0) & 0xff;
-	cmd.reg.cmd = ATA_CMD_PACKET;
+static void ide_dma_prepare(struct ide_dev *idedev, void *buffer,
+	uint32_t length)
+{
+	struct ide_prd *prd = idedev->prdt;
+	uint32_t addr = tuint(buffer), size;
+	uint8_t status;
 
-	cmd.cmd = pkg;
-	cmd.cmdsize = pkglen;
-	cmd.buf = buf;
-	cmd.bufsize = buflen;
+	while (length) {
+		size = IDE_PRD_BOUNDARY - (addr & (IDE_PRD_BOUNDARY - 1));
+		if (size > length)
+			size = length;
+
+		prd->addr  = addr;
+		prd->size  = size & 0xffff;
+		prd->flags = 0;
+
+		addr   += size;
+		length -= size;
+		prd++;
+	}
+
+	prd[-1].flags = IDE_PRD_EOT;
+
+	outl(idedev->bmide + IDE_BM_REG_PRDT, tuint(idedev->prdt));
+	outb(idedev->bmide + IDE_BM_REG_COMMAND, IDE_BM_CMD_READ);
+
+	/* The interrupt and error bits are cleared by writing ones */
+	status = inb(idedev->bmide + IDE_BM_REG_STATUS);
+	outb(idedev->bmide + IDE_BM_REG_STATUS,
+		status | IDE_BM_SR_ERROR | IDE_BM_SR_IRQ);
+}
+
+static int ide_dma_wait(struct ide_dev *idedev)
+{
+	uint64_t deadline = timestamp_deadline(IDE_DMA_TIMEOUT);
+	uint8_t status, ata_status;
+	int ret = 0;
+
+	/*
+	 * The controller sets the interrupt bit once the device raised its
+	 * interrupt at the end of the command, even while the IRQ is masked.
+	 */
+	while (true) {
+		status = inb(idedev->bmide + IDE_BM_REG_STATUS);
+		if (status & (IDE_BM_SR_IRQ | IDE_BM_SR_ERROR))
+			break;
+
+		if (timestamp_expired(deadline)) {
+			ret = -ETIMEDOUT;
+			break;
+		}
+	}
+
+	outb(idedev->bmide + IDE_BM_REG_COMMAND, IDE_BM_CMD_READ);
+	outb(idedev->bmide + IDE_BM_REG_STATUS, status);
+
+	/* Reading the status register acknowledges the device interrupt */
+	ata_status = ide_poll_status(idedev);
+
+	if (ret)
+		return ret;
 
-	return (ide_send_command(bdev->private, &cmd) || cmd.bufsize != buflen);
+	if (status & IDE_BM_SR_ERROR)
+		return -EFAULT;
+
+	if (ata_status & (ATA_SR_ERR | ATA_SR_DF | ATA_SR_DRQ))
+		return -EIO;
+
+	return 0;
+}
+
+static int ide_dma_command(struct ide_dev *idedev, struct ata_cmd *cmd)
+{
+	uint8_t status;
+
+	ide_dma_prepare(idedev, cmd->buf, cmd->bufsize);
+	ide_write_taskfile(idedev, &cmd->reg);
+
+	if (cmd->cmdsize && cmd->cmd) {
+		status = ide_poll_io(idedev);
+
+		if (ide_send_packet(idedev, cmd, &status))
+			return -EFAULT;
+	}
+
+	outb(idedev->bmide + IDE_BM_REG_COMMAND,
+		IDE_BM_CMD_READ | IDE_BM_CMD_START);
+
+	return ide_dma_wait(idedev);
 }
 
-static int ide_atapi_request_sense(struct bdev *bdev)
+static bool ide_dma_failed(struct ide_dev *idedev, int ret)
 {
-	struct scsi_request_sense_data rsd;
-	struct scsi_request_sense rs = {
-		.cmd = SCSI_CMD_REQUEST_SENSE,
-		.len = sizeof(rs)
-	};
+	/*
+	 * Errors reported by the device would happen with PIO as well. Every
+	 * other failure means that DMA doesn't work for this device.
+	 */
+	if (!ret || ret == -EIO)
+		return false;
+
+	bprintln(DRIVER_IDE ": DMA failed (%d), falling back to PIO", ret);
 
-	return ide_atapi_send(bdev, &rs, sizeof(rs), &rsd, sizeof(rsd));
+	idedev->dma = 0;
+
+	return true;
 }
 
-static int ide_atapi_read_capacity(struct bdev *bdev)
+static int ide_atapi_send(struct libatapi_dev *atapi, void *pkg, void *buf,
+	size_t buflen)
 {
+	struct ide_dev *idedev = atapi->bdev->private;
+	struct ata_cmd cmd = { 0 };
+	uint32_t limit;
 	int ret;
-	struct scsi_read_capacity10_data rcd;
-	struct scsi_read_capacity10 rc = {
-		.cmd = SCSI_CMD_READ_CAPACITY10
-	};
 
-	ret = ide_atapi_send(bdev, &rc, sizeof(rc), &rcd, sizeof(rcd));
-	if (ide_atapi_request_sense(bdev))
-		return -EFAULT;
+	/*
+	 * The byte count limit is the size of a single PIO data block and has
+	 * to be even. Larger transfers take multiple blocks.
+	 */
+	limit = min(buflen, (size_t)IDE_ATAPI_BYTE_LIMIT);
+
+	cmd.reg.atapi_cnthigh = (limit >> 8) & 0xff;
+	cmd.reg.atapi_cntlow  = (limit >> 0) & 0xff;
+	cmd.reg.cmd = ATA_CMD_PACKET;
+
+	cmd.cmd = pkg;
+	cmd.cmdsize = LIBATAPI_PACKET_SIZE;
+	cmd.buf = buf;
+	cmd.bufsize = buflen;
+
+	if (ide_dma_usable(idedev, buf, buflen)) {
+		cmd.reg.features = ATAPI_FEATURE_DMA;
 
+		ret = ide_dma_command(idedev, &cmd);
+		if (!ide_dma_failed(idedev, ret))
+			return ret;
+
+		cmd.reg.features = 0;
+	}
+
+	ret = ide_send_command(idedev, &cmd);
 	if (ret)
 		return ret;
 
-	bdev->last_block = betocpu32(rcd.last_block);
-	bdev->block_size = betocpu32(rcd.block_size);
-
-	return 0;
+	return (cmd.bufsize == buflen) ? 0 : -EFAULT;
 }
 
 /*
@@ -260,30 +422,144 @@ static int ide_ata_send(struct ide_dev *idedev, struct ata_cmd *cmd,
 	return ide_send_command(idedev, cmd);
 }
 
-static int ide_ata_read(struct bdev *bdev, uint64_t sector, uint64_t blknum,
-	void *buffer)
+static uint8_t ide_ata_read_command(struct ide_dev *idedev, bool dma)
 {
-	struct ata_cmd cmd = { 0 };
+	if (dma)
+		return idedev->lba48 ? ATA_CMD_READ_DMA_EXT : ATA_CMD_READ_DMA;
+
+	if (idedev->multiple)
+		return idedev->lba48 ? ATA_CMD_READ_MULTIPLE_EXT :
+			ATA_CMD_READ_MULTIPLE;
+
+	return idedev->lba48 ? ATA_CMD_READ_PIO_EXT : ATA_CMD_READ_PIO;
+}
+
+static uint32_t ide_ata_max_blocks(struct bdev *bdev, bool dma)
+{
+	struct ide_dev *idedev = bdev->private;
+	uint32_t max_count, max_dma;
+
+	/*
+	 * A sector count of zero means 256 sectors for 28-bit and CHS commands
+	 * and 65536 sectors for 48-bit commands. With DMA, the PRD table limits
+	 * a single command even further.
+	 */
+	max_count = idedev->lba48 ? 65536 : 256;
 
-	if (bdev->flags & BDEV_FLAGS_LBA) {
-		cmd.reg.sectors48  = (blknum >>  8) & 0xFF;
-		cmd.reg.lba48_low  = (sector >> 24) & 0xFF;
-		cmd.reg.lba48_mid  = (sector >> 32) & 0xFF;
-		cmd.reg.lba48_high = (sector >> 40) & 0xFF;
+	if (dma) {
+		max_dma = IDE_DMA_MAX_SIZE >> bdev->block_logs;
+		if (max_count > max_dma)
+			max_count = max_dma;
 	}
 
-	cmd.reg.sectors  = (blknum >>  0) & 0xFF;
-	cmd.reg.lba_low  = (sector >>  0) & 0xFF;
-	cmd.reg.lba_mid  = (sector >>  8) & 0xFF;
-	cmd.reg.lba_high = (sector >> 16) & 0xFF;
+	return max_count;
+}
 
-	cmd.buf = buffer;
-	cmd.bufsize = bdev->block_size * blknum;
+static int ide_ata_setup(struct bdev *bdev, struct ata_cmd *cmd,
+	uint64_t sector, uint32_t count, bool dma)
+{
+	struct ide_dev *idedev = bdev->private;
+	uint32_t track, head, cyl, sect;
 
-	if (ide_ata_send(bdev->private, &cmd, ATA_CMD_READ_PIO_EXT))
-		return -EFAULT;
+	memset(cmd, 0, sizeof(*cmd));
+
+	cmd->reg.cmd     = ide_ata_read_command(idedev, dma);
+	cmd->reg.disk    = idedev->disk;
+	cmd->reg.sectors = (count >> 0) & 0xFF;
+
+	if (idedev->lba48) {
+		cmd->reg.sectors48  = (count  >>  8) & 0xFF;
+		cmd->reg.lba48_low  = (sector >> 24) & 0xFF;
+		cmd->reg.lba48_mid  = (sector >> 32) & 0xFF;
+		cmd->reg.lba48_high = (sector >> 40) & 0xFF;
+	} else if (bdev->flags & BDEV_FLAGS_LBA) {
+		if (sector + count - 1 > ATA_MAX_28BIT_LBA)
+			return -EINVAL;
+
+		cmd->reg.disk |= (sector >> 24) & 0x0F;
+	} else {
+		if (!bdev->sectors_per_track || !bdev->heads)
+			return -EINVAL;
+
+		track = div(sector, bdev->sectors_per_track, &sect);
+		cyl   = div(track, bdev->heads, &head);
 
-	if (cmd.bufsize != bdev->block_size * blknum)
+		if (cyl > 0xFFFF)
+			return -EINVAL;
+
+		cmd->reg.disk     = (idedev->disk & ~ATA_DEV_LBA) | head;
+		cmd->reg.sectnum  = sect + 1;
+		cmd->reg.cyllsb   = (cyl >> 0) & 0xFF;
+		cmd->reg.cylmsb   = (cyl >> 8) & 0xFF;
+
+		return 0;
+	}
+
+	cmd->reg.lba_low  = (sector >>  0) & 0xFF;
+	cmd->reg.lba_mid  = (sector >>  8) & 0xFF;
+	cmd->reg.lba_high = (sector >> 16) & 0xFF;
+
+	return 0;
+}
+
+static int ide_ata_read_blocks(struct bdev *bdev, uint64_t sector,
+	uint64_t blknum, void *buffer, bool dma)
+{
+	struct ide_dev *idedev = bdev->private;
+	struct ata_cmd cmd;
+	uint32_t count, length, max_count;
+	int ret;
+
+	max_count = ide_ata_max_blocks(bdev, dma);
+
+	/*
+	 * Split the request at the limits of a single command. A channel only
+	 * executes one command at a time, so the next chunk is issued as soon
+	 * as the previous one completed.
+	 */
+	while (blknum) {
+		count  = min(blknum, (uint64_t)max_count);
+		length = count << bdev->block_logs;
+
+		ret = ide_ata_setup(bdev, &cmd, sector, count, dma);
+		if (ret)
+			return ret;
+
+		cmd.buf = buffer;
+		cmd.bufsize = length;
+
+		if (dma) {
+			ret = ide_dma_command(idedev, &cmd);
+		} else {
+			ret = ide_send_command(idedev, &cmd);
+			if (!ret && cmd.bufsize != length)
+				ret = -EIO;
+		}
+
+		if (ret)
+			return ret;
+
+		sector += count;
+		blknum -= count;
+		buffer  = vptradd(buffer, length);
+	}
+
+	return 0;
+}
+
+static int ide_ata_read(struct bdev *bdev, uint64_t sector, uint64_t blknum,
+	void *buffer)
+{
+	struct ide_dev *idedev = bdev->private;
+	int ret;
+
+	if (ide_dma_usable(idedev, buffer, bdev->block_size * blknum)) {
+		ret = ide_ata_read_blocks(bdev, sector, blknum, buffer, true);
+		if (!ide_dma_failed(idedev, ret))
+			return ret ? -EFAULT : 0;
+	}
+
+	if (ide_ata_read_blocks(bdev, sector, blknum, buffer, false))
 		return -EFAULT;
 
 	return 0;
@@ -307,21 +583,9 @@ static int ide_ata_ioctl(struct bdev *bdev, int request, void *args)
 static int ide_atapi_read(struct bdev *bdev, uint64_t sector, uint64_t blknum,
 	void *buffer)
 {
-	int ret;
-	struct scsi_xfer12 xf = {
-		.cmd = SCSI_CMD_READ12,
-		.lba = cputobe32(sector),
-		.num = cputobe32(blknum)
-	};
-
-	ret = ide_atapi_send(bdev, &xf, sizeof(xf), buffer, blknum * bdev->block_size);
-	if (ide_atapi_request_sense(bdev))
-		return -EFAULT;
-
-	if (ret)
-		return ret;
+	struct ide_dev *idedev = bdev->private;
 
-	return 0;
+	return libatapi_read(&idedev->atapi, sector, blknum, buffer);
 }
 
 static int ide_atapi_write(struct bdev *bdev, uint64_t sector, uint64_t blknum,
@@ -371,16 +635,75 @@ static int ide_dev_name(struct ide_dev *idedev, struct bdev *bdev)
 	return 0;
 }
 
+/*
+ * Drive position as encoded in the EDD device path: channel and drive
+ */
+static inline uint16_t ide_port(struct ide_dev *idedev)
+{
+	return (idedev->channel << 1) | idedev->slave;
+}
+
+static void ide_init_dma(struct ide_dev *idedev)
+{
+	/*
+	 * Bus Master IDE is only available through an I/O BAR and the device
+	 * has to support DMA according to its identify data. The I/O space
+	 * bit has already been stripped from bmaster, so check the raw BAR.
+	 */
+	if (!(idedev->pcidev->bar[4] & PCI_BAR_IO) || !idedev->bmaster ||
+	    !idedev->private ||
+	    !libata_has_dma_support(idedev->private))
+		return;
+
+	idedev->prdt = bmalloc(IDE_DMA_PRDS * sizeof(struct ide_prd));
+	if (!idedev->prdt)
+		return;
+
+	idedev->bmide = (idedev->bmaster & PCI_BAR_MASK) +
+		idedev->channel * IDE_BM_CHANNEL_SIZE;
+	idedev->dma = 1;
+}
+
+static void ide_set_multiple(struct ide_dev *idedev)
+{
+	struct ata_cmd cmd = { 0 };
+	uint32_t count;
+
+	/*
+	 * SET MULTIPLE MODE only accepts powers of two up to the maximum the
+	 * device reported in its identify data.
+	 */
+	count = libata_max_multiple(idedev->private);
+	if (count > IDE_MAX_MULTIPLE)
+		count = IDE_MAX_MULTIPLE;
+
+	while (count & (count - 1))
+		count &= count - 1;
+
+	if (count < 2)
+		return;
+
+	cmd.reg.sectors = count;
+
+	if (ide_ata_send(idedev, &cmd, ATA_CMD_SET_MULTIPLE))
+		return;
+
+	idedev->multiple = count;
+}
+
 static int ide_fill_ata(struct bdev *bdev)
 {
 	struct ide_dev *idedev = bdev->private;
 
 	bdev->init_block = 0;
+	ide_set_multiple(idedev);
+	ide_init_dma(idedev);
 
 	if (!libata_has_lba_support(idedev->private))
 		goto fill_ata_chs;
 
 	bdev->flags |= BDEV_FLAGS_LBA;
+	idedev->lba48 = libata_has_lba48_support(idedev->private);
 	bdev->last_block = libata_last_block(idedev->private);
 
 	goto fill_ata_block_size;
@@ -396,8 +719,9 @@ fill_ata_block_size:
 	bdev->block_size = libata_block_size(idedev->private);
 
 #ifdef CONFIG_DRIVER_IDE_DEBUG
-	bprintln(DRIVER_IDE ": %s: sectors = %llu, block size = %u",
-		bdev->name, bdev->last_block, bdev->block_size);
+	bprintln(DRIVER_IDE ": %s: sectors = %llu, block size = %u, dma = %u, "
+		"multiple = %u", bdev->name, bdev->last_block, bdev->block_size,
+		idedev->dma, idedev->multiple);
 #endif
 
 	return 0;
@@ -413,7 +737,7 @@ static int ide_init_ata(struct ide_dev *idedev)
 
 	ide_read_io(idedev, idedev->private, ATA_IDENTIFY_SIZE);
 
-	bdev = bmalloc(sizeof(*bdev));
+	bdev = bzalloc(sizeof(*bdev));
 	if (!bdev)
 		goto ide_free_ibuf_ata;
 
@@ -424,6 +748,7 @@ static int ide_init_ata(struct ide_dev *idedev)
 
 	idedev->disk = 0xe0;
 	bdev->private = idedev;
+	bdev_set_location(bdev, &idedev->pcidev->addr, ide_port(idedev));
 
 	if (ide_fill_ata(bdev))
 		goto ide_free_bdev_ata;
@@ -441,23 +766,65 @@ ide_free_ibuf_ata:
 
 static int ide_fill_atapi(struct bdev *bdev)
 {
-	if (ide_atapi_read_capacity(bdev))
+	struct ide_dev *idedev = bdev->private;
+
+	ide_init_dma(idedev);
+
+	idedev->atapi.bdev = bdev;
+	idedev->atapi.send = ide_atapi_send;
+
+	if (libatapi_read_capacity(&idedev->atapi))
 		return -EFAULT;
 
+	if (!bdev->block_size)
+		return -EINVAL;
+
+	bdev->max_blocks = IDE_DMA_MAX_SIZE / bdev->block_size;
+
 	bdev->flags |= BDEV_FLAGS_LBA;
 
 #ifdef CONFIG_DRIVER_IDE_DEBUG
-	bprintln(DRIVER_IDE ": %s: sectors = %llu, block size = %u",
-		bdev->name, bdev->last_block, bdev->block_size);
+	bprintln(DRIVER_IDE ": %s: sectors = %llu, block size = %u, dma = %u",
+		bdev->name, bdev->last_block, bdev->block_size, idedev->dma);
 #endif
 
 	return 0;
 }
 
+static int ide_identify_packet(struct ide_dev *idedev)
+{
+	uint8_t status;
+
+	ide_outb(idedev, ATA_REG_HDDEVSEL, idedev->slave << 4);
+	ide_outb(idedev, ATA_REG_COMMAND, ATA_CMD_IDENTIFY_PACKET);
+
+	status = ide_poll_io(idedev);
+	if ((status & ATA_SR_POLL) != ATA_SR_DRQ)
+		return -EIO;
+
+	ide_read_io(idedev, idedev->private, ATA_IDENTIFY_SIZE);
+
+	return 0;
+}
+
 static int ide_init_atapi(struct ide_dev *idedev)
 {
-	struct bdev *bdev = bmalloc(sizeof(*bdev));
+	struct bdev *bdev;
+
+	idedev->private = bmalloc(ATA_IDENTIFY_SIZE);
+	if (!idedev->private)
+		return -ENOMEM;
+
+	/*
+	 * The identify data is only needed to find out about DMA support,
+	 * older devices simply use PIO.
+	 */
+	if (ide_identify_packet(idedev)) {
+		bfree(idedev->private);
+		idedev->private = NULL;
+	}
 
+	bdev = bzalloc(sizeof(*bdev));
 	if (!bdev)
 		goto ide_free_ibuf_atapi;
 
@@ -466,6 +833,7 @@ static int ide_init_atapi(struct ide_dev *idedev)
 
 	idedev->disk = 0;
 	bdev->private = idedev;
+	bdev_set_location(bdev, &idedev->pcidev->addr, ide_port(idedev));
 
 	if (ide_fill_atapi(bdev))
 		goto ide_free_bdev_atapi;
@@ -476,7 +844,15 @@ ide_free_bdev_atapi:
 	bfree(bdev);
 
 ide_free_ibuf_atapi:
-	bfree(idedev->private);
+	if (idedev->private)
+		bfree(idedev->private);
+
+	if (idedev->prdt)
+		bfree(idedev->prdt);
+
+	idedev->private = NULL;
+	idedev->prdt = NULL;
+	idedev->dma = 0;
 
 	return -EFAULT;
 }
@@ -504,7 +880,7 @@ static int ide_identify(struct ide_dev *idedev)
 
 static int ide_init_devchn(struct pci_dev *pcidev, uint16_t chn, int slave)
 {
-	struct ide_dev *idedev = bmalloc(sizeof(*idedev));
+	struct ide_dev *idedev = bzalloc(sizeof(*idedev));
 
 	if (!idedev)
 		return -ENOMEM;
@@ -512,6 +888,7 @@ static int ide_init_devchn(struct pci_dev *pcidev, uint16_t chn, int slave)
 	idedev->io_base = ide_ports[chn];
 	idedev->control = ide_ports[chn] + IDE_CTRL_OFFSET;
 
+	idedev->pcidev = pcidev;
 	idedev->channel = chn;
 	idedev->slave = slave;
 	idedev->bmaster = pcidev->bar[4];
@@ -521,10 +898,24 @@ static int ide_init_devchn(struct pci_dev *pcidev, uint16_t chn, int slave)
 	return ide_identify(idedev);
 }
 
-static int ide_init_controller(struct pci_dev *pcidev)
+static int ide_init_controller(struct pci_dev *pcidev,
+	const struct pci_dev_id *id __unused)
 {
+	static struct pci_dev *ide_ctrl = NULL;
 	uint16_t chn;
 
+	/*
+	 * The channels are accessed through the legacy ports, which can only
+	 * be decoded by a single controller.
+	 */
+	if (ide_ctrl)
+		return -EBUSY;
+
+	ide_ctrl = pcidev;
+
+	/* Required for Bus Master DMA */
+	pci_set_master(pcidev);
+
 	for (chn = 0; chn < IDE_MAX_CHANNELS; chn++) {
 
 		/*
@@ -539,22 +930,27 @@ static int ide_init_controller(struct pci_dev *pcidev)
 	return 0;
 }
 
+/*
+ * TODO CRO: Iterate over all class-subclass combinations. The used
+ * IDE cotroller might not have the used class in the PCI_CLASS_IDE
+ * macro (it could be a different interface, like PCI).
+ */
+static const struct pci_dev_id ide_ids[] = {
+	{ PCI_ID_CLASS(PCI_CLASS_IDE) },
+	{ 0 }
+};
+
+static struct pci_driver ide_driver = {
+	.name  = DRIVER_IDE,
+	.ids   = ide_ids,
+	.probe = ide_init_controller
+};
+
 static int ide_init(void)
 {
-	struct pci_dev *pcidev;
-
 	bprintln(DRIVER_IDE ": Initialize module...");
 
-	/*
-	 * TODO CRO: Iterate over all class-subclass combinations. The used
-	 * IDE cotroller might not have the used class in the PCI_CLASS_IDE
-	 * macro (it could be a different interface, like PCI).
-	 */
-	pcidev = pci_get_class(PCI_CLASS_IDE, NULL);
-	if (!pcidev)
-		return 0;
-
-	return ide_init_controller(pcidev);
+	return pci_register_driver(&ide_driver);
 }
 
 static void ide_exit(void)
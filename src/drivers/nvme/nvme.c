@@ -0,0 +1,700 @@
+#include <elfboot/core.h>
+#include <elfboot/linkage.h>
+#include <elfboot/mm.h>
+#include <elfboot/io.h>
+#include <elfboot/module.h>
+#include <elfboot/bdev.h>
+#include <elfboot/bitops.h>
+#include <elfboot/pci.h>
+#include <elfboot/time.h>
+#include <elfboot/string.h>
+#include <elfboot/printf.h>
+
+#include <drivers/nvme.h>
+
+static LIST_HEAD(nvme_ctrls);
+static int nvme_num_ctrls = 0;
+
+/*
+ * Register access
+ */
+
+static inline uint32_t nvme_readl(struct nvme_ctrl *ctrl, uint32_t reg)
+{
+	return *(volatile uint32_t *)(ctrl->regs + reg);
+}
+
+static inline void nvme_writel(struct nvme_ctrl *ctrl, uint32_t reg,
+	uint32_t val)
+{
+	*(volatile uint32_t *)(ctrl->regs + reg) = val;
+}
+
+static inline void nvme_writeq(struct nvme_ctrl *ctrl, uint32_t reg,
+	uint64_t val)
+{
+	nvme_writel(ctrl, reg, val & 0xffffffff);
+	nvme_writel(ctrl, reg + 4, val >> 32);
+}
+
+static volatile uint32_t *nvme_doorbell(struct nvme_ctrl *ctrl, uint32_t index)
+{
+	return (volatile uint32_t *)(ctrl->regs + NVME_REG_DBS +
+		index * (4 << ctrl->dstrd));
+}
+
+static int nvme_wait_ready(struct nvme_ctrl *ctrl, bool ready)
+{
+	uint64_t deadline = timestamp_deadline(ctrl->timeout);
+	uint32_t csts;
+
+	while (true) {
+		csts = nvme_readl(ctrl, NVME_REG_CSTS);
+
+		if (csts == 0xffffffff || (ready && (csts & NVME_CSTS_CFS)))
+			return -EIO;
+
+		if (!!(csts & NVME_CSTS_RDY) == ready)
+			return 0;
+
+		if (timestamp_expired(deadline))
+			return -ETIMEDOUT;
+	}
+}
+
+static int nvme_disable(struct nvme_ctrl *ctrl)
+{
+	uint32_t cc = nvme_readl(ctrl, NVME_REG_CC);
+
+	/*
+	 * A disabled controller stops processing all queues, which is also how
+	 * we make sure it doesn't touch our buffers after a timeout.
+	 */
+	if (cc & NVME_CC_EN)
+		nvme_writel(ctrl, NVME_REG_CC, cc & ~NVME_CC_EN);
+
+	return nvme_wait_ready(ctrl, false);
+}
+
+/*
+ * Queues
+ */
+
+static void nvme_free_queue(struct nvme_queue *queue)
+{
+	if (queue->sq)
+		free_page(tuint(queue->sq));
+
+	if (queue->cq)
+		free_page(tuint(queue->cq));
+
+	if (queue->prps)
+		free_page(tuint(queue->prps));
+
+	queue->sq = NULL;
+	queue->cq = NULL;
+	queue->prps = NULL;
+}
+
+static int nvme_alloc_queue(struct nvme_ctrl *ctrl, struct nvme_queue *queue,
+	uint16_t qid, uint16_t depth)
+{
+	queue->qid = qid;
+	queue->depth = depth;
+	queue->sq_tail = 0;
+	queue->cq_head = 0;
+	queue->phase = 1;
+
+	/*
+	 * A full ring would look empty to the controller, since the tail would
+	 * wrap onto the head. Only depth - 1 commands may be outstanding.
+	 */
+	queue->free = (1UL << (depth - 1)) - 1;
+
+	queue->sq_db = nvme_doorbell(ctrl, 2 * qid);
+	queue->cq_db = nvme_doorbell(ctrl, 2 * qid + 1);
+
+	/* Queues and PRP lists have to be page aligned */
+	queue->sq = get_zeroed_page();
+	queue->cq = get_zeroed_page();
+
+	if (qid)
+		queue->prps = get_zeroed_page();
+
+	if (!queue->sq || !queue->cq || (qid && !queue->prps)) {
+		nvme_free_queue(queue);
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+static int nvme_submit(struct nvme_queue *queue, struct nvme_cmd *cmd)
+{
+	int cid;
+
+	if (!queue->free)
+		return -EAGAIN;
+
+	cid = ffs(queue->free);
+	queue->free &= ~(1UL << cid);
+
+	cmd->cid = cid;
+	memcpy(&queue->sq[queue->sq_tail], cmd, sizeof(*cmd));
+
+	if (++queue->sq_tail == queue->depth)
+		queue->sq_tail = 0;
+
+	return cid;
+}
+
+static void nvme_ring(struct nvme_queue *queue)
+{
+	barrier();
+
+	*queue->sq_db = queue->sq_tail;
+}
+
+static uint32_t nvme_reap(struct nvme_queue *queue)
+{
+	volatile struct nvme_cqe *cqe;
+	uint32_t num = 0;
+
+	while (true) {
+		cqe = &queue->cq[queue->cq_head];
+		if ((cqe->status & NVME_CQE_PHASE) != queue->phase)
+			break;
+
+		barrier();
+
+		if (NVME_CQE_STATUS(cqe->status))
+			queue->errors++;
+
+		queue->result = cqe->result;
+		queue->free |= 1UL << (cqe->cid % NVME_QUEUE_DEPTH);
+
+		if (++queue->cq_head == queue->depth) {
+			queue->cq_head = 0;
+			queue->phase ^= 1;
+		}
+
+		num++;
+	}
+
+	if (num)
+		*queue->cq_db = queue->cq_head;
+
+	return num;
+}
+
+static void nvme_fail(struct nvme_ctrl *ctrl)
+{
+	bprintln(DRIVER_NVME ": nvme%d: Command timed out, disabling controller",
+		ctrl->index);
+
+	ctrl->failed = true;
+	nvme_disable(ctrl);
+}
+
+static int nvme_admin_command(struct nvme_ctrl *ctrl, struct nvme_cmd *cmd,
+	uint32_t *result)
+{
+	struct nvme_queue *admin = &ctrl->admin;
+	uint64_t deadline;
+	int cid;
+
+	cid = nvme_submit(admin, cmd);
+	if (cid < 0)
+		return cid;
+
+	admin->errors = 0;
+	nvme_ring(admin);
+
+	deadline = timestamp_deadline(NVME_CMD_TIMEOUT);
+
+	while (!nvme_reap(admin)) {
+		if (timestamp_expired(deadline)) {
+			nvme_fail(ctrl);
+			return -ETIMEDOUT;
+		}
+	}
+
+	if (admin->errors)
+		return -EIO;
+
+	if (result)
+		*result = admin->result;
+
+	return 0;
+}
+
+static int nvme_identify(struct nvme_ctrl *ctrl, uint32_t cns, uint32_t nsid)
+{
+	struct nvme_cmd cmd = { 0 };
+
+	cmd.opcode = NVME_ADMIN_IDENTIFY;
+	cmd.nsid = nsid;
+	cmd.prp1 = tuint(ctrl->identify);
+	cmd.cdw10 = cns;
+
+	return nvme_admin_command(ctrl, &cmd, NULL);
+}
+
+static int nvme_create_io_queue(struct nvme_ctrl *ctrl, struct nvme_queue *queue,
+	uint16_t qid, uint16_t depth)
+{
+	struct nvme_cmd cmd = { 0 };
+	int ret;
+
+	ret = nvme_alloc_queue(ctrl, queue, qid, depth);
+	if (ret)
+		return ret;
+
+	cmd.opcode = NVME_ADMIN_CREATE_CQ;
+	cmd.prp1 = tuint(queue->cq);
+	cmd.cdw10 = ((depth - 1) << 16) | qid;
+	cmd.cdw11 = NVME_QUEUE_PHYS_CONTIG;
+
+	ret = nvme_admin_command(ctrl, &cmd, NULL);
+	if (ret)
+		goto nvme_create_free_queue;
+
+	memset(&cmd, 0, sizeof(cmd));
+
+	cmd.opcode = NVME_ADMIN_CREATE_SQ;
+	cmd.prp1 = tuint(queue->sq);
+	cmd.cdw10 = ((depth - 1) << 16) | qid;
+	cmd.cdw11 = (qid << 16) | NVME_QUEUE_PHYS_CONTIG;
+
+	ret = nvme_admin_command(ctrl, &cmd, NULL);
+	if (ret)
+		goto nvme_create_delete_cq;
+
+	return 0;
+
+nvme_create_delete_cq:
+	/*
+	 * The completion queue is still live unless the controller has been
+	 * disabled after a timeout. If we can't delete it, its memory is lost
+	 * rather than handed out while the controller may still write to it.
+	 */
+	if (!ctrl->failed) {
+		memset(&cmd, 0, sizeof(cmd));
+
+		cmd.opcode = NVME_ADMIN_DELETE_CQ;
+		cmd.cdw10 = qid;
+
+		if (nvme_admin_command(ctrl, &cmd, NULL) && !ctrl->failed)
+			return ret;
+	}
+
+nvme_create_free_queue:
+	nvme_free_queue(queue);
+
+	return ret;
+}
+
+/*
+ * NVMe device operations
+ */
+
+static void nvme_setup_prps(struct nvme_queue *queue, struct nvme_cmd *cmd,
+	int cid, void *buffer, uint32_t length)
+{
+	uint32_t addr = tuint(buffer), first, i;
+	uint64_t *list;
+
+	/*
+	 * The first entry may start anywhere within a page, all further ones
+	 * are page aligned. Transfers of more than two pages need a PRP list.
+	 */
+	first = NVME_PAGE_SIZE - (addr & (NVME_PAGE_SIZE - 1));
+
+	cmd->prp1 = addr;
+	cmd->prp2 = 0;
+
+	if (length <= first)
+		return;
+
+	addr   += first;
+	length -= first;
+
+	if (length <= NVME_PAGE_SIZE) {
+		cmd->prp2 = addr;
+		return;
+	}
+
+	list = &queue->prps[cid * NVME_MAX_PAGES];
+
+	for (i = 0; length; i++) {
+		list[i] = addr;
+
+		addr   += NVME_PAGE_SIZE;
+		length -= min(length, NVME_PAGE_SIZE);
+	}
+
+	cmd->prp2 = tuint(list);
+}
+
+static struct nvme_queue *nvme_next_queue(struct nvme_ctrl *ctrl)
+{
+	struct nvme_queue *queue;
+	uint32_t i;
+
+	/* Spread the commands over all I/O queues */
+	for (i = 0; i < ctrl->nr_io; i++) {
+		queue = &ctrl->io[ctrl->next_io++ % ctrl->nr_io];
+
+		if (queue->free)
+			return queue;
+	}
+
+	return NULL;
+}
+
+static int nvme_read(struct bdev *bdev, uint64_t lba, uint64_t num,
+	void *buffer)
+{
+	struct nvme_ns *ns = bdev->private;
+	struct nvme_ctrl *ctrl = ns->ctrl;
+	struct nvme_queue *queue;
+	struct nvme_cmd cmd = { 0 };
+	uint32_t i, count, length, max_count, inflight = 0, pending;
+	uint64_t deadline = 0;
+	int cid, ret = 0;
+
+	if (ctrl->failed)
+		return -EIO;
+
+	max_count = (ctrl->max_pages << NVME_PAGE_SHIFT) >> bdev->block_logs;
+
+	for (i = 0; i < ctrl->nr_io; i++)
+		ctrl->io[i].errors = 0;
+
+	/*
+	 * Keep every I/O queue as full as possible and refill it as soon as
+	 * the controller completes commands. The doorbell of each queue is
+	 * only rung once per batch.
+	 */
+	while (num || inflight) {
+		pending = 0;
+
+		while (num && (queue = nvme_next_queue(ctrl)) != NULL) {
+			count  = min(num, (uint64_t)max_count);
+			length = count << bdev->block_logs;
+
+			cmd.opcode = NVME_CMD_READ;
+			cmd.nsid   = ns->nsid;
+			cmd.cdw10  = lba & 0xffffffff;
+			cmd.cdw11  = lba >> 32;
+			cmd.cdw12  = count - 1;
+
+			/* The PRP list belongs to the command ID we get */
+			cid = ffs(queue->free);
+			nvme_setup_prps(queue, &cmd, cid, buffer, length);
+			nvme_submit(queue, &cmd);
+
+			pending |= 1UL << (queue - ctrl->io);
+			inflight++;
+
+			lba    += count;
+			num    -= count;
+			buffer  = vptradd(buffer, length);
+		}
+
+		for (i = 0; i < ctrl->nr_io; i++) {
+			if (pending & (1UL << i))
+				nvme_ring(&ctrl->io[i]);
+		}
+
+		if (pending || !deadline)
+			deadline = timestamp_deadline(NVME_CMD_TIMEOUT);
+
+		for (i = 0; i < ctrl->nr_io; i++) {
+			count = nvme_reap(&ctrl->io[i]);
+			if (count)
+				deadline = timestamp_deadline(NVME_CMD_TIMEOUT);
+
+			inflight -= count;
+
+			/* Drain the outstanding commands, but don't issue new ones */
+			if (ctrl->io[i].errors) {
+				ret = -EIO;
+				num = 0;
+			}
+		}
+
+		if (inflight && timestamp_expired(deadline)) {
+			nvme_fail(ctrl);
+			return -ETIMEDOUT;
+		}
+	}
+
+	return ret;
+}
+
+static int nvme_write(struct bdev *bdev __unused, uint64_t lba __unused,
+	uint64_t num __unused, const void *buffer __unused)
+{
+	/*
+	 * Not supported.
+	 */
+	return -ENOTSUP;
+}
+
+static int nvme_ioctl(struct bdev *bdev __unused, int request __unused,
+	void *args __unused)
+{
+	return 0;
+}
+
+static struct bdev_ops nvme_bdev_ops = {
+	.read  = nvme_read,
+	.write = nvme_write,
+	.ioctl = nvme_ioctl
+};
+
+/*
+ * Module initialization and exit function
+ */
+
+static int nvme_init_ns(struct nvme_ctrl *ctrl, uint32_t nsid)
+{
+	char name[] = "nvmeXXXXnXXXX";
+	struct nvme_ns *ns;
+	struct bdev *bdev;
+	uint32_t lbaf, lbads;
+	uint64_t nsze;
+	int ret;
+
+	ret = nvme_identify(ctrl, NVME_IDENTIFY_NS, nsid);
+	if (ret)
+		return ret;
+
+	/* Inactive namespaces report a size of zero */
+	nsze = get_le64(ctrl->identify + NVME_ID_NS_NSZE);
+	if (!nsze)
+		return -ENODEV;
+
+	lbaf = get_le32(ctrl->identify + NVME_ID_NS_LBAF +
+		4 * (ctrl->identify[NVME_ID_NS_FLBAS] & 0xf));
+
+	lbads = NVME_LBAF_LBADS(lbaf);
+	if (lbads < 9 || lbads > NVME_PAGE_SHIFT)
+		return -EINVAL;
+
+	ns = bzalloc(sizeof(*ns));
+	if (!ns)
+		return -ENOMEM;
+
+	bdev = bzalloc(sizeof(*bdev));
+	if (!bdev)
+		goto nvme_ns_free_ns;
+
+	sprintf(name, "nvme%dn%lu", ctrl->index, nsid);
+
+	bdev->name = bstrdup(name);
+	if (!bdev->name)
+		goto nvme_ns_free_bdev;
+
+	ns->ctrl = ctrl;
+	ns->nsid = nsid;
+
+	bdev->flags |= BDEV_FLAGS_LBA;
+	bdev->private = ns;
+	bdev_set_location(bdev, &ctrl->pcidev->addr, BDEV_PORT_NONE);
+	bdev->block_size = 1UL << lbads;
+	bdev->last_block = nsze - 1;
+	bdev->max_blocks = (ctrl->max_pages << NVME_PAGE_SHIFT) >> lbads;
+
+#ifdef CONFIG_DRIVER_NVME_DEBUG
+	bprintln(DRIVER_NVME ": %s: sectors = %llu, block size = %u",
+		bdev->name, nsze, bdev->block_size);
+#endif
+
+	if (bdev_init(bdev, &nvme_bdev_ops))
+		goto nvme_ns_free_name;
+
+	return 0;
+
+nvme_ns_free_name:
+	bfree_const(bdev->name);
+
+nvme_ns_free_bdev:
+	bfree(bdev);
+
+nvme_ns_free_ns:
+	bfree(ns);
+
+	return -ENOMEM;
+}
+
+static int nvme_init_io_queues(struct nvme_ctrl *ctrl, uint32_t mqes)
+{
+	struct nvme_cmd cmd = { 0 };
+	uint32_t result, nr, depth;
+	int ret;
+
+	cmd.opcode = NVME_ADMIN_SET_FEATURES;
+	cmd.cdw10 = NVME_FEAT_NUM_QUEUES;
+	cmd.cdw11 = ((NVME_MAX_IO_QUEUES - 1) << 16) | (NVME_MAX_IO_QUEUES - 1);
+
+	ret = nvme_admin_command(ctrl, &cmd, &result);
+	if (ret)
+		return ret;
+
+	/* The controller may grant fewer queues than we asked for */
+	nr = min((result & 0xffff) + 1, (result >> 16) + 1);
+	nr = min(nr, (uint32_t)NVME_MAX_IO_QUEUES);
+
+	depth = min(mqes + 1, (uint32_t)NVME_QUEUE_DEPTH);
+
+	for (ctrl->nr_io = 0; ctrl->nr_io < nr; ctrl->nr_io++) {
+		ret = nvme_create_io_queue(ctrl, &ctrl->io[ctrl->nr_io],
+			ctrl->nr_io + 1, depth);
+		if (ret)
+			break;
+	}
+
+	return ctrl->nr_io ? 0 : ret;
+}
+
+static int nvme_enable(struct nvme_ctrl *ctrl, uint32_t mqes)
+{
+	uint16_t depth = min(mqes + 1, (uint32_t)NVME_ADMIN_DEPTH);
+	int ret;
+
+	ret = nvme_disable(ctrl);
+	if (ret)
+		return ret;
+
+	ret = nvme_alloc_queue(ctrl, &ctrl->admin, 0, depth);
+	if (ret)
+		return ret;
+
+	/* We poll all completion queues */
+	nvme_writel(ctrl, NVME_REG_INTMS, 0xffffffff);
+
+	nvme_writel(ctrl, NVME_REG_AQA, ((depth - 1) << 16) | (depth - 1));
+	nvme_writeq(ctrl, NVME_REG_ASQ, tuint(ctrl->admin.sq));
+	nvme_writeq(ctrl, NVME_REG_ACQ, tuint(ctrl->admin.cq));
+
+	nvme_writel(ctrl, NVME_REG_CC, NVME_CC_EN | NVME_CC_CSS_NVM |
+		NVME_CC_MPS(NVME_PAGE_SHIFT) | NVME_CC_AMS_RR |
+		NVME_CC_IOSQES(6) | NVME_CC_IOCQES(4));
+
+	return nvme_wait_ready(ctrl, true);
+}
+
+static int nvme_init_controller(struct pci_dev *pcidev,
+	const struct pci_dev_id *id __unused)
+{
+	struct nvme_ctrl *ctrl;
+	uint32_t cap_lo, cap_hi, mdts, nn, nsid;
+	int ret = -ENOMEM;
+
+	ctrl = bzalloc(sizeof(*ctrl));
+	if (!ctrl)
+		return -ENOMEM;
+
+	ctrl->pcidev = pcidev;
+	ctrl->regs = pci_map_bar(pcidev, 0);
+	if (!ctrl->regs) {
+		ret = -ENODEV;
+		goto nvme_free_ctrl;
+	}
+
+	ctrl->identify = get_zeroed_page();
+	if (!ctrl->identify)
+		goto nvme_free_ctrl;
+
+	pci_set_master(pcidev);
+
+	cap_lo = nvme_readl(ctrl, NVME_REG_CAP);
+	cap_hi = nvme_readl(ctrl, NVME_REG_CAP + 4);
+
+	/* We only use the NVM command set with 4 KiB pages */
+	if (!NVME_CAP_CSS_NVM(cap_hi) || NVME_CAP_MPSMIN(cap_hi)) {
+		ret = -ENODEV;
+		goto nvme_free_identify;
+	}
+
+	ctrl->dstrd = NVME_CAP_DSTRD(cap_hi);
+	ctrl->timeout = (NVME_CAP_TO(cap_lo) + 1) * 500;
+
+	ret = nvme_enable(ctrl, NVME_CAP_MQES(cap_lo));
+	if (ret)
+		goto nvme_disable_ctrl;
+
+	ret = nvme_identify(ctrl, NVME_IDENTIFY_CTRL, 0);
+	if (ret)
+		goto nvme_disable_ctrl;
+
+	/* The maximum data transfer size is a power of two of the page size */
+	mdts = ctrl->identify[NVME_ID_CTRL_MDTS];
+	nn = get_le32(ctrl->identify + NVME_ID_CTRL_NN);
+
+	ctrl->max_pages = NVME_MAX_PAGES;
+	if (mdts && mdts < 31 && (1UL << mdts) < ctrl->max_pages)
+		ctrl->max_pages = 1UL << mdts;
+
+	ret = nvme_init_io_queues(ctrl, NVME_CAP_MQES(cap_lo));
+	if (ret)
+		goto nvme_disable_ctrl;
+
+	ctrl->index = nvme_num_ctrls++;
+	list_add_tail(&ctrl->list, &nvme_ctrls);
+	pcidev->private = ctrl;
+
+	for (nsid = 1; nsid <= min(nn, (uint32_t)NVME_MAX_NAMESPACES); nsid++)
+		nvme_init_ns(ctrl, nsid);
+
+	return 0;
+
+nvme_disable_ctrl:
+	/* The controller must not access any of our queues anymore */
+	nvme_disable(ctrl);
+
+	while (ctrl->nr_io)
+		nvme_free_queue(&ctrl->io[--ctrl->nr_io]);
+
+	nvme_free_queue(&ctrl->admin);
+
+nvme_free_identify:
+	free_page(tuint(ctrl->identify));
+
+nvme_free_ctrl:
+	bfree(ctrl);
+
+	return ret;
+}
+
+static const struct pci_dev_id nvme_ids[] = {
+	{ PCI_ID_CLASS(PCI_CLASS_NVME) },
+	{ 0 }
+};
+
+static struct pci_driver nvme_driver = {
+	.name  = DRIVER_NVME,
+	.ids   = nvme_ids,
+	.probe = nvme_init_controller
+};
+
+static int nvme_init(void)
+{
+	bprintln(DRIVER_NVME ": Initialize module...");
+
+	return pci_register_driver(&nvme_driver);
+}
+
+static void nvme_exit(void)
+{
+	/*
+	 * Not supported.
+	 */
+
+	bprintln(DRIVER_NVME ": Exit module...");
+}
+
+module_init(nvme_init);
+module_exit(nvme_exit);
@@ -0,0 +1,389 @@
+#include <elfboot/core.h>
+#include <elfboot/linkage.h>
+#include <elfboot/mm.h>
+#include <elfboot/module.h>
+#include <elfboot/bdev.h>
+#include <elfboot/bitops.h>
+#include <elfboot/pci.h>
+#include <elfboot/time.h>
+#include <elfboot/virtio.h>
+#include <elfboot/string.h>
+#include <elfboot/printf.h>
+
+#include <drivers/virtio_blk.h>
+
+static int virtio_blk_num_devs = 0;
+
+/*
+ * Virtio block device requests
+ */
+
+static uint32_t virtio_blk_setup(struct virtio_blk_dev *blkdev,
+	struct virtio_blk_req *req, uint64_t sector, void *buffer,
+	uint32_t length)
+{
+	struct virtq_desc *desc = req->table;
+	uint32_t seg, num = 0;
+
+	req->hdr.type = VIRTIO_BLK_T_IN;
+	req->hdr.ioprio = 0;
+	req->hdr.sector = sector;
+	req->status = 0xff;
+
+	desc->addr = tuint(&req->hdr);
+	desc->len = sizeof(req->hdr);
+	desc->flags = 0;
+	desc++;
+
+	while (length && num < blkdev->max_segs) {
+		seg = min(length, blkdev->seg_size);
+
+		desc->addr = tuint(buffer);
+		desc->len = seg;
+		desc->flags = VIRTQ_DESC_F_WRITE;
+		desc++;
+
+		buffer  = vptradd(buffer, seg);
+		length -= seg;
+		num++;
+	}
+
+	desc->addr = tuint(&req->status);
+	desc->len = sizeof(req->status);
+	desc->flags = VIRTQ_DESC_F_WRITE;
+
+	return num + 2;
+}
+
+static struct virtio_blk_req *virtio_blk_wait(struct virtio_blk_dev *blkdev)
+{
+	uint64_t deadline = timestamp_deadline(VIRTIO_BLK_TIMEOUT);
+	struct virtio_blk_req *req;
+
+	while (!(req = virtqueue_get(&blkdev->vq, NULL))) {
+		if (timestamp_expired(deadline))
+			return NULL;
+	}
+
+	blkdev->free |= 1UL << (req - blkdev->reqs);
+
+	return req;
+}
+
+static void virtio_blk_fail(struct virtio_blk_dev *blkdev)
+{
+	bprintln(DRIVER_VIRTIO_BLK ": vd%d: Request timed out, disabling device",
+		blkdev->index);
+
+	/*
+	 * Resetting the device makes sure it doesn't write to any of the
+	 * buffers of the outstanding requests later on.
+	 */
+	virtio_reset(&blkdev->vdev);
+	blkdev->free = 0;
+}
+
+/*
+ * Virtio block device operations
+ */
+
+static int virtio_blk_read(struct bdev *bdev, uint64_t lba, uint64_t num,
+	void *buffer)
+{
+	struct virtio_blk_dev *blkdev = bdev->private;
+	struct virtio_blk_req *req;
+	uint32_t length, max_length, inflight = 0;
+	uint64_t sector, remaining;
+	bool kick = false;
+	int slot, ret = 0;
+
+	if (!blkdev->free)
+		return -EIO;
+
+	sector = lba << (bdev->block_logs - VIRTIO_BLK_SECTOR_SHIFT);
+	remaining = num << bdev->block_logs;
+	max_length = blkdev->seg_size * blkdev->max_segs;
+
+	/*
+	 * Keep as many requests in flight as we have, and reuse every request
+	 * as soon as the device is done with it.
+	 */
+	while (remaining || inflight) {
+		while (remaining && blkdev->free) {
+			slot = ffs(blkdev->free);
+			req = &blkdev->reqs[slot];
+
+			length = min(remaining, (uint64_t)max_length);
+
+			ret = virtqueue_add(&blkdev->vq, req->table,
+				virtio_blk_setup(blkdev, req, sector, buffer, length), req);
+			if (ret)
+				break;
+
+			blkdev->free &= ~(1UL << slot);
+			inflight++;
+			kick = true;
+
+			sector    += length >> VIRTIO_BLK_SECTOR_SHIFT;
+			buffer     = vptradd(buffer, length);
+			remaining -= length;
+		}
+
+		if (kick) {
+			virtqueue_kick(&blkdev->vq);
+			kick = false;
+		}
+
+		if (!inflight)
+			break;
+
+		req = virtio_blk_wait(blkdev);
+		if (!req) {
+			virtio_blk_fail(blkdev);
+			return -ETIMEDOUT;
+		}
+
+		inflight--;
+
+		/* Drain the outstanding requests, but don't issue new ones */
+		if (req->status != VIRTIO_BLK_S_OK) {
+			ret = -EIO;
+			remaining = 0;
+		}
+	}
+
+	if (remaining)
+		return -EIO;
+
+	return ret;
+}
+
+static int virtio_blk_write(struct bdev *bdev, uint64_t lba, uint64_t num,
+	const void *buffer)
+{
+	/*
+	 * Not supported.
+	 */
+	return -ENOTSUP;
+}
+
+static int virtio_blk_ioctl(struct bdev *bdev, int request, void *args)
+{
+	return 0;
+}
+
+static struct bdev_ops virtio_blk_bdev_ops = {
+	.read  = virtio_blk_read,
+	.write = virtio_blk_write,
+	.ioctl = virtio_blk_ioctl
+};
+
+/*
+ * Module initialization and exit function
+ */
+
+static int virtio_blk_read_config(struct virtio_blk_dev *blkdev,
+	struct bdev *bdev)
+{
+	volatile struct virtio_blk_config *config = blkdev->vdev.device;
+	struct virtio_dev *vdev = &blkdev->vdev;
+	uint32_t block_size = VIRTIO_BLK_SECTOR_SIZE;
+	uint64_t capacity;
+	uint8_t generation;
+
+	/* The 64-bit capacity is only consistent within one generation */
+	do {
+		generation = vdev->common->config_generation;
+		capacity = config->capacity;
+	} while (generation != vdev->common->config_generation);
+
+	if (virtio_has_feature(vdev, VIRTIO_BLK_F_BLK_SIZE))
+		block_size = config->blk_size;
+
+	if (block_size < VIRTIO_BLK_SECTOR_SIZE ||
+	    (block_size & (block_size - 1)))
+		return -EINVAL;
+
+	capacity >>= ffs(block_size) - VIRTIO_BLK_SECTOR_SHIFT;
+	if (!capacity)
+		return -ENODEV;
+
+	bdev->block_size = block_size;
+	bdev->last_block = capacity - 1;
+
+	blkdev->seg_size = VIRTIO_BLK_SEG_SIZE;
+	blkdev->max_segs = 1;
+
+	if (virtio_has_feature(vdev, VIRTIO_BLK_F_SIZE_MAX) &&
+	    config->size_max < blkdev->seg_size)
+		blkdev->seg_size = round_down(config->size_max, block_size);
+
+	if (virtio_has_feature(vdev, VIRTIO_BLK_F_SEG_MAX) && config->seg_max)
+		blkdev->max_segs = min(config->seg_max, VIRTIO_BLK_MAX_SEGS);
+
+	if (!blkdev->seg_size)
+		return -EINVAL;
+
+	return 0;
+}
+
+static int virtio_blk_alloc_reqs(struct virtio_blk_dev *blkdev)
+{
+	uint32_t nreqs;
+
+	/*
+	 * With indirect descriptors, a request takes a single slot of the ring.
+	 * Otherwise, each of its descriptors needs one.
+	 */
+	nreqs = blkdev->vq.size;
+	if (!blkdev->vq.indirect) {
+		if (nreqs < 3)
+			return -ENOSPC;
+
+		blkdev->max_segs = min(blkdev->max_segs, nreqs - 2UL);
+		nreqs /= blkdev->max_segs + 2;
+	}
+
+	nreqs = clamp(nreqs, 1UL, (uint32_t)VIRTIO_BLK_MAX_REQS);
+
+	blkdev->reqs = bzalloc(nreqs * sizeof(*blkdev->reqs));
+	if (!blkdev->reqs)
+		return -ENOMEM;
+
+	blkdev->nreqs = nreqs;
+	blkdev->free = (nreqs == 32) ? ~0UL : (1UL << nreqs) - 1;
+
+	return 0;
+}
+
+static int virtio_blk_dev_name(struct virtio_blk_dev *blkdev,
+	struct bdev *bdev)
+{
+	char vd[] = "vdXXXX";
+
+	sprintf(vd, "vd%d", blkdev->index);
+
+	bdev->name = bstrdup(vd);
+	if (!bdev->name)
+		return -ENOMEM;
+
+	return 0;
+}
+
+static int virtio_blk_probe(struct pci_dev *pcidev,
+	const struct pci_dev_id *id __unused)
+{
+	struct virtio_blk_dev *blkdev;
+	struct bdev *bdev;
+	int ret = -ENOMEM;
+
+	blkdev = bzalloc(sizeof(*blkdev));
+	if (!blkdev)
+		return -ENOMEM;
+
+	bdev = bzalloc(sizeof(*bdev));
+	if (!bdev)
+		goto virtio_blk_free_dev;
+
+	ret = virtio_init(&blkdev->vdev, pcidev);
+	if (ret)
+		goto virtio_blk_free_bdev;
+
+	ret = virtio_negotiate(&blkdev->vdev, VIRTIO_BLK_FEATURES);
+	if (ret)
+		goto virtio_blk_reset;
+
+	ret = virtio_blk_read_config(blkdev, bdev);
+	if (ret)
+		goto virtio_blk_reset;
+
+	ret = virtqueue_init(&blkdev->vdev, &blkdev->vq, 0);
+	if (ret)
+		goto virtio_blk_reset;
+
+	ret = virtio_blk_alloc_reqs(blkdev);
+	if (ret)
+		goto virtio_blk_free_queue;
+
+	blkdev->index = virtio_blk_num_devs;
+
+	ret = virtio_blk_dev_name(blkdev, bdev);
+	if (ret)
+		goto virtio_blk_free_reqs;
+
+	bdev->flags |= BDEV_FLAGS_LBA;
+	bdev->private = blkdev;
+	bdev_set_location(bdev, &blkdev->vdev.pcidev->addr, BDEV_PORT_NONE);
+
+	virtio_driver_ok(&blkdev->vdev);
+
+#ifdef CONFIG_DRIVER_VIRTIO_BLK_DEBUG
+	bprintln(DRIVER_VIRTIO_BLK ": %s: sectors = %llu, block size = %u, "
+		"requests = %lu, indirect = %u", bdev->name, bdev->last_block + 1,
+		bdev->block_size, blkdev->nreqs, blkdev->vq.indirect);
+#endif
+
+	ret = bdev_init(bdev, &virtio_blk_bdev_ops);
+	if (ret)
+		goto virtio_blk_free_name;
+
+	virtio_blk_num_devs++;
+	pcidev->private = blkdev;
+
+	return 0;
+
+virtio_blk_free_name:
+	bfree_const(bdev->name);
+
+virtio_blk_free_reqs:
+	bfree(blkdev->reqs);
+
+virtio_blk_free_queue:
+	virtio_reset(&blkdev->vdev);
+	virtqueue_free(&blkdev->vq);
+	goto virtio_blk_free_bdev;
+
+virtio_blk_reset:
+	virtio_reset(&blkdev->vdev);
+
+virtio_blk_free_bdev:
+	bfree(bdev);
+
+virtio_blk_free_dev:
+	bfree(blkdev);
+
+	return ret;
+}
+
+static const struct pci_dev_id virtio_blk_ids[] = {
+	{ PCI_ID_DEVICE(VIRTIO_PCI_VENDOR,
+		VIRTIO_PCI_LEGACY_ID(VIRTIO_ID_BLOCK)) },
+	{ PCI_ID_DEVICE(VIRTIO_PCI_VENDOR,
+		VIRTIO_PCI_MODERN_ID(VIRTIO_ID_BLOCK)) },
+	{ 0 }
+};
+
+static struct pci_driver virtio_blk_driver = {
+	.name  = DRIVER_VIRTIO_BLK,
+	.ids   = virtio_blk_ids,
+	.probe = virtio_blk_probe
+};
+
+static int virtio_blk_init(void)
+{
+	bprintln(DRIVER_VIRTIO_BLK ": Initialize module...");
+
+	return pci_register_driver(&virtio_blk_driver);
+}
+
+static void virtio_blk_exit(void)
+{
+	/*
+	 * Not supported.
+	 */
+
+	bprintln(DRIVER_VIRTIO_BLK ": Exit module...");
+}
+
+module_init(virtio_blk_init);
+module_exit(virtio_blk_exit);
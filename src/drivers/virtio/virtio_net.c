@@ -0,0 +1,267 @@
+#include <elfboot/core.h>
+#include <elfboot/linkage.h>
+#include <elfboot/mm.h>
+#include <elfboot/module.h>
+#include <elfboot/bitops.h>
+#include <elfboot/net.h>
+#include <elfboot/pci.h>
+#include <elfboot/time.h>
+#include <elfboot/virtio.h>
+#include <elfboot/string.h>
+#include <elfboot/printf.h>
+
+#include <drivers/virtio_net.h>
+
+static int virtio_net_num_devs = 0;
+
+static inline void *virtio_net_buf(void *bufs, uint32_t index)
+{
+	return vptradd(bufs, index << VIRTIO_NET_BUF_SHIFT);
+}
+
+/*
+ * Receive and transmit buffers
+ */
+
+static int virtio_net_add_rx(struct virtio_net_dev *netdev, void *buf)
+{
+	struct virtq_desc desc = {
+		.addr  = tuint(buf),
+		.len   = VIRTIO_NET_BUF_SIZE,
+		.flags = VIRTQ_DESC_F_WRITE
+	};
+
+	return virtqueue_add(&netdev->rxq, &desc, 1, buf);
+}
+
+static void virtio_net_reclaim_tx(struct virtio_net_dev *netdev)
+{
+	void *buf;
+
+	while ((buf = virtqueue_get(&netdev->txq, NULL)) != NULL) {
+		netdev->tx_free |= 1UL << ((tuint(buf) - tuint(netdev->tx_bufs)) >>
+			VIRTIO_NET_BUF_SHIFT);
+	}
+}
+
+/*
+ * Network device operations
+ */
+
+static int virtio_net_xmit(struct netdev *ndev, const void *frame,
+	uint32_t length)
+{
+	struct virtio_net_dev *netdev = ndev->private;
+	struct virtio_net_hdr *hdr;
+	struct virtq_desc desc;
+	uint64_t deadline;
+	int slot, ret;
+
+	if (length > VIRTIO_NET_BUF_SIZE - sizeof(*hdr))
+		return -EMSGSIZE;
+
+	deadline = timestamp_deadline(VIRTIO_NET_TIMEOUT);
+
+	virtio_net_reclaim_tx(netdev);
+	while (!netdev->tx_free) {
+		if (timestamp_expired(deadline))
+			return -ETIMEDOUT;
+
+		virtio_net_reclaim_tx(netdev);
+	}
+
+	slot = ffs(netdev->tx_free);
+	hdr = virtio_net_buf(netdev->tx_bufs, slot);
+
+	/* The header and the frame share a single descriptor */
+	memset(hdr, 0, sizeof(*hdr));
+	memcpy(hdr + 1, frame, length);
+
+	desc.addr = tuint(hdr);
+	desc.len = sizeof(*hdr) + length;
+	desc.flags = 0;
+
+	ret = virtqueue_add(&netdev->txq, &desc, 1, hdr);
+	if (ret)
+		return ret;
+
+	netdev->tx_free &= ~(1UL << slot);
+	virtqueue_kick(&netdev->txq);
+
+	return 0;
+}
+
+static void virtio_net_poll(struct netdev *ndev)
+{
+	struct virtio_net_dev *netdev = ndev->private;
+	uint32_t length;
+	bool kick = false;
+	void *buf;
+
+	while ((buf = virtqueue_get(&netdev->rxq, &length)) != NULL) {
+		if (length > sizeof(struct virtio_net_hdr))
+			net_receive(ndev, vptradd(buf, sizeof(struct virtio_net_hdr)),
+				length - sizeof(struct virtio_net_hdr));
+
+		/* The buffer goes right back to the device */
+		virtio_net_add_rx(netdev, buf);
+		kick = true;
+	}
+
+	if (kick)
+		virtqueue_kick(&netdev->rxq);
+}
+
+static struct netdev_ops virtio_net_netdev_ops = {
+	.xmit = virtio_net_xmit,
+	.poll = virtio_net_poll
+};
+
+/*
+ * Module initialization and exit function
+ */
+
+static int virtio_net_alloc_bufs(struct virtio_net_dev *netdev)
+{
+	struct page *rx, *tx;
+	uint32_t i;
+
+	rx = alloc_pages(VIRTIO_NET_RX_ORDER);
+	if (!rx)
+		return -ENOMEM;
+
+	tx = alloc_pages(VIRTIO_NET_TX_ORDER);
+	if (!tx)
+		goto virtio_net_free_rx;
+
+	netdev->rx_bufs = page_address(rx);
+	netdev->nr_rx = min((PAGE_SIZE << VIRTIO_NET_RX_ORDER) >>
+		VIRTIO_NET_BUF_SHIFT, (uint32_t)netdev->rxq.size);
+
+	netdev->tx_bufs = page_address(tx);
+	netdev->nr_tx = min((PAGE_SIZE << VIRTIO_NET_TX_ORDER) >>
+		VIRTIO_NET_BUF_SHIFT, (uint32_t)netdev->txq.size);
+	netdev->tx_free = (1UL << netdev->nr_tx) - 1;
+
+	for (i = 0; i < netdev->nr_rx; i++)
+		virtio_net_add_rx(netdev, virtio_net_buf(netdev->rx_bufs, i));
+
+	return 0;
+
+virtio_net_free_rx:
+	free_page(page_to_phys(rx));
+
+	return -ENOMEM;
+}
+
+static int virtio_net_probe(struct pci_dev *pcidev,
+	const struct pci_dev_id *id __unused)
+{
+	volatile struct virtio_net_config *config;
+	struct virtio_net_dev *netdev;
+	uint32_t i;
+	int ret;
+
+	netdev = bzalloc(sizeof(*netdev));
+	if (!netdev)
+		return -ENOMEM;
+
+	ret = virtio_init(&netdev->vdev, pcidev);
+	if (ret)
+		goto virtio_net_free_dev;
+
+	ret = virtio_negotiate(&netdev->vdev, VIRTIO_NET_FEATURES);
+	if (ret)
+		goto virtio_net_reset;
+
+	/* We don't make up addresses */
+	ret = -ENOTSUP;
+	if (!virtio_has_feature(&netdev->vdev, VIRTIO_NET_F_MAC))
+		goto virtio_net_reset;
+
+	config = netdev->vdev.device;
+	for (i = 0; i < ETH_ALEN; i++)
+		netdev->netdev.mac[i] = config->mac[i];
+
+	ret = virtqueue_init(&netdev->vdev, &netdev->rxq, VIRTIO_NET_RX_QUEUE);
+	if (ret)
+		goto virtio_net_reset;
+
+	ret = virtqueue_init(&netdev->vdev, &netdev->txq, VIRTIO_NET_TX_QUEUE);
+	if (ret)
+		goto virtio_net_free_rxq;
+
+	ret = virtio_net_alloc_bufs(netdev);
+	if (ret)
+		goto virtio_net_free_txq;
+
+	virtio_driver_ok(&netdev->vdev);
+	virtqueue_kick(&netdev->rxq);
+
+	netdev->index = virtio_net_num_devs;
+	netdev->netdev.private = netdev;
+
+	ret = netdev_register(&netdev->netdev, &virtio_net_netdev_ops);
+	if (ret)
+		goto virtio_net_free_bufs;
+
+	virtio_net_num_devs++;
+	pcidev->private = netdev;
+
+	return 0;
+
+virtio_net_free_bufs:
+	virtio_reset(&netdev->vdev);
+	free_page(tuint(netdev->rx_bufs));
+	free_page(tuint(netdev->tx_bufs));
+
+virtio_net_free_txq:
+	virtio_reset(&netdev->vdev);
+	virtqueue_free(&netdev->txq);
+
+virtio_net_free_rxq:
+	virtio_reset(&netdev->vdev);
+	virtqueue_free(&netdev->rxq);
+	goto virtio_net_free_dev;
+
+virtio_net_reset:
+	virtio_reset(&netdev->vdev);
+
+virtio_net_free_dev:
+	bfree(netdev);
+
+	return ret;
+}
+
+static const struct pci_dev_id virtio_net_ids[] = {
+	{ PCI_ID_DEVICE(VIRTIO_PCI_VENDOR,
+		VIRTIO_PCI_LEGACY_ID(VIRTIO_ID_NET)) },
+	{ PCI_ID_DEVICE(VIRTIO_PCI_VENDOR,
+		VIRTIO_PCI_MODERN_ID(VIRTIO_ID_NET)) },
+	{ 0 }
+};
+
+static struct pci_driver virtio_net_driver = {
+	.name  = DRIVER_VIRTIO_NET,
+	.ids   = virtio_net_ids,
+	.probe = virtio_net_probe
+};
+
+static int virtio_net_init(void)
+{
+	bprintln(DRIVER_VIRTIO_NET ": Initialize module...");
+
+	return pci_register_driver(&virtio_net_driver);
+}
+
+static void virtio_net_exit(void)
+{
+	/*
+	 * Not supported.
+	 */
+
+	bprintln(DRIVER_VIRTIO_NET ": Exit module...");
+}
+
+module_init(virtio_net_init);
+module_exit(virtio_net_exit);
@@ -335,13 +335,95 @@ ext2fs_finddir_free_dent:
 	return NULL;
 }
 
+static int ext2fs_bmap(struct fs_node *node, uint32_t blkidx, uint64_t *sector,
+	uint32_t *count)
+{
+	struct superblock *sb = node->sb;
+	struct ext2_inode *inode = node->private;
+	uint32_t direct[EXT2_DLP_NUM], *table, *buffer = NULL;
+	uint32_t blkibn, entries, depth, span, iblock, i;
+	int ret = -ENOENT;
+
+	if (blkidx < EXT2_DLP_NUM) {
+		memcpy(direct, inode->dbp, sizeof(direct));
+		table = direct;
+		entries = EXT2_DLP_NUM;
+		goto ext2fs_bmap_run;
+	}
+
+	/* Find the level of indirection for this block */
+	blkibn = sb->block_size / EXT2_MLP_LEN;
+	blkidx -= EXT2_DLP_NUM;
+
+	for (depth = 0, span = blkibn; blkidx >= span; depth++) {
+		if (depth == 2)
+			return -EINVAL;
+
+		blkidx -= span;
+		span *= blkibn;
+	}
+
+	buffer = bmalloc(sb->block_size);
+	if (!buffer)
+		return -ENOMEM;
+
+	if (depth == 0)
+		iblock = inode->singly_block;
+	else if (depth == 1)
+		iblock = inode->doubly_block;
+	else
+		iblock = inode->triply_block;
+
+	for (;;) {
+		if (!iblock)
+			goto ext2fs_bmap_free_buffer;
+
+		if (superblock_read_block(sb, iblock, buffer)) {
+			ret = -EIO;
+			goto ext2fs_bmap_free_buffer;
+		}
+
+		span /= blkibn;
+		if (span == 1)
+			break;
+
+		iblock = buffer[blkidx / span];
+		blkidx %= span;
+	}
+
+	table = buffer;
+	entries = blkibn;
+
+ext2fs_bmap_run:
+	/* Holes are not mapped */
+	if (!table[blkidx])
+		goto ext2fs_bmap_free_buffer;
+
+	/* Runs end with the block pointer table, at the latest */
+	for (i = 1; blkidx + i < entries; i++) {
+		if (table[blkidx + i] != table[blkidx] + i)
+			break;
+	}
+
+	*sector = ((uint64_t)table[blkidx] << sb->block_logs) >> sb_bdlogs(sb);
+	*count = i;
+	ret = 0;
+
+ext2fs_bmap_free_buffer:
+	if (buffer)
+		bfree(buffer);
+
+	return ret;
+}
+
 static struct fs_node_ops ext2fs_node_ops = {
 	.open = ext2fs_open,
 	.close = ext2fs_close,
 	.read = ext2fs_read,
 	.write = ext2fs_write,
 	.readdir = ext2fs_readdir,
-	.finddir = ext2fs_finddir
+	.finddir = ext2fs_finddir,
+	.bmap = ext2fs_bmap
 };
 
 static int ext2fs_init(void)
@@ -0,0 +1,652 @@
+#include <elfboot/core.h>
+#include <elfboot/linkage.h>
+#include <elfboot/mm.h>
+#include <elfboot/fs.h>
+#include <elfboot/super.h>
+#include <elfboot/module.h>
+#include <elfboot/math.h>
+#include <elfboot/net.h>
+#include <elfboot/time.h>
+#include <elfboot/string.h>
+#include <elfboot/printf.h>
+
+#include <fs/httpfs.h>
+
+#include <uapi/elfboot/common.h>
+
+static struct fs_node_ops httpfs_node_ops;
+
+/*
+ * Response parsing
+ */
+
+static char *http_match(char *str, const char *prefix)
+{
+	/* The prefix is lower case, header names and tokens are not */
+	for (; *prefix; str++, prefix++) {
+		if ((*str | 0x20) != *prefix)
+			return NULL;
+	}
+
+	return str;
+}
+
+static char *http_header(char *line, const char *name)
+{
+	line = http_match(line, name);
+	if (!line || *line++ != ':')
+		return NULL;
+
+	while (*line == ' ' || *line == '\t')
+		line++;
+
+	return line;
+}
+
+static int http_parse_header(struct http_host *host)
+{
+	char *line, *value, *store;
+	uint64_t start = 0;
+	bool range = false;
+
+	host->length = HTTP_LENGTH_UNKNOWN;
+
+	line = strtok_r(host->header, "\r\n", &store);
+	if (!line || strncmp(line, "HTTP/1.", 7) || strlen(line) < 12)
+		return -EIO;
+
+	/* HTTP/1.0 servers close the connection after every response */
+	host->keep_alive = line[7] != '0';
+	host->status = strtoul(line + 9, NULL, 10);
+
+	while ((line = strtok_r(NULL, "\r\n", &store)) != NULL) {
+		if ((value = http_header(line, "content-length")) != NULL) {
+			host->length = strtoul(value, NULL, 10);
+		} else if ((value = http_header(line, "content-range")) != NULL) {
+			value = http_match(value, "bytes ");
+			if (!value)
+				return -EIO;
+
+			start = strtoul(value, NULL, 10);
+			range = true;
+		} else if ((value = http_header(line, "connection")) != NULL) {
+			if (http_match(value, "close"))
+				host->keep_alive = false;
+		} else if ((value = http_header(line, "transfer-encoding")) != NULL) {
+			if (!http_match(value, "identity"))
+				return -ENOTSUP;
+		}
+	}
+
+	/* The caller looks at the status of HEAD requests */
+	if (host->head) {
+		host->state = HTTP_STATE_DONE;
+		return 0;
+	}
+
+	switch (host->status) {
+	case 200:
+		/* The server ignored the range, we get the whole file */
+		host->body_pos = 0;
+		host->body_end = host->length;
+		break;
+	case 206:
+		if (!range || start != host->req_off ||
+		    host->length == HTTP_LENGTH_UNKNOWN)
+			return -EIO;
+
+		host->body_pos = start;
+		host->body_end = start + host->length;
+		break;
+	default:
+		return host->status == 404 ? -ENOENT : -EIO;
+	}
+
+	host->state = host->body_pos == host->body_end ?
+		HTTP_STATE_DONE : HTTP_STATE_BODY;
+
+	return 0;
+}
+
+static uint32_t http_recv_header(struct http_host *host, uint8_t *data,
+	uint32_t length)
+{
+	uint32_t start, end, i;
+
+	length = min(length, HTTP_MAX_HEADER - host->hlen);
+	memcpy(host->header + host->hlen, data, length);
+
+	/* The terminator may be split over two segments */
+	start = host->hlen > 3 ? host->hlen - 3 : 0;
+	end = host->hlen + length;
+
+	for (i = start; i + 4 <= end; i++) {
+		if (memcmp(host->header + i, "\r\n\r\n", 4))
+			continue;
+
+		host->header[i] = '\0';
+		host->error = http_parse_header(host);
+
+		length = i + 4 - host->hlen;
+		host->hlen = i;
+
+		return length;
+	}
+
+	host->hlen = end;
+	if (host->hlen == HTTP_MAX_HEADER)
+		host->error = -EMSGSIZE;
+
+	return length;
+}
+
+static uint32_t http_recv_body(struct http_host *host, uint8_t *data,
+	uint32_t length)
+{
+	uint64_t start, end;
+
+	if (host->body_end - host->body_pos < length)
+		length = host->body_end - host->body_pos;
+
+	start = max(host->body_pos, host->req_off);
+	end = min(host->body_pos + length, host->req_end);
+
+	if (start < end)
+		memcpy(host->dst + (start - host->req_off),
+			data + (start - host->body_pos), end - start);
+
+	host->body_pos += length;
+
+	/*
+	 * A full response goes on after the end of the read, we rather close
+	 * the connection than receive the rest of the file.
+	 */
+	if (host->body_pos == host->body_end) {
+		host->state = HTTP_STATE_DONE;
+	} else if (host->body_pos >= host->req_end) {
+		host->state = HTTP_STATE_DONE;
+		host->keep_alive = false;
+	}
+
+	return length;
+}
+
+static void http_recv(struct tcp_socket *sock, void *data, uint32_t length)
+{
+	struct http_host *host = sock->private;
+	uint32_t done;
+
+	while (length && !host->error) {
+		switch (host->state) {
+		case HTTP_STATE_HEADER:
+			done = http_recv_header(host, data, length);
+			break;
+		case HTTP_STATE_BODY:
+			done = http_recv_body(host, data, length);
+			break;
+		default:
+			/* Nobody asked for it */
+			return;
+		}
+
+		data = vptradd(data, done);
+		length -= done;
+	}
+}
+
+/*
+ * Requests
+ */
+
+static void http_disconnect(struct http_host *host)
+{
+	if (!host->connected)
+		return;
+
+	tcp_close(&host->sock);
+	host->connected = false;
+}
+
+static int http_connect(struct http_host *host)
+{
+	int ret;
+
+	if (host->connected && host->sock.state == TCP_ESTABLISHED)
+		return 0;
+
+	/* The server closed the connection we kept */
+	http_disconnect(host);
+
+	host->sock.recv = http_recv;
+	host->sock.private = host;
+
+	ret = tcp_connect(&host->sock, host->netdev, host->addr,
+		htons(host->port));
+	if (ret)
+		return ret;
+
+	host->connected = true;
+
+	return 0;
+}
+
+static int http_wait(struct http_host *host)
+{
+	uint64_t deadline = timestamp_deadline(HTTP_TIMEOUT);
+	uint64_t progress = 0;
+
+	while (host->state != HTTP_STATE_DONE) {
+		tcp_poll(&host->sock);
+
+		if (host->error)
+			return host->error;
+
+		if (host->sock.error)
+			return host->sock.error;
+
+		if (host->state == HTTP_STATE_DONE)
+			break;
+
+		/* Bodies without a length end with the connection */
+		if (host->sock.state == TCP_CLOSE_WAIT) {
+			if (host->state != HTTP_STATE_BODY ||
+			    host->body_end != HTTP_LENGTH_UNKNOWN)
+				return -ECONNRESET;
+
+			host->state = HTTP_STATE_DONE;
+			host->keep_alive = false;
+			break;
+		}
+
+		if (host->hlen + host->body_pos != progress) {
+			progress = host->hlen + host->body_pos;
+			deadline = timestamp_deadline(HTTP_TIMEOUT);
+		} else if (timestamp_expired(deadline)) {
+			return -ETIMEDOUT;
+		}
+	}
+
+	return 0;
+}
+
+static int http_request(struct http_host *host, const char *method,
+	const char *path, uint64_t start, uint64_t end)
+{
+	char request[HTTP_MAX_REQUEST];
+	uint32_t length, retry;
+	int ret;
+
+	length = sprintf(request, "%s %s HTTP/1.1\r\nHost: %s\r\n", method,
+		path, host->name);
+
+	if (end > start)
+		length += sprintf(request + length, "Range: bytes=%llu-%llu\r\n",
+			start, end - 1);
+
+	length += sprintf(request + length, "\r\n");
+
+	/*
+	 * The server may have closed the connection since the last request,
+	 * which we only notice when sending. We try once more with a new one.
+	 */
+	for (retry = 0; retry < 2; retry++) {
+		ret = http_connect(host);
+		if (ret)
+			return ret;
+
+		host->state = HTTP_STATE_HEADER;
+		host->error = 0;
+		host->head = !strcmp(method, "HEAD");
+		host->keep_alive = true;
+		host->hlen = 0;
+		host->body_pos = 0;
+
+		ret = tcp_send(&host->sock, request, length);
+		if (!ret)
+			break;
+
+		http_disconnect(host);
+	}
+
+	if (!ret)
+		ret = http_wait(host);
+
+	if (ret || !host->keep_alive)
+		http_disconnect(host);
+
+	host->state = HTTP_STATE_IDLE;
+
+	return ret;
+}
+
+/*
+ * Superblock operations to be registered
+ */
+
+static struct fs_node *httpfs_alloc_node(struct superblock *sb,
+	const char *name)
+{
+	struct fs_node *node = fs_node_alloc(name);
+
+	if (!node)
+		return NULL;
+
+	/*
+	 * Assign fs_node_ops to newly allocated node
+	 */
+	node->ops = &httpfs_node_ops;
+	node->sb = sb;
+
+	return node;
+}
+
+static struct fs_node *httpfs_fill_super(struct superblock *sb,
+	const char *name)
+{
+	struct fs_node *node;
+
+	/* Files come from the network and not from a block device */
+	if (sb->bdev || !netdev_get())
+		return NULL;
+
+	node = httpfs_alloc_node(sb, name);
+	if (!node)
+		return NULL;
+
+	/* The root holds the servers, it doesn't have a file */
+	node->flags |= FS_DIRECTORY;
+	node->private = NULL;
+
+	/* Superblock */
+	sb->root  = node;
+	sb->mount = node;
+
+	return node;
+}
+
+static struct fs_type fs_httpfs = {
+	.name = "http",
+	.fill_super = httpfs_fill_super
+};
+
+/*
+ * Functions for HTTP filesystem nodes
+ */
+
+static void httpfs_open(struct fs_node *node)
+{
+
+}
+
+static void httpfs_close(struct fs_node *node)
+{
+
+}
+
+static uint32_t httpfs_read(struct fs_node *node, uint64_t offset,
+	uint32_t length, void *buffer)
+{
+	struct http_file *file = node->private;
+	struct http_host *host = file->host;
+#ifdef CONFIG_FS_HTTPFS_DEBUG
+	uint32_t rem, msecs;
+	uint64_t start;
+#endif
+	int ret;
+
+	if (offset >= node->length)
+		return 0;
+
+	if (length > node->length - offset)
+		length = node->length - offset;
+
+	/* Every read asks for exactly its range */
+	host->dst = buffer;
+	host->req_off = offset;
+	host->req_end = offset + length;
+
+#ifdef CONFIG_FS_HTTPFS_DEBUG
+	start = timestamp();
+#endif
+	ret = http_request(host, "GET", file->path, offset, offset + length);
+
+	host->dst = NULL;
+	host->req_end = 0;
+
+	if (ret) {
+		bprintln(FS_HTTP ": %s%s: Request failed: %d", host->name,
+			file->path, ret);
+		return 0;
+	}
+
+#ifdef CONFIG_FS_HTTPFS_DEBUG
+	msecs = div(timestamp() - start, arch_timestamp_khz(), &rem);
+
+	bprintln(FS_HTTP ": %s%s: %lu bytes in %lu ms", host->name, file->path,
+		length, msecs);
+#endif
+
+	/* The server may end the body early */
+	if (host->body_pos < offset + length)
+		return host->body_pos > offset ? host->body_pos - offset : 0;
+
+	return length;
+}
+
+static uint32_t httpfs_write(struct fs_node *node, uint64_t offset,
+	uint32_t length, const void *buffer)
+{
+	return 0;
+}
+
+static struct fs_dent *httpfs_readdir(struct fs_node *node, uint32_t index)
+{
+	return NULL;
+}
+
+static struct http_host *httpfs_alloc_host(const char *name)
+{
+	char addr[HTTP_MAX_HOST], *port;
+	struct http_host *host;
+
+	if (strlen(name) >= HTTP_MAX_HOST)
+		return NULL;
+
+	strcpy(addr, name);
+
+	host = bzalloc(sizeof(*host));
+	if (!host)
+		return NULL;
+
+	host->port = HTTP_PORT;
+
+	port = strchr(addr, ':');
+	if (port) {
+		*port++ = '\0';
+		host->port = strtoul(port, NULL, 10);
+	}
+
+	host->header = bmalloc(HTTP_MAX_HEADER);
+	if (!host->header)
+		goto httpfs_free_host;
+
+	host->addr = net_parse_addr(addr);
+	host->netdev = netdev_get();
+	if (!host->addr || !host->port || !host->netdev)
+		goto httpfs_free_header;
+
+	strcpy(host->name, name);
+
+	return host;
+
+httpfs_free_header:
+	bfree(host->header);
+
+httpfs_free_host:
+	bfree(host);
+
+	return NULL;
+}
+
+static struct http_file *httpfs_alloc_file(struct http_host *host,
+	const char *dir, const char *name)
+{
+	struct http_file *file;
+	uint32_t length;
+
+	length = strlen(dir) + strlen(name) + 2;
+	if (length > HTTP_MAX_PATH)
+		return NULL;
+
+	file = bmalloc(sizeof(*file));
+	if (!file)
+		return NULL;
+
+	file->path = bmalloc(length);
+	if (!file->path) {
+		bfree(file);
+		return NULL;
+	}
+
+	/* The server itself has an empty path */
+	if (*name)
+		sprintf(file->path, "%s/%s", dir, name);
+	else
+		*file->path = '\0';
+
+	file->host = host;
+
+	return file;
+}
+
+static void httpfs_free_file(struct http_file *file)
+{
+	bfree(file->path);
+	bfree(file);
+}
+
+static int httpfs_lookup(struct http_host *host, struct http_file *file,
+	bool *dir)
+{
+	int ret;
+
+	ret = http_request(host, "HEAD", file->path, 0, 0);
+	if (ret) {
+		bprintln(FS_HTTP ": %s%s: Request failed: %d", host->name,
+			file->path, ret);
+		return ret;
+	}
+
+	/*
+	 * Paths the server doesn't know or redirects may still be directories,
+	 * HTTP has no way to tell them apart.
+	 */
+	if (host->status >= 300 && host->status < 500) {
+		*dir = true;
+		return 0;
+	}
+
+	if (host->status < 200 || host->status >= 300)
+		return -EIO;
+
+	if (host->length == HTTP_LENGTH_UNKNOWN) {
+		bprintln(FS_HTTP ": %s%s: Server doesn't report the file size",
+			host->name, file->path);
+		return -ENOTSUP;
+	}
+
+	*dir = false;
+
+	return 0;
+}
+
+static struct fs_node *httpfs_finddir(struct fs_node *node, const char *name)
+{
+	struct http_file *parent = node->private, *file;
+	struct http_host *host;
+	struct fs_node *nent;
+	bool dir = true;
+
+	/* Directories of the root are servers */
+	if (!parent) {
+		host = httpfs_alloc_host(name);
+		if (!host)
+			return NULL;
+
+		file = httpfs_alloc_file(host, "", "");
+		if (!file)
+			goto httpfs_finddir_free_host;
+	} else {
+		host = parent->host;
+
+		file = httpfs_alloc_file(host, parent->path, name);
+		if (!file)
+			return NULL;
+
+		if (httpfs_lookup(host, file, &dir))
+			goto httpfs_finddir_free_file;
+	}
+
+	nent = httpfs_alloc_node(node->sb, name);
+	if (!nent)
+		goto httpfs_finddir_free_file;
+
+	nent->private = file;
+
+	if (dir) {
+		nent->flags |= FS_DIRECTORY;
+	} else {
+		nent->flags |= FS_FILE;
+		nent->length = host->length;
+	}
+
+	return nent;
+
+httpfs_finddir_free_file:
+	httpfs_free_file(file);
+
+httpfs_finddir_free_host:
+	if (!parent) {
+		bfree(host->header);
+		bfree(host);
+	}
+
+	return NULL;
+}
+
+static struct fs_node_ops httpfs_node_ops = {
+	.open = httpfs_open,
+	.close = httpfs_close,
+	.read = httpfs_read,
+	.write = httpfs_write,
+	.readdir = httpfs_readdir,
+	.finddir = httpfs_finddir
+};
+
+static int httpfs_init(void)
+{
+	fs_register(&fs_httpfs);
+
+	if (vfs_mount_type(fs_httpfs.name, NULL, "/", HTTP_MOUNTPOINT)) {
+		bprintln(FS_HTTP ": No network device, not mounted");
+		return 0;
+	}
+
+	bprintln(FS_HTTP ": Mounted to /" HTTP_MOUNTPOINT);
+
+	return 0;
+}
+
+static void httpfs_exit(void)
+{
+	/*
+	 * Not supported.
+	 */
+
+	bprintln(FS_HTTP ": Exit module \"http\"...");
+
+	fs_unregister(&fs_httpfs);
+}
+
+vfs_module_init(httpfs_init);
+vfs_module_exit(httpfs_exit);
@@ -223,13 +223,32 @@ isofs_finddir_free_dent:
 	return NULL;
 }
 
+static int isofs_bmap(struct fs_node *node, uint32_t blkidx, uint64_t *sector,
+	uint32_t *count)
+{
+	struct superblock *sb = node->sb;
+	uint32_t blknum;
+
+	blknum = (node->length + sb->block_size - 1) >> sb->block_logs;
+	if (blkidx >= blknum)
+		return -EINVAL;
+
+	/* Files are stored in a single extent */
+	*sector = ((uint64_t)(node->inode + blkidx) << sb->block_logs) >>
+		sb_bdlogs(sb);
+	*count = blknum - blkidx;
+
+	return 0;
+}
+
 static struct fs_node_ops isofs_node_ops = {
 	.open = isofs_open,
 	.close = isofs_close,
 	.read = isofs_read,
 	.write = isofs_write,
 	.readdir = isofs_readdir,
-	.finddir = isofs_finddir
+	.finddir = isofs_finddir,
+	.bmap = isofs_bmap
 };
 
 static int isofs_init(void)
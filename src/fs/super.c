@@ -15,8 +15,9 @@ struct superblock *superblock_alloc(struct fs_type *fs, struct bdev *bdev)
 	if (!sb)
 		return NULL;
 
-	sb->block_logs = bdev->block_logs;
-	sb->block_size = bdev->block_size;
+	/* Memory and network file systems don't have a block device */
+	sb->block_logs = bdev ? bdev->block_logs : 0;
+	sb->block_size = bdev ? bdev->block_size : 0;
 
 	sb->fs = fs;
 	sb->bdev = bdev;
@@ -99,6 +100,19 @@ int superblock_read_offset(struct superblock *sb, uint64_t offset,
 {
 	uint64_t blkidx, blknum, blkoff, *blkbuf;
 	uint32_t blkmod, remlen, bufoff = 0;
+	void *data;
+
+	/*
+	 * Memory-backed devices don't need a bounce buffer, we copy the data
+	 * straight out of the device.
+	 */
+	data = bdev_map(sb->bdev, offset >> sb_bdlogs(sb),
+		sb_length(sb, offset, length));
+	if (data) {
+		blkmod = offset & (sb->bdev->block_size - 1);
+		memcpy(buffer, vptradd(data, blkmod), length);
+		return 0;
+	}
 
 	blkidx = div(offset, sb->block_size, &blkmod);
 	blknum = superblock_blockno(sb, blkmod, length);
@@ -0,0 +1,614 @@
+#include <elfboot/core.h>
+#include <elfboot/linkage.h>
+#include <elfboot/mm.h>
+#include <elfboot/fs.h>
+#include <elfboot/super.h>
+#include <elfboot/module.h>
+#include <elfboot/math.h>
+#include <elfboot/net.h>
+#include <elfboot/time.h>
+#include <elfboot/string.h>
+#include <elfboot/printf.h>
+
+#include <fs/tftpfs.h>
+
+#include <uapi/elfboot/common.h>
+
+static struct fs_node_ops tftpfs_node_ops;
+
+/* Options we ask the server for */
+static uint32_t tftp_blksize;
+static uint32_t tftp_windowsize;
+
+/*
+ * Packets
+ */
+
+static int tftp_send(struct tftp_file *file, const void *packet,
+	uint32_t length)
+{
+	uint16_t port = file->tid ? file->tid : htons(TFTP_PORT);
+
+	return udp_send(&file->sock, file->mnt->server, port, packet, length);
+}
+
+static void tftp_send_ack(struct tftp_file *file)
+{
+	uint16_t packet[2];
+
+	packet[0] = htons(TFTP_ACK);
+	packet[1] = htons(file->block & 0xffff);
+
+	tftp_send(file, packet, sizeof(packet));
+
+	file->need_ack = false;
+	file->inwin = 0;
+}
+
+static void tftp_send_error(struct tftp_file *file, uint16_t code)
+{
+	uint16_t packet[3];
+
+	/* The message is empty, but still null-terminated */
+	packet[0] = htons(TFTP_ERROR);
+	packet[1] = htons(code);
+	packet[2] = 0;
+
+	tftp_send(file, packet, TFTP_HLEN + 1);
+}
+
+static uint32_t tftp_put_string(char *packet, uint32_t pos, const char *str)
+{
+	strcpy(packet + pos, str);
+
+	return pos + strlen(str) + 1;
+}
+
+static uint32_t tftp_put_option(char *packet, uint32_t pos, const char *name,
+	uint32_t value)
+{
+	char number[12];
+
+	sprintf(number, "%lu", value);
+
+	pos = tftp_put_string(packet, pos, name);
+
+	return tftp_put_string(packet, pos, number);
+}
+
+static int tftp_send_request(struct tftp_file *file)
+{
+	char packet[TFTP_MAX_REQUEST];
+	uint32_t length;
+
+	packet[0] = 0;
+	packet[1] = TFTP_RRQ;
+
+	length = tftp_put_string(packet, 2, file->path);
+	length = tftp_put_string(packet, length, "octet");
+	length = tftp_put_option(packet, length, "blksize", tftp_blksize);
+	length = tftp_put_option(packet, length, "tsize", 0);
+	length = tftp_put_option(packet, length, "windowsize", tftp_windowsize);
+
+	return tftp_send(file, packet, length);
+}
+
+static int tftp_parse_oack(struct tftp_file *file, char *option,
+	uint32_t length)
+{
+	char *end = option + length, *value;
+	uint32_t number;
+
+	/* Every option is a pair of null-terminated strings */
+	if (!length || end[-1])
+		return -EINVAL;
+
+	while (option < end) {
+		value = option + strlen(option) + 1;
+		if (value >= end)
+			return -EINVAL;
+
+		number = strtoul(value, NULL, 10);
+
+		/* The server may only lower the values we asked for */
+		if (!strcmp(option, "blksize")) {
+			if (number < 8 || number > tftp_blksize)
+				return -EINVAL;
+
+			file->blksize = number;
+		} else if (!strcmp(option, "windowsize")) {
+			if (!number || number > tftp_windowsize)
+				return -EINVAL;
+
+			file->windowsize = number;
+		} else if (!strcmp(option, "tsize")) {
+			file->tsize = number;
+		}
+
+		option = value + strlen(value) + 1;
+	}
+
+	return 0;
+}
+
+static void tftp_report(struct tftp_file *file)
+{
+	uint32_t msecs, rem;
+
+	msecs = div(timestamp() - file->start, arch_timestamp_khz(), &rem);
+
+	bprintln(FS_TFTP ": %s: %llu bytes in %lu ms, blksize %u, windowsize %u",
+		file->path, file->pos, msecs, file->blksize, file->windowsize);
+}
+
+static void tftp_recv_data(struct tftp_file *file, uint16_t blkno,
+	uint8_t *data, uint32_t length)
+{
+	uint16_t expected = (file->block + 1) & 0xffff;
+	uint64_t start, end;
+
+	if (length > file->blksize)
+		return;
+
+	/*
+	 * Older blocks are duplicates. A newer one means we lost a block, the
+	 * server starts over with the block after the one we acknowledge.
+	 */
+	if (blkno != expected) {
+		if (((uint16_t)(blkno - expected)) < 0x8000 && !file->nak_sent) {
+			tftp_send_ack(file);
+			file->nak_sent = true;
+		}
+
+		return;
+	}
+
+	/* Nobody waits for the block, we ask for it again on the next read */
+	if (file->pos >= file->req_end) {
+		file->need_ack = true;
+		return;
+	}
+
+	start = file->pos > file->req_off ? file->pos : file->req_off;
+	end = file->pos + length;
+	if (end > file->req_end)
+		end = file->req_end;
+
+	if (start < end)
+		memcpy(file->dst + (start - file->req_off),
+			data + (start - file->pos), end - start);
+
+	/* The read ends within this block, keep the rest of it */
+	if (file->pos + length > file->req_end) {
+		memcpy(file->cache, data, length);
+		file->cache_pos = file->pos;
+		file->cache_len = length;
+	}
+
+	file->block++;
+	file->pos += length;
+	file->nak_sent = false;
+
+	if (length < file->blksize) {
+		file->last = true;
+		tftp_send_ack(file);
+		tftp_report(file);
+	} else if (++file->inwin == file->windowsize) {
+		tftp_send_ack(file);
+	} else if (file->pos >= file->req_end) {
+		file->need_ack = true;
+	}
+}
+
+static void tftp_recv(struct udp_socket *sock, uint32_t saddr, uint16_t sport,
+	void *data, uint32_t length)
+{
+	struct tftp_file *file = sock->private;
+	uint8_t *packet = data;
+
+	if (saddr != file->mnt->server || length < TFTP_HLEN)
+		return;
+
+	/* The first reply tells us the port of the server */
+	if (!file->tid)
+		file->tid = sport;
+	else if (sport != file->tid)
+		return;
+
+	switch (get_be16(packet)) {
+	case TFTP_OACK:
+		if (file->oack || file->block)
+			return;
+
+		file->error = tftp_parse_oack(file, data + 2, length - 2);
+		file->oack = true;
+		file->need_ack = true;
+		break;
+	case TFTP_DATA:
+		tftp_recv_data(file, get_be16(packet + 2), packet + TFTP_HLEN,
+			length - TFTP_HLEN);
+		break;
+	case TFTP_ERROR:
+		file->error = get_be16(packet + 2) == TFTP_ERR_NOT_FOUND ?
+			-ENOENT : -EIO;
+		break;
+	}
+}
+
+/*
+ * Transfers
+ */
+
+static void tftp_stop(struct tftp_file *file)
+{
+	if (!file->active)
+		return;
+
+	/* Let the server know we are not interested in the rest */
+	if (file->tid && !file->last && !file->error)
+		tftp_send_error(file, TFTP_ERR_UNDEFINED);
+
+	udp_unbind(&file->sock);
+	file->active = false;
+}
+
+static int tftp_start(struct tftp_file *file)
+{
+	int ret;
+
+	tftp_stop(file);
+
+	if (!file->cache) {
+		file->cache = bmalloc(TFTP_MAX_BLKSIZE);
+		if (!file->cache)
+			return -ENOMEM;
+	}
+
+	file->tid = 0;
+	file->blksize = TFTP_DEFAULT_BLKSIZE;
+	file->windowsize = 1;
+	file->tsize = TFTP_TSIZE_UNKNOWN;
+	file->oack = false;
+	file->block = 0;
+	file->inwin = 0;
+	file->pos = 0;
+	file->last = false;
+	file->need_ack = false;
+	file->nak_sent = false;
+	file->error = 0;
+	file->cache_len = 0;
+
+	file->sock.recv = tftp_recv;
+	file->sock.private = file;
+
+	ret = udp_bind(&file->sock, file->mnt->netdev, 0);
+	if (ret)
+		return ret;
+
+	file->active = true;
+	file->start = timestamp();
+
+	return tftp_send_request(file);
+}
+
+static int tftp_wait(struct tftp_file *file)
+{
+	struct netdev *netdev = file->mnt->netdev;
+	uint32_t block = file->block, retries = 0;
+	uint64_t deadline = timestamp_deadline(TFTP_TIMEOUT);
+
+	/*
+	 * Wait for the reply to our request and for all blocks of the current
+	 * read. Every block resets the timeout.
+	 */
+	while (!file->tid || (!file->last && file->pos < file->req_end)) {
+		if (file->need_ack && file->tid)
+			tftp_send_ack(file);
+
+		net_poll(netdev);
+
+		if (file->error)
+			return file->error;
+
+		if (file->block != block) {
+			block = file->block;
+			retries = 0;
+			deadline = timestamp_deadline(TFTP_TIMEOUT);
+			continue;
+		}
+
+		if (!timestamp_expired(deadline))
+			continue;
+
+		if (++retries > TFTP_RETRIES)
+			return -ETIMEDOUT;
+
+		if (!file->tid)
+			tftp_send_request(file);
+		else
+			tftp_send_ack(file);
+
+		deadline = timestamp_deadline(TFTP_TIMEOUT);
+	}
+
+	return 0;
+}
+
+/*
+ * Superblock operations to be registered
+ */
+
+static struct fs_node *tftpfs_alloc_node(struct superblock *sb,
+	const char *name)
+{
+	struct fs_node *node = fs_node_alloc(name);
+
+	if (!node)
+		return NULL;
+
+	/*
+	 * Assign fs_node_ops to newly allocated node
+	 */
+	node->ops = &tftpfs_node_ops;
+	node->sb = sb;
+
+	return node;
+}
+
+static struct tftp_file *tftpfs_alloc_file(struct tftp_mount *mnt,
+	const char *dir, const char *name)
+{
+	struct tftp_file *file;
+	uint32_t length;
+
+	length = strlen(dir) + strlen(name) + 2;
+	if (length > TFTP_MAX_PATH)
+		return NULL;
+
+	file = bzalloc(sizeof(*file));
+	if (!file)
+		return NULL;
+
+	file->path = bmalloc(length);
+	if (!file->path)
+		goto tftpfs_free_file;
+
+	/* TFTP has no directories, we only build paths the server knows */
+	if (*dir)
+		sprintf(file->path, "%s/%s", dir, name);
+	else
+		strcpy(file->path, name);
+
+	file->mnt = mnt;
+
+	return file;
+
+tftpfs_free_file:
+	bfree(file);
+
+	return NULL;
+}
+
+static struct fs_node *tftpfs_fill_super(struct superblock *sb,
+	const char *name)
+{
+	struct tftp_mount *mnt;
+	struct fs_node *node;
+
+	/* Files come from the network and not from a block device */
+	if (sb->bdev)
+		return NULL;
+
+	mnt = bmalloc(sizeof(*mnt));
+	if (!mnt)
+		return NULL;
+
+	mnt->netdev = netdev_get();
+	mnt->server = net_parse_addr(CONFIG_NET_TFTP_SERVER);
+	if (!mnt->netdev || !mnt->server)
+		goto tftpfs_fill_free_mnt;
+
+	node = tftpfs_alloc_node(sb, name);
+	if (!node)
+		goto tftpfs_fill_free_mnt;
+
+	node->private = tftpfs_alloc_file(mnt, "", "");
+	if (!node->private)
+		goto tftpfs_fill_free_mnt;
+
+	node->flags |= FS_DIRECTORY;
+
+	/* Superblock */
+	sb->root  = node;
+	sb->mount = node;
+	sb->private = mnt;
+
+	return node;
+
+tftpfs_fill_free_mnt:
+	bfree(mnt);
+
+	return NULL;
+}
+
+static struct fs_type fs_tftpfs = {
+	.name = "tftp",
+	.fill_super = tftpfs_fill_super
+};
+
+/*
+ * Functions for TFTP filesystem nodes
+ */
+
+static void tftpfs_open(struct fs_node *node)
+{
+
+}
+
+static void tftpfs_close(struct fs_node *node)
+{
+	tftp_stop(node->private);
+}
+
+static uint32_t tftpfs_read(struct fs_node *node, uint64_t offset,
+	uint32_t length, void *buffer)
+{
+	struct tftp_file *file = node->private;
+	uint64_t avail;
+	uint32_t copied = 0;
+	bool restart;
+	int ret;
+
+	if (offset >= node->length)
+		return 0;
+
+	if (length > node->length - offset)
+		length = node->length - offset;
+
+	if (file->cache_len && offset >= file->cache_pos &&
+	    offset < file->cache_pos + file->cache_len) {
+		avail = file->cache_pos + file->cache_len - offset;
+		copied = avail < length ? avail : length;
+
+		memcpy(buffer, file->cache + (offset - file->cache_pos), copied);
+	}
+
+	if (copied == length)
+		return length;
+
+	/*
+	 * A transfer only goes forward, so we have to start over for anything
+	 * we have already passed. Sequential reads just continue the transfer.
+	 */
+	offset += copied;
+	restart = !file->active || file->error || offset < file->pos;
+
+	file->dst = vptradd(buffer, copied);
+	file->req_off = offset;
+	file->req_end = offset + length - copied;
+
+	ret = restart ? tftp_start(file) : 0;
+	if (!ret)
+		ret = tftp_wait(file);
+
+	/* Blocks arriving from now on must not end up in the buffer */
+	file->dst = NULL;
+	file->req_end = 0;
+
+	if (ret) {
+		bprintln(FS_TFTP ": %s: Transfer failed: %d", file->path, ret);
+		tftp_stop(file);
+		return 0;
+	}
+
+	if (file->pos < offset + length - copied)
+		return file->pos > offset ? file->pos - offset + copied : copied;
+
+	return length;
+}
+
+static uint32_t tftpfs_write(struct fs_node *node, uint64_t offset,
+	uint32_t length, const void *buffer)
+{
+	return 0;
+}
+
+static struct fs_dent *tftpfs_readdir(struct fs_node *node, uint32_t index)
+{
+	return NULL;
+}
+
+static struct fs_node *tftpfs_finddir(struct fs_node *node, const char *name)
+{
+	struct tftp_file *dir = node->private, *file;
+	struct fs_node *nent;
+	int ret;
+
+	file = tftpfs_alloc_file(dir->mnt, dir->path, name);
+	if (!file)
+		return NULL;
+
+	/*
+	 * Ask for the file to get its size and stop the transfer right away.
+	 * Names the server doesn't know may still be directories.
+	 */
+	ret = tftp_start(file);
+	if (!ret)
+		ret = tftp_wait(file);
+
+	tftp_stop(file);
+
+	if (ret && ret != -ENOENT && ret != -EIO)
+		goto tftpfs_finddir_free_file;
+
+	if (!ret && file->tsize == TFTP_TSIZE_UNKNOWN) {
+		bprintln(FS_TFTP ": %s: Server doesn't report the file size",
+			file->path);
+		goto tftpfs_finddir_free_file;
+	}
+
+	nent = tftpfs_alloc_node(node->sb, name);
+	if (!nent)
+		goto tftpfs_finddir_free_file;
+
+	nent->private = file;
+
+	if (ret) {
+		nent->flags |= FS_DIRECTORY;
+	} else {
+		nent->flags |= FS_FILE;
+		nent->length = file->tsize;
+	}
+
+	return nent;
+
+tftpfs_finddir_free_file:
+	if (file->cache)
+		bfree(file->cache);
+
+	bfree(file->path);
+	bfree(file);
+
+	return NULL;
+}
+
+static struct fs_node_ops tftpfs_node_ops = {
+	.open = tftpfs_open,
+	.close = tftpfs_close,
+	.read = tftpfs_read,
+	.write = tftpfs_write,
+	.readdir = tftpfs_readdir,
+	.finddir = tftpfs_finddir
+};
+
+static int tftpfs_init(void)
+{
+	tftp_blksize = min(CONFIG_NET_TFTP_BLKSIZE, TFTP_MAX_BLKSIZE);
+	tftp_windowsize = max(CONFIG_NET_TFTP_WINDOWSIZE, 1);
+
+	fs_register(&fs_tftpfs);
+
+	if (vfs_mount_type(fs_tftpfs.name, NULL, "/", TFTP_MOUNTPOINT)) {
+		bprintln(FS_TFTP ": No network device or server, not mounted");
+		return 0;
+	}
+
+	bprintln(FS_TFTP ": Mounted server %s to /" TFTP_MOUNTPOINT,
+		CONFIG_NET_TFTP_SERVER);
+
+	return 0;
+}
+
+static void tftpfs_exit(void)
+{
+	/*
+	 * Not supported.
+	 */
+
+	bprintln(FS_TFTP ": Exit module \"tftp\"...");
+
+	fs_unregister(&fs_tftpfs);
+}
+
+vfs_module_init(tftpfs_init);
+vfs_module_exit(tftpfs_exit);
@@ -3,12 +3,33 @@
 
 #include <elfboot/core.h>
 #include <elfboot/linkage.h>
+#include <elfboot/list.h>
+#include <elfboot/interrupts.h>
+#include <elfboot/libatapi.h>
 
 #include <drivers/ata.h>
 
 #define DRIVER_AHCI		"AHCI"
 
 #define AHCI_MAX_DEVICES	32
+#define AHCI_MAX_PORTS		32
+
+/*
+ * Timeouts in milliseconds. Commands may have to wait for a drive to spin
+ * up, the other ones only wait for the HBA or the link.
+ */
+#define AHCI_CMD_TIMEOUT	10000
+#define AHCI_ENGINE_TIMEOUT	500
+#define AHCI_LINK_TIMEOUT	1000
+
+/*
+ * After a COMRESET, a device has to show its presence on the link within
+ * this time. Empty ports would otherwise cost a full link timeout.
+ */
+#define AHCI_PRESENCE_TIMEOUT	100
+
+/* Number of times a failed or timed out command is issued again */
+#define AHCI_RETRIES		3
 
 #define SATA_SIG_ATA	0x00000101
 #define SATA_SIG_ATAPI	0xeb140101
@@ -22,6 +43,9 @@ struct hba_prdt {
 	uint32_t idbc;
 } __packed;
 
+/* A single PRDT entry describes at most 4 MiB */
+#define HBA_PRDT_MAX_SIZE	0x400000
+
 #define HBA_IDBC_DBC(val)	(((val) & 0x3fffff) << 0)
 #define HBA_IDBC_I(val)		(((val) & 0x01) << 31)
 
@@ -112,7 +136,7 @@ struct hba_fis_reg {
 	uint8_t lba_ext_low;
 	uint8_t lba_ext_mid;
 	uint8_t lba_ext_high;
-	uint8_t __reserved1;
+	uint8_t featureh;
 	uint8_t countl;
 	uint8_t counth;
 	uint8_t __reserved2;
@@ -173,9 +197,35 @@ struct hba_port {
 	uint32_t vs[4];
 } __packed;
 
+#define HBA_PxIS_DHRS	_BITUL(0)
+#define HBA_PxIS_PSS	_BITUL(1)
+#define HBA_PxIS_DSS	_BITUL(2)
+#define HBA_PxIS_SDBS	_BITUL(3)
+#define HBA_PxIS_DPS	_BITUL(5)
+#define HBA_PxIS_IFS	_BITUL(27)
+#define HBA_PxIS_HBDS	_BITUL(28)
+#define HBA_PxIS_HBFS	_BITUL(29)
 #define HBA_PxIS_TFES	_BITUL(30)
 
+#define HBA_PxIS_ERROR	\
+	(HBA_PxIS_IFS | HBA_PxIS_HBDS | HBA_PxIS_HBFS | HBA_PxIS_TFES)
+
+/* Command completions and errors raise an interrupt, PxIE uses PxIS bits */
+#define HBA_PxIE_DEFAULT	\
+	(HBA_PxIS_DHRS | HBA_PxIS_PSS | HBA_PxIS_DSS | HBA_PxIS_SDBS | \
+	 HBA_PxIS_DPS | HBA_PxIS_ERROR)
+
+#define HBA_PxSSTS_DET(val)	(((val) >> 0) & 0x0f)
+#define HBA_PxSSTS_IPM(val)	(((val) >> 8) & 0x0f)
+
+#define HBA_PxSSTS_DET_PHY	0x03
+#define HBA_PxSSTS_IPM_ACTIVE	0x01
+
+#define HBA_PxSCTL_DET_MASK	0x0f
+#define HBA_PxSCTL_DET_INIT	0x01
+
 #define HBA_PxCMD_ST	0x0001
+#define HBA_PxCMD_SUD	0x0002
 #define HBA_PxCMD_FRE	0x0010
 #define HBA_PxCMD_FR	0x4000
 #define HBA_PxCMD_CR	0x8000
@@ -200,12 +250,109 @@ struct hba_memory {
 	struct hba_port ports[1];
 } __packed;
 
+/*
+ * Every port gets a single allocation holding the command list, the received
+ * FIS area and one command table per implemented command slot. The number of
+ * PRDT entries per command table is configurable.
+ */
+
+#ifdef CONFIG_DRIVER_AHCI_PRDTS
+#define AHCI_MAX_PRDTS		CONFIG_DRIVER_AHCI_PRDTS
+#else
+#define AHCI_MAX_PRDTS		8
+#endif
+
+/* The allocation for a port has to come from the largest bmalloc cache */
+#if AHCI_MAX_PRDTS < 1 || AHCI_MAX_PRDTS > 48
+#error "DRIVER_AHCI_PRDTS must be between 1 and 48"
+#endif
+
+#define AHCI_CMD_LIST_SIZE	(AHCI_MAX_DEVICES * sizeof(struct hba_cmd_hdr))
+#define AHCI_RX_FIS_SIZE	sizeof(struct hba_fis)
+#define AHCI_CMD_TBL_ALIGN	128
+#define AHCI_CMD_TBL_OFFSET	(AHCI_CMD_LIST_SIZE + AHCI_RX_FIS_SIZE)
+#define AHCI_CMD_TBL_SIZE	\
+	round_up(sizeof(struct hba_cmd_tbl) + AHCI_MAX_PRDTS * sizeof(struct hba_prdt), \
+		AHCI_CMD_TBL_ALIGN)
+
+#define AHCI_PORT_MEM_SIZE(slots)	\
+	(AHCI_CMD_TBL_OFFSET + (slots) * AHCI_CMD_TBL_SIZE)
+
+#define HBA_GHC_HR		_BITUL(0)
+#define HBA_GHC_IE		_BITUL(1)
+#define HBA_GHC_AE		_BITUL(31)
+
 #define HBA_CAP_NP(val)	(((val) >> 0) & 0x1f)
+#define HBA_CAP_NCS(val)	(((val) >> 8) & 0x1f)
+#define HBA_CAP_SSS		_BITUL(27)
+#define HBA_CAP_SNCQ		_BITUL(30)
+
+struct ahci_dev;
+
+struct ahci_ctrl {
+	int index;
+	struct pci_dev *pcidev;
+	volatile struct hba_memory *hba;
+
+	/* Initialized ports, indexed by their port number */
+	struct ahci_dev *ports[AHCI_MAX_PORTS];
+
+	/*
+	 * Interrupts received so far. Ports only halt the CPU while waiting
+	 * once we know that the interrupt line actually works. The handler is
+	 * only registered once interrupts are set up, until then we poll.
+	 */
+	uint32_t irq;
+	uint32_t irqs;
+	bool irq_setup;
+	bool irq_enabled;
+	struct interrupt_handler handler;
+
+	struct list_head list;
+};
+
+/* Port states while the controllers are brought up */
+#define AHCI_PORT_LINK		0
+#define AHCI_PORT_ACTIVE	1
 
 struct ahci_dev {
 	int portno;
+	struct ahci_ctrl *ctrl;
 	volatile struct hba_port *port;
+
+	/* Timestamp of the last COMRESET */
+	uint64_t reset;
+	uint8_t state;
+
 	uint8_t atapi;
+	uint8_t lba48;
+
+	/* Packet command state of SATAPI devices */
+	struct libatapi_dev satapi;
+
+	/*
+	 * Command slots implemented by the HBA, slots currently owned by the
+	 * driver and the number of commands we keep outstanding. The queue
+	 * depth is only larger than one if both the HBA and the device support
+	 * Native Command Queuing.
+	 */
+	uint32_t slots;
+	uint32_t active;
+	uint8_t qdepth;
+	uint8_t ncq;
+
+	/*
+	 * Slots handed to the HBA, slots the HBA has finished since we last
+	 * waited for them and the error bits of PxIS seen in the meantime.
+	 * Both the interrupt handler and the polling fallback update them.
+	 */
+	uint32_t issued;
+	uint32_t completed;
+	uint32_t error;
+
+	/* Command list, received FIS and command tables */
+	void *cmdmem;
+
 	uint16_t *private;
 };
 
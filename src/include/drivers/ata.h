@@ -44,6 +44,9 @@
 #define ATA_CMD_READ_PIO_EXT                      0x24
 #define ATA_CMD_READ_DMA                          0xC8
 #define ATA_CMD_READ_DMA_EXT                      0x25
+#define ATA_CMD_READ_MULTIPLE                     0xC4
+#define ATA_CMD_READ_MULTIPLE_EXT                 0x29
+#define ATA_CMD_SET_MULTIPLE                      0xC6
 #define ATA_CMD_WRITE_PIO                         0x30
 #define ATA_CMD_WRITE_PIO_EXT                     0x34
 #define ATA_CMD_WRITE_DMA                         0xCA
@@ -106,6 +109,8 @@
 #define ATAPI_IREASON_DATA_IN                     0x2
 #define ATAPI_IREASON_ERROR                       0x3
 
+#define ATAPI_FEATURE_DMA                         0x1
+
 /*
  * Channels
  */
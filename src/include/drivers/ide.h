@@ -1,6 +1,9 @@
 #ifndef __DRIVER_IDE_H__
 #define __DRIVER_IDE_H__
 
+#include <elfboot/core.h>
+#include <elfboot/libatapi.h>
+
 #define DRIVER_IDE			"IDE"
 
 #define IDE_MAX_CHANNELS		2
@@ -17,7 +20,57 @@
 
 #define IS_IDE_FAULTY_ATA(clb, chb)	(clb == 0xf0 && chb == 0xff)
 
+/*
+ * Bus Master IDE registers, relative to the base of a channel
+ */
+
+#define IDE_BM_CHANNEL_SIZE		8
+
+#define IDE_BM_REG_COMMAND		0x00
+#define IDE_BM_REG_STATUS		0x02
+#define IDE_BM_REG_PRDT			0x04
+
+#define IDE_BM_CMD_START		0x01
+#define IDE_BM_CMD_READ			0x08
+
+#define IDE_BM_SR_ACTIVE		0x01
+#define IDE_BM_SR_ERROR			0x02
+#define IDE_BM_SR_IRQ			0x04
+
+/*
+ * Physical Region Descriptor. A region must not cross a 64 KiB boundary and
+ * a size of zero stands for 64 KiB.
+ */
+struct ide_prd {
+	uint32_t addr;
+	uint16_t size;
+	uint16_t flags;
+} __packed;
+
+#define IDE_PRD_EOT			0x8000
+#define IDE_PRD_BOUNDARY		0x10000
+
+/*
+ * The PRD table of a device has 64 entries, which covers any buffer of 63 *
+ * 64 KiB regardless of its alignment.
+ */
+#define IDE_DMA_PRDS			64
+#define IDE_DMA_MAX_SIZE		((IDE_DMA_PRDS - 1) * IDE_PRD_BOUNDARY)
+
+/* Sectors per DRQ block we request with SET MULTIPLE MODE */
+#define IDE_MAX_MULTIPLE		16
+
+/*
+ * Byte count limit of ATAPI PIO transfers, the largest even value that fits
+ * into the 16-bit register and is commonly used by other drivers as well.
+ */
+#define IDE_ATAPI_BYTE_LIMIT		0xF800
+
+/* Timeout of a DMA command in milliseconds */
+#define IDE_DMA_TIMEOUT			10000
+
 struct ide_dev {
+	struct pci_dev *pcidev;
 	uint16_t io_base;
 	uint16_t control;
 	uint16_t channel;
@@ -25,6 +78,22 @@ struct ide_dev {
 	int slave;
 	uint8_t disk;
 	uint8_t irq;
+	uint8_t lba48;
+
+	/* Sectors per DRQ block for READ MULTIPLE, zero if not enabled */
+	uint8_t multiple;
+
+	/*
+	 * Bus Master IDE registers of our channel and PRD table. DMA is only
+	 * used if both the controller and the device support it.
+	 */
+	uint16_t bmide;
+	uint8_t dma;
+	struct ide_prd *prdt;
+
+	/* Packet command state of ATAPI devices */
+	struct libatapi_dev atapi;
+
 	uint16_t *private;
 };
 
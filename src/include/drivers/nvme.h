@@ -0,0 +1,174 @@
+#ifndef __DRIVER_NVME_H__
+#define __DRIVER_NVME_H__
+
+#include <elfboot/core.h>
+#include <elfboot/linkage.h>
+#include <elfboot/list.h>
+#include <elfboot/pci.h>
+
+#define DRIVER_NVME			"NVME"
+
+/*
+ * Controller registers
+ */
+
+#define NVME_REG_CAP			0x00
+#define NVME_REG_VS			0x08
+#define NVME_REG_INTMS			0x0c
+#define NVME_REG_INTMC			0x10
+#define NVME_REG_CC			0x14
+#define NVME_REG_CSTS			0x1c
+#define NVME_REG_AQA			0x24
+#define NVME_REG_ASQ			0x28
+#define NVME_REG_ACQ			0x30
+#define NVME_REG_DBS			0x1000
+
+/* Controller capabilities, split into the low and high 32 bits */
+#define NVME_CAP_MQES(lo)		((lo) & 0xffff)
+#define NVME_CAP_TO(lo)			(((lo) >> 24) & 0xff)
+#define NVME_CAP_DSTRD(hi)		((hi) & 0xf)
+#define NVME_CAP_CSS_NVM(hi)		(((hi) >> 5) & 0x1)
+#define NVME_CAP_MPSMIN(hi)		(((hi) >> 16) & 0xf)
+
+#define NVME_CC_EN			_BITUL(0)
+#define NVME_CC_CSS_NVM			(0 << 4)
+#define NVME_CC_MPS(shift)		(((shift) - 12) << 7)
+#define NVME_CC_AMS_RR			(0 << 11)
+#define NVME_CC_SHN_MASK		(3 << 14)
+#define NVME_CC_IOSQES(shift)		((shift) << 16)
+#define NVME_CC_IOCQES(shift)		((shift) << 20)
+
+#define NVME_CSTS_RDY			_BITUL(0)
+#define NVME_CSTS_CFS			_BITUL(1)
+
+/*
+ * Commands
+ */
+
+#define NVME_ADMIN_DELETE_SQ		0x00
+#define NVME_ADMIN_CREATE_SQ		0x01
+#define NVME_ADMIN_DELETE_CQ		0x04
+#define NVME_ADMIN_CREATE_CQ		0x05
+#define NVME_ADMIN_IDENTIFY		0x06
+#define NVME_ADMIN_SET_FEATURES		0x09
+
+#define NVME_CMD_READ			0x02
+
+#define NVME_IDENTIFY_NS		0x00
+#define NVME_IDENTIFY_CTRL		0x01
+
+#define NVME_FEAT_NUM_QUEUES		0x07
+
+#define NVME_QUEUE_PHYS_CONTIG		_BITUL(0)
+
+/* Completion status, the lowest bit is the phase tag */
+#define NVME_CQE_PHASE			_BITUL(0)
+#define NVME_CQE_STATUS(x)		(((x) >> 1) & 0x7fff)
+
+struct nvme_cmd {
+	uint8_t  opcode;
+	uint8_t  flags;
+	uint16_t cid;
+	uint32_t nsid;
+	uint64_t rsvd;
+	uint64_t mptr;
+	uint64_t prp1;
+	uint64_t prp2;
+	uint32_t cdw10;
+	uint32_t cdw11;
+	uint32_t cdw12;
+	uint32_t cdw13;
+	uint32_t cdw14;
+	uint32_t cdw15;
+} __packed;
+
+struct nvme_cqe {
+	uint32_t result;
+	uint32_t rsvd;
+	uint16_t sq_head;
+	uint16_t sq_id;
+	uint16_t cid;
+	uint16_t status;
+} __packed;
+
+/* Offsets within the identify data structures */
+#define NVME_ID_CTRL_MDTS		77
+#define NVME_ID_CTRL_NN			516
+
+#define NVME_ID_NS_NSZE			0
+#define NVME_ID_NS_FLBAS		26
+#define NVME_ID_NS_LBAF			128
+
+#define NVME_LBAF_LBADS(x)		(((x) >> 16) & 0xff)
+
+/*
+ * Driver limits
+ *
+ * Each queue is a single page. A command transfers up to 16 pages, so the
+ * PRP lists of all commands of a queue fit into one page as well.
+ */
+
+#define NVME_PAGE_SHIFT			12
+#define NVME_PAGE_SIZE			_BITUL(NVME_PAGE_SHIFT)
+
+#define NVME_ADMIN_DEPTH		16
+#define NVME_QUEUE_DEPTH		32
+#define NVME_MAX_PAGES			16
+#define NVME_MAX_IO_QUEUES		2
+#define NVME_MAX_NAMESPACES		16
+
+/* Timeout of a single command in milliseconds */
+#define NVME_CMD_TIMEOUT		10000
+
+struct nvme_queue {
+	uint16_t qid;
+	uint16_t depth;
+
+	struct nvme_cmd *sq;
+	volatile struct nvme_cqe *cq;
+	volatile uint32_t *sq_db;
+	volatile uint32_t *cq_db;
+
+	uint16_t sq_tail;
+	uint16_t cq_head;
+	uint8_t phase;
+
+	/* Unused command IDs and one PRP list per command ID */
+	uint32_t free;
+	uint64_t *prps;
+
+	/* Result of the last completion and the number of failed commands */
+	uint32_t result;
+	uint32_t errors;
+};
+
+struct nvme_ctrl {
+	int index;
+	struct pci_dev *pcidev;
+	volatile uint8_t *regs;
+
+	uint32_t dstrd;
+	uint32_t timeout;
+	uint32_t max_pages;
+
+	struct nvme_queue admin;
+	struct nvme_queue io[NVME_MAX_IO_QUEUES];
+	uint32_t nr_io;
+
+	/* Queue the next command is submitted to */
+	uint32_t next_io;
+
+	/* The controller is disabled after a command timed out */
+	bool failed;
+
+	uint8_t *identify;
+
+	struct list_head list;
+};
+
+struct nvme_ns {
+	struct nvme_ctrl *ctrl;
+	uint32_t nsid;
+};
+
+#endif /* __DRIVER_NVME_H__ */
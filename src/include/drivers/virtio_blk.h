@@ -0,0 +1,89 @@
+#ifndef __DRIVER_VIRTIO_BLK_H__
+#define __DRIVER_VIRTIO_BLK_H__
+
+#include <elfboot/core.h>
+#include <elfboot/linkage.h>
+#include <elfboot/bdev.h>
+#include <elfboot/virtio.h>
+
+#define DRIVER_VIRTIO_BLK		"VIRTIO-BLK"
+
+/* Feature bits */
+#define VIRTIO_BLK_F_SIZE_MAX		1
+#define VIRTIO_BLK_F_SEG_MAX		2
+#define VIRTIO_BLK_F_RO			5
+#define VIRTIO_BLK_F_BLK_SIZE		6
+
+#define VIRTIO_BLK_FEATURES					\
+	(VIRTIO_FEATURE(VIRTIO_BLK_F_SIZE_MAX) |		\
+	 VIRTIO_FEATURE(VIRTIO_BLK_F_SEG_MAX) |			\
+	 VIRTIO_FEATURE(VIRTIO_BLK_F_RO) |			\
+	 VIRTIO_FEATURE(VIRTIO_BLK_F_BLK_SIZE) |		\
+	 VIRTIO_FEATURE(VIRTIO_F_INDIRECT_DESC))
+
+/* Request types and status */
+#define VIRTIO_BLK_T_IN			0
+#define VIRTIO_BLK_T_OUT		1
+
+#define VIRTIO_BLK_S_OK			0
+#define VIRTIO_BLK_S_IOERR		1
+#define VIRTIO_BLK_S_UNSUPP		2
+
+/* Sector size the request header always refers to */
+#define VIRTIO_BLK_SECTOR_SHIFT		9
+#define VIRTIO_BLK_SECTOR_SIZE		(1 << VIRTIO_BLK_SECTOR_SHIFT)
+
+/*
+ * Requests in flight and data segments per request. A request holds up to
+ * 64 KiB per segment unless the device has a lower segment size limit.
+ */
+#define VIRTIO_BLK_MAX_REQS		16
+#define VIRTIO_BLK_MAX_SEGS		8
+#define VIRTIO_BLK_SEG_SIZE		0x10000
+
+/* Timeout of a single request in milliseconds */
+#define VIRTIO_BLK_TIMEOUT		10000
+
+struct virtio_blk_config {
+	uint64_t capacity;
+	uint32_t size_max;
+	uint32_t seg_max;
+	uint16_t cylinders;
+	uint8_t  heads;
+	uint8_t  sectors;
+	uint32_t blk_size;
+} __packed;
+
+struct virtio_blk_outhdr {
+	uint32_t type;
+	uint32_t ioprio;
+	uint64_t sector;
+} __packed;
+
+struct virtio_blk_req {
+	/*
+	 * Indirect descriptor table of the request: the header, the data
+	 * segments and the status byte.
+	 */
+	struct virtq_desc table[VIRTIO_BLK_MAX_SEGS + 2];
+
+	struct virtio_blk_outhdr hdr;
+	uint8_t status;
+} __aligned(16);
+
+struct virtio_blk_dev {
+	int index;
+	struct virtio_dev vdev;
+	struct virtqueue vq;
+
+	/* Requests we keep in flight and bitmap of the unused ones */
+	struct virtio_blk_req *reqs;
+	uint32_t nreqs;
+	uint32_t free;
+
+	/* Limits of a single request */
+	uint32_t seg_size;
+	uint32_t max_segs;
+};
+
+#endif /* __DRIVER_VIRTIO_BLK_H__ */
@@ -0,0 +1,69 @@
+#ifndef __DRIVER_VIRTIO_NET_H__
+#define __DRIVER_VIRTIO_NET_H__
+
+#include <elfboot/core.h>
+#include <elfboot/linkage.h>
+#include <elfboot/net.h>
+#include <elfboot/virtio.h>
+
+#define DRIVER_VIRTIO_NET		"VIRTIO-NET"
+
+/* Feature bits */
+#define VIRTIO_NET_F_MAC		5
+
+#define VIRTIO_NET_FEATURES					\
+	(VIRTIO_FEATURE(VIRTIO_NET_F_MAC))
+
+#define VIRTIO_NET_RX_QUEUE		0
+#define VIRTIO_NET_TX_QUEUE		1
+
+/*
+ * Every buffer holds the virtio header and a single ethernet frame. The
+ * receive buffers have to take a full window of a transfer, e.g. TFTP
+ * with windowsize or a TCP receive window, otherwise the device drops
+ * frames. 128 buffers hold about 180 KiB of payload.
+ */
+#define VIRTIO_NET_BUF_SHIFT		11
+#define VIRTIO_NET_BUF_SIZE		(1 << VIRTIO_NET_BUF_SHIFT)
+#define VIRTIO_NET_RX_ORDER		6
+#define VIRTIO_NET_TX_ORDER		2
+
+/* Timeout for a free transmit buffer in milliseconds */
+#define VIRTIO_NET_TIMEOUT		1000
+
+struct virtio_net_config {
+	uint8_t  mac[ETH_ALEN];
+	uint16_t status;
+	uint16_t max_virtqueue_pairs;
+	uint16_t mtu;
+} __packed;
+
+/* Header in front of every frame, no offloads are negotiated */
+struct virtio_net_hdr {
+	uint8_t  flags;
+	uint8_t  gso_type;
+	uint16_t hdr_len;
+	uint16_t gso_size;
+	uint16_t csum_start;
+	uint16_t csum_offset;
+	uint16_t num_buffers;
+} __packed;
+
+struct virtio_net_dev {
+	int index;
+	struct virtio_dev vdev;
+	struct virtqueue rxq;
+	struct virtqueue txq;
+
+	void *rx_bufs;
+	uint32_t nr_rx;
+
+	/* Transmit buffers and bitmap of the unused ones */
+	void *tx_bufs;
+	uint32_t nr_tx;
+	uint32_t tx_free;
+
+	struct netdev netdev;
+};
+
+#endif /* __DRIVER_VIRTIO_NET_H__ */
@@ -4,6 +4,7 @@
 #include <elfboot/core.h>
 #include <elfboot/linkage.h>
 #include <elfboot/list.h>
+#include <elfboot/pci.h>
 
 #include <uapi/elfboot/const.h>
 
@@ -11,6 +12,13 @@
 
 #define BDEV_FLAGS_BOOT	_BITUL(0)
 #define BDEV_FLAGS_LBA	_BITUL(1)
+#define BDEV_FLAGS_ZEROCOPY	_BITUL(2)
+#define BDEV_FLAGS_PARTITION	_BITUL(3)
+#define BDEV_FLAGS_LOCATED	_BITUL(4)
+#define BDEV_FLAGS_PROBED	_BITUL(5)
+
+/* The controller does not have multiple ports or we don't know the port */
+#define BDEV_PORT_NONE		0xffff
 
 /*
  * Block devices
@@ -23,6 +31,12 @@ struct bdev_ops {
 	int (*write)(struct bdev *, uint64_t, uint64_t, const void *);
 	int (*ioctl)(struct bdev *, int, void *);
 
+	/*
+	 * Memory-backed devices can hand out a pointer to their blocks instead of
+	 * copying them, see BDEV_FLAGS_ZEROCOPY.
+	 */
+	void *(*map)(struct bdev *, uint64_t, uint64_t);
+
 	/* List of bdev drivers */
 	struct list_head list;
 };
@@ -75,6 +89,22 @@ struct bdev {
 	uint16_t block_size;
 	uint16_t block_logs;
 
+	/*
+	 * Maximum number of blocks the device transfers with a single command.
+	 * Larger requests are split up by the driver. A value of zero means the
+	 * limit is unknown.
+	 */
+	uint32_t max_blocks;
+
+	/*
+	 * Position of the device in the system, only valid if BDEV_FLAGS_LOCATED
+	 * is set: the PCI function of the controller and the port behind it, e.g.
+	 * channel and drive of an IDE device. This allows matching the device to
+	 * the boot drive reported by the firmware without reading from it.
+	 */
+	struct pci_address location;
+	uint16_t port;
+
 	/*
 	 * Operations for this device. The functions can only be retrieved from a
 	 * module which implements block device functions.
@@ -100,6 +130,14 @@ static inline uint32_t bootdev_partitions(void)
  * Block device functions
  */
 
+static inline void bdev_set_location(struct bdev *bdev,
+	struct pci_address *addr, uint16_t port)
+{
+	bdev->location = *addr;
+	bdev->port = port;
+	bdev->flags |= BDEV_FLAGS_LOCATED;
+}
+
 static inline uint64_t bdev_blknum(struct bdev *bdev, uint64_t length)
 {
 	return ((length - 1) >> bdev->block_logs) + 1;
@@ -113,6 +151,8 @@ int bdev_write(struct bdev *bdev, uint64_t sector,
 
 int bdev_ioctl(struct bdev *bdev, int request, void *args);
 
+void *bdev_map(struct bdev *bdev, uint64_t sector, uint64_t blknum);
+
 void bdev_register_driver(struct bdev_ops *ops);
 
 struct bdev *bdev_get(uint32_t flags, struct bdev *from);
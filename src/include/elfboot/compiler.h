@@ -8,4 +8,14 @@
 
 #define __noreturn	__attribute(noreturn)
 
+/*
+ * Address of the instruction following the call to the current function
+ */
+#define _RET_IP_	((uint32_t)__builtin_return_address(0))
+
+/*
+ * Keeps the compiler from moving memory accesses across this point
+ */
+#define barrier()	asm volatile("" ::: "memory")
+
 #endif /* __ELFBOOT_COMPILER_H__ */
\ No newline at end of file
@@ -0,0 +1,54 @@
+#ifndef __ELFBOOT_CONFIG_H__
+#define __ELFBOOT_CONFIG_H__
+
+#define CONFIG_Y 1
+#define CONFIG_M 2
+
+/* CONFIG_DEBUG is not defined */
+/* CONFIG_DEBUG_BOCHS is not defined */
+/* CONFIG_DEBUG_QEMU is not defined */
+/* CONFIG_X86_INTERRUPT_INFO is not defined */
+#define CONFIG_X86_EDD CONFIG_Y
+/* CONFIG_DEBUG_PCI is not defined */
+#define CONFIG_PCI_ECAM CONFIG_Y
+/* CONFIG_MM_TRACE is not defined */
+/* CONFIG_LOADER_AUTOBOOT is not defined */
+#define CONFIG_LOADER_LINUX_PROTMODE CONFIG_Y
+/* CONFIG_RAMDISK is not defined */
+#define CONFIG_RAMDISK_ADDR 0
+#define CONFIG_RAMDISK_SIZE 0
+#define CONFIG_RAMDISK_BLOCK_SIZE 2048
+/* CONFIG_LOOP is not defined */
+/* CONFIG_PARTITIONS is not defined */
+#define CONFIG_DRIVER_IDE CONFIG_M
+/* CONFIG_DRIVER_IDE_DEBUG is not defined */
+/* CONFIG_DRIVER_IDE_PIO32 is not defined */
+#define CONFIG_DRIVER_AHCI CONFIG_Y
+/* CONFIG_DRIVER_AHCI_DEBUG is not defined */
+#define CONFIG_DRIVER_AHCI_PRDTS 8
+#define CONFIG_DRIVER_NVME CONFIG_M
+/* CONFIG_DRIVER_NVME_DEBUG is not defined */
+/* CONFIG_VIRTIO is not defined */
+/* CONFIG_DRIVER_VIRTIO_BLK is not defined */
+/* CONFIG_DRIVER_VIRTIO_BLK_DEBUG is not defined */
+/* CONFIG_DRIVER_VIRTIO_NET is not defined */
+#define CONFIG_DRIVER_TTY CONFIG_M
+#define CONFIG_DRIVER_PIT CONFIG_M
+#define CONFIG_DRIVER_KBD CONFIG_M
+#define CONFIG_DRIVER_KBD_LAYOUT_DE CONFIG_Y
+/* CONFIG_DEBUG_FS is not defined */
+#define CONFIG_FS_ISOFS CONFIG_Y
+/* CONFIG_FS_ISOFS_DEBUG is not defined */
+/* CONFIG_NET is not defined */
+#define CONFIG_NET_IPADDR "10.0.2.15"
+#define CONFIG_NET_NETMASK "255.255.255.0"
+#define CONFIG_NET_GATEWAY "10.0.2.2"
+#define CONFIG_NET_TCP_WINDOW 131072
+/* CONFIG_FS_TFTPFS is not defined */
+#define CONFIG_NET_TFTP_SERVER "10.0.2.2"
+#define CONFIG_NET_TFTP_BLKSIZE 1468
+#define CONFIG_NET_TFTP_WINDOWSIZE 16
+/* CONFIG_FS_HTTPFS is not defined */
+/* CONFIG_FS_HTTPFS_DEBUG is not defined */
+
+#endif /* __ELFBOOT_CONFIG_H__ */
@@ -38,6 +38,13 @@ struct fs_node_ops {
 	uint32_t (*write)(struct fs_node *, uint64_t, uint32_t, const void *);
 	struct fs_dent *(*readdir)(struct fs_node *, uint32_t);
 	struct fs_node *(*finddir)(struct fs_node *, const char *);
+
+	/*
+	 * Maps a file block onto the sectors of the underlying block device. The
+	 * number of file blocks which follow contiguously on the device is stored
+	 * in the last argument.
+	 */
+	int (*bmap)(struct fs_node *, uint32_t, uint64_t *, uint32_t *);
 	struct list_head list;
 };
 
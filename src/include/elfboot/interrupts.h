@@ -7,6 +7,7 @@
 #include <asm/interrupts.h>
 
 #define NUM_INTERRUPTS		ARCH_NUM_INTERRUPTS
+#define NUM_IRQS		ARCH_NUM_IRQS
 
 struct interrupt_handler {
 	const char *name;
@@ -29,6 +30,18 @@ void enable_clock(void);
 
 void disable_clock(void);
 
+bool clock_is_enabled(void);
+
+/*
+ * Device interrupts - Enable & disable legacy IRQ lines
+ */
+
+int enable_irq(uint32_t irq);
+
+void disable_irq(uint32_t irq);
+
+uint32_t irq_to_vector(uint32_t irq);
+
 /*
  * Interrupt handler registration
  */
@@ -42,6 +55,10 @@ bool has_interrupt_handler(uint32_t vector);
 
 void interrupt_callback(uint32_t vector, void *info);
 
+void set_interrupts_ready(void);
+
+bool interrupts_are_ready(void);
+
 int init_interrupts(void);
 
 #endif /* __ELFBOOT_INTERRUPT_H__ */
\ No newline at end of file
@@ -8,9 +8,15 @@
 
 #define ATA_IDENTIFY_SIZE		ATA_BLOCK_SIZE
 
+#define ATA_SUPPORT_DMA			0x0100
 #define ATA_SUPPORT_LBA			0x0200
 #define ATA_SUPPORT_ADDRESS48	0x0400
 
+#define ATA_SUPPORT_NCQ			0x0100
+#define ATA_QUEUE_LEN(x)		((x) & 0x001f)
+
+#define ATA_MULTIPLE_MAX(x)		((x) & 0x00ff)
+
 #define ATA_PSS_VALID_MASK		0xC000
 #define ATA_PSS_VALID_VALUE		0x4000
 
@@ -20,6 +26,25 @@ bool libata_has_lba_support(uint16_t *params);
 
 bool libata_has_lba48_support(uint16_t *params);
 
+bool libata_has_dma_support(uint16_t *params);
+
+/*
+ * libata_has_ncq_support, libata_queue_depth: Native Command Queuing
+ *
+ * SATA devices report whether they support NCQ and how many commands they
+ * are able to queue at most. The queue depth is only valid with NCQ.
+ */
+bool libata_has_ncq_support(uint16_t *params);
+
+uint32_t libata_queue_depth(uint16_t *params);
+
+/*
+ * libata_max_multiple: Sectors per DRQ block of READ/WRITE MULTIPLE
+ *
+ * Zero means that the device doesn't support the multiple commands.
+ */
+uint32_t libata_max_multiple(uint16_t *params);
+
 /*
  * libata_cylinders, libata_heads, libata_sectors_per_track: CHS addressing
  *
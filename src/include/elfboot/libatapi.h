@@ -0,0 +1,93 @@
+#ifndef __ELFBOOT_LIBATAPI_H__
+#define __ELFBOOT_LIBATAPI_H__
+
+#include <elfboot/core.h>
+#include <elfboot/bdev.h>
+
+/*
+ * ATAPI devices take SCSI commands as 12 byte packets. Larger command
+ * structures are truncated to this size when they are sent.
+ */
+#define LIBATAPI_PACKET_SIZE		12
+
+/*
+ * Commands failing with a unit attention or while the device is becoming
+ * ready are issued again. Waiting for a device starts with the initial
+ * backoff, which doubles with each retry up to the maximum (in ms).
+ */
+#define LIBATAPI_RETRIES		8
+#define LIBATAPI_BACKOFF		50
+#define LIBATAPI_BACKOFF_MAX		2000
+
+/*
+ * SCSI sense keys
+ */
+#define SCSI_SENSE_NO_SENSE		0x00
+#define SCSI_SENSE_RECOVERED_ERROR	0x01
+#define SCSI_SENSE_NOT_READY		0x02
+#define SCSI_SENSE_MEDIUM_ERROR		0x03
+#define SCSI_SENSE_HARDWARE_ERROR	0x04
+#define SCSI_SENSE_ILLEGAL_REQUEST	0x05
+#define SCSI_SENSE_UNIT_ATTENTION	0x06
+#define SCSI_SENSE_DATA_PROTECT		0x07
+#define SCSI_SENSE_ABORTED_COMMAND	0x0b
+
+#define SCSI_SENSE_KEY(x)		((x) & 0x0f)
+#define SCSI_SENSE_RESPONSE(x)		((x) & 0x7f)
+
+/* Additional sense codes for NOT READY */
+#define SCSI_ASC_NOT_READY		0x04
+#define SCSI_ASC_NO_MEDIUM		0x3a
+
+struct libatapi_dev;
+
+/*
+ * Drivers send a packet and transfer the data of the command. They return
+ * -EIO if and only if the device reported a check condition, every other
+ * error is considered a transport failure and not retried here.
+ */
+typedef int (*libatapi_send_t)(struct libatapi_dev *atapi, void *packet,
+	void *buffer, size_t buflen);
+
+struct libatapi_stats {
+	uint32_t commands;
+	uint32_t check_conditions;
+	uint32_t unit_attentions;
+	uint32_t not_ready;
+	uint32_t retries;
+	uint32_t failures;
+};
+
+struct libatapi_dev {
+	struct bdev *bdev;
+	libatapi_send_t send;
+
+	/* Sense data of the last check condition */
+	uint8_t sense_key;
+	uint8_t asc;
+	uint8_t ascq;
+
+	struct libatapi_stats stats;
+};
+
+/*
+ * libatapi_command: Send a packet command to an ATAPI device
+ *
+ * Sense data is only requested if the device reports a check condition.
+ * Depending on the sense key, the command is issued again or fails.
+ */
+int libatapi_command(struct libatapi_dev *atapi, void *packet, void *buffer,
+	size_t buflen);
+
+/*
+ * libatapi_read_capacity, libatapi_read: Block device helpers
+ *
+ * The capacity fills in last_block and block_size of the block device.
+ * Reads are split at the max_blocks limit of the block device, if any.
+ */
+int libatapi_read_capacity(struct libatapi_dev *atapi);
+
+int libatapi_read(struct libatapi_dev *atapi, uint64_t lba, uint64_t num,
+	void *buffer);
+
+#endif /* __ELFBOOT_LIBATAPI_H__ */
@@ -0,0 +1,40 @@
+#ifndef __ELFBOOT_LOOP_H__
+#define __ELFBOOT_LOOP_H__
+
+#include <elfboot/core.h>
+#include <elfboot/bdev.h>
+#include <elfboot/file.h>
+
+/*
+ * Loop devices
+ *
+ * A loop device is a block device on top of a file, e.g. an ISO image stored
+ * on an ext2 partition. If the file system maps the blocks of the file onto
+ * its device, the extents are resolved once and loop reads go straight to the
+ * underlying device. Otherwise, we read through the file.
+ */
+
+#define LOOP_BLOCK_SIZE			2048
+#define LOOP_MAX_EXTENTS		128
+
+/*
+ * Extents are kept in blocks of the underlying device
+ */
+
+struct loop_extent {
+	uint32_t start;
+	uint32_t count;
+	uint64_t sector;
+};
+
+struct loop_dev {
+	struct file *file;
+	struct bdev *backing;
+
+	uint32_t nr_extents;
+	struct loop_extent *extents;
+};
+
+struct bdev *loop_create(const char *path, uint16_t block_size);
+
+#endif /* __ELFBOOT_LOOP_H__ */
@@ -5,6 +5,12 @@
 
 #define MEMBLOCK_MAX_REGIONS	8
 
+/*
+ * Memory above 1 MB gets fragmented by kernel images, initrds and modules,
+ * which is why there are more regions available for it.
+ */
+#define MEMBLOCK_MAX_KERN_REGIONS	32
+
 #define MEMBLOCK_START			MEMORY_START
 #define MEMBLOCK_LIMIT			MEMORY_LIMIT
 
@@ -43,12 +49,23 @@ extern struct memblock memblock;
 #define for_each_kern_memblock(i, region)			\
 	for_each_memblock_type(i, (&memblock.kernmem), region)
 
-void memblock_add(uint32_t base, uint32_t size);
+int memblock_add(uint32_t base, uint32_t size);
 
-void memblock_add_kernel(uint32_t base, uint32_t size);
+int memblock_add_kernel(uint32_t base, uint32_t size);
 
 int memblock_reserve(uint32_t base, uint32_t size);
 
+int memblock_reserve_kernel(uint32_t base, uint32_t size);
+
+int memblock_remove_range(struct memblock_type *type, uint32_t base,
+	uint32_t size);
+
+bool memblock_is_available(struct memblock_type *type, uint32_t base,
+	uint32_t size);
+
+uint32_t memblock_find_range(struct memblock_type *type, uint32_t size,
+	uint32_t align, uint32_t start, uint32_t end, bool topdown);
+
 void *memblock_alloc(uint32_t size, uint32_t align);
 
 void *memblock_alloc_kernel(uint32_t size, uint32_t align);
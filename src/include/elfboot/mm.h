@@ -41,6 +41,8 @@ static inline uint32_t memory_upper_size(void)
 
 void bfree(void *dptr);
 
+void *__bmalloc(size_t size, uint32_t caller);
+
 void *bmalloc(size_t size);
 
 void *bzalloc(size_t size);
@@ -0,0 +1,61 @@
+#ifndef __ELFBOOT_MMTRACE_H__
+#define __ELFBOOT_MMTRACE_H__
+
+#include <elfboot/core.h>
+#include <elfboot/linkage.h>
+
+/*
+ * Allocation tracer
+ *
+ * Records the caller, size and timestamp of every allocation and free in
+ * a fixed ring and accumulates the live and peak usage per call site. All
+ * memory used by the tracer is preallocated, so enabling it doesn't change
+ * the behaviour of the allocators themselves.
+ */
+
+#define MM_TRACE_BMALLOC		0
+#define MM_TRACE_PAGES			1
+#define MM_TRACE_MEMBLOCK		2
+#define MM_TRACE_TYPES			3
+
+#define MM_TRACE_RING_SIZE		256
+#define MM_TRACE_SITES			96
+#define MM_TRACE_OBJECTS		4096
+#define MM_TRACE_REPORT			12
+
+#define MM_TRACE_KEY			't'
+
+#ifdef CONFIG_MM_TRACE
+
+void mm_trace_alloc(int type, uint32_t caller, void *addr, uint32_t size);
+
+void mm_trace_free(int type, uint32_t caller, void *addr);
+
+void mm_trace_dump(void);
+
+int mm_trace_init(void);
+
+#else /* !CONFIG_MM_TRACE */
+
+static inline void mm_trace_alloc(int type __unused, uint32_t caller __unused,
+	void *addr __unused, uint32_t size __unused)
+{
+}
+
+static inline void mm_trace_free(int type __unused, uint32_t caller __unused,
+	void *addr __unused)
+{
+}
+
+static inline void mm_trace_dump(void)
+{
+}
+
+static inline int mm_trace_init(void)
+{
+	return 0;
+}
+
+#endif /* CONFIG_MM_TRACE */
+
+#endif /* __ELFBOOT_MMTRACE_H__ */
@@ -0,0 +1,293 @@
+#ifndef __ELFBOOT_NET_H__
+#define __ELFBOOT_NET_H__
+
+#include <elfboot/core.h>
+#include <elfboot/linkage.h>
+#include <elfboot/list.h>
+
+#include <uapi/elfboot/const.h>
+
+#define NET				"NET"
+
+/*
+ * Minimal IPv4 network stack
+ *
+ * Everything is polled: network drivers hand received frames to net_receive
+ * from their poll function, which in turn is called by whoever waits for a
+ * packet. Addresses and ports are kept in network byte order, except for the
+ * local port of a socket.
+ */
+
+#define ETH_ALEN			6
+#define ETH_HLEN			14
+#define ETH_MTU				1500
+#define ETH_FRAME_LEN			(ETH_HLEN + ETH_MTU)
+
+#define ETH_P_IP			0x0800
+#define ETH_P_ARP			0x0806
+
+#define ARP_HRD_ETHER			1
+#define ARP_OP_REQUEST			1
+#define ARP_OP_REPLY			2
+
+#define IP_VERSION_IHL			0x45
+#define IP_TTL				64
+#define IP_PROTO_TCP			6
+#define IP_PROTO_UDP			17
+#define IP_FLAG_MF			0x2000
+#define IP_FRAG_OFFSET			0x1fff
+
+#define UDP_HLEN			8
+
+/* Largest UDP payload of a single, unfragmented frame */
+#define UDP_MAX_PAYLOAD			(ETH_MTU - sizeof(struct ip_hdr) - UDP_HLEN)
+
+/* TCP flags and options */
+#define TCP_FIN				0x01
+#define TCP_SYN				0x02
+#define TCP_RST				0x04
+#define TCP_PSH				0x08
+#define TCP_ACK				0x10
+
+#define TCP_OPT_END			0
+#define TCP_OPT_NOP			1
+#define TCP_OPT_MSS			2
+#define TCP_OPT_WSCALE			3
+
+/* Largest TCP payload of a single frame and the default without option */
+#define TCP_MSS				(ETH_MTU - sizeof(struct ip_hdr) - \
+					 sizeof(struct tcp_hdr))
+#define TCP_DEFAULT_MSS			536
+
+/* Retransmission timeout (ms) and number of retransmissions */
+#define TCP_TIMEOUT			1000
+#define TCP_RETRIES			5
+
+/* Received segments which are acknowledged together */
+#define TCP_ACK_SEGMENTS		2
+
+/* Connection states, we only ever open connections actively */
+#define TCP_CLOSED			0
+#define TCP_SYN_SENT			1
+#define TCP_ESTABLISHED			2
+#define TCP_CLOSE_WAIT			3
+
+/* Entries of the ARP cache and timeout of a single ARP request (ms) */
+#define ARP_CACHE_SIZE			8
+#define ARP_TIMEOUT			1000
+#define ARP_RETRIES			3
+
+/* Local ports of sockets bound without an explicit port */
+#define NET_EPHEMERAL_PORT		49152
+
+struct eth_hdr {
+	uint8_t  dst[ETH_ALEN];
+	uint8_t  src[ETH_ALEN];
+	uint16_t proto;
+} __packed;
+
+struct arp_hdr {
+	uint16_t hrd;
+	uint16_t pro;
+	uint8_t  hln;
+	uint8_t  pln;
+	uint16_t op;
+	uint8_t  sha[ETH_ALEN];
+	uint32_t spa;
+	uint8_t  tha[ETH_ALEN];
+	uint32_t tpa;
+} __packed;
+
+struct ip_hdr {
+	uint8_t  version_ihl;
+	uint8_t  tos;
+	uint16_t length;
+	uint16_t id;
+	uint16_t frag;
+	uint8_t  ttl;
+	uint8_t  proto;
+	uint16_t csum;
+	uint32_t saddr;
+	uint32_t daddr;
+} __packed;
+
+struct udp_hdr {
+	uint16_t sport;
+	uint16_t dport;
+	uint16_t length;
+	uint16_t csum;
+} __packed;
+
+struct tcp_hdr {
+	uint16_t sport;
+	uint16_t dport;
+	uint32_t seq;
+	uint32_t ack;
+	uint8_t  doff;
+	uint8_t  flags;
+	uint16_t window;
+	uint16_t csum;
+	uint16_t urgent;
+} __packed;
+
+/*
+ * Network devices
+ */
+
+struct netdev;
+
+struct netdev_ops {
+	/* Send a complete ethernet frame */
+	int (*xmit)(struct netdev *, const void *, uint32_t);
+
+	/* Pass all frames received so far to net_receive */
+	void (*poll)(struct netdev *);
+};
+
+struct arp_entry {
+	uint32_t ipaddr;
+	uint8_t  mac[ETH_ALEN];
+};
+
+struct netdev {
+	const char *name;
+	uint8_t mac[ETH_ALEN];
+
+	/* Interface configuration */
+	uint32_t ipaddr;
+	uint32_t netmask;
+	uint32_t gateway;
+
+	/* Frame being built for transmission */
+	uint8_t *frame;
+
+	struct arp_entry arp_cache[ARP_CACHE_SIZE];
+	uint32_t arp_next;
+
+	void *private;
+	struct netdev_ops *ops;
+
+	/* List of registered network devices */
+	struct list_head list;
+};
+
+/*
+ * UDP sockets
+ */
+
+struct udp_socket;
+
+typedef void (*udp_recv_t)(struct udp_socket *, uint32_t, uint16_t, void *,
+	uint32_t);
+
+struct udp_socket {
+	struct netdev *netdev;
+	uint16_t port;
+
+	/*
+	 * Called for every datagram sent to our port with the address and port
+	 * of the sender. The payload is only valid during the call.
+	 */
+	udp_recv_t recv;
+	void *private;
+
+	/* List of bound sockets */
+	struct list_head list;
+};
+
+/*
+ * TCP sockets
+ */
+
+struct tcp_socket;
+
+typedef void (*tcp_recv_t)(struct tcp_socket *, void *, uint32_t);
+
+struct tcp_socket {
+	struct netdev *netdev;
+	uint16_t port;
+
+	/* Peer and the MAC address of the next hop towards it */
+	uint32_t daddr;
+	uint16_t dport;
+	uint8_t  mac[ETH_ALEN];
+
+	int state;
+	int error;
+
+	/*
+	 * Sequence numbers in host byte order. We only send a single segment
+	 * at a time and wait for its acknowledgement.
+	 */
+	uint32_t snd_una;
+	uint32_t snd_nxt;
+	uint32_t rcv_nxt;
+
+	/* Segment size of the peer and scale of the window we announce */
+	uint16_t mss;
+	uint8_t  wscale;
+	uint32_t unacked;
+
+	/*
+	 * Called for received data in order, everything else is dropped and
+	 * retransmitted by the peer. The data is only valid during the call.
+	 */
+	tcp_recv_t recv;
+	void *private;
+
+	/* List of open connections */
+	struct list_head list;
+};
+
+static inline uint16_t htons(uint16_t val)
+{
+	return cputobe16(val);
+}
+
+static inline uint16_t ntohs(uint16_t val)
+{
+	return betocpu16(val);
+}
+
+static inline uint32_t htonl(uint32_t val)
+{
+	return cputobe32(val);
+}
+
+static inline uint32_t ntohl(uint32_t val)
+{
+	return betocpu32(val);
+}
+
+/*
+ * Parse a dotted-quad IPv4 address. Returns zero for invalid addresses.
+ */
+uint32_t net_parse_addr(const char *str);
+
+uint16_t net_checksum(const void *data, uint32_t length, uint32_t sum);
+
+int netdev_register(struct netdev *netdev, struct netdev_ops *ops);
+
+struct netdev *netdev_get(void);
+
+void net_receive(struct netdev *netdev, void *frame, uint32_t length);
+
+void net_poll(struct netdev *netdev);
+
+int udp_bind(struct udp_socket *sock, struct netdev *netdev, uint16_t port);
+
+void udp_unbind(struct udp_socket *sock);
+
+int udp_send(struct udp_socket *sock, uint32_t daddr, uint16_t dport,
+	const void *data, uint32_t length);
+
+int tcp_connect(struct tcp_socket *sock, struct netdev *netdev, uint32_t daddr,
+	uint16_t dport);
+
+int tcp_send(struct tcp_socket *sock, const void *data, uint32_t length);
+
+void tcp_poll(struct tcp_socket *sock);
+
+void tcp_close(struct tcp_socket *sock);
+
+#endif /* __ELFBOOT_NET_H__ */
@@ -10,22 +10,37 @@
 #define PAGE_SHIFT			12
 #define PAGE_SIZE			_BITUL(PAGE_SHIFT)
 
+/*
+ * Pages are linked together with 16-bit page frame numbers instead
+ * of list_head pointers. This limits the page map to 65535 pages
+ * (256 MB), which is plenty for our low memory heap. The value of
+ * PAGE_NIL terminates a page list.
+ */
+
+#define PAGE_NIL			0xffff
+
+struct page_list {
+	uint16_t first;
+	uint16_t last;
+};
+
 struct free_area {
 	uint32_t nr_free;
-	struct list_head list;
+	struct page_list list;
 };
 
 struct page {
-	uint32_t flags;
+	uint8_t flags;
 
 #define PAGE_FLAG_FREE_BIT		0
 #define PAGE_FLAG_FREE			_BITUL(PAGE_FLAG_FREE_BIT)
+#define PAGE_FLAG_TAIL_BIT		1
+#define PAGE_FLAG_TAIL			_BITUL(PAGE_FLAG_TAIL_BIT)
 
-	uint32_t paddr;
-	uint32_t order;
+	uint8_t order;
 
 	/*
-	 * The list is used to insert the page to the freelist
+	 * The links are used to insert the page to the freelist
 	 * when the page is a compound head for a set of pages
 	 * and is free for allocation.
 	 *
@@ -35,18 +50,27 @@ struct page {
 	 * cache.
 	 */
 
-	struct list_head list;
-	struct page *compound_head;
+	uint16_t next;
+	uint16_t prev;
 
 	/*
-	 * In case this page is allocated for a slab cache we
-	 * use the following members to store information for
-	 * the dedicated slab cache in them.
+	 * The physical address of a page is not stored, it is
+	 * implied by the position of the page in the page map.
+	 *
+	 * Tail pages of a compound page only need to know the
+	 * head page, while the members for the slab cache are
+	 * only used in the head page. Both share the memory.
 	 */
-	
-	struct bmem_cache *slab_cache;
-	uint32_t inuse;
-	struct list_head freelist;
+
+	union {
+		uint16_t head;
+
+		struct {
+			uint16_t inuse;
+			uint16_t freelist;
+			struct bmem_cache *slab_cache;
+		};
+	};
 };
 
 extern struct page *page_map;
@@ -56,6 +80,11 @@ static inline bool page_is_free(struct page *page)
 	return (page->flags & PAGE_FLAG_FREE) != 0;
 }
 
+static inline bool page_is_tail(struct page *page)
+{
+	return (page->flags & PAGE_FLAG_TAIL) != 0;
+}
+
 static inline uint32_t phys_to_pfn(uint32_t paddr)
 {
 	return paddr >> PAGE_SHIFT;
@@ -63,7 +92,12 @@ static inline uint32_t phys_to_pfn(uint32_t paddr)
 
 static inline uint32_t page_to_pfn(struct page *page)
 {
-	return phys_to_pfn(page->paddr);
+	return page - page_map;
+}
+
+static inline uint32_t page_to_phys(struct page *page)
+{
+	return page_to_pfn(page) << PAGE_SHIFT;
 }
 
 static inline struct page *pfn_to_page(uint32_t pfn)
@@ -78,34 +112,96 @@ static inline struct page *phys_to_page(uint32_t addr)
 
 static inline void *page_address(struct page *page)
 {
-	return tvptr(page->paddr);
+	return tvptr(page_to_phys(page));
 }
 
 static inline struct page *compound_head(struct page *page)
 {
-	return page->compound_head;
+	if (page_is_tail(page))
+		return pfn_to_page(page->head);
+
+	return page;
 }
 
 static inline struct page *page_buddy(struct page *page, uint32_t order)
 {
-	uint32_t diff, bpfn, ppfn;
-
 	/*
 	 * We retrieve the buddy to a corresponding page by
-	 * calculating the difference in their PFN. This only
-	 * works because we allocated all pages in a continuous
+	 * flipping the order bit in its PFN. This only works
+	 * because we allocated all pages in a continuous
 	 * struct page array.
 	 */
 
-	ppfn = page_to_pfn(page);
-	bpfn = phys_to_pfn(page->paddr ^ ((1ULL << order) * PAGE_SIZE));
+	return pfn_to_page(page_to_pfn(page) ^ (1UL << order));
+}
+
+/*
+ * Page lists
+ */
+
+static inline void page_list_init(struct page_list *list)
+{
+	list->first = PAGE_NIL;
+	list->last  = PAGE_NIL;
+}
+
+static inline bool page_list_empty(struct page_list *list)
+{
+	return list->first == PAGE_NIL;
+}
+
+static inline struct page *page_list_first(struct page_list *list)
+{
+	if (page_list_empty(list))
+		return NULL;
+
+	return pfn_to_page(list->first);
+}
+
+static inline void page_list_add(struct page *page, struct page_list *list)
+{
+	uint16_t pfn = page_to_pfn(page);
+
+	page->prev = PAGE_NIL;
+	page->next = list->first;
+
+	if (page_list_empty(list))
+		list->last = pfn;
+	else
+		pfn_to_page(list->first)->prev = pfn;
 
-	diff = abs_difference(bpfn, ppfn);
+	list->first = pfn;
+}
+
+static inline void page_list_add_tail(struct page *page, struct page_list *list)
+{
+	uint16_t pfn = page_to_pfn(page);
 
-	if (ppfn < bpfn)
-		return page + diff;
+	page->next = PAGE_NIL;
+	page->prev = list->last;
 
-	return page - diff;
+	if (page_list_empty(list))
+		list->first = pfn;
+	else
+		pfn_to_page(list->last)->next = pfn;
+
+	list->last = pfn;
+}
+
+static inline void page_list_del(struct page *page, struct page_list *list)
+{
+	if (page->prev == PAGE_NIL)
+		list->first = page->next;
+	else
+		pfn_to_page(page->prev)->next = page->next;
+
+	if (page->next == PAGE_NIL)
+		list->last = page->prev;
+	else
+		pfn_to_page(page->next)->prev = page->prev;
+
+	page->next = PAGE_NIL;
+	page->prev = PAGE_NIL;
 }
 
 #endif /* __ELFBOOT_PAGE_H__ */
\ No newline at end of file
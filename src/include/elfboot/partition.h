@@ -0,0 +1,119 @@
+#ifndef __ELFBOOT_PARTITION_H__
+#define __ELFBOOT_PARTITION_H__
+
+#include <elfboot/core.h>
+#include <elfboot/linkage.h>
+#include <elfboot/bdev.h>
+
+#include <uapi/elfboot/const.h>
+
+/*
+ * Partitions
+ *
+ * The boot device is scanned for MBR (including logical partitions in
+ * extended partitions) and GPT partition tables when looking for the root
+ * partition. Each partition becomes a child block device which forwards its
+ * requests to the parent device with an offset of init_block.
+ */
+
+#define PARTITION_MAX_LOGICAL		32
+#define PARTITION_MAX_GPT_ENTRIES	128
+
+/*
+ * Master boot record
+ */
+
+#define MBR_SIGNATURE			0xAA55
+#define MBR_SIGNATURE_OFFSET		0x1FE
+#define MBR_TABLE_OFFSET		0x1BE
+#define MBR_TABLE_ENTRIES		4
+
+#define MBR_STATUS_ACTIVE		0x80
+
+#define MBR_TYPE_EMPTY			0x00
+#define MBR_TYPE_EXTENDED_CHS		0x05
+#define MBR_TYPE_EXTENDED_LBA		0x0f
+#define MBR_TYPE_LINUX			0x83
+#define MBR_TYPE_LINUX_EXTENDED		0x85
+#define MBR_TYPE_GPT			0xee
+
+#define mbr_type_extended(type)				\
+	((type) == MBR_TYPE_EXTENDED_CHS ||		\
+	 (type) == MBR_TYPE_EXTENDED_LBA ||		\
+	 (type) == MBR_TYPE_LINUX_EXTENDED)
+
+struct mbr_partition {
+	uint8_t status;
+	uint8_t chs_first[3];
+	uint8_t type;
+	uint8_t chs_last[3];
+	uint32_t lba;
+	uint32_t sectors;
+} __packed;
+
+/*
+ * GUID partition table
+ */
+
+#define GPT_HEADER_LBA			1
+#define GPT_SIGNATURE			"EFI PART"
+#define GPT_NAME_LENGTH			36
+
+/* Legacy BIOS bootable */
+#define GPT_ATTR_BOOTABLE_BIT		2
+#define GPT_ATTR_BOOTABLE		_BITULL(GPT_ATTR_BOOTABLE_BIT)
+
+/* 0FC63DAF-8483-4772-8E79-3D69D8477DE4, in on-disk byte order */
+#define GPT_TYPE_LINUX					\
+	{ 0xaf, 0x3d, 0xc6, 0x0f, 0x83, 0x84, 0x72, 0x47,	\
+	  0x8e, 0x79, 0x3d, 0x69, 0xd8, 0x47, 0x7d, 0xe4 }
+
+struct gpt_header {
+	char signature[8];
+	uint32_t revision;
+	uint32_t header_size;
+	uint32_t header_crc;
+	uint32_t _reserved;
+	uint64_t current_lba;
+	uint64_t backup_lba;
+	uint64_t first_lba;
+	uint64_t last_lba;
+	uint8_t disk_guid[16];
+	uint64_t entries_lba;
+	uint32_t num_entries;
+	uint32_t entry_size;
+	uint32_t entries_crc;
+} __packed;
+
+struct gpt_entry {
+	uint8_t type_guid[16];
+	uint8_t part_guid[16];
+	uint64_t first_lba;
+	uint64_t last_lba;
+	uint64_t attributes;
+	uint16_t name[GPT_NAME_LENGTH];
+} __packed;
+
+/*
+ * Partition information, stored in the private field of the child device
+ */
+
+#define PARTITION_BOOTABLE_BIT		0
+#define PARTITION_BOOTABLE		_BITUL(PARTITION_BOOTABLE_BIT)
+#define PARTITION_GPT_BIT		1
+#define PARTITION_GPT			_BITUL(PARTITION_GPT_BIT)
+
+struct partition {
+	struct bdev *parent;
+	uint32_t index;
+	uint32_t flags;
+
+	/* MBR partition type, or MBR_TYPE_GPT for GPT partitions */
+	uint8_t type;
+	uint8_t type_guid[16];
+	char label[GPT_NAME_LENGTH + 1];
+};
+
+struct bdev *partition_find_root(struct bdev *bdev);
+
+#endif /* __ELFBOOT_PARTITION_H__ */
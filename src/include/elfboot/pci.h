@@ -6,6 +6,8 @@
 
 #include <uapi/elfboot/const.h>
 
+#include <asm/pci.h>
+
 /*
  * PCI device enumeration defines
  */
@@ -21,6 +23,9 @@
 #define PCI_CONFIG_ADDR		0xcf8
 #define PCI_CONFIG_DATA		0xcfc
 
+/* Standard header of endpoints and bridges */
+#define PCI_HEADER_SIZE		0x40
+
 #define PCI_CONFIG_REGISTER(bus, slot, func, offset)	\
 	((1 << 31) | (bus << 16) | (slot << 11) | (func << 8) | offset)
 
@@ -44,7 +49,11 @@
 #define PCI_INVALID_DEVICE	(~0UL)
 #define PCI_ANY_ID			(~0UL)
 
+#define PCI_COMMAND_MEMORY		_BITUL(1)
 #define PCI_COMMAND_BUSMASTER	_BITUL(2)
+#define PCI_COMMAND_INTX_DISABLE	_BITUL(10)
+
+#define PCI_STATUS_CAP_LIST	_BITUL(4)
 
 #define PCI_CLASS_MASK		(~(_BITUL(8) - 1))
 	
@@ -72,12 +81,30 @@
 
 #define PCI_BAR_MASK		0xfffffffc
 
+#define PCI_BAR_IO			_BITUL(0)
+#define PCI_BAR_MEM_TYPE_64	0x04
+#define PCI_BAR_MEM_TYPE_MASK	0x06
+#define PCI_BAR_MEM_MASK	0xfffffff0
+
+/*
+ * PCI capabilities
+ */
+
+#define PCI_CAP_ID			0x00
+#define PCI_CAP_NEXT		0x01
+
+#define PCI_CAP_ID_MSI		0x05
+#define PCI_CAP_ID_VNDR		0x09
+#define PCI_CAP_ID_EXP		0x10
+#define PCI_CAP_ID_MSIX		0x11
+
 /*
  * PCI Header Type 0x00
  */
 
 #define PCI_PRIMARY_BUS		0x18
 #define PCI_SECONDARY_BUS	0x19
+#define PCI_SUBORDINATE_BUS	0x1A
 
 /*
  * PCI Classes and Subclasses
@@ -107,6 +134,9 @@
 #define PCI_CLASS_SATA 					\
 	PCI_DEVICE_CLASS(PCI_CLASS_STORAGE, PCI_SUBCLASS_STORAGE_SATA, 0x01)
 
+#define PCI_CLASS_NVME 					\
+	PCI_DEVICE_CLASS(PCI_CLASS_STORAGE, PCI_SUBCLASS_STORAGE_MEM, 0x02)
+
 #define PCI_CLASS_NETWORK				0x02
 #define PCI_SUBCLASS_NETWORK_ETH		0x00
 #define PCI_SUBCLASS_NETWORK_TOKEN		0x01
@@ -257,8 +287,27 @@ struct pci_dev_id {
 	 */
 
 	uint32_t class;
+
+	/*
+	 * Private to the driver, e.g. quirks of a specific device
+	 */
+
+	uint32_t driver_data;
 };
 
+/*
+ * Initializers for entries of a driver's match table, which ends with an
+ * empty entry
+ */
+
+#define PCI_ID_DEVICE(v, d)					\
+	.vendor = (v), .device = (d), .subvendor = PCI_ANY_ID,	\
+	.subdevice = PCI_ANY_ID, .class = PCI_ANY_ID
+
+#define PCI_ID_CLASS(c)						\
+	.vendor = PCI_ANY_ID, .device = PCI_ANY_ID,		\
+	.subvendor = PCI_ANY_ID, .subdevice = PCI_ANY_ID, .class = (c)
+
 struct pci_dev {
 	struct pci_address addr;
 
@@ -299,11 +348,22 @@ struct pci_dev {
 	uint32_t subvendor;
 	uint32_t subdevice;
 
+	/*
+	 * Legacy IRQ routed to INTx# by the firmware
+	 */
+	uint8_t irq;
+
 	/*
 	 * Parent PCI device
 	 */
 	struct pci_dev *parent;
 
+	/*
+	 * Bound driver and its private data for this function
+	 */
+	struct pci_driver *driver;
+	void *private;
+
 	/*
 	 * List of registered PCI devices
 	 */
@@ -311,6 +371,18 @@ struct pci_dev {
 	struct list_head list;
 };
 
+struct pci_driver {
+	const char *name;
+	const struct pci_dev_id *ids;
+
+	/*
+	 * Called for every function matching one of the IDs which is not yet
+	 * bound to a driver. The function is bound on success.
+	 */
+
+	int (*probe)(struct pci_dev *pcidev, const struct pci_dev_id *id);
+};
+
 /*
  * PCI device utility functions for reading and writing
  */
@@ -329,12 +401,16 @@ void pci_write_config_long(struct pci_address *addr, uint8_t offset, uint32_t va
 
 void pci_set_master(struct pci_dev *pcidev);
 
-struct pci_dev *pci_get_device(uint16_t vendor, uint16_t device, struct pci_dev *prev);
+void pci_enable_intx(struct pci_dev *pcidev);
 
-struct pci_dev *pci_get_class(uint32_t class, struct pci_dev *prev);
+uint8_t pci_find_capability(struct pci_dev *pcidev, uint8_t id, uint8_t from);
+
+void *pci_map_bar(struct pci_dev *pcidev, uint8_t bar);
 
 struct pci_dev *pci_find_device(uint16_t bus, uint16_t slot, uint16_t func);
 
+int pci_register_driver(struct pci_driver *driver);
+
 int pci_init(void);
 
 #endif /* __ELFBOOT_PCI_H__ */
\ No newline at end of file
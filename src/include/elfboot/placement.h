@@ -0,0 +1,63 @@
+#ifndef __ELFBOOT_PLACEMENT_H__
+#define __ELFBOOT_PLACEMENT_H__
+
+#include <elfboot/core.h>
+#include <elfboot/memblock.h>
+
+#include <uapi/elfboot/const.h>
+
+/*
+ * Placement planner
+ *
+ * Loaders describe every image they are going to put into memory above
+ * 1 MB (kernel segments, initrds, modules, information structures) before
+ * reading a single byte from disk. The planner then computes a layout in
+ * which no two images overlap and each of them lies within usable memory
+ * according to memblock.kernmem. The layout is only committed if every
+ * image could be placed, so a loader never has to undo a partial load.
+ */
+
+#define PLACEMENT_MAX_IMAGES		16
+
+/* The image has to be loaded at exactly the requested address */
+#define PLACEMENT_FIXED_BIT		0
+#define PLACEMENT_FIXED			_BITUL(PLACEMENT_FIXED_BIT)
+/* Choose the highest suitable address instead of the lowest one */
+#define PLACEMENT_TOPDOWN_BIT		1
+#define PLACEMENT_TOPDOWN		_BITUL(PLACEMENT_TOPDOWN_BIT)
+
+struct placement {
+	const char *name;
+	uint32_t flags;
+	uint32_t addr;
+	uint32_t size;
+	uint32_t align;
+	uint32_t start;
+	uint32_t end;
+};
+
+struct placement_plan {
+	uint32_t cnt;
+	struct placement images[PLACEMENT_MAX_IMAGES];
+};
+
+static inline void placement_init(struct placement_plan *plan)
+{
+	plan->cnt = 0;
+}
+
+struct placement *placement_add(struct placement_plan *plan, const char *name,
+	uint32_t size, uint32_t align, uint32_t start, uint32_t end,
+	uint32_t flags);
+
+struct placement *placement_add_fixed(struct placement_plan *plan,
+	const char *name, uint32_t addr, uint32_t size);
+
+int placement_commit(struct placement_plan *plan);
+
+static inline void *placement_ptr(struct placement *image)
+{
+	return tvptr(image->addr);
+}
+
+#endif /* __ELFBOOT_PLACEMENT_H__ */
\ No newline at end of file
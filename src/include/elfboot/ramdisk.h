@@ -0,0 +1,22 @@
+#ifndef __ELFBOOT_RAMDISK_H__
+#define __ELFBOOT_RAMDISK_H__
+
+#include <elfboot/core.h>
+#include <elfboot/bdev.h>
+
+/*
+ * Ramdisks
+ *
+ * A ramdisk is a block device on top of a range of physical memory, e.g. an
+ * image which has been loaded by a previous boot stage. Reads are a plain
+ * memcpy and file systems can map the blocks directly.
+ */
+
+#define RAMDISK_BLOCK_SIZE		512
+
+struct bdev *ramdisk_create(uint32_t addr, uint32_t size,
+	uint16_t block_size);
+
+int ramdisk_init(void);
+
+#endif /* __ELFBOOT_RAMDISK_H__ */
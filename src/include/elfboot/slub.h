@@ -2,6 +2,7 @@
 #define __ELFBOOT_SLUB_H__
 
 #include <elfboot/core.h>
+#include <elfboot/page.h>
 
 #include <uapi/elfboot/const.h>
 
@@ -31,11 +32,15 @@ struct bmem_info {
  * no multiple CPUs.
  *
  * Fourth: The freelist pointer used in the Linux kernel is used
- * differently: We use a list_head structure instead and link free
- * objects together. That way we don't need so allocate freelists
- * in order to keep track of free objects for allocations.
+ * differently: We store the 16-bit index of the next free object
+ * in the first bytes of each free object and keep the index of the
+ * first free object in the slab page. That way we don't need to
+ * allocate freelists in order to keep track of free objects and
+ * objects can be as small as two bytes.
  */
 
+#define BMEM_FREELIST_END	0xffff
+
 struct bmem_cache {
 	const char *name;
 	uint32_t size;
@@ -44,9 +49,9 @@ struct bmem_cache {
 	uint32_t free_objs;
 	uint32_t free_slabs;
 	uint32_t total_slabs;
-	struct list_head slabs_full;
-	struct list_head slabs_partial;
-	struct list_head slabs_free;
+	struct page_list slabs_full;
+	struct page_list slabs_partial;
+	struct page_list slabs_free;
 	void (*ctor)(void *);
 	struct list_head next;
 };
@@ -4,6 +4,8 @@
 #include <elfboot/core.h>
 #include <elfboot/linkage.h>
 
+#include <asm/time.h>
+
 /*
  * We only directly work with milliseconds as the time unit. Use the following
  * macros to convert other time units to milliseconds or back.
@@ -12,4 +14,40 @@
 #define TIME_SECSTOMILLI(x)			(x) * 1000
 #define TIME_MILLITOSECS(x)			(x) / 1000
 
+/*
+ * Raw timestamp counter, only suitable for measuring intervals.
+ */
+
+static inline uint64_t timestamp(void)
+{
+	return arch_timestamp();
+}
+
+/*
+ * Timeouts are deadlines on the timestamp counter. The counter frequency is
+ * calibrated on first use.
+ */
+
+static inline uint64_t timestamp_deadline(uint32_t msecs)
+{
+	return timestamp() + (uint64_t)msecs * arch_timestamp_khz();
+}
+
+static inline bool timestamp_expired(uint64_t deadline)
+{
+	return timestamp() >= deadline;
+}
+
+static inline bool timestamp_elapsed(uint64_t start, uint32_t msecs)
+{
+	return timestamp() - start >= (uint64_t)msecs * arch_timestamp_khz();
+}
+
+static inline void mdelay(uint32_t msecs)
+{
+	uint64_t deadline = timestamp_deadline(msecs);
+
+	while (!timestamp_expired(deadline));
+}
+
 #endif /* __ELFBOOT_TIME_H__ */
\ No newline at end of file
@@ -0,0 +1,200 @@
+#ifndef __ELFBOOT_VIRTIO_H__
+#define __ELFBOOT_VIRTIO_H__
+
+#include <elfboot/core.h>
+#include <elfboot/pci.h>
+
+#include <uapi/elfboot/const.h>
+
+/*
+ * Virtio over PCI (modern transport, virtio 1.0)
+ *
+ * Transitional devices use the legacy device IDs but provide the modern
+ * interface as well, which is the only one we support.
+ */
+
+#define VIRTIO_PCI_VENDOR		0x1af4
+#define VIRTIO_PCI_LEGACY_ID(type)	(0x0fff + (type))
+#define VIRTIO_PCI_MODERN_ID(type)	(0x1040 + (type))
+
+#define VIRTIO_ID_NET			1
+#define VIRTIO_ID_BLOCK			2
+
+/* Vendor specific PCI capabilities describing the register layout */
+#define VIRTIO_PCI_CAP_COMMON_CFG	1
+#define VIRTIO_PCI_CAP_NOTIFY_CFG	2
+#define VIRTIO_PCI_CAP_ISR_CFG		3
+#define VIRTIO_PCI_CAP_DEVICE_CFG	4
+
+#define VIRTIO_PCI_CAP_CFG_TYPE		3
+#define VIRTIO_PCI_CAP_BAR		4
+#define VIRTIO_PCI_CAP_OFFSET		8
+#define VIRTIO_PCI_CAP_LENGTH		12
+#define VIRTIO_PCI_NOTIFY_MULTIPLIER	16
+
+/* Device status */
+#define VIRTIO_STATUS_ACKNOWLEDGE	0x01
+#define VIRTIO_STATUS_DRIVER		0x02
+#define VIRTIO_STATUS_DRIVER_OK		0x04
+#define VIRTIO_STATUS_FEATURES_OK	0x08
+#define VIRTIO_STATUS_NEEDS_RESET	0x40
+#define VIRTIO_STATUS_FAILED		0x80
+
+/* Device independent feature bits */
+#define VIRTIO_F_INDIRECT_DESC		28
+#define VIRTIO_F_VERSION_1		32
+
+#define VIRTIO_FEATURE(bit)		(1ULL << (bit))
+
+/* Timeout of a device reset in milliseconds */
+#define VIRTIO_RESET_TIMEOUT		1000
+
+struct virtio_pci_common_cfg {
+	uint32_t device_feature_select;
+	uint32_t device_feature;
+	uint32_t driver_feature_select;
+	uint32_t driver_feature;
+	uint16_t msix_config;
+	uint16_t num_queues;
+	uint8_t  device_status;
+	uint8_t  config_generation;
+
+	uint16_t queue_select;
+	uint16_t queue_size;
+	uint16_t queue_msix_vector;
+	uint16_t queue_enable;
+	uint16_t queue_notify_off;
+	uint32_t queue_desc_lo;
+	uint32_t queue_desc_hi;
+	uint32_t queue_driver_lo;
+	uint32_t queue_driver_hi;
+	uint32_t queue_device_lo;
+	uint32_t queue_device_hi;
+} __packed;
+
+/*
+ * Split virtqueues
+ */
+
+#define VIRTQ_DESC_F_NEXT		1
+#define VIRTQ_DESC_F_WRITE		2
+#define VIRTQ_DESC_F_INDIRECT		4
+
+#define VIRTQ_AVAIL_F_NO_INTERRUPT	1
+
+/* Ring size we ask for, devices may offer less */
+#define VIRTQ_MAX_SIZE			128
+
+#define VIRTQ_END			0xffff
+
+struct virtq_desc {
+	uint64_t addr;
+	uint32_t len;
+	uint16_t flags;
+	uint16_t next;
+} __packed;
+
+struct virtq_avail {
+	uint16_t flags;
+	uint16_t idx;
+	uint16_t ring[];
+} __packed;
+
+struct virtq_used_elem {
+	uint32_t id;
+	uint32_t len;
+} __packed;
+
+struct virtq_used {
+	uint16_t flags;
+	uint16_t idx;
+	struct virtq_used_elem ring[];
+} __packed;
+
+struct virtio_dev {
+	struct pci_dev *pcidev;
+
+	volatile struct virtio_pci_common_cfg *common;
+	volatile uint8_t *isr;
+	volatile void *device;
+
+	volatile uint8_t *notify;
+	uint32_t notify_mult;
+
+	/* Features both the device and the driver agreed upon */
+	uint64_t features;
+};
+
+struct virtqueue {
+	struct virtio_dev *vdev;
+	uint16_t index;
+	uint16_t size;
+
+	/* Indirect descriptors were negotiated for this device */
+	bool indirect;
+
+	struct virtq_desc *desc;
+	struct virtq_avail *avail;
+	volatile struct virtq_used *used;
+	volatile uint16_t *notify;
+
+	/*
+	 * Free descriptors are chained through their next field. The last used
+	 * index is the position in the used ring we haven't looked at yet.
+	 */
+	uint16_t free_head;
+	uint16_t num_free;
+	uint16_t last_used;
+
+	/* Cookies of the buffers in flight, indexed by head descriptor */
+	void **data;
+};
+
+static inline bool virtio_has_feature(struct virtio_dev *vdev, uint32_t bit)
+{
+	return (vdev->features & VIRTIO_FEATURE(bit)) != 0;
+}
+
+/*
+ * virtio_init: Find the register layout and reset the device
+ *
+ * Once the device is reset, the driver negotiates its features with the
+ * mask of features it supports, sets up its virtqueues and finally tells
+ * the device that it's ready.
+ */
+int virtio_init(struct virtio_dev *vdev, struct pci_dev *pcidev);
+
+int virtio_negotiate(struct virtio_dev *vdev, uint64_t features);
+
+void virtio_driver_ok(struct virtio_dev *vdev);
+
+void virtio_reset(struct virtio_dev *vdev);
+
+int virtqueue_init(struct virtio_dev *vdev, struct virtqueue *vq,
+	uint16_t index);
+
+void virtqueue_free(struct virtqueue *vq);
+
+/*
+ * virtqueue_add: Make a buffer available to the device
+ *
+ * The buffer is described by an array of descriptors, device readable ones
+ * first. Only the address, length and write flags have to be set. With
+ * indirect descriptors, the array itself is handed to the device and has
+ * to stay around until the buffer was used. Otherwise, every entry takes
+ * a slot in the ring. Returns -EAGAIN if the ring is full.
+ */
+int virtqueue_add(struct virtqueue *vq, struct virtq_desc *descs,
+	uint16_t num, void *data);
+
+void virtqueue_kick(struct virtqueue *vq);
+
+/*
+ * virtqueue_get: Get the next buffer the device is done with
+ *
+ * Returns the cookie passed to virtqueue_add and the number of bytes the
+ * device has written, or NULL if there is no used buffer.
+ */
+void *virtqueue_get(struct virtqueue *vq, uint32_t *len);
+
+#endif /* __ELFBOOT_VIRTIO_H__ */
@@ -0,0 +1,77 @@
+#ifndef __FS_HTTPFS_H__
+#define __FS_HTTPFS_H__
+
+#include <elfboot/core.h>
+#include <elfboot/linkage.h>
+#include <elfboot/net.h>
+
+#define FS_HTTP				"HTTP"
+
+/*
+ * The file system is mounted to /http, its directories are the servers,
+ * e.g. /http/10.0.2.2:8000/vmlinuz. There is no DNS.
+ */
+#define HTTP_MOUNTPOINT			"http"
+
+#define HTTP_PORT			80
+
+#define HTTP_MAX_HOST			32
+#define HTTP_MAX_PATH			512
+#define HTTP_MAX_REQUEST		(HTTP_MAX_PATH + 128)
+#define HTTP_MAX_HEADER			2048
+
+/* Time without any progress until a request fails (ms) */
+#define HTTP_TIMEOUT			5000
+
+/* The response has no length, the body ends with the connection */
+#define HTTP_LENGTH_UNKNOWN		(~0ULL)
+
+/* Response states */
+#define HTTP_STATE_IDLE			0
+#define HTTP_STATE_HEADER		1
+#define HTTP_STATE_BODY			2
+#define HTTP_STATE_DONE			3
+
+struct http_host {
+	/* Server address as in the path, used for the Host header */
+	char name[HTTP_MAX_HOST];
+	uint32_t addr;
+	uint16_t port;
+
+	/* Connections are kept open between requests */
+	struct netdev *netdev;
+	struct tcp_socket sock;
+	bool connected;
+	bool keep_alive;
+
+	/* Response being received */
+	int state;
+	int error;
+	bool head;
+	uint32_t status;
+
+	char *header;
+	uint32_t hlen;
+
+	/* File offsets of the body */
+	uint64_t body_pos;
+	uint64_t body_end;
+	uint64_t length;
+
+	/*
+	 * Destination of the current read. The body is copied straight from
+	 * the received segments.
+	 */
+	uint8_t *dst;
+	uint64_t req_off;
+	uint64_t req_end;
+};
+
+struct http_file {
+	/* Absolute path on the server, empty for the server itself */
+	char *path;
+
+	struct http_host *host;
+};
+
+#endif /* __FS_HTTPFS_H__ */
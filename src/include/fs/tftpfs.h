@@ -0,0 +1,97 @@
+#ifndef __FS_TFTPFS_H__
+#define __FS_TFTPFS_H__
+
+#include <elfboot/core.h>
+#include <elfboot/linkage.h>
+#include <elfboot/net.h>
+
+#define FS_TFTP				"TFTP"
+
+/* The file system is mounted to /net */
+#define TFTP_MOUNTPOINT			"net"
+
+#define TFTP_PORT			69
+
+/* Opcodes */
+#define TFTP_RRQ			1
+#define TFTP_WRQ			2
+#define TFTP_DATA			3
+#define TFTP_ACK			4
+#define TFTP_ERROR			5
+#define TFTP_OACK			6
+
+#define TFTP_ERR_UNDEFINED		0
+#define TFTP_ERR_NOT_FOUND		1
+
+#define TFTP_HLEN			4
+
+/*
+ * Without options (RFC 2347), blocks have 512 bytes and every block is
+ * acknowledged. We ask for the largest blocks that fit into one frame
+ * (RFC 2348), for several blocks per acknowledgement (RFC 7440) and for
+ * the size of the file (RFC 2349).
+ */
+#define TFTP_DEFAULT_BLKSIZE		512
+#define TFTP_MAX_BLKSIZE		(UDP_MAX_PAYLOAD - TFTP_HLEN)
+
+#define TFTP_MAX_REQUEST		512
+#define TFTP_MAX_PATH			(TFTP_MAX_REQUEST - 64)
+
+/* The server didn't tell us the size of the file */
+#define TFTP_TSIZE_UNKNOWN		0xffffffff
+
+/* Time to wait for the server in milliseconds and number of retries */
+#define TFTP_TIMEOUT			1000
+#define TFTP_RETRIES			5
+
+struct tftp_mount {
+	struct netdev *netdev;
+	uint32_t server;
+};
+
+struct tftp_file {
+	/* Path on the server, relative to its root */
+	char *path;
+
+	struct tftp_mount *mnt;
+	struct udp_socket sock;
+	bool active;
+
+	/*
+	 * Negotiated transfer parameters. The port of the server is the transfer
+	 * ID, it is only known after the first reply.
+	 */
+	uint16_t tid;
+	uint16_t blksize;
+	uint16_t windowsize;
+	uint32_t tsize;
+	bool oack;
+
+	/*
+	 * Blocks received in order and the file offset behind the last one. The
+	 * block number on the wire is only 16 bits wide and wraps around.
+	 */
+	uint32_t block;
+	uint32_t inwin;
+	uint64_t pos;
+	bool last;
+
+	/* The server waits for an acknowledgement of the current block */
+	bool need_ack;
+	bool nak_sent;
+	int error;
+
+	/* Destination of the current read */
+	uint8_t *dst;
+	uint64_t req_off;
+	uint64_t req_end;
+
+	/* Reads may end within a block, the rest of it is kept here */
+	uint8_t *cache;
+	uint64_t cache_pos;
+	uint32_t cache_len;
+
+	uint64_t start;
+};
+
+#endif /* __FS_TFTPFS_H__ */
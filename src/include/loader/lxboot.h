@@ -1,12 +1,37 @@
 #ifndef __ELFBOOT_LOADER_LXBOOT_H__
 #define __ELFBOOT_LOADER_LXBOOT_H__
 
+#include <elfboot/core.h>
+#include <elfboot/linkage.h>
+
+#include <uapi/asm/bootparam.h>
+
 #define DRIVER_LXBOOT				"LXB"
 
 #define LXBOOT_BZIMAGE_SIGNATURE	0x53726448
 
 #define LXBOOT_KERNEL_ADDR			0x00100000
-#define LXBOOT_INITRD_ADDR			0x01000000
+#define LXBOOT_INITRD_ADDR_MAX		0x37ffffff
+
+#define LXBOOT_LOADED_HIGH			0x01
+
+/* The command line limit before protocol version 2.06 */
+#define LXBOOT_CMDLINE_SIZE			255
+
+/*
+ * Segments expected by the 32-bit entry point, both are flat 4 GiB
+ */
+#define LXBOOT_BOOT_CS				0x10
+#define LXBOOT_BOOT_DS				0x18
+
+#define LXBOOT_GDT_CODE				0x00cf9a000000ffffULL
+#define LXBOOT_GDT_DATA				0x00cf92000000ffffULL
+
+#define LXBOOT_E820_MAX_ENTRIES		128
+
+/* Text mode information, as the real mode setup code stores it */
+#define LXBOOT_VIDEO_MODE_MONO		0x07
+#define LXBOOT_VIDEO_TYPE_VGA		0x01
 
 struct lxboot_rm_header {
 	uint8_t setup_sects;
@@ -49,14 +74,54 @@ struct lxboot_rm_header {
 	uint32_t handover_offset;
 } __packed;
 
+struct lxboot_screen_info {
+	uint8_t orig_x;
+	uint8_t orig_y;
+	uint16_t ext_mem_k;
+	uint16_t orig_video_page;
+	uint8_t orig_video_mode;
+	uint8_t orig_video_cols;
+	uint8_t flags;
+	uint8_t _unused2;
+	uint16_t orig_video_ega_bx;
+	uint16_t _unused3;
+	uint8_t orig_video_lines;
+	uint8_t orig_video_isVGA;
+	uint16_t orig_video_points;
+	uint8_t _reserved[0x2e];
+} __packed;
+
+/*
+ * The zero page, i.e. struct boot_params of the kernel. It is usually filled
+ * by the real mode setup code, with the 32-bit entry point it is our job.
+ * Only the fields we fill in are named.
+ */
+struct lxboot_params {
+	struct lxboot_screen_info screen_info;
+	uint8_t _pad1[0x1e0 - 0x040];
+	uint32_t alt_mem_k;
+	uint32_t scratch;
+	uint8_t e820_entries;
+	uint8_t _pad2[0x1f1 - 0x1e9];
+	struct lxboot_rm_header hdr;
+	uint8_t _pad3[0x2d0 - 0x1f1 - sizeof(struct lxboot_rm_header)];
+	struct e820_entry e820_table[LXBOOT_E820_MAX_ENTRIES];
+	uint8_t _pad4[0x1000 - 0x2d0 - LXBOOT_E820_MAX_ENTRIES *
+		sizeof(struct e820_entry)];
+} __packed;
+
 struct lxboot_info {
 	uint32_t signature;
 	uint16_t bprotvers;
 	uint8_t rmcodesec;
 	uint32_t rmcodelen;
 	uint32_t pmcodelen;
+	uint32_t pmcodeadr;
+	uint32_t initrdlen;
+	uint32_t initrdadr;
 	struct lxboot_rm_header *rmcodehdr;
 	void *rmcodebuf;
+	struct lxboot_params *params;
 };
 
 #endif /* __ELFBOOT_LOADER_LXBOOT_H__ */
\ No newline at end of file
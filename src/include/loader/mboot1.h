@@ -2,6 +2,7 @@
 #define __ELFBOOT_LOADER_MBOOT1_H__
 
 #include <elfboot/linkage.h>
+#include <elfboot/libelf.h>
 
 #define DRIVER_MBOOT1				"MB1"
 
@@ -169,6 +170,8 @@ struct mboot1_info {
 	uint32_t align;
 	struct multiboot_header *header;
 	struct multiboot_info *mbinfo;
+	Elf32_Ehdr *ehdr;
+	Elf32_Phdr *phdrs;
 };
 
 #define MBOOT1_SEARCH_LIMIT		MBOOT1_SEARCH - sizeof(struct multiboot_header)
@@ -76,4 +76,13 @@
 #define fptr(ptr)					\
 	tvptr(fptr_val((ptr) >> 16, (ptr) & 0xffff))
 
+/*
+ * fptr_make:
+ *
+ * Get the normalized real mode segment-offset address of
+ * an address below 1 MB. The offset is always below 16.
+ */
+#define fptr_make(addr)					\
+	((((addr) >> 4) << 16) | ((addr) & 0xf))
+
 #endif /* __UAPI_ELFBOOT_COMMON_H__ */
\ No newline at end of file
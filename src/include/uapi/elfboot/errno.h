@@ -41,5 +41,10 @@
 #define ENOLCK		34	/* No locks available */
 #define ENOTSUP		35	/* Unsupported value */
 #define EMSGSIZE	36	/* Message size */
+#define ETIMEDOUT	37	/* Timed out */
+#define EHOSTUNREACH	38	/* No route to host */
+#define ECONNREFUSED	39	/* Connection refused */
+#define ECONNRESET	40	/* Connection reset by peer */
+#define ENOTCONN	41	/* Transport endpoint is not connected */
 
 #endif /* __UAPI_ELFBOOT_ERRNO_H__ */
\ No newline at end of file
@@ -27,6 +27,37 @@ bool libata_has_lba48_support(uint16_t *params)
 	return !!(libata_read(params, 83, 1) & ATA_SUPPORT_ADDRESS48);
 }
 
+bool libata_has_dma_support(uint16_t *params)
+{
+	return !!(libata_read(params, 49, 1) & ATA_SUPPORT_DMA);
+}
+
+/*
+ * libata_has_ncq_support, libata_queue_depth: Native Command Queuing
+ *
+ * SATA devices report whether they support NCQ and how many commands they
+ * are able to queue at most. The queue depth is only valid with NCQ.
+ */
+bool libata_has_ncq_support(uint16_t *params)
+{
+	return !!(libata_read(params, 76, 1) & ATA_SUPPORT_NCQ);
+}
+
+uint32_t libata_queue_depth(uint16_t *params)
+{
+	return ATA_QUEUE_LEN(libata_read(params, 75, 1)) + 1;
+}
+
+/*
+ * libata_max_multiple: Sectors per DRQ block of READ/WRITE MULTIPLE
+ *
+ * Zero means that the device doesn't support the multiple commands.
+ */
+uint32_t libata_max_multiple(uint16_t *params)
+{
+	return ATA_MULTIPLE_MAX(libata_read(params, 47, 1));
+}
+
 /*
  * libata_cylinders, libata_heads, libata_sectors_per_track: CHS addressing
  *
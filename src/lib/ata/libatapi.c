@@ -0,0 +1,168 @@
+#include <elfboot/core.h>
+#include <elfboot/libatapi.h>
+#include <elfboot/time.h>
+#include <elfboot/string.h>
+#include <elfboot/printf.h>
+
+#include <drivers/scsi.h>
+
+static int libatapi_request_sense(struct libatapi_dev *atapi)
+{
+	struct scsi_request_sense_data rsd = { 0 };
+	struct scsi_request_sense rs = {
+		.cmd = SCSI_CMD_REQUEST_SENSE,
+		.len = sizeof(rsd)
+	};
+	int ret;
+
+	/*
+	 * A check condition of REQUEST SENSE itself can't be resolved, so it
+	 * counts as a failure like any other error.
+	 */
+	ret = atapi->send(atapi, &rs, &rsd, sizeof(rsd));
+	if (ret)
+		return ret;
+
+	switch (SCSI_SENSE_RESPONSE(rsd.error_code)) {
+		case 0x70:
+		case 0x71:
+			break;
+		default:
+			return -EIO;
+	}
+
+	atapi->sense_key = SCSI_SENSE_KEY(rsd.sense_key);
+	atapi->asc = rsd.additional_sense_code;
+	atapi->ascq = rsd.additional_sense_code_qualifier;
+
+	return 0;
+}
+
+/*
+ * Returns 0 if the command succeeded after all, -EAGAIN if it can be issued
+ * again right away, -EBUSY if we have to wait for the device first and any
+ * other error if the command failed.
+ */
+static int libatapi_check_sense(struct libatapi_dev *atapi)
+{
+	switch (atapi->sense_key) {
+		case SCSI_SENSE_RECOVERED_ERROR:
+			return 0;
+
+		case SCSI_SENSE_NO_SENSE:
+		case SCSI_SENSE_ABORTED_COMMAND:
+			return -EAGAIN;
+
+		case SCSI_SENSE_UNIT_ATTENTION:
+			atapi->stats.unit_attentions++;
+			return -EAGAIN;
+
+		case SCSI_SENSE_NOT_READY:
+			atapi->stats.not_ready++;
+
+			if (atapi->asc == SCSI_ASC_NO_MEDIUM)
+				return -ENODEV;
+
+			return -EBUSY;
+
+		default:
+			return -EIO;
+	}
+}
+
+int libatapi_command(struct libatapi_dev *atapi, void *packet, void *buffer,
+	size_t buflen)
+{
+	uint32_t retries = 0, backoff = LIBATAPI_BACKOFF;
+	int ret;
+
+	while (true) {
+		atapi->stats.commands++;
+
+		ret = atapi->send(atapi, packet, buffer, buflen);
+		if (ret != -EIO)
+			break;
+
+		atapi->stats.check_conditions++;
+
+		ret = libatapi_request_sense(atapi);
+		if (!ret)
+			ret = libatapi_check_sense(atapi);
+
+		if ((ret != -EAGAIN && ret != -EBUSY) ||
+		    retries++ == LIBATAPI_RETRIES)
+			break;
+
+		atapi->stats.retries++;
+
+		if (ret == -EBUSY) {
+			mdelay(backoff);
+
+			backoff <<= 1;
+			if (backoff > LIBATAPI_BACKOFF_MAX)
+				backoff = LIBATAPI_BACKOFF_MAX;
+		}
+	}
+
+	if (!ret)
+		return 0;
+
+	atapi->stats.failures++;
+
+	bprintln("ATAPI: %s: Command %02x failed (%d), sense %x/%02x/%02x",
+		atapi->bdev->name, *(uint8_t *)packet, ret, atapi->sense_key,
+		atapi->asc, atapi->ascq);
+
+	return (ret == -EAGAIN || ret == -EBUSY) ? -EIO : ret;
+}
+
+int libatapi_read_capacity(struct libatapi_dev *atapi)
+{
+	struct scsi_read_capacity10_data rcd;
+	struct scsi_read_capacity10 rc = {
+		.cmd = SCSI_CMD_READ_CAPACITY10
+	};
+	int ret;
+
+	ret = libatapi_command(atapi, &rc, &rcd, sizeof(rcd));
+	if (ret)
+		return ret;
+
+	atapi->bdev->last_block = betocpu32(rcd.last_block);
+	atapi->bdev->block_size = betocpu32(rcd.block_size);
+
+	return 0;
+}
+
+int libatapi_read(struct libatapi_dev *atapi, uint64_t lba, uint64_t num,
+	void *buffer)
+{
+	struct bdev *bdev = atapi->bdev;
+	struct scsi_xfer12 xf;
+	uint32_t count, length;
+	int ret;
+
+	while (num) {
+		count = min(num, (uint64_t)UINT32_MAX);
+		if (bdev->max_blocks && count > bdev->max_blocks)
+			count = bdev->max_blocks;
+
+		length = count << bdev->block_logs;
+
+		memset(&xf, 0, sizeof(xf));
+
+		xf.cmd = SCSI_CMD_READ12;
+		xf.lba = cputobe32(lba);
+		xf.num = cputobe32(count);
+
+		ret = libatapi_command(atapi, &xf, buffer, length);
+		if (ret)
+			return ret;
+
+		lba    += count;
+		num    -= count;
+		buffer  = vptradd(buffer, length);
+	}
+
+	return 0;
+}
@@ -0,0 +1,335 @@
+#include <elfboot/core.h>
+#include <elfboot/compiler.h>
+#include <elfboot/mm.h>
+#include <elfboot/pci.h>
+#include <elfboot/time.h>
+#include <elfboot/virtio.h>
+#include <elfboot/printf.h>
+
+/*
+ * Virtio PCI transport
+ */
+
+static volatile void *virtio_map_cap(struct virtio_dev *vdev, uint8_t pos)
+{
+	struct pci_address *addr = &vdev->pcidev->addr;
+	uint8_t *base;
+
+	base = pci_map_bar(vdev->pcidev,
+		pci_read_config_byte(addr, pos + VIRTIO_PCI_CAP_BAR));
+	if (!base)
+		return NULL;
+
+	return base + pci_read_config_long(addr, pos + VIRTIO_PCI_CAP_OFFSET);
+}
+
+static int virtio_find_caps(struct virtio_dev *vdev)
+{
+	struct pci_address *addr = &vdev->pcidev->addr;
+	uint8_t pos = 0;
+
+	/*
+	 * There may be multiple capabilities of the same type, the first one
+	 * we are able to use is the preferred one.
+	 */
+	while ((pos = pci_find_capability(vdev->pcidev, PCI_CAP_ID_VNDR, pos))) {
+		switch (pci_read_config_byte(addr, pos + VIRTIO_PCI_CAP_CFG_TYPE)) {
+			case VIRTIO_PCI_CAP_COMMON_CFG:
+				if (!vdev->common)
+					vdev->common = virtio_map_cap(vdev, pos);
+				break;
+
+			case VIRTIO_PCI_CAP_NOTIFY_CFG:
+				if (vdev->notify)
+					break;
+
+				vdev->notify = virtio_map_cap(vdev, pos);
+				vdev->notify_mult = pci_read_config_long(addr,
+					pos + VIRTIO_PCI_NOTIFY_MULTIPLIER);
+				break;
+
+			case VIRTIO_PCI_CAP_ISR_CFG:
+				if (!vdev->isr)
+					vdev->isr = virtio_map_cap(vdev, pos);
+				break;
+
+			case VIRTIO_PCI_CAP_DEVICE_CFG:
+				if (!vdev->device)
+					vdev->device = virtio_map_cap(vdev, pos);
+				break;
+		}
+	}
+
+	if (!vdev->common || !vdev->notify || !vdev->device)
+		return -ENODEV;
+
+	return 0;
+}
+
+void virtio_reset(struct virtio_dev *vdev)
+{
+	uint64_t deadline = timestamp_deadline(VIRTIO_RESET_TIMEOUT);
+
+	vdev->common->device_status = 0;
+
+	while (vdev->common->device_status && !timestamp_expired(deadline))
+		;
+}
+
+int virtio_init(struct virtio_dev *vdev, struct pci_dev *pcidev)
+{
+	int ret;
+
+	vdev->pcidev = pcidev;
+
+	ret = virtio_find_caps(vdev);
+	if (ret)
+		return ret;
+
+	pci_set_master(pcidev);
+
+	virtio_reset(vdev);
+	if (vdev->common->device_status)
+		return -ETIMEDOUT;
+
+	vdev->common->device_status = VIRTIO_STATUS_ACKNOWLEDGE;
+	vdev->common->device_status |= VIRTIO_STATUS_DRIVER;
+
+	return 0;
+}
+
+int virtio_negotiate(struct virtio_dev *vdev, uint64_t features)
+{
+	volatile struct virtio_pci_common_cfg *common = vdev->common;
+	uint64_t offered;
+
+	common->device_feature_select = 0;
+	offered = common->device_feature;
+	common->device_feature_select = 1;
+	offered |= (uint64_t)common->device_feature << 32;
+
+	/* Legacy devices are not supported */
+	features |= VIRTIO_FEATURE(VIRTIO_F_VERSION_1);
+	vdev->features = offered & features;
+
+	if (!virtio_has_feature(vdev, VIRTIO_F_VERSION_1))
+		goto virtio_negotiate_failed;
+
+	common->driver_feature_select = 0;
+	common->driver_feature = vdev->features & 0xffffffff;
+	common->driver_feature_select = 1;
+	common->driver_feature = vdev->features >> 32;
+
+	common->device_status |= VIRTIO_STATUS_FEATURES_OK;
+	if (!(common->device_status & VIRTIO_STATUS_FEATURES_OK))
+		goto virtio_negotiate_failed;
+
+	return 0;
+
+virtio_negotiate_failed:
+	common->device_status |= VIRTIO_STATUS_FAILED;
+
+	return -ENODEV;
+}
+
+void virtio_driver_ok(struct virtio_dev *vdev)
+{
+	vdev->common->device_status |= VIRTIO_STATUS_DRIVER_OK;
+}
+
+/*
+ * Split virtqueues
+ */
+
+int virtqueue_init(struct virtio_dev *vdev, struct virtqueue *vq,
+	uint16_t index)
+{
+	volatile struct virtio_pci_common_cfg *common = vdev->common;
+	uint16_t i, size;
+
+	common->queue_select = index;
+
+	/* Queue sizes are powers of two, so is our maximum */
+	size = common->queue_size;
+	if (!size)
+		return -ENOENT;
+
+	size = min(size, VIRTQ_MAX_SIZE);
+
+	vq->vdev = vdev;
+	vq->index = index;
+	vq->size = size;
+	vq->indirect = virtio_has_feature(vdev, VIRTIO_F_INDIRECT_DESC);
+
+	/*
+	 * The allocator aligns objects to their size, which satisfies all ring
+	 * alignment requirements.
+	 */
+	vq->desc  = bzalloc(size * sizeof(*vq->desc));
+	vq->avail = bzalloc(sizeof(*vq->avail) + (size + 1) * sizeof(uint16_t));
+	vq->used  = bzalloc(sizeof(*vq->used) + size * sizeof(*vq->used->ring) +
+		sizeof(uint16_t));
+	vq->data  = bzalloc(size * sizeof(*vq->data));
+
+	if (!vq->desc || !vq->avail || !vq->used || !vq->data) {
+		virtqueue_free(vq);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < size; i++)
+		vq->desc[i].next = i + 1;
+
+	vq->free_head = 0;
+	vq->num_free = size;
+	vq->last_used = 0;
+
+	/* We poll the used ring and never want to be interrupted */
+	vq->avail->flags = VIRTQ_AVAIL_F_NO_INTERRUPT;
+
+	vq->notify = (volatile uint16_t *)(vdev->notify +
+		common->queue_notify_off * vdev->notify_mult);
+
+	common->queue_size = size;
+	common->queue_desc_lo = tuint(vq->desc);
+	common->queue_desc_hi = 0;
+	common->queue_driver_lo = tuint(vq->avail);
+	common->queue_driver_hi = 0;
+	common->queue_device_lo = tuint(vq->used);
+	common->queue_device_hi = 0;
+	common->queue_enable = 1;
+
+	return 0;
+}
+
+void virtqueue_free(struct virtqueue *vq)
+{
+	if (vq->desc)
+		bfree(vq->desc);
+
+	if (vq->avail)
+		bfree(vq->avail);
+
+	if (vq->used)
+		bfree((void *)vq->used);
+
+	if (vq->data)
+		bfree(vq->data);
+
+	vq->desc = NULL;
+	vq->avail = NULL;
+	vq->used = NULL;
+	vq->data = NULL;
+}
+
+static uint16_t virtqueue_alloc_desc(struct virtqueue *vq)
+{
+	uint16_t head = vq->free_head;
+
+	vq->free_head = vq->desc[head].next;
+	vq->num_free--;
+
+	return head;
+}
+
+int virtqueue_add(struct virtqueue *vq, struct virtq_desc *descs,
+	uint16_t num, void *data)
+{
+	struct virtq_desc *desc = NULL;
+	uint16_t i, head, next;
+
+	if (!num)
+		return -EINVAL;
+
+	if (vq->indirect && num > 1) {
+		if (!vq->num_free)
+			return -EAGAIN;
+
+		for (i = 0; i < num; i++) {
+			descs[i].flags &= VIRTQ_DESC_F_WRITE;
+			descs[i].next = i + 1;
+
+			if (i + 1 < num)
+				descs[i].flags |= VIRTQ_DESC_F_NEXT;
+		}
+
+		head = virtqueue_alloc_desc(vq);
+
+		desc = &vq->desc[head];
+		desc->addr = tuint(descs);
+		desc->len = num * sizeof(*descs);
+		desc->flags = VIRTQ_DESC_F_INDIRECT;
+	} else {
+		if (vq->num_free < num)
+			return -EAGAIN;
+
+		head = next = virtqueue_alloc_desc(vq);
+
+		for (i = 0; i < num; i++) {
+			if (desc) {
+				next = virtqueue_alloc_desc(vq);
+
+				desc->flags |= VIRTQ_DESC_F_NEXT;
+				desc->next = next;
+			}
+
+			desc = &vq->desc[next];
+			desc->addr = descs[i].addr;
+			desc->len = descs[i].len;
+			desc->flags = descs[i].flags & VIRTQ_DESC_F_WRITE;
+		}
+	}
+
+	vq->data[head] = data;
+	vq->avail->ring[vq->avail->idx & (vq->size - 1)] = head;
+
+	/* The descriptors have to be visible before the new index */
+	barrier();
+
+	vq->avail->idx++;
+
+	return 0;
+}
+
+void virtqueue_kick(struct virtqueue *vq)
+{
+	barrier();
+
+	*vq->notify = vq->index;
+}
+
+void *virtqueue_get(struct virtqueue *vq, uint32_t *len)
+{
+	volatile struct virtq_used_elem *elem;
+	uint16_t head, last;
+	void *data;
+
+	if (vq->last_used == vq->used->idx)
+		return NULL;
+
+	barrier();
+
+	elem = &vq->used->ring[vq->last_used & (vq->size - 1)];
+	head = elem->id;
+
+	if (len)
+		*len = elem->len;
+
+	vq->last_used++;
+
+	/* Put the whole chain back onto the free list */
+	last = head;
+	vq->num_free++;
+
+	while (vq->desc[last].flags & VIRTQ_DESC_F_NEXT) {
+		last = vq->desc[last].next;
+		vq->num_free++;
+	}
+
+	vq->desc[last].next = vq->free_head;
+	vq->free_head = head;
+
+	data = vq->data[head];
+	vq->data[head] = NULL;
+
+	return data;
+}
@@ -1,16 +1,39 @@
 #include <elfboot/core.h>
 #include <elfboot/linkage.h>
 #include <elfboot/mm.h>
+#include <elfboot/mmtrace.h>
+#include <elfboot/placement.h>
 #include <elfboot/file.h>
 #include <elfboot/loader.h>
 #include <elfboot/module.h>
 #include <elfboot/string.h>
 #include <elfboot/printf.h>
 
+#include <asm/bda.h>
 #include <asm/segment.h>
 
 #include <loader/lxboot.h>
 
+#ifdef CONFIG_LOADER_LINUX_PROTMODE
+
+static int lxboot_prepare_fields(struct boot_entry *boot_entry __unused,
+	struct lxboot_info *info)
+{
+	/*
+	 * The real mode setup code is skipped, so there is no heap for it. The
+	 * command line gets a page of its own in lxboot_prepare_params(), which
+	 * needs cmd_line_ptr from protocol version 2.02 on.
+	 */
+	if (info->bprotvers < 0x0202)
+		return -ENOTSUP;
+
+	info->rmcodehdr->type_of_loader = 0xff;
+
+	return 0;
+}
+
+#else
+
 static int lxboot_prepare_fields(struct boot_entry *boot_entry,
 	struct lxboot_info *info)
 {
@@ -44,6 +67,8 @@ static int lxboot_prepare_fields(struct boot_entry *boot_entry,
 	return 0;
 }
 
+#endif /* CONFIG_LOADER_LINUX_PROTMODE */
+
 static int lxboot_prepare_kernel(struct boot_entry *boot_entry,
 	struct file *kernel, struct lxboot_info *info)
 {
@@ -83,37 +108,277 @@ static int lxboot_prepare_kernel(struct boot_entry *boot_entry,
 	info->rmcodehdr->vid_mode = 0xffff;
 	info->pmcodelen = kernel->length - info->rmcodelen;
 
+	bprintln(DRIVER_LXBOOT ": Boot protocol version: %04x", info->bprotvers);
+
+	return 0;
+}
+
+static struct placement *lxboot_layout_kernel(struct placement_plan *plan,
+	struct lxboot_info *info)
+{
+	struct lxboot_rm_header *rmcodehdr = info->rmcodehdr;
+	uint32_t size, align, pref;
+
+	if (!(rmcodehdr->loadflags & LXBOOT_LOADED_HIGH))
+		return NULL;
+
+	/*
+	 * Starting with version 2.10, the kernel tells us how much memory it
+	 * needs for decompressing itself in place. This memory must not be used
+	 * for anything else, especially not for the initrd.
+	 */
+	size = info->pmcodelen;
+	pref = rmcodehdr->code32_start;
+
+	if (info->bprotvers >= 0x020a) {
+		size = max(size, rmcodehdr->init_size);
+
+		if (!(rmcodehdr->pref_address >> 32))
+			pref = rmcodehdr->pref_address;
+	}
+
+	if (memblock_is_available(&memblock.kernmem, pref, size))
+		return placement_add_fixed(plan, "kernel", pref, size);
+
+	if (info->bprotvers < 0x0205 || !rmcodehdr->relocatable_kernel)
+		return placement_add_fixed(plan, "kernel", rmcodehdr->code32_start, size);
+
+	align = rmcodehdr->kernel_alignment;
+	if (!align || (align & (align - 1)))
+		align = PAGE_SIZE;
+
+	return placement_add(plan, "kernel", size, align, LXBOOT_KERNEL_ADDR, 0, 0);
+}
+
+static struct placement *lxboot_layout_initrd(struct placement_plan *plan,
+	struct lxboot_info *info)
+{
+	uint32_t limit = LXBOOT_INITRD_ADDR_MAX;
+
+	if (info->bprotvers >= 0x0203 && info->rmcodehdr->initrd_addr_max)
+		limit = info->rmcodehdr->initrd_addr_max;
+
+	/*
+	 * Like other bootloaders, we put the initrd as high as possible so
+	 * that the kernel has enough space to decompress itself.
+	 */
+	return placement_add(plan, "initrd", info->initrdlen, PAGE_SIZE,
+		LXBOOT_KERNEL_ADDR, limit + 1, PLACEMENT_TOPDOWN);
+}
+
+static int lxboot_prepare_layout(struct lxboot_info *info)
+{
+	struct placement_plan *plan;
+	struct placement *kernel, *initrd = NULL;
+	int ret = -ENOMEM;
+
+	plan = bmalloc(sizeof(*plan));
+	if (!plan)
+		return -ENOMEM;
+
+	placement_init(plan);
+
+	kernel = lxboot_layout_kernel(plan, info);
+	if (!kernel)
+		goto lxboot_layout_fail;
+
+	/*
+	 * An empty initrd has nothing to place, the kernel then simply finds
+	 * a zero ramdisk address and size.
+	 */
+	if (info->initrdlen) {
+		initrd = lxboot_layout_initrd(plan, info);
+		if (!initrd)
+			goto lxboot_layout_fail;
+	}
+
+	ret = placement_commit(plan);
+	if (ret)
+		goto lxboot_layout_fail;
+
+	info->pmcodeadr = kernel->addr;
+	if (initrd)
+		info->initrdadr = initrd->addr;
+
+	/* The kernel might have been relocated */
+	info->rmcodehdr->code32_start = kernel->addr;
+
+lxboot_layout_fail:
+	bfree(plan);
+
+	return ret;
+}
+
+static int lxboot_load_kernel(struct file *kernel, struct lxboot_info *info)
+{
 	file_seek(kernel, FILE_SET, info->rmcodelen);
-	if (!file_read(kernel, info->pmcodelen, tvptr(LXBOOT_KERNEL_ADDR)))
+	if (!file_read(kernel, info->pmcodelen, tvptr(info->pmcodeadr)))
 		return -EFAULT;
 
-	bprintln(DRIVER_LXBOOT ": Boot protocol version: %04x", info->bprotvers);
-
 	return 0;
 }
 
-static int lxboot_prepare_initrd(struct file *initrd, struct lxboot_info *info)
+static int lxboot_load_initrd(struct file *initrd, struct lxboot_info *info)
 {
 	struct lxboot_rm_header *rmcodehdr = info->rmcodehdr;
 
-	if (!file_read(initrd, initrd->length, tvptr(LXBOOT_INITRD_ADDR)))
+	if (info->initrdlen &&
+	    !file_read(initrd, info->initrdlen, tvptr(info->initrdadr)))
 		return -EFAULT;
 
-	rmcodehdr->ramdisk_image = LXBOOT_INITRD_ADDR;
-	rmcodehdr->ramdisk_size = initrd->length;
+	rmcodehdr->ramdisk_image = info->initrdadr;
+	rmcodehdr->ramdisk_size = info->initrdlen;
 
 	return 0;
 }
 
+#ifdef CONFIG_LOADER_LINUX_PROTMODE
+
+static void lxboot_prepare_video(struct lxboot_screen_info *screen)
+{
+	struct bios_data_area *bda = bios_get_bda();
+
+	/*
+	 * We leave the display in the text mode set up by the BIOS, so the
+	 * BIOS data area describes it just like the setup code would.
+	 */
+	screen->orig_video_mode = bda->video_mode & 0x7f;
+	screen->orig_video_page = bda->video_page;
+	screen->orig_video_cols = bda->video_columns;
+	screen->orig_video_lines = bda->video_rows + 1;
+	screen->orig_video_points = bda->bytes_per_char;
+	screen->orig_x = bda->video_cursor[(bda->video_page & 7) << 1];
+	screen->orig_y = bda->video_cursor[((bda->video_page & 7) << 1) + 1];
+
+	if (screen->orig_video_mode != LXBOOT_VIDEO_MODE_MONO)
+		screen->orig_video_isVGA = LXBOOT_VIDEO_TYPE_VGA;
+}
+
+static void lxboot_prepare_e820(struct lxboot_params *params)
+{
+	struct e820_table *table = arch_memory_e820();
+	uint32_t nr_entries;
+
+	nr_entries = min((uint32_t)table->nr_entries, LXBOOT_E820_MAX_ENTRIES);
+
+	memcpy(params->e820_table, table->entries,
+		nr_entries * sizeof(struct e820_entry));
+	params->e820_entries = nr_entries;
+
+	params->alt_mem_k = memory_upper_size();
+	params->screen_info.ext_mem_k = min(params->alt_mem_k, 0xfc00);
+}
+
+static int lxboot_prepare_params(struct boot_entry *boot_entry,
+	struct lxboot_info *info)
+{
+	struct lxboot_rm_header *rmcodehdr = info->rmcodehdr;
+	struct lxboot_params *params;
+	uint32_t hdrlen, cmdline_size = LXBOOT_CMDLINE_SIZE;
+	char *cmdline;
+
+	params = get_zeroed_page();
+	if (!params)
+		return -ENOMEM;
+
+	cmdline = get_zeroed_page();
+	if (!cmdline)
+		goto lxboot_free_params;
+
+	/*
+	 * The setup header ends at the target of the jump at 0x200, older
+	 * kernels have less fields than we know of.
+	 */
+	hdrlen = 0x202 + (rmcodehdr->jump >> 8) - 0x1f1;
+	memcpy(&params->hdr, rmcodehdr, min(hdrlen, sizeof(*rmcodehdr)));
+
+	if (info->bprotvers >= 0x0206 && rmcodehdr->cmdline_size)
+		cmdline_size = rmcodehdr->cmdline_size;
+
+	if (boot_entry->cmdline)
+		strncpy(cmdline, boot_entry->cmdline,
+			min(cmdline_size, PAGE_SIZE - 1));
+
+	params->hdr.cmd_line_ptr = tuint(cmdline);
+
+	lxboot_prepare_video(&params->screen_info);
+	lxboot_prepare_e820(params);
+
+	info->params = params;
+
+	return 0;
+
+lxboot_free_params:
+	free_page(tuint(params));
+
+	return -ENOMEM;
+}
+
+static int lxboot_prepare_protjmp(struct boot_entry *boot_entry,
+	struct lxboot_info *info)
+{
+	static const uint64_t gdt[] = {
+		0, 0, LXBOOT_GDT_CODE, LXBOOT_GDT_DATA
+	};
+	struct {
+		uint16_t limit;
+		uint32_t base;
+	} __packed gdt_desc = {
+		.limit = sizeof(gdt) - 1,
+		.base = tuint(gdt)
+	};
+
+	if (lxboot_prepare_params(boot_entry, info))
+		return -ENOMEM;
+
+	bprintln(DRIVER_LXBOOT ": Jumping to %08lx", info->params->hdr.code32_start);
+
+	/* Last chance to look at our memory usage */
+	mm_trace_dump();
+
+	/*
+	 * Enter the kernel through the 32-bit boot protocol. We skip its real
+	 * mode setup code, it would only probe the BIOS once more for what is
+	 * in the zero page already.
+	 */
+	asm volatile(
+		"cli\n\t"
+		"lgdt (%0)\n\t"
+		"movl %1, %%eax\n\t"
+		"movw %%ax, %%ds\n\t"
+		"movw %%ax, %%es\n\t"
+		"movw %%ax, %%fs\n\t"
+		"movw %%ax, %%gs\n\t"
+		"movw %%ax, %%ss\n\t"
+		"xorl %%ebx, %%ebx\n\t"
+		"xorl %%edi, %%edi\n\t"
+		"xorl %%ebp, %%ebp\n\t"
+		"pushl %2\n\t"
+		"pushl %3\n\t"
+		"lret"
+		:: "c" (&gdt_desc), "i" (LXBOOT_BOOT_DS), "i" (LXBOOT_BOOT_CS),
+		   "d" (info->params->hdr.code32_start), "S" (info->params)
+		: "eax", "ebx", "edi", "memory");
+
+	return -EFAULT;
+}
+
+#else
+
 static int lxboot_prepare_farjmp(struct lxboot_info *info)
 {
 	uint16_t rmcodeseg = RM_SEG(tuint(info->rmcodebuf));
 
+	/* Last chance to look at our memory usage */
+	mm_trace_dump();
+
 	kernel_realmode_jump(rmcodeseg, rmcodeseg + 0x20);
 
 	return -EFAULT;
 }
 
+#endif /* CONFIG_LOADER_LINUX_PROTMODE */
+
 static int lxboot_boot(struct boot_entry *boot_entry)
 {
 	struct file *kernel, *initrd;
@@ -123,18 +388,39 @@ static int lxboot_boot(struct boot_entry *boot_entry)
 	if (!kernel)
 		return -ENOENT;
 
-	initrd = file_open(boot_entry->initrd_path, 0);
-	if (!initrd)
-		return -ENOENT;
+	/* The initrd is optional */
+	initrd = NULL;
+	if (boot_entry->initrd_path) {
+		initrd = file_open(boot_entry->initrd_path, 0);
+		if (!initrd)
+			return -ENOENT;
+	}
 
 	if (lxboot_prepare_kernel(boot_entry, kernel, &info))
 		return -EFAULT;
 
-	if (lxboot_prepare_initrd(initrd, &info))
+	/*
+	 * Both images get their final place before we read any of them, so
+	 * there is no need to move anything around afterwards.
+	 */
+	if (initrd)
+		info.initrdlen = initrd->length;
+	if (lxboot_prepare_layout(&info))
+		return -ENOMEM;
+
+	if (lxboot_load_kernel(kernel, &info))
 		return -EFAULT;
 
+	if (lxboot_load_initrd(initrd, &info))
+		return -EFAULT;
+
+#ifdef CONFIG_LOADER_LINUX_PROTMODE
+	if (lxboot_prepare_protjmp(boot_entry, &info))
+		return -EFAULT;
+#else
 	if (lxboot_prepare_farjmp(&info))
 		return -EFAULT;
+#endif
 
 	return 0;
 }
@@ -2,6 +2,7 @@
 #include <elfboot/linkage.h>
 #include <elfboot/mm.h>
 #include <elfboot/file.h>
+#include <elfboot/placement.h>
 #include <elfboot/loader.h>
 #include <elfboot/module.h>
 #include <elfboot/string.h>
@@ -143,32 +144,132 @@ mboot1_signature_fail:
 	return -EFAULT;
 }
 
-static int mboot1_prepare_kernel(struct boot_entry *boot_entry,
+static int mboot1_prepare_kernel(struct boot_entry *boot_entry __unused,
 	struct file *kernel, struct mboot1_info *info)
 {
-	Elf32_Ehdr *ehdr = bmalloc(sizeof(*ehdr));
+	Elf32_Ehdr *ehdr;
+	uint32_t phdrs_size;
+
+	ehdr = bmalloc(sizeof(*ehdr));
+	if (!ehdr)
+		return -ENOMEM;
 
 	file_seek(kernel, FILE_SET, 0);
 	if (!file_read(kernel, sizeof(*ehdr), ehdr))
 		goto mboot1_kernel_fail;
 
+	if (!libelf_compare_magic(ehdr) || !libelf_compare_class(ehdr, ELFCLASS32))
+		goto mboot1_kernel_fail;
+
+	phdrs_size = ehdr->e_phnum * sizeof(*info->phdrs);
+	if (!phdrs_size || ehdr->e_phentsize != sizeof(*info->phdrs))
+		goto mboot1_kernel_fail;
+
+	info->phdrs = bmalloc(phdrs_size);
+	if (!info->phdrs)
+		goto mboot1_kernel_fail;
+
+	file_seek(kernel, FILE_SET, ehdr->e_phoff);
+	if (!file_read(kernel, phdrs_size, info->phdrs))
+		goto mboot1_phdrs_fail;
+
+	info->ehdr = ehdr;
+
 	bprintln(DRIVER_MBOOT1 ": Found valid ELF object");
 
 	return 0;
 
+mboot1_phdrs_fail:
+	bfree(info->phdrs);
+
 mboot1_kernel_fail:
 	bfree(ehdr);
 
 	return -EFAULT;
 }
 
+static void mboot1_free_kernel(struct mboot1_info *info)
+{
+	bfree(info->phdrs);
+	bfree(info->ehdr);
+
+	info->phdrs = NULL;
+	info->ehdr = NULL;
+}
+
+static int mboot1_prepare_layout(struct mboot1_info *info)
+{
+	struct placement_plan *plan;
+	struct placement *mbinfo;
+	Elf32_Phdr *phdr;
+	uint32_t i;
+	int ret = -ENOMEM;
+
+	plan = bmalloc(sizeof(*plan));
+	if (!plan)
+		return -ENOMEM;
+
+	placement_init(plan);
+
+	/*
+	 * The kernel segments have to be loaded at their physical addresses,
+	 * everything else we hand over to the kernel can go anywhere.
+	 */
+	for (i = 0; i < info->ehdr->e_phnum; i++) {
+		phdr = &info->phdrs[i];
+
+		if (phdr->p_type != PT_LOAD || !phdr->p_memsz)
+			continue;
+
+		if (!placement_add_fixed(plan, "segment", phdr->p_paddr, phdr->p_memsz))
+			goto mboot1_layout_fail;
+	}
+
+	mbinfo = placement_add(plan, "mbinfo", PAGE_SIZE, PAGE_SIZE, 0, 0, 0);
+	if (!mbinfo)
+		goto mboot1_layout_fail;
+
+	ret = placement_commit(plan);
+	if (ret)
+		goto mboot1_layout_fail;
+
+	info->mbinfo = placement_ptr(mbinfo);
+
+mboot1_layout_fail:
+	bfree(plan);
+
+	return ret;
+}
+
+static int mboot1_load_kernel(struct file *kernel, struct mboot1_info *info)
+{
+	Elf32_Phdr *phdr;
+	uint32_t i;
+
+	for (i = 0; i < info->ehdr->e_phnum; i++) {
+		phdr = &info->phdrs[i];
+
+		if (phdr->p_type != PT_LOAD || !phdr->p_memsz)
+			continue;
+
+		if (phdr->p_filesz) {
+			file_seek(kernel, FILE_SET, phdr->p_offset);
+			if (!file_read(kernel, phdr->p_filesz, tvptr(phdr->p_paddr)))
+				return -EFAULT;
+		}
+
+		if (phdr->p_memsz > phdr->p_filesz)
+			memset(tvptr(phdr->p_paddr + phdr->p_filesz), 0,
+				phdr->p_memsz - phdr->p_filesz);
+	}
+
+	return 0;
+}
+
 static int mboot1_prepare_info(struct boot_entry *boot_entry,
 	struct file *kernel, struct mboot1_info *info)
 {
-	
-	info->mbinfo = memblock_alloc_kernel(PAGE_SIZE, PAGE_SIZE);
-	if (!info->mbinfo)
-		return -ENOMEM;
+	memset(info->mbinfo, 0, PAGE_SIZE);
 
 	multiboot_data = vptradd(info->mbinfo, sizeof(struct multiboot_info));
 
@@ -224,6 +325,7 @@ static int mboot1_boot(struct boot_entry *boot_entry)
 {
 	struct file *kernel;
 	struct mboot1_info info = { 0 };
+	int ret;
 
 	kernel = file_open(boot_entry->kernel_path, 0);
 	if (!kernel)
@@ -237,12 +339,31 @@ static int mboot1_boot(struct boot_entry *boot_entry)
 	if (mboot1_prepare_kernel(boot_entry, kernel, &info))
 		return -EFAULT;
 
+	ret = -ENOMEM;
+	if (mboot1_prepare_layout(&info))
+		goto mboot1_boot_fail;
+
+	ret = -EFAULT;
+	if (mboot1_load_kernel(kernel, &info))
+		goto mboot1_boot_fail;
+
+	/*
+	 * The ELF and program headers are not needed anymore once all segments
+	 * are in place.
+	 */
+	mboot1_free_kernel(&info);
+
 	if (mboot1_prepare_info(boot_entry, kernel, &info))
 		return -EFAULT;
 
 	// kernel_realmode_jump(rmcodeseg, rmcodeseg + 0x20);
 
 	return 0;
+
+mboot1_boot_fail:
+	mboot1_free_kernel(&info);
+
+	return ret;
 }
 
 static struct elf_loader mboot1_loader = {
@@ -1,18 +1,19 @@
 #include <elfboot/core.h>
 #include <elfboot/mm.h>
+#include <elfboot/mmtrace.h>
 #include <elfboot/sections.h>
 #include <elfboot/string.h>
 #include <elfboot/printf.h>
 
 static struct memblock_region bootmem[MEMBLOCK_MAX_REGIONS];
-static struct memblock_region kernmem[MEMBLOCK_MAX_REGIONS];
+static struct memblock_region kernmem[MEMBLOCK_MAX_KERN_REGIONS];
 
 struct memblock memblock = {
 	.bootmem.cnt = 1,
 	.bootmem.max = MEMBLOCK_MAX_REGIONS,
 	.bootmem.regions = bootmem,
 	.kernmem.cnt = 1,
-	.kernmem.max = MEMBLOCK_MAX_REGIONS,
+	.kernmem.max = MEMBLOCK_MAX_KERN_REGIONS,
 	.kernmem.regions = kernmem
 };
 
@@ -72,10 +73,13 @@ static void memblock_fusion_region(struct memblock_type *type,
 		prvreg = region - 1;
 
 		if (memblock_end(prvreg) == memblock_beg(region)) {
-			region->base  = prvreg->base;
-			region->size += prvreg->size;
+			prvreg->size += region->size;
 
-			memmove(prvreg, region, (type->cnt - index) * sizeof(*region));
+			memmove(region, region + 1, (type->cnt - (index + 1)) * sizeof(*region));
+			type->cnt--;
+
+			region = prvreg;
+			index--;
 		}
 	}
 
@@ -85,23 +89,30 @@ static void memblock_fusion_region(struct memblock_type *type,
 	 * to the current memblock region.
 	 */
 
-	if (index < type->cnt) {
+	if (index + 1 < type->cnt) {
 		nxtreg = region + 1;
 
 		if (memblock_end(region) == memblock_beg(nxtreg)) {
-			nxtreg->base  = region->base;
-			nxtreg->size += region->size;
+			region->size += nxtreg->size;
 
-			memmove(region, nxtreg, (type->cnt - (index + 1)) * sizeof(*region));
+			memmove(nxtreg, nxtreg + 1, (type->cnt - (index + 2)) * sizeof(*region));
+			type->cnt--;
 		}
 	}
 }
 
-static void memblock_insert_region(struct memblock_type *type, uint32_t index,
+static int memblock_insert_region(struct memblock_type *type, uint32_t index,
 	uint32_t base, uint32_t size)
 {
 	struct memblock_region *region = &type->regions[index];
 
+	/*
+	 * Running out of region slots has to be reported to the caller, the
+	 * memory map would not describe the memory correctly anymore.
+	 */
+	if (type->cnt >= type->max)
+		return -ENOMEM;
+
 	/*
 	 * Move all existing memblock regions one place to the right. That way,
 	 * the region pointer points to our new memblock region which we update
@@ -113,13 +124,16 @@ static void memblock_insert_region(struct memblock_type *type, uint32_t index,
 	region->size = size;
 	type->total_size += size;
 	type->cnt++;
+
+	return 0;
 }
 
-static void memblock_add_region(struct memblock_type *type, uint32_t base,
+static int memblock_add_region(struct memblock_type *type, uint32_t base,
 	uint32_t size)
 {
 	uint32_t i, rbeg, rend, nend;
 	struct memblock_region *region;
+	int ret;
 
 	nend = memblock_adjust_region(&base, &size);
 
@@ -128,7 +142,7 @@ static void memblock_add_region(struct memblock_type *type, uint32_t base,
 		region->base = base;
 		region->size = size;
 		type->total_size += size;
-		return;
+		return 0;
 	}
 
 	for_each_memblock_type(i, type, region) {
@@ -140,28 +154,38 @@ static void memblock_add_region(struct memblock_type *type, uint32_t base,
 		if (rend <= base)
 			continue;
 
-		if (rbeg >= base)
-			memblock_insert_region(type, i++, base, rbeg - base);
+		if (rbeg >= base) {
+			ret = memblock_insert_region(type, i++, base, rbeg - base);
+			if (ret)
+				return ret;
+		}
 
 		base = min(rend, nend);
 	}
 
-	if (base < nend)
-		memblock_insert_region(type, i, base, nend - base);
+	if (base < nend) {
+		ret = memblock_insert_region(type, i, base, nend - base);
+		if (ret)
+			return ret;
+	}
 
 	/*
-	 * Check if the new block can be fused with its neighbours.
+	 * Check if the new block can be fused with its neighbours. There is
+	 * nothing to fuse if the range was already covered completely.
 	 */
-	memblock_fusion_region(type, &type->regions[i], i);
+	if (i < type->cnt)
+		memblock_fusion_region(type, &type->regions[i], i);
+
+	return 0;
 }
 
 static int memblock_del_region(struct memblock_type *type, uint32_t base,
 	uint32_t size)
 {
-	uint32_t i, rbeg, rend, nend, mbeg, mend, dbeg;
+	uint32_t i, rbeg, rend, nend, mbeg, mend;
 	struct memblock_region *region;
+	int ret = -ENOENT;
 
-	dbeg = MEMBLOCK_INVLD;
 	nend = memblock_adjust_region(&base, &size);
 
 	for_each_memblock_type(i, type, region) {
@@ -169,23 +193,26 @@ static int memblock_del_region(struct memblock_type *type, uint32_t base,
 		rend = memblock_end(region);
 
 		if (rbeg >= nend)
-			return dbeg;
+			return ret;
 		if (rend <= base)
 			continue;
 
 		mbeg = max(rbeg, base);
 		mend = min(rend, nend);
-		if (!dbeg)
-			dbeg = mbeg;
+		ret = 0;
 
 		/*
 		 * In a special case: The memory region to be removed is will cause the
 		 * current memblock region to be split into two memblock regions
 		 */
 		if (rbeg < base && rend > nend) {
+			ret = memblock_insert_region(type, i + 1, nend, rend - nend);
+			if (ret)
+				return ret;
+
 			region->size = base - rbeg;
-			memblock_insert_region(type, i + 1, nend, rend - nend);
-			return base;
+			type->total_size -= rend - base;
+			return 0;
 		}
 
 		region->size -= mend - mbeg;
@@ -199,7 +226,7 @@ static int memblock_del_region(struct memblock_type *type, uint32_t base,
 
 		if (rbeg >= base) {
 			region->base = nend;
-			return base;
+			return 0;
 		}
 
 		if (rend <= nend) {
@@ -209,28 +236,90 @@ static int memblock_del_region(struct memblock_type *type, uint32_t base,
 		}
 	}
 
-	return dbeg;
+	return ret;
 }
 
-void memblock_add(uint32_t base, uint32_t size)
+int memblock_add(uint32_t base, uint32_t size)
 {
-	memblock_add_region(&memblock.bootmem, base, size);
+	return memblock_add_region(&memblock.bootmem, base, size);
 }
 
-void memblock_add_kernel(uint32_t base, uint32_t size)
+int memblock_add_kernel(uint32_t base, uint32_t size)
 {
-	memblock_add_region(&memblock.kernmem, base, size);
+	return memblock_add_region(&memblock.kernmem, base, size);
 }
 
 static int __memblock_reserve(struct memblock_type *type,
 	uint32_t base, uint32_t size)
 {
-	return memblock_del_region(type, base, size) != MEMBLOCK_INVLD;
+	return !memblock_del_region(type, base, size);
 }
 
 int memblock_reserve(uint32_t base, uint32_t size)
 {
-	return memblock_del_region(&memblock.bootmem, base, size) != MEMBLOCK_INVLD;
+	return __memblock_reserve(&memblock.bootmem, base, size);
+}
+
+int memblock_reserve_kernel(uint32_t base, uint32_t size)
+{
+	return __memblock_reserve(&memblock.kernmem, base, size);
+}
+
+int memblock_remove_range(struct memblock_type *type, uint32_t base,
+	uint32_t size)
+{
+	return memblock_del_region(type, base, size);
+}
+
+bool memblock_is_available(struct memblock_type *type, uint32_t base,
+	uint32_t size)
+{
+	struct memblock_region *region;
+	uint32_t i, nend;
+
+	nend = memblock_adjust_region(&base, &size);
+
+	/*
+	 * The range may span several adjacent memblock regions, so we advance
+	 * the base address past every region containing it until we reach
+	 * the end of the range or a hole.
+	 */
+	for_each_memblock_type(i, type, region) {
+		if (base >= nend)
+			break;
+		if (memblock_end(region) <= base)
+			continue;
+		if (memblock_beg(region) > base)
+			return false;
+
+		base = memblock_end(region);
+	}
+
+	return base >= nend;
+}
+
+static uint32_t memblock_find_in_range_top(struct memblock_type *type,
+	uint32_t size, uint32_t align, uint32_t start, uint32_t end)
+{
+	uint32_t rbeg, rend, cand;
+	struct memblock_region *region;
+	uint32_t i;
+
+	for (i = type->cnt; i-- > 0;) {
+		region = &type->regions[i];
+
+		rbeg = clamp(memblock_beg(region), start, end);
+		rend = clamp(memblock_end(region), start, end);
+
+		if (rend - rbeg < size)
+			continue;
+
+		cand = round_down(rend - size, align);
+		if (cand >= rbeg)
+			return cand;
+	}
+
+	return 0;
 }
 
 static uint32_t memblock_find_in_range(struct memblock_type *type, 
@@ -252,6 +341,15 @@ static uint32_t memblock_find_in_range(struct memblock_type *type,
 	return 0;
 }
 
+uint32_t memblock_find_range(struct memblock_type *type, uint32_t size,
+	uint32_t align, uint32_t start, uint32_t end, bool topdown)
+{
+	if (topdown)
+		return memblock_find_in_range_top(type, size, align, start, end);
+
+	return memblock_find_in_range(type, size, align, start, end);
+}
+
 static uint32_t memblock_alloc_range(struct memblock_type *type, 
 	uint32_t size, uint32_t align, uint32_t start, uint32_t end)
 {
@@ -276,22 +374,34 @@ static void *memblock_alloc_internal(struct memblock_type *type,
 
 void *memblock_alloc(uint32_t size, uint32_t align)
 {
+	void *addr;
+
 	/*
 	 * We only support allocations below the 1MB mark since we
 	 * want to load kernels starting at addresses > 1MB.
 	 */
 	
-	return memblock_alloc_internal(&memblock.bootmem, size, align,
+	addr = memblock_alloc_internal(&memblock.bootmem, size, align,
 		MEMBLOCK_START, MEMBLOCK_LIMIT);
+
+	mm_trace_alloc(MM_TRACE_MEMBLOCK, _RET_IP_, addr, size);
+
+	return addr;
 }
 
 void *memblock_alloc_kernel(uint32_t size, uint32_t align)
 {
+	void *addr;
+
 	/*
 	 * This function is intented to be used for the allocation
 	 * of kernel and kernel module pages only.
 	 */
 
-	return memblock_alloc_internal(&memblock.kernmem, size, align,
+	addr = memblock_alloc_internal(&memblock.kernmem, size, align,
 		MEMBLOCK_LIMIT, MEMBLOCK_INVLD);
+
+	mm_trace_alloc(MM_TRACE_MEMBLOCK, _RET_IP_, addr, size);
+
+	return addr;
 }
\ No newline at end of file
@@ -0,0 +1,302 @@
+#include <elfboot/core.h>
+#include <elfboot/mm.h>
+#include <elfboot/mmtrace.h>
+#include <elfboot/symbol.h>
+#include <elfboot/time.h>
+#include <elfboot/string.h>
+#include <elfboot/printf.h>
+
+#define MM_TRACE_FREE			0x80
+
+/*
+ * An empty slot in the object table has an address of zero. Removed
+ * objects leave a tombstone behind so that lookups of other objects
+ * with the same hash don't stop early.
+ */
+#define MM_TRACE_OBJ_EMPTY		0
+#define MM_TRACE_OBJ_TOMB		1
+
+struct mm_trace_event {
+	uint64_t tsc;
+	uint32_t caller;
+	uint32_t addr;
+	uint32_t size;
+	uint32_t type;
+};
+
+struct mm_trace_site {
+	uint32_t caller;
+	uint32_t type;
+	uint32_t live;
+	uint32_t peak;
+	uint32_t count;
+};
+
+struct mm_trace_object {
+	uint32_t addr;
+	uint16_t type;
+	uint16_t site;
+	uint32_t size;
+};
+
+/*
+ * The tables are taken from the memblock allocator during initialization
+ * since the bootloader image itself has to fit in the first 64 KiB.
+ */
+static struct mm_trace_event *mm_trace_ring = NULL;
+static struct mm_trace_site *mm_trace_sites = NULL;
+static struct mm_trace_object *mm_trace_objects = NULL;
+
+static uint32_t mm_trace_events = 0;
+static uint32_t mm_trace_nsites = 0;
+
+/* Allocations we were unable to account for */
+static uint32_t mm_trace_lost = 0;
+
+/* Total bytes per allocation type */
+static uint32_t mm_trace_live[MM_TRACE_TYPES];
+static uint32_t mm_trace_peak[MM_TRACE_TYPES];
+
+static const char *mm_trace_names[MM_TRACE_TYPES] = {
+	[MM_TRACE_BMALLOC]  = "bmalloc",
+	[MM_TRACE_PAGES]    = "pages",
+	[MM_TRACE_MEMBLOCK] = "memblock"
+};
+
+static void mm_trace_record(int type, uint32_t caller, uint32_t addr,
+	uint32_t size)
+{
+	struct mm_trace_event *event;
+
+	event = &mm_trace_ring[mm_trace_events++ % MM_TRACE_RING_SIZE];
+	event->tsc = timestamp();
+	event->caller = caller;
+	event->addr = addr;
+	event->size = size;
+	event->type = type;
+}
+
+static struct mm_trace_site *mm_trace_site(int type, uint32_t caller)
+{
+	struct mm_trace_site *site;
+	uint32_t i;
+
+	for (i = 0; i < mm_trace_nsites; i++) {
+		site = &mm_trace_sites[i];
+
+		if (site->caller == caller && site->type == (uint32_t)type)
+			return site;
+	}
+
+	if (mm_trace_nsites == MM_TRACE_SITES)
+		return NULL;
+
+	site = &mm_trace_sites[mm_trace_nsites++];
+	site->caller = caller;
+	site->type = type;
+
+	return site;
+}
+
+static inline uint32_t mm_trace_hash(int type, uint32_t addr)
+{
+	/*
+	 * Slab objects and pages share the same addresses, which is why the
+	 * type is part of the hash. All addresses are at least 8 byte aligned.
+	 */
+	return ((addr >> 3) ^ (addr >> 12) ^ type) % MM_TRACE_OBJECTS;
+}
+
+static struct mm_trace_object *mm_trace_object(int type, uint32_t addr,
+	bool insert)
+{
+	struct mm_trace_object *object, *tomb = NULL;
+	uint32_t i, hash = mm_trace_hash(type, addr);
+
+	for (i = 0; i < MM_TRACE_OBJECTS; i++) {
+		object = &mm_trace_objects[(hash + i) % MM_TRACE_OBJECTS];
+
+		if (object->addr == MM_TRACE_OBJ_EMPTY)
+			return insert ? (tomb ? tomb : object) : NULL;
+
+		if (object->addr == MM_TRACE_OBJ_TOMB) {
+			if (!tomb)
+				tomb = object;
+
+			continue;
+		}
+
+		if (object->addr == addr && object->type == type)
+			return object;
+	}
+
+	return insert ? tomb : NULL;
+}
+
+void mm_trace_alloc(int type, uint32_t caller, void *addr, uint32_t size)
+{
+	struct mm_trace_object *object;
+	struct mm_trace_site *site;
+
+	if (!mm_trace_ring || !addr)
+		return;
+
+	mm_trace_record(type, caller, tuint(addr), size);
+
+	site = mm_trace_site(type, caller);
+	if (!site)
+		goto mm_trace_alloc_lost;
+
+	/*
+	 * Memory from the memblock allocator is never given back, so we don't
+	 * need to remember the allocation for a subsequent free.
+	 */
+	if (type != MM_TRACE_MEMBLOCK) {
+		object = mm_trace_object(type, tuint(addr), true);
+		if (!object)
+			goto mm_trace_alloc_lost;
+
+		object->addr = tuint(addr);
+		object->type = type;
+		object->site = site - mm_trace_sites;
+		object->size = size;
+	}
+
+	site->count++;
+	site->live += size;
+	site->peak = max(site->peak, site->live);
+
+	mm_trace_live[type] += size;
+	mm_trace_peak[type] = max(mm_trace_peak[type], mm_trace_live[type]);
+
+	return;
+
+mm_trace_alloc_lost:
+	mm_trace_lost++;
+}
+
+void mm_trace_free(int type, uint32_t caller, void *addr)
+{
+	struct mm_trace_object *object;
+	struct mm_trace_site *site;
+
+	if (!mm_trace_ring)
+		return;
+
+	object = mm_trace_object(type, tuint(addr), false);
+	if (!object) {
+		mm_trace_record(type | MM_TRACE_FREE, caller, tuint(addr), 0);
+		return;
+	}
+
+	mm_trace_record(type | MM_TRACE_FREE, caller, object->addr, object->size);
+
+	site = &mm_trace_sites[object->site];
+	site->live -= object->size;
+	mm_trace_live[type] -= object->size;
+
+	object->addr = MM_TRACE_OBJ_TOMB;
+}
+
+/*
+ * Report
+ */
+
+static const char *mm_trace_symbol(uint32_t caller)
+{
+	const char *name = symbol_lookup_caller(caller);
+
+	return name ? name : "?";
+}
+
+static void mm_trace_dump_sites(void)
+{
+	struct mm_trace_site *site, *top;
+	bool shown[MM_TRACE_SITES] = { 0 };
+	uint32_t i, n;
+
+	bprintln("MMT: %-8s %-24s %-8s %8s %8s %6s",
+		"Type", "Call site", "Address", "Live", "Peak", "Count");
+
+	for (n = 0; n < min(mm_trace_nsites, MM_TRACE_REPORT); n++) {
+		top = NULL;
+
+		for (i = 0; i < mm_trace_nsites; i++) {
+			site = &mm_trace_sites[i];
+
+			if (shown[i] || (top && site->peak <= top->peak))
+				continue;
+
+			top = site;
+		}
+
+		shown[top - mm_trace_sites] = true;
+
+		bprintln("MMT: %-8s %-24.24s %08lx %8lu %8lu %6lu",
+			mm_trace_names[top->type], mm_trace_symbol(top->caller),
+			top->caller, top->live, top->peak, top->count);
+	}
+}
+
+static void mm_trace_dump_events(void)
+{
+	struct mm_trace_event *event;
+	uint32_t i, num;
+
+	num = min(mm_trace_events, MM_TRACE_REPORT);
+
+	bprintln("MMT: Last %lu of %lu events:", num, mm_trace_events);
+
+	for (i = mm_trace_events - num; i < mm_trace_events; i++) {
+		event = &mm_trace_ring[i % MM_TRACE_RING_SIZE];
+
+		bprintln("MMT: %12llu %-5s %-8s %-24.24s %08lx %8lu",
+			event->tsc, (event->type & MM_TRACE_FREE) ? "free" : "alloc",
+			mm_trace_names[event->type & ~MM_TRACE_FREE],
+			mm_trace_symbol(event->caller), event->addr, event->size);
+	}
+}
+
+void mm_trace_dump(void)
+{
+	int type;
+
+	if (!mm_trace_ring)
+		return;
+
+	bprintln("MMT: Allocation trace (%lu call sites, %lu untracked)",
+		mm_trace_nsites, mm_trace_lost);
+
+	for (type = 0; type < MM_TRACE_TYPES; type++)
+		bprintln("MMT: %-8s live %8lu bytes, peak %8lu bytes",
+			mm_trace_names[type], mm_trace_live[type], mm_trace_peak[type]);
+
+	mm_trace_dump_sites();
+	mm_trace_dump_events();
+}
+
+int mm_trace_init(void)
+{
+	uint32_t size;
+	void *tables;
+
+	size  = MM_TRACE_RING_SIZE * sizeof(*mm_trace_ring);
+	size += MM_TRACE_SITES * sizeof(*mm_trace_sites);
+	size += MM_TRACE_OBJECTS * sizeof(*mm_trace_objects);
+
+	tables = memblock_alloc(size, PAGE_SIZE);
+	if (!tables)
+		return -ENOMEM;
+
+	memset(tables, 0, size);
+
+	mm_trace_sites = tables;
+	mm_trace_objects = vptradd(mm_trace_sites,
+		MM_TRACE_SITES * sizeof(*mm_trace_sites));
+
+	/* Enables the tracer */
+	mm_trace_ring = vptradd(mm_trace_objects,
+		MM_TRACE_OBJECTS * sizeof(*mm_trace_objects));
+
+	return 0;
+}
@@ -1,5 +1,6 @@
 #include <elfboot/core.h>
 #include <elfboot/mm.h>
+#include <elfboot/mmtrace.h>
 #include <elfboot/printf.h>
 #include <elfboot/string.h>
 #include <elfboot/math.h>
@@ -33,6 +34,8 @@ void page_dump(void)
 		free_area[0].nr_free, free_area[1].nr_free, free_area[2].nr_free, 
 		free_area[3].nr_free, free_area[4].nr_free, free_area[5].nr_free, 
 		free_area[6].nr_free, free_area[7].nr_free, free_area[8].nr_free);
+	bprintln("Pages %lu, page map %lu bytes (%lu per page)",
+		page_num, page_num * sizeof(struct page), sizeof(struct page));
 	bprintln("-----------------------------------------");
 }
 
@@ -57,7 +60,7 @@ static void free_page_add(struct page *page, uint32_t order)
 {
 	struct free_area *free_area = page_free_area_order(order);
 
-	list_add(&page->list, &free_area->list);
+	page_list_add(page, &free_area->list);
 	free_area->nr_free++;
 }
 
@@ -65,7 +68,7 @@ static void free_page_append(struct page *page, uint32_t order)
 {
 	struct free_area *free_area = page_free_area_order(order);
 
-	list_add_tail(&page->list, &free_area->list);
+	page_list_add_tail(page, &free_area->list);
 	free_area->nr_free++;
 }
 
@@ -73,7 +76,7 @@ static void free_page_del(struct page *page)
 {
 	struct free_area *free_area = page_free_area(page);
 
-	list_del(&page->list);
+	page_list_del(page, &free_area->list);
 	free_area->nr_free--;
 }
 
@@ -81,7 +84,7 @@ static struct page *free_area_get_first(uint32_t order)
 {
 	struct free_area *free_area = page_free_area_order(order);
 
-	return list_first_entry_or_null(&free_area->list, struct page, list);
+	return page_list_first(&free_area->list);
 }
 
 /*
@@ -97,10 +100,18 @@ static void page_set_compound_head(struct page *page, uint32_t order)
 	 * can determine on which order all pages of the same
 	 * set were allocated. This is easily done by getting
 	 * the order of the compound head page.
+	 *
+	 * The head page itself is left untouched apart from
+	 * its flags, since its head member shares the memory
+	 * with the slab cache information.
 	 */
-	
-	for (pfn = 0; pfn < nr_pages; pfn++)
-		(page + pfn)->compound_head = page;
+
+	page->flags &= ~PAGE_FLAG_TAIL;
+
+	for (pfn = 1; pfn < nr_pages; pfn++) {
+		(page + pfn)->flags |= PAGE_FLAG_TAIL;
+		(page + pfn)->head = page_to_pfn(page);
+	}
 }
 
 static void free_page_fix(struct page *page, uint32_t order)
@@ -114,6 +125,7 @@ static void free_page_fix(struct page *page, uint32_t order)
 		buddy = page_buddy(page, --porder);
 		buddy->order = porder;
 		buddy->flags |= PAGE_FLAG_FREE;
+		buddy->flags &= ~PAGE_FLAG_TAIL;
 
 		free_page_add(buddy, porder);
 	}
@@ -121,7 +133,7 @@ static void free_page_fix(struct page *page, uint32_t order)
 
 static struct page *get_free_pages(uint32_t order)
 {
-	struct page *buddy, *page = NULL;
+	struct page *page = NULL;
 	uint32_t porder;
 
 	for (porder = order; porder < PAGE_MAX_ORDER; porder++) {
@@ -145,25 +157,33 @@ static struct page *get_free_pages(uint32_t order)
 	/* Set the head page in all pages */
 	page_set_compound_head(page, order);
 
-	buddy = page_buddy(page, order);
-	page_set_compound_head(buddy, order);
+	return page;
+}
+
+static struct page *__alloc_pages(uint32_t order, uint32_t caller)
+{
+	struct page *page = get_free_pages(order);
+
+	if (page)
+		mm_trace_alloc(MM_TRACE_PAGES, caller, page_address(page),
+			PAGE_SIZE << order);
 
 	return page;
 }
 
 struct page *alloc_pages(uint32_t order)
 {
-	return get_free_pages(order);
+	return __alloc_pages(order, _RET_IP_);
 }
 
 struct page *alloc_page(void)
 {
-	return alloc_pages(0);
+	return __alloc_pages(0, _RET_IP_);
 }
 
 void *get_zeroed_page(void)
 {
-	struct page *page = alloc_page();
+	struct page *page = __alloc_pages(0, _RET_IP_);
 
 	if (!page)
 		return NULL;
@@ -187,7 +207,7 @@ static struct page *merge_pages(struct page *page, struct page *buddy)
 	page->order++;
 	buddy->order++;
 
-	left = page->paddr < buddy->paddr ? page : buddy;
+	left = page < buddy ? page : buddy;
 	page_set_compound_head(left, left->order);
 
 	return left;
@@ -202,7 +222,11 @@ static void merge_free_page(struct page *page)
 		buddy = page_buddy(page, page->order);
 
 		/* Buddy page is currently in use */
-		if (!page_is_free(buddy))
+		if (!page_is_free(buddy) || page_is_tail(buddy))
+			return;
+
+		/* Buddy page has been split up */
+		if (buddy->order != page->order)
 			return;
 
 		/* Merge pages and get left buddy */
@@ -231,6 +255,8 @@ void free_page(uint32_t addr)
 {
 	struct page *page = phys_to_page(addr);
 
+	mm_trace_free(MM_TRACE_PAGES, _RET_IP_, tvptr(addr));
+
 	__free_page(page);
 }
 
@@ -247,13 +273,12 @@ static void compound_page_init(uint32_t paddr, uint32_t order)
 		page = phys_to_page(paddr + pfn * PAGE_SIZE);
 
 		page->flags = PAGE_FLAG_FREE;
-		page->paddr = paddr + pfn * PAGE_SIZE;
-		page->compound_head = phys_to_page(paddr);
-		list_init(&page->list);
 		page->order = order;
-		page->inuse = 0;
-		list_init(&page->freelist);
+		page->next  = PAGE_NIL;
+		page->prev  = PAGE_NIL;
 	}
+
+	page_set_compound_head(phys_to_page(paddr), order);
 }
 
 static void __page_map_free_bootmem(struct memblock_region *region)
@@ -318,8 +343,15 @@ static int page_map_init(void)
 	if (!page_map)
 		return -ENOMEM;
 
+	/*
+	 * Pages outside of the available memory regions are never
+	 * initialized, but they might still be looked at as buddy
+	 * pages. Make sure that they don't appear to be free.
+	 */
+	memset(page_map, 0, page_num * sizeof(struct page));
+
 	for (order = 0; order < PAGE_MAX_ORDER; order++) {
-		list_init(&page_free_area_order(order)->list);
+		page_list_init(&page_free_area_order(order)->list);
 		page_free_area_order(order)->nr_free = 0;
 	}
 
@@ -0,0 +1,192 @@
+#include <elfboot/core.h>
+#include <elfboot/mm.h>
+#include <elfboot/mmtrace.h>
+#include <elfboot/placement.h>
+#include <elfboot/string.h>
+#include <elfboot/printf.h>
+
+/*
+ * Every image we place may split a free memblock region in two, so the
+ * scratch copy of the kernel memory map needs one extra slot per image.
+ */
+#define PLACEMENT_MAX_REGIONS		\
+	(MEMBLOCK_MAX_KERN_REGIONS + PLACEMENT_MAX_IMAGES)
+
+struct placement *placement_add(struct placement_plan *plan, const char *name,
+	uint32_t size, uint32_t align, uint32_t start, uint32_t end,
+	uint32_t flags)
+{
+	struct placement *image;
+
+	if (plan->cnt == PLACEMENT_MAX_IMAGES || !size)
+		return NULL;
+
+	image = &plan->images[plan->cnt++];
+	image->name = name;
+	image->flags = flags;
+	image->addr = 0;
+	image->size = size;
+	image->align = max(align, PAGE_SIZE);
+	image->start = max(start, MEMBLOCK_LIMIT);
+	image->end = end ? end : (uint32_t)MEMBLOCK_INVLD;
+
+	return image;
+}
+
+struct placement *placement_add_fixed(struct placement_plan *plan,
+	const char *name, uint32_t addr, uint32_t size)
+{
+	struct placement *image;
+
+	image = placement_add(plan, name, size, 0, addr, addr + size,
+		PLACEMENT_FIXED);
+	if (image)
+		image->addr = addr;
+
+	return image;
+}
+
+static bool placement_overlap(struct placement *a, struct placement *b)
+{
+	return a->addr < b->addr + b->size && b->addr < a->addr + a->size;
+}
+
+static int placement_check_fixed(struct placement_plan *plan,
+	struct memblock_type *avail, uint32_t index)
+{
+	struct placement *image = &plan->images[index];
+	uint32_t i;
+
+	if (image->addr < MEMBLOCK_LIMIT || image->addr + image->size < image->addr)
+		return -EINVAL;
+
+	/*
+	 * ELF segments of the same kernel can share a page, which is why fixed
+	 * images are only checked for overlapping bytes with each other and not
+	 * against the page-granular memory map we carve them out of.
+	 */
+	if (!memblock_is_available(avail, image->addr, image->size))
+		return -ENOMEM;
+
+	for (i = 0; i < index; i++) {
+		if (!(plan->images[i].flags & PLACEMENT_FIXED))
+			continue;
+
+		if (placement_overlap(image, &plan->images[i]))
+			return -EEXIST;
+	}
+
+	return 0;
+}
+
+static struct placement *placement_next(struct placement_plan *plan,
+	uint32_t placed)
+{
+	struct placement *image, *next = NULL;
+	uint32_t i;
+
+	/*
+	 * Flexible images are placed in order of decreasing size. Big images
+	 * have the fewest candidate locations, small ones still fit into the
+	 * remaining holes afterwards.
+	 */
+	for (i = 0; i < plan->cnt; i++) {
+		image = &plan->images[i];
+
+		if (placed & _BITUL(i))
+			continue;
+
+		if (!next || image->size > next->size)
+			next = image;
+	}
+
+	return next;
+}
+
+static void placement_failed(struct placement *image, int error)
+{
+	bprintln("PLC: Unable to place %s (%08lx bytes, %08lx - %08lx): %d",
+		image->name, image->size, image->start, image->end, error);
+}
+
+int placement_commit(struct placement_plan *plan)
+{
+	struct memblock_region regions[PLACEMENT_MAX_REGIONS];
+	struct memblock_type scratch, *avail = &memblock.kernmem;
+	struct placement *image;
+	uint32_t i, placed = 0;
+	int error;
+
+	scratch.cnt = avail->cnt;
+	scratch.max = PLACEMENT_MAX_REGIONS;
+	scratch.total_size = avail->total_size;
+	scratch.regions = regions;
+
+	memcpy(regions, avail->regions, avail->cnt * sizeof(*regions));
+
+	for (i = 0; i < plan->cnt; i++) {
+		image = &plan->images[i];
+
+		if (!(image->flags & PLACEMENT_FIXED))
+			continue;
+
+		error = placement_check_fixed(plan, avail, i);
+		if (error) {
+			placement_failed(image, error);
+			return error;
+		}
+
+		/*
+		 * A segment sharing its pages with earlier segments may already be
+		 * gone from the scratch map completely.
+		 */
+		error = memblock_remove_range(&scratch, image->addr, image->size);
+		if (error && error != -ENOENT) {
+			placement_failed(image, error);
+			return error;
+		}
+
+		placed |= _BITUL(i);
+	}
+
+	while ((image = placement_next(plan, placed)) != NULL) {
+		image->addr = memblock_find_range(&scratch, image->size, image->align,
+			image->start, image->end, image->flags & PLACEMENT_TOPDOWN);
+
+		if (!image->addr) {
+			placement_failed(image, -ENOMEM);
+			return -ENOMEM;
+		}
+
+		error = memblock_remove_range(&scratch, image->addr, image->size);
+		if (error) {
+			placement_failed(image, error);
+			return error;
+		}
+
+		placed |= _BITUL(image - plan->images);
+	}
+
+	/*
+	 * All images have a place now. Replacing the kernel memory map with our
+	 * scratch copy reserves all of them at once.
+	 */
+	if (scratch.cnt > avail->max)
+		return -ENOMEM;
+
+	memcpy(avail->regions, regions, scratch.cnt * sizeof(*regions));
+	avail->cnt = scratch.cnt;
+	avail->total_size = scratch.total_size;
+
+	for (i = 0; i < plan->cnt; i++) {
+		image = &plan->images[i];
+
+		mm_trace_alloc(MM_TRACE_MEMBLOCK, _RET_IP_, placement_ptr(image),
+			image->size);
+
+		bprintln("PLC: %-16s %08lx - %08lx", image->name, image->addr,
+			image->addr + image->size - 1);
+	}
+
+	return 0;
+}
\ No newline at end of file
@@ -1,6 +1,7 @@
 #include <elfboot/core.h>
 #include <elfboot/mm.h>
 #include <elfboot/slub.h>
+#include <elfboot/mmtrace.h>
 #include <elfboot/printf.h>
 #include <elfboot/string.h>
 #include <elfboot/math.h>
@@ -34,9 +35,9 @@ static void bmem_cache_init(void *objp)
 	cachep->free_objs   = 0;
 	cachep->free_slabs  = 0;
 	cachep->total_slabs = 0;
-	list_init(&cachep->slabs_free);
-	list_init(&cachep->slabs_partial);
-	list_init(&cachep->slabs_full);
+	page_list_init(&cachep->slabs_free);
+	page_list_init(&cachep->slabs_partial);
+	page_list_init(&cachep->slabs_full);
 	cachep->ctor = NULL;
 	list_init(&cachep->next);
 }
@@ -118,14 +119,29 @@ static inline uint32_t calculate_cache_order(uint32_t size)
 	return ret - min(ret, PAGE_SHIFT);
 }
 
-static void *bmem_cache_fetch(struct page *page)
+static inline void *bmem_obj_addr(struct bmem_cache *cachep,
+				  struct page *page, uint32_t objc)
 {
-	void *objp = list_first_or_null(&page->freelist);
+	return vptradd(page_address(page), objc * cachep->size);
+}
 
-	if (!objp)
+static inline uint16_t bmem_obj_index(struct bmem_cache *cachep,
+				      struct page *page, void *objp)
+{
+	return (tuint(objp) - page_to_phys(page)) >> log2(cachep->size);
+}
+
+static void *bmem_cache_fetch(struct bmem_cache *cachep, struct page *page)
+{
+	uint16_t *objp;
+
+	if (page->freelist == BMEM_FREELIST_END)
 		return NULL;
 
-	list_del(objp);
+	objp = bmem_obj_addr(cachep, page, page->freelist);
+
+	/* Free objects store the index of the next free object */
+	page->freelist = *objp;
 	page->inuse++;
 
 	return objp;
@@ -135,38 +151,78 @@ static struct page *bmem_cache_page(struct bmem_cache *cachep)
 {
 	struct page *page;
 
-	page = list_first_entry_or_null(&cachep->slabs_partial, struct page, list);
+	page = page_list_first(&cachep->slabs_partial);
 	if (page)
 		return page;
 
-	page = list_first_entry_or_null(&cachep->slabs_free, struct page, list);
+	page = page_list_first(&cachep->slabs_free);
 	if (page)
 		cachep->free_slabs--;
 
 	return page;
 }
 
-static void bmem_cache_fixup(struct bmem_cache *cachep, struct page *page)
+static struct page_list *bmem_cache_slabs(struct bmem_cache *cachep,
+					  uint32_t inuse)
+{
+	/*
+	 * Slab pages only store the links to their neighbours,
+	 * so we determine the list a slab is currently on by
+	 * the number of objects in use.
+	 */
+
+	if (!inuse)
+		return &cachep->slabs_free;
+
+	if (inuse == cachep->nums)
+		return &cachep->slabs_full;
+
+	return &cachep->slabs_partial;
+}
+
+static void bmem_cache_move(struct bmem_cache *cachep, struct page *page,
+			    uint32_t inuse)
 {
-	list_del(&page->list);
+	struct page_list *prev, *next;
+
+	prev = bmem_cache_slabs(cachep, inuse);
+	next = bmem_cache_slabs(cachep, page->inuse);
+
+	/*
+	 * Only touch the neighbouring slab pages if the slab has
+	 * to switch lists, which is not the case for most of the
+	 * allocations in a partially filled slab.
+	 */
+
+	if (prev == next)
+		return;
 
-	if (page->inuse == cachep->nums)
-		list_add(&page->list, &cachep->slabs_full);
-	else
-		list_add(&page->list, &cachep->slabs_partial);
+	page_list_del(page, prev);
+	page_list_add(page, next);
+}
+
+static void bmem_cache_fixup(struct bmem_cache *cachep, struct page *page)
+{
+	bmem_cache_move(cachep, page, page->inuse - 1);
 }
 
 static void bmem_cache_setup(struct bmem_cache *cachep, struct page *page)
 {
-	struct list_head *objp;
+	uint16_t *objp;
 	uint32_t objc;
 
-	for (objc = 0; objc < cachep->nums; objc++) {
-		objp = tvptr(page->paddr + cachep->size * objc);
+	for (objc = 0; objc < cachep->nums - 1; objc++) {
+		objp = bmem_obj_addr(cachep, page, objc);
 
-		/* Append to freelist */
-		list_add_tail(objp, &page->freelist);
+		/* Link to the next object */
+		*objp = objc + 1;
 	}
+
+	/* Terminate freelist at the last object */
+	objp = bmem_obj_addr(cachep, page, objc);
+	*objp = BMEM_FREELIST_END;
+
+	page->freelist = 0;
 }
 
 static struct page *bmem_cache_grow(struct bmem_cache *cachep)
@@ -177,15 +233,13 @@ static struct page *bmem_cache_grow(struct bmem_cache *cachep)
 	if (!page)
 		return NULL;
 
-	list_init(&page->freelist);
-
 	page->slab_cache = cachep;
 	page->inuse = 0;
 
 	bmem_cache_setup(cachep, page);
 	cachep->total_slabs++;
 
-	list_add(&page->list, &cachep->slabs_free);
+	page_list_add(page, &cachep->slabs_free);
 
 	cachep->free_objs += cachep->nums;
 
@@ -208,33 +262,34 @@ static struct page *bmem_obj_page(void *objp)
 
 static void __bfree(struct page *page, struct bmem_cache *cachep, void *objp)
 {
-	/* We treat the object as a list */
-	struct list_head *new = objp;
+	/* We treat the object as a freelist index */
+	uint16_t *new = objp;
 
 	/* 
 	 * Add the object back to the freelist. We don't really
 	 * care about at which position the object was inserted
-	 * so we simply add it at the end of the freelist.
+	 * so we simply push it to the front of the freelist.
 	 */
-	
-	list_add_tail(new, &page->freelist);
+
+	*new = page->freelist;
+	page->freelist = bmem_obj_index(cachep, page, objp);
 
 	cachep->free_objs++;
 
 	if (!--page->inuse) {
-		list_del(&page->list);
-		free_page(page->paddr);
+		page_list_del(page, bmem_cache_slabs(cachep, 1));
+		free_page(page_to_phys(page));
 		cachep->free_objs -= cachep->nums;
 	} else {
 
 		/*
 		 * Before freeing the object, the slab is either
-		 * full or partially allocated. Either way, it's
-		 * neccessary to move the slab to the partially
-		 * filled slab list.
+		 * full or partially allocated. Either way, the
+		 * slab has to end up in the partially filled slab
+		 * list.
 		 */
 
-		list_move(&page->list, &cachep->slabs_partial);
+		bmem_cache_move(cachep, page, page->inuse + 1);
 	}
 }
 
@@ -242,12 +297,14 @@ void bfree(void *objp)
 {
 	struct page *page = bmem_obj_page(objp);
 
+	mm_trace_free(MM_TRACE_BMALLOC, _RET_IP_, objp);
+
 	__bfree(page, page->slab_cache, objp);
 }
 
 static void *bmem_cache_alloc_object(struct bmem_cache *cachep, struct page *page)
 {
-	void *objp = bmem_cache_fetch(page);
+	void *objp = bmem_cache_fetch(cachep, page);
 
 	if (!objp)
 		return NULL;
@@ -274,19 +331,28 @@ void *bmem_cache_alloc(struct bmem_cache *cachep)
 	return bmem_cache_alloc_object(cachep, page);
 }
 
-void *bmalloc(uint32_t size)
+void *__bmalloc(uint32_t size, uint32_t caller)
 {
 	struct bmem_cache *cachep = bmalloc_cache(size);
+	void *objp;
 
 	if (!cachep)
 		return NULL;
 
-	return bmem_cache_alloc(cachep);
+	objp = bmem_cache_alloc(cachep);
+	mm_trace_alloc(MM_TRACE_BMALLOC, caller, objp, size);
+
+	return objp;
+}
+
+void *bmalloc(uint32_t size)
+{
+	return __bmalloc(size, _RET_IP_);
 }
 
 void *bzalloc(uint32_t size)
 {
-	void *objp = bmalloc(size);
+	void *objp = __bmalloc(size, _RET_IP_);
 
 	if (objp)
 		memset(objp, 0, size);
@@ -306,6 +372,9 @@ struct bmem_cache *bmem_cache_create(const char *name, uint32_t size,
 	if (!cachep->name)
 		goto bmem_cache_alloc_free;
 
+	/* Free objects have to hold the index of the next free object */
+	size = max(size, sizeof(uint16_t));
+
 	cachep->size  = round_up_pow2(size);
 	cachep->nums  = max(PAGE_SIZE / cachep->size, 1);
 	cachep->order = calculate_cache_order(cachep->size);
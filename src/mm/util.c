@@ -20,7 +20,7 @@ char *bstrdup(const char *str)
 		return NULL;
 
 	len = strlen(str) + 1;
-	buf = bmalloc(len);
+	buf = __bmalloc(len, _RET_IP_);
 
 	if (!buf)
 		return NULL;
@@ -0,0 +1,776 @@
+#include <elfboot/core.h>
+#include <elfboot/linkage.h>
+#include <elfboot/mm.h>
+#include <elfboot/module.h>
+#include <elfboot/net.h>
+#include <elfboot/time.h>
+#include <elfboot/string.h>
+#include <elfboot/printf.h>
+
+static LIST_HEAD(netdevs);
+static LIST_HEAD(udp_sockets);
+static LIST_HEAD(tcp_sockets);
+
+static uint32_t netdev_num = 0;
+static uint16_t net_next_port = NET_EPHEMERAL_PORT;
+static uint16_t ip_next_id = 0;
+
+/* Shift of the receive window we announce */
+static uint8_t tcp_wscale = 0;
+
+static const uint8_t eth_broadcast[ETH_ALEN] = {
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+};
+
+/*
+ * Helpers
+ */
+
+uint32_t net_parse_addr(const char *str)
+{
+	uint32_t addr = 0, part, i;
+	char *end;
+
+	for (i = 0; i < 4; i++) {
+		part = strtoul(str, &end, 10);
+		if (end == str || part > 255)
+			return 0;
+
+		if (*end != (i < 3 ? '.' : '\0'))
+			return 0;
+
+		addr = (addr << 8) | part;
+		str = end + 1;
+	}
+
+	return htonl(addr);
+}
+
+uint16_t net_checksum(const void *data, uint32_t length, uint32_t sum)
+{
+	const uint8_t *pos = data;
+
+	/*
+	 * Internet checksum over big endian 16-bit words. The sum argument
+	 * allows to start with the sum of a pseudo header.
+	 */
+	for (; length > 1; length -= 2, pos += 2)
+		sum += (pos[0] << 8) | pos[1];
+
+	if (length)
+		sum += pos[0] << 8;
+
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+
+	return ~sum & 0xffff;
+}
+
+/*
+ * Ephemeral ports are handed out in order, a new transfer always gets a new
+ * port and can't be confused with an earlier one.
+ */
+static uint16_t net_alloc_port(void)
+{
+	uint16_t port = net_next_port++;
+
+	if (!net_next_port)
+		net_next_port = NET_EPHEMERAL_PORT;
+
+	return port;
+}
+
+static int net_xmit(struct netdev *netdev, const uint8_t *dst, uint16_t proto,
+	uint32_t length)
+{
+	struct eth_hdr *eth = (struct eth_hdr *)netdev->frame;
+
+	memcpy(eth->dst, dst, ETH_ALEN);
+	memcpy(eth->src, netdev->mac, ETH_ALEN);
+	eth->proto = htons(proto);
+
+	return netdev->ops->xmit(netdev, netdev->frame, ETH_HLEN + length);
+}
+
+/*
+ * ARP
+ */
+
+static struct arp_entry *arp_lookup(struct netdev *netdev, uint32_t ipaddr)
+{
+	uint32_t i;
+
+	for (i = 0; i < ARP_CACHE_SIZE; i++) {
+		if (netdev->arp_cache[i].ipaddr == ipaddr)
+			return &netdev->arp_cache[i];
+	}
+
+	return NULL;
+}
+
+static void arp_update(struct netdev *netdev, uint32_t ipaddr,
+	const uint8_t *mac)
+{
+	struct arp_entry *entry = arp_lookup(netdev, ipaddr);
+
+	/* Replace the oldest entry if the address is new */
+	if (!entry) {
+		entry = &netdev->arp_cache[netdev->arp_next++ % ARP_CACHE_SIZE];
+		entry->ipaddr = ipaddr;
+	}
+
+	memcpy(entry->mac, mac, ETH_ALEN);
+}
+
+static int arp_send(struct netdev *netdev, uint16_t op, const uint8_t *mac,
+	uint32_t ipaddr)
+{
+	struct arp_hdr *arp = vptradd(netdev->frame, ETH_HLEN);
+
+	arp->hrd = htons(ARP_HRD_ETHER);
+	arp->pro = htons(ETH_P_IP);
+	arp->hln = ETH_ALEN;
+	arp->pln = sizeof(ipaddr);
+	arp->op = htons(op);
+	memcpy(arp->sha, netdev->mac, ETH_ALEN);
+	arp->spa = netdev->ipaddr;
+	memcpy(arp->tha, op == ARP_OP_REPLY ? mac : eth_broadcast, ETH_ALEN);
+	arp->tpa = ipaddr;
+
+	return net_xmit(netdev, mac, ETH_P_ARP, sizeof(*arp));
+}
+
+static void arp_receive(struct netdev *netdev, struct arp_hdr *arp,
+	uint32_t length)
+{
+	if (length < sizeof(*arp) || arp->hrd != htons(ARP_HRD_ETHER) ||
+	    arp->pro != htons(ETH_P_IP) || arp->hln != ETH_ALEN ||
+	    arp->pln != sizeof(arp->spa))
+		return;
+
+	if (arp->spa)
+		arp_update(netdev, arp->spa, arp->sha);
+
+	if (arp->op == htons(ARP_OP_REQUEST) && arp->tpa == netdev->ipaddr)
+		arp_send(netdev, ARP_OP_REPLY, arp->sha, arp->spa);
+}
+
+static int arp_resolve(struct netdev *netdev, uint32_t ipaddr, uint8_t *mac)
+{
+	struct arp_entry *entry;
+	uint64_t deadline;
+	uint32_t retries;
+
+	if (ipaddr == 0xffffffff) {
+		memcpy(mac, eth_broadcast, ETH_ALEN);
+		return 0;
+	}
+
+	for (retries = 0; retries <= ARP_RETRIES; retries++) {
+		entry = arp_lookup(netdev, ipaddr);
+		if (entry) {
+			memcpy(mac, entry->mac, ETH_ALEN);
+			return 0;
+		}
+
+		if (retries == ARP_RETRIES)
+			break;
+
+		arp_send(netdev, ARP_OP_REQUEST, eth_broadcast, ipaddr);
+
+		deadline = timestamp_deadline(ARP_TIMEOUT);
+		while (!arp_lookup(netdev, ipaddr) && !timestamp_expired(deadline))
+			net_poll(netdev);
+	}
+
+	return -EHOSTUNREACH;
+}
+
+/*
+ * IPv4 transmission
+ */
+
+static uint16_t ip_checksum(uint32_t saddr, uint32_t daddr, uint8_t proto,
+	const void *data, uint32_t length)
+{
+	uint32_t sum;
+
+	/* Pseudo header of UDP and TCP */
+	sum  = (ntohl(saddr) >> 16) + (ntohl(saddr) & 0xffff);
+	sum += (ntohl(daddr) >> 16) + (ntohl(daddr) & 0xffff);
+	sum += proto + length;
+
+	return net_checksum(data, length, sum);
+}
+
+static uint32_t ip_nexthop(struct netdev *netdev, uint32_t daddr)
+{
+	/* Anything outside of our subnet goes through the gateway */
+	if (daddr != 0xffffffff && ((daddr ^ netdev->ipaddr) & netdev->netmask))
+		return netdev->gateway;
+
+	return daddr;
+}
+
+static int ip_xmit(struct netdev *netdev, const uint8_t *mac, uint32_t daddr,
+	uint8_t proto, uint32_t length)
+{
+	struct ip_hdr *ip = vptradd(netdev->frame, ETH_HLEN);
+
+	ip->version_ihl = IP_VERSION_IHL;
+	ip->tos = 0;
+	ip->length = htons(sizeof(*ip) + length);
+	ip->id = htons(ip_next_id++);
+	ip->frag = 0;
+	ip->ttl = IP_TTL;
+	ip->proto = proto;
+	ip->csum = 0;
+	ip->saddr = netdev->ipaddr;
+	ip->daddr = daddr;
+	ip->csum = htons(net_checksum(ip, sizeof(*ip), 0));
+
+	return net_xmit(netdev, mac, ETH_P_IP, sizeof(*ip) + length);
+}
+
+/*
+ * UDP
+ */
+
+static void udp_receive(struct netdev *netdev, struct ip_hdr *ip,
+	struct udp_hdr *udp, uint32_t length)
+{
+	struct udp_socket *sock;
+	uint16_t port;
+
+	if (length < UDP_HLEN || ntohs(udp->length) < UDP_HLEN ||
+	    ntohs(udp->length) > length)
+		return;
+
+	length = ntohs(udp->length);
+
+	/* The checksum is optional for UDP over IPv4 */
+	if (udp->csum && ip_checksum(ip->saddr, ip->daddr, IP_PROTO_UDP, udp,
+			length))
+		return;
+
+	port = ntohs(udp->dport);
+
+	list_for_each_entry(sock, &udp_sockets, list) {
+		if (sock->port != port || sock->netdev != netdev)
+			continue;
+
+		sock->recv(sock, ip->saddr, udp->sport, udp + 1, length - UDP_HLEN);
+		return;
+	}
+}
+
+int udp_bind(struct udp_socket *sock, struct netdev *netdev, uint16_t port)
+{
+	struct udp_socket *pos;
+
+	if (!port)
+		port = net_alloc_port();
+
+	list_for_each_entry(pos, &udp_sockets, list) {
+		if (pos->port == port && pos->netdev == netdev)
+			return -EBUSY;
+	}
+
+	sock->netdev = netdev;
+	sock->port = port;
+
+	list_add(&sock->list, &udp_sockets);
+
+	return 0;
+}
+
+void udp_unbind(struct udp_socket *sock)
+{
+	list_del(&sock->list);
+}
+
+int udp_send(struct udp_socket *sock, uint32_t daddr, uint16_t dport,
+	const void *data, uint32_t length)
+{
+	struct netdev *netdev = sock->netdev;
+	uint8_t mac[ETH_ALEN];
+	struct udp_hdr *udp;
+	uint32_t nexthop;
+	uint16_t csum;
+	int ret;
+
+	if (length > UDP_MAX_PAYLOAD)
+		return -EMSGSIZE;
+
+	nexthop = ip_nexthop(netdev, daddr);
+	if (!nexthop)
+		return -EHOSTUNREACH;
+
+	/* Resolving uses the frame buffer, so it has to happen first */
+	ret = arp_resolve(netdev, nexthop, mac);
+	if (ret)
+		return ret;
+
+	udp = vptradd(netdev->frame, ETH_HLEN + sizeof(struct ip_hdr));
+
+	memcpy(udp + 1, data, length);
+	length += UDP_HLEN;
+
+	udp->sport = htons(sock->port);
+	udp->dport = dport;
+	udp->length = htons(length);
+	udp->csum = 0;
+
+	csum = ip_checksum(netdev->ipaddr, daddr, IP_PROTO_UDP, udp, length);
+	udp->csum = htons(csum ? csum : 0xffff);
+
+	return ip_xmit(netdev, mac, daddr, IP_PROTO_UDP, length);
+}
+
+/*
+ * TCP
+ */
+
+static inline bool tcp_seq_after(uint32_t seq1, uint32_t seq2)
+{
+	return (int32_t)(seq1 - seq2) > 0;
+}
+
+static int tcp_xmit(struct tcp_socket *sock, uint32_t seq, uint8_t flags,
+	const void *data, uint32_t length)
+{
+	struct netdev *netdev = sock->netdev;
+	struct tcp_hdr *tcp;
+	uint8_t *opt;
+	uint32_t hlen = sizeof(*tcp), window = CONFIG_NET_TCP_WINDOW;
+
+	tcp = vptradd(netdev->frame, ETH_HLEN + sizeof(struct ip_hdr));
+	opt = (uint8_t *)(tcp + 1);
+
+	/*
+	 * The SYN announces our segment size and window scale, its own window
+	 * is never scaled.
+	 */
+	if (flags & TCP_SYN) {
+		opt[0] = TCP_OPT_MSS;
+		opt[1] = 4;
+		opt[2] = TCP_MSS >> 8;
+		opt[3] = TCP_MSS & 0xff;
+		opt[4] = TCP_OPT_NOP;
+		opt[5] = TCP_OPT_WSCALE;
+		opt[6] = 3;
+		opt[7] = tcp_wscale;
+		hlen += 8;
+	} else {
+		window >>= sock->wscale;
+	}
+
+	memcpy(vptradd(tcp, hlen), data, length);
+
+	tcp->sport = htons(sock->port);
+	tcp->dport = sock->dport;
+	tcp->seq = htonl(seq);
+	tcp->ack = (flags & TCP_ACK) ? htonl(sock->rcv_nxt) : 0;
+	tcp->doff = (hlen >> 2) << 4;
+	tcp->flags = flags;
+	tcp->window = htons(min(window, 0xffffUL));
+	tcp->csum = 0;
+	tcp->urgent = 0;
+
+	length += hlen;
+	tcp->csum = htons(ip_checksum(netdev->ipaddr, sock->daddr, IP_PROTO_TCP,
+		tcp, length));
+
+	if (flags & TCP_ACK)
+		sock->unacked = 0;
+
+	return ip_xmit(netdev, sock->mac, sock->daddr, IP_PROTO_TCP, length);
+}
+
+static void tcp_send_ack(struct tcp_socket *sock)
+{
+	tcp_xmit(sock, sock->snd_nxt, TCP_ACK, NULL, 0);
+}
+
+static void tcp_parse_options(struct tcp_socket *sock, uint8_t *opt,
+	uint32_t length)
+{
+	bool wscale = false;
+
+	while (length && opt[0] != TCP_OPT_END) {
+		if (opt[0] == TCP_OPT_NOP) {
+			opt++;
+			length--;
+			continue;
+		}
+
+		if (length < 2 || opt[1] < 2 || opt[1] > length)
+			break;
+
+		if (opt[0] == TCP_OPT_MSS && opt[1] == 4)
+			sock->mss = min(get_be16(opt + 2), TCP_MSS);
+		else if (opt[0] == TCP_OPT_WSCALE && opt[1] == 3)
+			wscale = true;
+
+		length -= opt[1];
+		opt += opt[1];
+	}
+
+	/* Windows are only scaled if both sides agree */
+	if (!wscale)
+		sock->wscale = 0;
+}
+
+static void tcp_receive_data(struct tcp_socket *sock, struct tcp_hdr *tcp,
+	uint8_t *data, uint32_t length)
+{
+	uint32_t seq = ntohl(tcp->seq), skip;
+
+	if (!length && !(tcp->flags & TCP_FIN))
+		return;
+
+	/*
+	 * Segments are not queued, anything beyond the next expected byte is
+	 * dropped. The duplicate acknowledgement lets the peer retransmit fast.
+	 */
+	if (tcp_seq_after(seq, sock->rcv_nxt)) {
+		tcp_send_ack(sock);
+		return;
+	}
+
+	skip = sock->rcv_nxt - seq;
+	if (skip > length || (skip == length && !(tcp->flags & TCP_FIN))) {
+		tcp_send_ack(sock);
+		return;
+	}
+
+	if (skip < length) {
+		sock->recv(sock, data + skip, length - skip);
+		sock->rcv_nxt += length - skip;
+	}
+
+	if (tcp->flags & TCP_FIN) {
+		sock->rcv_nxt++;
+		sock->state = TCP_CLOSE_WAIT;
+	}
+
+	if (++sock->unacked >= TCP_ACK_SEGMENTS || (tcp->flags & TCP_FIN))
+		tcp_send_ack(sock);
+}
+
+static void tcp_receive(struct netdev *netdev, struct ip_hdr *ip,
+	struct tcp_hdr *tcp, uint32_t length)
+{
+	struct tcp_socket *sock;
+	uint32_t hlen, ack;
+
+	if (length < sizeof(*tcp))
+		return;
+
+	hlen = (tcp->doff >> 4) << 2;
+	if (hlen < sizeof(*tcp) || hlen > length)
+		return;
+
+	if (ip_checksum(ip->saddr, ip->daddr, IP_PROTO_TCP, tcp, length))
+		return;
+
+	list_for_each_entry(sock, &tcp_sockets, list) {
+		if (sock->netdev == netdev && sock->port == ntohs(tcp->dport) &&
+		    sock->daddr == ip->saddr && sock->dport == tcp->sport)
+			break;
+	}
+
+	if (&sock->list == &tcp_sockets || sock->state == TCP_CLOSED)
+		return;
+
+	ack = ntohl(tcp->ack);
+
+	if (tcp->flags & TCP_RST) {
+		if (sock->state == TCP_SYN_SENT) {
+			if (!(tcp->flags & TCP_ACK) || ack != sock->snd_nxt)
+				return;
+
+			sock->error = -ECONNREFUSED;
+		} else {
+			sock->error = -ECONNRESET;
+		}
+
+		sock->state = TCP_CLOSED;
+		return;
+	}
+
+	if (sock->state == TCP_SYN_SENT) {
+		if ((tcp->flags & (TCP_SYN | TCP_ACK)) != (TCP_SYN | TCP_ACK) ||
+		    ack != sock->snd_nxt)
+			return;
+
+		tcp_parse_options(sock, (uint8_t *)(tcp + 1), hlen - sizeof(*tcp));
+
+		sock->rcv_nxt = ntohl(tcp->seq) + 1;
+		sock->snd_una = ack;
+		sock->state = TCP_ESTABLISHED;
+
+		tcp_send_ack(sock);
+		return;
+	}
+
+	if ((tcp->flags & TCP_ACK) && tcp_seq_after(ack, sock->snd_una) &&
+	    !tcp_seq_after(ack, sock->snd_nxt))
+		sock->snd_una = ack;
+
+	tcp_receive_data(sock, tcp, vptradd(tcp, hlen), length - hlen);
+}
+
+/*
+ * Send a single segment and wait for its acknowledgement
+ */
+static int tcp_transmit(struct tcp_socket *sock, uint8_t flags,
+	const void *data, uint32_t length)
+{
+	uint32_t seq = sock->snd_una, retries;
+	uint64_t deadline;
+
+	sock->snd_nxt = seq + length + !!(flags & (TCP_SYN | TCP_FIN));
+
+	for (retries = 0; retries <= TCP_RETRIES; retries++) {
+		tcp_xmit(sock, seq, flags, data, length);
+
+		deadline = timestamp_deadline(TCP_TIMEOUT);
+		while (sock->snd_una != sock->snd_nxt) {
+			tcp_poll(sock);
+
+			if (sock->error)
+				return sock->error;
+
+			if (timestamp_expired(deadline))
+				break;
+		}
+
+		if (sock->snd_una == sock->snd_nxt)
+			return 0;
+	}
+
+	return -ETIMEDOUT;
+}
+
+int tcp_connect(struct tcp_socket *sock, struct netdev *netdev, uint32_t daddr,
+	uint16_t dport)
+{
+	uint32_t nexthop;
+	int ret;
+
+	nexthop = ip_nexthop(netdev, daddr);
+	if (!nexthop)
+		return -EHOSTUNREACH;
+
+	/* Segments are sent while receiving, the next hop has to be known */
+	ret = arp_resolve(netdev, nexthop, sock->mac);
+	if (ret)
+		return ret;
+
+	sock->netdev = netdev;
+	sock->port = net_alloc_port();
+	sock->daddr = daddr;
+	sock->dport = dport;
+	sock->state = TCP_SYN_SENT;
+	sock->error = 0;
+	sock->snd_una = timestamp();
+	sock->rcv_nxt = 0;
+	sock->mss = TCP_DEFAULT_MSS;
+	sock->wscale = tcp_wscale;
+	sock->unacked = 0;
+
+	list_add(&sock->list, &tcp_sockets);
+
+	ret = tcp_transmit(sock, TCP_SYN, NULL, 0);
+	if (ret) {
+		list_del(&sock->list);
+		sock->state = TCP_CLOSED;
+	}
+
+	return ret;
+}
+
+int tcp_send(struct tcp_socket *sock, const void *data, uint32_t length)
+{
+	uint32_t chunk;
+	int ret;
+
+	while (length) {
+		if (sock->state != TCP_ESTABLISHED)
+			return sock->error ? sock->error : -ENOTCONN;
+
+		chunk = min(length, (uint32_t)sock->mss);
+
+		ret = tcp_transmit(sock, TCP_ACK | TCP_PSH, data, chunk);
+		if (ret)
+			return ret;
+
+		data = vptradd(data, chunk);
+		length -= chunk;
+	}
+
+	return 0;
+}
+
+void tcp_poll(struct tcp_socket *sock)
+{
+	net_poll(sock->netdev);
+
+	/* Everything received in one go is acknowledged at once */
+	if (sock->unacked && sock->state != TCP_CLOSED)
+		tcp_send_ack(sock);
+}
+
+void tcp_close(struct tcp_socket *sock)
+{
+	/*
+	 * Only for connected sockets, even if the peer reset them. We don't
+	 * wait for the peer to close its side, segments arriving afterwards
+	 * are simply ignored.
+	 */
+	if (sock->state == TCP_ESTABLISHED || sock->state == TCP_CLOSE_WAIT)
+		tcp_xmit(sock, sock->snd_nxt, TCP_FIN | TCP_ACK, NULL, 0);
+
+	list_del(&sock->list);
+	sock->state = TCP_CLOSED;
+}
+
+/*
+ * IPv4
+ */
+
+static void ip_receive(struct netdev *netdev, struct ip_hdr *ip,
+	uint32_t length)
+{
+	uint32_t hlen;
+
+	if (length < sizeof(*ip) || (ip->version_ihl >> 4) != 4)
+		return;
+
+	hlen = (ip->version_ihl & 0xf) << 2;
+	if (hlen < sizeof(*ip) || ntohs(ip->length) < hlen ||
+	    ntohs(ip->length) > length)
+		return;
+
+	if (net_checksum(ip, hlen, 0) || ip->daddr != netdev->ipaddr)
+		return;
+
+	/* We don't reassemble fragments */
+	if (ntohs(ip->frag) & (IP_FLAG_MF | IP_FRAG_OFFSET))
+		return;
+
+	length = ntohs(ip->length) - hlen;
+
+	switch (ip->proto) {
+	case IP_PROTO_UDP:
+		udp_receive(netdev, ip, vptradd(ip, hlen), length);
+		break;
+	case IP_PROTO_TCP:
+		tcp_receive(netdev, ip, vptradd(ip, hlen), length);
+		break;
+	}
+}
+
+/*
+ * Network devices
+ */
+
+void net_receive(struct netdev *netdev, void *frame, uint32_t length)
+{
+	struct eth_hdr *eth = frame;
+
+	if (length < ETH_HLEN)
+		return;
+
+	if (memcmp(eth->dst, netdev->mac, ETH_ALEN) &&
+	    memcmp(eth->dst, eth_broadcast, ETH_ALEN))
+		return;
+
+	switch (ntohs(eth->proto)) {
+	case ETH_P_ARP:
+		arp_receive(netdev, vptradd(frame, ETH_HLEN), length - ETH_HLEN);
+		break;
+	case ETH_P_IP:
+		ip_receive(netdev, vptradd(frame, ETH_HLEN), length - ETH_HLEN);
+		break;
+	}
+}
+
+void net_poll(struct netdev *netdev)
+{
+	netdev->ops->poll(netdev);
+}
+
+struct netdev *netdev_get(void)
+{
+	return list_first_entry_or_null(&netdevs, struct netdev, list);
+}
+
+int netdev_register(struct netdev *netdev, struct netdev_ops *ops)
+{
+	char name[] = "ethXXXX";
+	uint8_t *mac = netdev->mac;
+
+	sprintf(name, "eth%lu", netdev_num);
+
+	netdev->name = bstrdup(name);
+	if (!netdev->name)
+		return -ENOMEM;
+
+	netdev->frame = bmalloc(ETH_FRAME_LEN);
+	if (!netdev->frame)
+		goto netdev_free_name;
+
+	/*
+	 * All interfaces share the static configuration, we only expect to
+	 * find a single one anyway.
+	 */
+	netdev->ipaddr = net_parse_addr(CONFIG_NET_IPADDR);
+	netdev->netmask = net_parse_addr(CONFIG_NET_NETMASK);
+	netdev->gateway = net_parse_addr(CONFIG_NET_GATEWAY);
+	netdev->arp_next = 0;
+	netdev->ops = ops;
+
+	memset(netdev->arp_cache, 0, sizeof(netdev->arp_cache));
+
+	list_add_tail(&netdev->list, &netdevs);
+	netdev_num++;
+
+	bprintln(NET ": %s: %02x:%02x:%02x:%02x:%02x:%02x, address %s",
+		netdev->name, mac[0], mac[1], mac[2], mac[3], mac[4], mac[5],
+		CONFIG_NET_IPADDR);
+
+	return 0;
+
+netdev_free_name:
+	bfree_const(netdev->name);
+
+	return -ENOMEM;
+}
+
+/*
+ * Module initialization and exit function
+ */
+
+static int net_init(void)
+{
+	bprintln(NET ": Initialize module...");
+
+	while ((CONFIG_NET_TCP_WINDOW >> tcp_wscale) > 0xffff)
+		tcp_wscale++;
+
+	return 0;
+}
+
+static void net_exit(void)
+{
+	/*
+	 * Not supported.
+	 */
+
+	bprintln(NET ": Exit module...");
+}
+
+module_init(net_init);
+module_exit(net_exit);
@@ -28,10 +28,14 @@ def parse_config_macro(file, line):
 	elif value == 'y':
 		file.write("#define CONFIG_%s CONFIG_Y\n" % name)
 
-	# Everything else is simply defined with a value
+	# The configuration is built as an external module
 	elif value == 'm':
 		file.write("#define CONFIG_%s CONFIG_M\n" % name)
 
+	# Everything else is simply defined with a value
+	else:
+		file.write("#define CONFIG_%s %s\n" % (name, value))
+
 
 parser = argparse.ArgumentParser(description="elfboot genconf")
 parser.add_argument('-i', '--ifile', required=True)